@@ -1 +1,2 @@
-g++ src/main.cc -Wall -Wextra -Werror -std=c++11 -o bin/led
+g++ src/main.cc -Wall -Wextra -Werror -std=c++11 -pthread -o bin/led
+g++ src/bench.cc -Wall -Wextra -Werror -std=c++11 -O2 -pthread -o bin/led-bench
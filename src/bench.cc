@@ -0,0 +1,1549 @@
+// led-bench: benchmarks for led's internals, and for the whole editor
+// driven headless through key scripts.
+// usage: led-bench [max lines]
+//        led-bench script <file of raw key bytes> [lines] [rows] [cols]
+//        led-bench check
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "buffer_manager.h"
+#include "editor.h"
+#include "grep.h"
+#include "regex.h"
+#include "search.h"
+#include "tags.h"
+#include "tokeniser.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// allocations made by this thread, so the input thread's can be told apart
+// from the highlighter's. kept out of line, inlined into callers gcc thinks
+// the free() doesn't match the new.
+thread_local size_t tAllocations = 0;
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    tAllocations++;
+    void* p = malloc(size ? size : 1);
+    if(!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+// a made up source file with the given number of lines
+std::string GenerateSource(size_t lines)
+{
+    std::string text;
+    text.reserve(lines * 32);
+    for(size_t i = 0; i < lines; i++)
+    {
+        text += "    int value" + std::to_string(i) + " = Compute(" + std::to_string(i % 97) + ");\n";
+    }
+    return text;
+}
+
+double NanosPerOp(Clock::time_point start, int ops)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+    return (double) elapsed.count() / ops;
+}
+
+// time single keystrokes at random places in a file of the given size
+void BenchKeystrokes(size_t lines, int ops)
+{
+    Buffer buf("bench", 0, 80, 24);
+    buf.Load(TextSource::FromString(GenerateSource(lines)));
+
+    std::mt19937 rng(1234);
+    std::vector<int> rows(ops);
+    for(auto& row : rows)
+    {
+        row = rng() % lines;
+    }
+
+    // typing a character
+    auto start = Clock::now();
+    for(int i = 0; i < ops; i++)
+    {
+        buf.mCursY = rows[i];
+        buf.mCursX = 4;
+        buf.Scroll();
+        buf.InsertChar('x');
+    }
+    double insertChar = NanosPerOp(start, ops);
+
+    // enter in the middle of a line
+    start = Clock::now();
+    for(int i = 0; i < ops; i++)
+    {
+        buf.mCursY = rows[i];
+        buf.mCursX = 8;
+        buf.Scroll();
+        buf.InsertNewLine();
+    }
+    double newLine = NanosPerOp(start, ops);
+
+    // backspace at the start of a line, joining it to the one above
+    start = Clock::now();
+    for(int i = 0; i < ops; i++)
+    {
+        buf.mCursY = rows[i] + 1;
+        buf.mCursX = 0;
+        buf.Scroll();
+        buf.DeleteCharBackwards();
+    }
+    double joinLine = NanosPerOp(start, ops);
+
+    printf("%10zu %14.0f %14.0f %14.0f\n", lines, insertChar, newLine, joinLine);
+}
+
+// a line of made up c++
+const char* SampleLine(size_t i)
+{
+    static const char* sample[] =
+    {
+        "#include <vector>",
+        "struct Widget : public Base",
+        "{",
+        "    // draws the widget, returns false if it's hidden",
+        "    virtual bool Draw(const Canvas& canvas, int x, int y) const override",
+        "    {",
+        "        for(unsigned int i = 0; i < mChildren.size(); i++)",
+        "        {",
+        "            if(mChildren[i]->mVisible && x >= 0x10 && name != \"root\")",
+        "            {",
+        "                total += mChildren[i]->Measure(x * 2.5f, y << 1, '\\t');",
+        "            }",
+        "        }",
+        "        return static_cast<bool>(total) || sizeof(Widget) > 64;",
+        "    }",
+        "};",
+        "/* the next one is much the same,",
+        "   only different */",
+        "",
+    };
+    return sample[i % (sizeof(sample) / sizeof(sample[0]))];
+}
+
+// a few MB of made up c++ to tokenise
+std::vector<std::string> GenerateCorpus(size_t bytes)
+{
+    std::vector<std::string> lines;
+    size_t total = 0;
+    for(size_t i = 0; total < bytes; i++)
+    {
+        lines.push_back(SampleLine(i));
+        total += lines.back().size() + 1;
+    }
+    return lines;
+}
+
+// the same as one file
+std::string GenerateCode(size_t lines)
+{
+    std::string text;
+    for(size_t i = 0; i < lines; i++)
+    {
+        text += SampleLine(i);
+        text += '\n';
+    }
+    return text;
+}
+
+// tokeniser throughput, through the old Token api and the span one
+void BenchTokeniser(size_t bytes)
+{
+    std::vector<std::string> corpus = GenerateCorpus(bytes);
+    double megabytes = bytes / (1024.0 * 1024.0);
+
+    auto start = Clock::now();
+    size_t tokens = 0;
+    for(auto& line : corpus)
+    {
+        tokens += Tokenise(line, "bench.cc").size();
+    }
+    double tokenSeconds = NanosPerOp(start, 1) / 1e9;
+
+    start = Clock::now();
+    std::vector<TokenSpan> spans;
+    size_t spanCount = 0;
+    for(auto& line : corpus)
+    {
+        spans.clear();
+        TokeniseLine(line.data(), line.size(), spans);
+        spanCount += spans.size();
+    }
+    double spanSeconds = NanosPerOp(start, 1) / 1e9;
+
+    printf("tokeniser, %.0f MB of c++\n", megabytes);
+    printf("%10s %10.1f MB/s %12zu tokens\n", "Tokenise", megabytes / tokenSeconds, tokens);
+    printf("%10s %10.1f MB/s %12zu tokens\n", "spans", megabytes / spanSeconds, spanCount);
+}
+
+// search throughput for a string that isn't there, so every byte is looked
+// at: std::string::find, FindBytes, and TextSearch over a buffer's storage a
+// slice at a time as the editor runs it
+void BenchSearch(size_t lines)
+{
+    std::string code = GenerateCode(lines);
+    double megabytes = code.size() / (1024.0 * 1024.0);
+    const std::string needle = "mChildren[j]";
+
+    auto start = Clock::now();
+    volatile size_t found = code.find(needle);
+    double findSeconds = NanosPerOp(start, 1) / 1e9;
+
+    start = Clock::now();
+    found = FindBytes(code.data(), code.size(), needle.data(), needle.size()) != nullptr;
+    double bytesSeconds = NanosPerOp(start, 1) / 1e9;
+    (void) found;
+
+    TextStorage text;
+    text.Load(TextSource::FromString(code));
+    text.SetLine(lines / 2, "edited");
+    TextSearch search;
+    search.Start(needle, TextPos(lines / 3, 0));
+    double slowestSlice = 0;
+    start = Clock::now();
+    for(;;)
+    {
+        auto sliceStart = Clock::now();
+        bool done = search.Step(text, Buffer::kSearchSlice);
+        slowestSlice = std::max(slowestSlice, NanosPerOp(sliceStart, 1) / 1e6);
+        if(done)
+        {
+            break;
+        }
+    }
+    double searchSeconds = NanosPerOp(start, 1) / 1e9;
+
+    printf("search, %.0f MB of c++ for a string that isn't there\n", megabytes);
+    printf("%12s %10.1f MB/s\n", "string find", megabytes / findSeconds);
+    printf("%12s %10.1f MB/s\n", "FindBytes", megabytes / bytesSeconds);
+    printf("%12s %10.1f MB/s, slowest slice %.1f ms\n", "TextSearch", megabytes / searchSeconds, slowestSlice);
+}
+
+// regex scanning, for a pattern that isn't there and one that's on every
+// few lines, then a replace all of the second through a buffer and its undo
+void BenchRegex(size_t lines, size_t replaceLines)
+{
+    std::string code = GenerateCode(lines);
+    double megabytes = code.size() / (1024.0 * 1024.0);
+    printf("regex, %.0f MB of c++\n", megabytes);
+    const char* patterns[] = { "mChildren\\[j\\]", "\\bm[A-Z]\\w*", "[A-Z][a-z]+\\(" };
+    for(auto pattern : patterns)
+    {
+        Regex regex;
+        regex.Compile(pattern);
+        size_t matches = 0;
+        auto start = Clock::now();
+        regex.ForEachMatch(code.data(), code.size(), 0, [&](size_t, size_t)
+        {
+            matches++;
+            return true;
+        });
+        double seconds = NanosPerOp(start, 1) / 1e9;
+        printf("%16s %10.1f MB/s %12zu matches\n", pattern, megabytes / seconds, matches);
+    }
+
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(GenerateCode(replaceLines)));
+    buf.mText.LineCount();
+    Regex regex;
+    regex.Compile("\\bm[A-Z]\\w*");
+    auto start = Clock::now();
+    size_t replaced = buf.ReplaceAll(regex, "&_");
+    double replaceSeconds = NanosPerOp(start, 1) / 1e9;
+    start = Clock::now();
+    buf.Undo();
+    double undoSeconds = NanosPerOp(start, 1) / 1e9;
+    printf("replace all in %zu lines, %zu matches: %.2f s, undo %.3f ms\n", replaceLines, replaced,
+           replaceSeconds, undoSeconds * 1000);
+}
+
+// ledlang: running a command that's compiled already, compiling one from
+// scratch every time, and the vm going round a loop
+void BenchLedLang(int runs)
+{
+    Editor led;
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(GenerateCode(1000)));
+    led.AddBuffer(&buf);
+    led.SetCurrentBuffer(&buf);
+
+    const std::string command = "if line() < lines() { down 2 } else { top }; let n = col() + 1";
+    LedValue result;
+    auto start = Clock::now();
+    for(int i = 0; i < runs; i++)
+    {
+        led.mLedLang.Run(command, result);
+    }
+    double cached = NanosPerOp(start, runs);
+
+    start = Clock::now();
+    for(int i = 0; i < runs; i++)
+    {
+        led.mLedLang.mCache.clear();
+        led.mLedLang.Run(command, result);
+    }
+    double compiled = NanosPerOp(start, runs);
+
+    const int loops = 1000000;
+    start = Clock::now();
+    led.mLedLang.Run("let i = 0; while i < " + std::to_string(loops) + " { let i = i + 1 }", result);
+    double loop = NanosPerOp(start, loops);
+
+    printf("ledlang, ns/op\n");
+    printf("%16s %10.0f\n", "cached command", cached);
+    printf("%16s %10.0f\n", "compiled command", compiled);
+    printf("%16s %10.1f\n", "loop iteration", loop);
+}
+
+// a macro that puts "> " at the start of a line and goes down one, played
+// over a file a line at a time, the way keys come in with a frame drawn
+// after each, and then in one go
+void BenchMacro(size_t lines)
+{
+    const int keys[] = { CtrlKey('x'), CtrlKey('a'), '>', ' ', CtrlKey('n'), CtrlKey('x') };
+    double nanos[2];
+    for(int batched = 0; batched < 2; batched++)
+    {
+        Editor led;
+        led.mOutputFd = open("/dev/null", O_WRONLY);
+        gWindowResized = 0;
+        led.SetScreenSize(24, 80);
+        Buffer buf("bench.cc", 0, 80, 24);
+        buf.Load(TextSource::FromString(GenerateCode(lines)));
+        led.AddBuffer(&buf);
+        led.SetCurrentBuffer(&buf);
+        for(int key : keys)
+        {
+            led.HandleKey(key);
+        }
+
+        size_t plays = batched ? lines - 2 : std::min<size_t>(lines - 2, 10000);
+        std::string error;
+        auto start = Clock::now();
+        if(batched)
+        {
+            led.ReplayMacro(plays, error);
+            led.DrawScreen();
+        }
+        else
+        {
+            for(size_t i = 0; i < plays; i++)
+            {
+                led.HandleKey(CtrlKey('v'));
+                led.DrawScreen();
+            }
+        }
+        nanos[batched] = NanosPerOp(start, plays * 4);
+        close(led.mOutputFd);
+    }
+    printf("macro over %zu lines, ns/key\n", lines);
+    printf("%16s %10.0f\n", "key by key", nanos[0]);
+    printf("%16s %10.0f\n", "batched", nanos[1]);
+}
+
+// a cursor at every for loop, which is one line in nineteen, then keys
+// typed at all of them
+void BenchCursors(size_t lines)
+{
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(GenerateCode(lines)));
+    std::string error;
+    auto start = Clock::now();
+    size_t cursors = buf.PlaceCursors("for\\(", true, error);
+    double placeSeconds = NanosPerOp(start, 1) / 1e9;
+
+    const char keys[] = "// ";
+    start = Clock::now();
+    for(const char* key = keys; *key != '\0'; key++)
+    {
+        buf.InsertChar(*key);
+    }
+    buf.DeleteCharBackwards();
+    buf.KillForward();
+    double perCursor = NanosPerOp(start, (sizeof(keys) + 1) * cursors);
+
+    start = Clock::now();
+    buf.Undo();
+    double undoSeconds = NanosPerOp(start, 1) / 1e9;
+
+    printf("%zu cursors over %zu lines: placed in %.1f ms, %.0f ns per edit per cursor, undo %.1f ms\n",
+           cursors, lines, placeSeconds * 1000, perCursor, undoSeconds * 1000);
+}
+
+// entering jump mode half way down a big file, the first time and then
+// after each of a run of edits, when only the edited line is looked at again
+void BenchJump(size_t lines, int ops)
+{
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(GenerateCode(lines)));
+    buf.mCursY = lines / 2;
+    buf.Scroll();
+
+    auto start = Clock::now();
+    buf.EnterJumpMode();
+    double first = NanosPerOp(start, 1);
+    size_t targets = buf.mJumpTargets.size();
+    buf.Cancel();
+
+    size_t scanned = buf.mWords.mLinesScanned;
+    double total = 0;
+    for(int i = 0; i < ops; i++)
+    {
+        buf.InsertChar('x');
+        start = Clock::now();
+        buf.EnterJumpMode();
+        total += NanosPerOp(start, 1);
+        buf.Cancel();
+    }
+    printf("jump mode over %zu lines, %zu labels: first %.1f us, after an edit %.1f us, %.1f lines looked at\n",
+           lines, targets, first / 1000, total / ops / 1000, (double) (buf.mWords.mLinesScanned - scanned) / ops);
+}
+
+// a made up etags file with millions of tags: loading it, which maps,
+// parses and sorts it, then looking names and prefixes up in it. and how
+// fast definitions are found in c++ to make tags without one.
+void BenchTags(size_t tags)
+{
+    const std::string path = "/tmp/led-bench-TAGS";
+    {
+        std::ofstream file(path, std::ios::binary);
+        const size_t perFile = 1000;
+        for(size_t i = 0; i < tags; i += perFile)
+        {
+            std::string section;
+            for(size_t j = i; j < std::min(tags, i + perFile); j++)
+            {
+                section += "void Symbol" + std::to_string(j * 7919 % tags) + "(\x7f" + std::to_string(j - i + 1) + "," +
+                           std::to_string((j - i) * 40) + "\n";
+            }
+            file << "\f\nsrc/file" << i / perFile << ".cc," << section.size() << "\n" << section;
+        }
+    }
+
+    auto start = Clock::now();
+    std::string error;
+    auto index = SymbolIndex::Load(path, error);
+    double loadMs = NanosPerOp(start, 1) / 1e6;
+    if(!index)
+    {
+        printf("tags: %s\n", error.c_str());
+        return;
+    }
+
+    std::mt19937 random(1);
+    const int lookups = 100000;
+    size_t found = 0;
+    start = Clock::now();
+    for(int i = 0; i < lookups; i++)
+    {
+        found += index->Find("Symbol" + std::to_string(random() % tags)).size();
+    }
+    double findNs = NanosPerOp(start, lookups);
+
+    start = Clock::now();
+    for(int i = 0; i < lookups; i++)
+    {
+        found += index->Search("Symbol" + std::to_string(random() % 1000), 10).size();
+    }
+    double searchNs = NanosPerOp(start, lookups);
+    unlink(path.c_str());
+
+    std::string code = GenerateCode(200000);
+    start = Clock::now();
+    TagScanner scanner;
+    scanner.Scan(code.data(), code.size());
+    double scanSeconds = NanosPerOp(start, 1) / 1e9;
+
+    printf("tags, %zu of them: load %.0f ms, find %.0f ns, first 10 by prefix %.0f ns (%zu found)\n",
+           index->Size(), loadMs, findNs, searchNs, found);
+    printf("making tags: %.1f MB/s, %zu tags in %.1f MB\n", code.size() / scanSeconds / (1024 * 1024),
+           scanner.mTags, code.size() / (1024.0 * 1024.0));
+}
+
+// pasting lines of code through a pipe into a headless editor, wrapped
+// in bracketed paste and as plain keys with a frame drawn after each batch
+// of them, the way a terminal without bracketed paste would send it
+void BenchPaste(size_t lines, size_t plainLines)
+{
+    printf("paste, ms\n");
+    for(int bracketed = 1; bracketed >= 0; bracketed--)
+    {
+        size_t count = bracketed ? lines : plainLines;
+        std::string text;
+        for(size_t i = 0; i < count; i++)
+        {
+            text += SampleLine(i);
+            text += '\r';
+        }
+        if(bracketed)
+        {
+            text = "\x1b[200~" + text + "\x1b[201~";
+        }
+
+        int input[2];
+        if(pipe(input) != 0)
+        {
+            return;
+        }
+        fcntl(input[0], F_SETFL, O_NONBLOCK);
+        Editor led;
+        led.mInputFd = input[0];
+        led.mOutputFd = open("/dev/null", O_WRONLY);
+        gWindowResized = 0;
+        led.SetScreenSize(24, 80);
+        Buffer buf("bench.cc", 0, 80, 24);
+        buf.Load(TextSource::FromString(GenerateCode(1000)));
+        led.AddBuffer(&buf);
+        led.SetCurrentBuffer(&buf);
+
+        auto start = Clock::now();
+        std::thread writer([&]()
+        {
+            for(size_t written = 0; written < text.size();)
+            {
+                ssize_t n = write(input[1], text.data() + written, text.size() - written);
+                written += n > 0 ? n : 0;
+            }
+        });
+        size_t expected = 1000 + count;
+        while((size_t) buf.NumLines() < expected)
+        {
+            led.ReadInput();
+            led.DrawScreen();
+        }
+        writer.join();
+        double ms = NanosPerOp(start, 1) / 1e6;
+        printf("%16s %10.1f for %zu lines\n", bracketed ? "bracketed" : "key by key", ms, count);
+        close(input[0]);
+        close(input[1]);
+        close(led.mOutputFd);
+    }
+}
+
+// decode a burst of terminal input coming down a pipe: typing, utf-8 and
+// arrow keys with modifiers. against it, what reading a byte at a time
+// costs in syscalls alone.
+void BenchInput(size_t bytes)
+{
+    static const char* const kPieces[] = { "hello ", "w\xc3\xb6rld ", "\xe2\x82\xac", "\x1b[A", "\x1b[1;5C",
+                                           "\x1bOH", "\x1b[3~", "\x7f", "\r", "\xf0\x9f\x98\x80" };
+    std::string text;
+    for(size_t i = 0; text.size() < bytes; i++)
+    {
+        text += kPieces[(i * 7) % (sizeof(kPieces) / sizeof(kPieces[0]))];
+    }
+
+    printf("input, %zu bytes through a pipe\n", text.size());
+    for(int bulk = 1; bulk >= 0; bulk--)
+    {
+        int input[2];
+        if(pipe(input) != 0)
+        {
+            return;
+        }
+        fcntl(input[0], F_SETFL, O_NONBLOCK);
+        std::thread writer([&]()
+        {
+            for(size_t written = 0; written < text.size();)
+            {
+                ssize_t n = write(input[1], text.data() + written, text.size() - written);
+                written += n > 0 ? n : 0;
+            }
+            close(input[1]);
+        });
+
+        auto start = Clock::now();
+        size_t keys = 0;
+        size_t reads = 0;
+        size_t got = 0;
+        if(bulk)
+        {
+            InputDecoder decoder;
+            while(got < text.size())
+            {
+                size_t before = decoder.mTail;
+                while(decoder.ReadKey(input[0]) != -1)
+                {
+                    keys++;
+                }
+                got += decoder.mTail - before;
+            }
+            reads = decoder.mReads;
+        }
+        else
+        {
+            char c;
+            while(got < text.size())
+            {
+                reads++;
+                got += read(input[0], &c, 1) == 1 ? 1 : 0;
+            }
+        }
+        double ns = NanosPerOp(start, 1);
+        writer.join();
+        close(input[0]);
+
+        printf("%16s %8.2f ns/byte %8.0f MB/s %9zu keys %9zu reads\n", bulk ? "decoded" : "byte reads",
+               ns / text.size(), text.size() / (ns / 1e3), keys, reads);
+    }
+}
+
+// grep through a tree of generated files, on one thread and then on all of
+// them. the files are fresh so they're in the page cache, it's the scanning
+// that's timed rather than the disk.
+void BenchGrep(size_t files)
+{
+    const std::string root = "/tmp/led-bench-grep";
+    const size_t perDir = 100;
+    std::string code = GenerateCode(200);
+    mkdir(root.c_str(), 0777);
+    for(size_t i = 0; i < files; i++)
+    {
+        std::string dir = root + "/d" + std::to_string(i / perDir);
+        if(i % perDir == 0)
+        {
+            mkdir(dir.c_str(), 0777);
+        }
+        std::ofstream(dir + "/f" + std::to_string(i) + ".cc") << code;
+    }
+    double megabytes = files * code.size() / (1024.0 * 1024.0);
+
+    printf("grep, %zu files, %.0f MB\n", files, megabytes);
+    size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    for(size_t threads = 1; ; threads = cores)
+    {
+        auto start = Clock::now();
+        GrepSearch grep("mChildren[j]", threads);
+        grep.SearchDirectory(root);
+        grep.Start();
+        size_t matches = 0;
+        while(!grep.Finished())
+        {
+            usleep(200);
+            matches += grep.TakeResults().size();
+        }
+        matches += grep.TakeResults().size();
+        double seconds = NanosPerOp(start, 1) / 1e9;
+        printf("%4zu threads %10.1f MB/s, %zu matching lines\n", threads, megabytes / seconds, matches);
+        if(threads == cores)
+        {
+            break;
+        }
+    }
+
+    for(size_t i = 0; i < files; i++)
+    {
+        std::string dir = root + "/d" + std::to_string(i / perDir);
+        unlink((dir + "/f" + std::to_string(i) + ".cc").c_str());
+        if(i % perDir == perDir - 1 || i == files - 1)
+        {
+            rmdir(dir.c_str());
+        }
+    }
+    rmdir(root.c_str());
+}
+
+// open many files without reading them, find them again by path, read them
+// ahead on all the cores, then switch round them under a budget that only
+// fits a few at a time
+void BenchBuffers(size_t files)
+{
+    const std::string root = "/tmp/led-bench-buffers";
+    std::string code = GenerateCode(500);
+    mkdir(root.c_str(), 0777);
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < files; i++)
+    {
+        paths.push_back(root + "/f" + std::to_string(i) + ".cc");
+        std::ofstream(paths.back()) << code;
+    }
+
+    std::mutex mutex;
+    std::vector<std::function<void()>> posted;
+    {
+        BufferManager buffers;
+        buffers.mPost = [&](std::function<void()> callback)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            posted.push_back(std::move(callback));
+        };
+
+        printf("buffers, %zu files of %zu KB\n", files, code.size() / 1024);
+        auto start = Clock::now();
+        std::vector<Buffer*> opened;
+        for(auto& path : paths)
+        {
+            opened.push_back(buffers.Open(path));
+        }
+        printf("%-24s %10.0f ns/file\n", "open without reading", NanosPerOp(start, files));
+
+        std::mt19937 random(1);
+        const int finds = 100000;
+        size_t found = 0;
+        start = Clock::now();
+        for(int i = 0; i < finds; i++)
+        {
+            found += buffers.FindId(random() % files) != nullptr;
+        }
+        printf("%-24s %10.0f ns/op\n", "find by id", NanosPerOp(start, finds));
+        start = Clock::now();
+        for(int i = 0; i < finds / 100; i++)
+        {
+            found += buffers.FindPath(paths[random() % files]) != nullptr;
+        }
+        printf("%-24s %10.0f ns/op, realpath included, %zu found\n", "find by path", NanosPerOp(start, finds / 100), found);
+
+        start = Clock::now();
+        buffers.ReadAhead(opened);
+        for(size_t done = 0; done < files;)
+        {
+            std::vector<std::function<void()>> callbacks;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                callbacks.swap(posted);
+            }
+            for(auto& callback : callbacks)
+            {
+                callback();
+            }
+            done += callbacks.size();
+            usleep(callbacks.empty() ? 200 : 0);
+        }
+        double seconds = NanosPerOp(start, 1) / 1e9;
+        printf("%-24s %10.1f MB/s\n", "read ahead", files * code.size() / (1024.0 * 1024.0) / seconds);
+
+        buffers.mMemoryBudget = 8 * code.size();
+        const int switches = std::min<int>(files * 2, 20000);
+        start = Clock::now();
+        for(int i = 0; i < switches; i++)
+        {
+            buffers.Use(opened[i % files]);
+        }
+        printf("%-24s %10.0f ns/op, %zu unloaded, %.1f MB held\n", "switch round, 8 fit",
+               NanosPerOp(start, switches), buffers.mUnloads, buffers.MemoryBytes() / (1024.0 * 1024.0));
+        start = Clock::now();
+        for(int i = 0; i < switches; i++)
+        {
+            buffers.Use(opened[i % 2]);
+        }
+        printf("%-24s %10.0f ns/op\n", "switch between two", NanosPerOp(start, switches));
+    }
+
+    for(auto& path : paths)
+    {
+        unlink(path.c_str());
+    }
+    rmdir(root.c_str());
+}
+
+// follow a log written as fast as a thread can write it, with the editor
+// going round its loop as it would for the terminal. reads are capped per
+// second however many writes there are, so it takes in big chunks and the
+// main thread's mostly asleep.
+void BenchFollow(size_t megabytes)
+{
+    const std::string path = "/tmp/led-bench-follow.log";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return;
+    }
+
+    Editor led;
+    led.mOutputFd = open("/dev/null", O_WRONLY);
+    gWindowResized = 0;
+    led.SetScreenSize(24, 80);
+    led.mEvents.mAfterEvents = [&led]() { led.DrawScreen(); };
+    Buffer* buf = led.OpenBuffer(path);
+    led.SetCurrentBuffer(buf);
+    led.ToggleFollow(buf);
+
+    std::atomic<bool> writing(true);
+    std::thread writer([&]()
+    {
+        std::string chunk;
+        for(int i = 0; chunk.size() < (64 << 10); i++)
+        {
+            chunk += "2024-01-01 12:00:00 INFO request " + std::to_string(i) + " served in 3ms\n";
+        }
+        for(size_t written = 0; written < (megabytes << 20);)
+        {
+            ssize_t wrote = write(fd, chunk.data(), chunk.size());
+            if(wrote <= 0)
+            {
+                break;
+            }
+            written += wrote;
+        }
+        writing = false;
+    });
+
+    struct timespec cpuStart, cpuEnd;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+    auto start = Clock::now();
+    while(writing || buf->mFollow.mOffset < Editor::FileSize(fd))
+    {
+        led.mEvents.RunOnce(100);
+    }
+    double seconds = NanosPerOp(start, 1) / 1e9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    writer.join();
+    double cpu = (cpuEnd.tv_sec - cpuStart.tv_sec) + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e9;
+
+    printf("follow, %zu MB written flat out\n", megabytes);
+    printf("%10.1f MB/s taken in, %zu lines, %zu reads, %.0f%% of a core\n", megabytes / seconds,
+           (size_t) buf->NumLines(), buf->mFollow.mReads, 100 * cpu / seconds);
+
+    led.ToggleFollow(buf);
+    close(fd);
+    unlink(path.c_str());
+}
+
+// a key script is what the terminal would send, one string per key
+typedef std::vector<std::string> KeyScript;
+
+std::string Key(char c) { return std::string(1, c); }
+
+KeyScript TypingScript()
+{
+    KeyScript keys;
+    for(int i = 0; i < 2000; i++)
+    {
+        keys.push_back(i % 60 == 59 ? Key('\r') : Key('a' + i % 26));
+    }
+    return keys;
+}
+
+KeyScript EditingScript()
+{
+    const char cycle[] =
+    {
+        CtrlKey('n'), CtrlKey('e'), 'x', 'y', (char) BACKSPACE, '\r', CtrlKey('p'),
+        CtrlKey('k'), CtrlKey('u'), '/', '*', CtrlKey('u'), CtrlKey('y'), CtrlKey('n')
+    };
+    KeyScript keys;
+    for(int i = 0; i < 2000; i++)
+    {
+        keys.push_back(Key(cycle[i % sizeof(cycle)]));
+    }
+    return keys;
+}
+
+KeyScript ScrollingScript()
+{
+    KeyScript keys;
+    for(int i = 0; i < 2000; i++)
+    {
+        keys.push_back(Key(i < 1000 ? CtrlKey('n') : CtrlKey('p')));
+    }
+    return keys;
+}
+
+KeyScript JumpingScript()
+{
+    KeyScript keys;
+    for(int i = 0; i < 200; i++)
+    {
+        keys.push_back(Key(i % 2 ? CtrlKey('t') : CtrlKey('z')));
+    }
+    return keys;
+}
+
+// a recording of raw terminal input, cut into keys the way ReadKey decodes them
+KeyScript LoadScript(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    KeyScript keys;
+    for(size_t i = 0; i < bytes.size();)
+    {
+        // a key is however many bytes the decoder takes to finish one
+        InputDecoder decoder;
+        size_t start = i;
+        bool again = false;
+        while(i < bytes.size())
+        {
+            int key = decoder.Feed(bytes[i], again);
+            i += again ? 0 : 1;
+            if(key != -1)
+            {
+                break;
+            }
+        }
+        keys.push_back(bytes.substr(start, i - start));
+    }
+    return keys;
+}
+
+double Percentile(std::vector<double> samples, double fraction)
+{
+    if(samples.empty())
+    {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[(size_t) (fraction * (samples.size() - 1))];
+}
+
+void PrintReplayHeader(int rows, int cols)
+{
+    printf("key scripts on a %dx%d screen. paint is key to frame written, settled\n", cols, rows);
+    printf("is until the highlighted frame is. us per key, allocs on the input thread.\n");
+    printf("%-10s %9s %6s %8s %8s %8s %8s %9s %9s %8s %8s\n", "script", "lines", "keys",
+           "p50", "p90", "p99", "max", "settled50", "settled99", "allocs", "bytes");
+}
+
+// feed keys through a pipe into a headless editor on a file of the given
+// size, timing each one from its bytes arriving to its frame being written.
+// with journal the edits are journalled as they would be for a real file.
+// with split, the screen is shared side by side with a second buffer that
+// the keys don't touch, which shouldn't cost anything to draw again
+void Replay(const char* name, const KeyScript& keys, size_t lines, int rows, int cols, bool journal = false,
+            bool split = false)
+{
+    int input[2];
+    if(pipe(input) != 0)
+    {
+        return;
+    }
+    fcntl(input[0], F_SETFL, O_NONBLOCK);
+    int sink = open("/dev/null", O_WRONLY);
+
+    Editor led;
+    led.mInputFd = input[0];
+    led.mOutputFd = sink;
+    gWindowResized = 0;
+    led.SetScreenSize(rows, cols);
+
+    Buffer buf("bench.cc", 0, cols, rows);
+    auto source = TextSource::FromString(GenerateCode(lines));
+    buf.Load(source);
+    if(journal)
+    {
+        buf.mFileName = "/tmp/led-bench.cc";
+        unlink(EditJournal::PathFor(buf.mFileName).c_str());
+        buf.StartJournal(source);
+    }
+    led.AddBuffer(&buf);
+    led.SetCurrentBuffer(&buf);
+
+    Buffer other("other.cc", 1, cols, rows);
+    if(split)
+    {
+        other.Load(TextSource::FromString(GenerateCode(lines)));
+        led.AddBuffer(&other);
+        led.SplitView(true);
+        led.SetCurrentBuffer(&other);
+        led.FocusView(led.mLayout.Step(led.mLayout.mFocus, -1));
+        led.DrawScreen();
+        other.mHighlighter.WaitForWorker();
+    }
+
+    led.DrawScreen();
+    buf.mHighlighter.WaitForWorker();
+    led.DrawScreen();
+    led.mBytesWritten = 0;
+
+    std::vector<double> paint;
+    std::vector<double> settled;
+    size_t allocations = 0;
+    for(auto& key : keys)
+    {
+        if(write(input[1], key.data(), key.size()) != (ssize_t) key.size())
+        {
+            break;
+        }
+
+        size_t allocationsBefore = tAllocations;
+        auto start = Clock::now();
+        led.ReadInput();
+        led.DrawScreen();
+        auto painted = Clock::now();
+        allocations += tAllocations - allocationsBefore;
+        led.WriteJournals();
+
+        buf.mHighlighter.WaitForWorker();
+        led.DrawScreen();
+        auto done = Clock::now();
+
+        paint.push_back(std::chrono::duration<double, std::micro>(painted - start).count());
+        settled.push_back(std::chrono::duration<double, std::micro>(done - start).count());
+    }
+
+    size_t count = std::max<size_t>(paint.size(), 1);
+    printf("%-10s %9zu %6zu %8.1f %8.1f %8.1f %8.1f %9.1f %9.1f %8.1f %8.1f\n", name, lines, paint.size(),
+           Percentile(paint, 0.5), Percentile(paint, 0.9), Percentile(paint, 0.99), Percentile(paint, 1),
+           Percentile(settled, 0.5), Percentile(settled, 0.99),
+           (double) allocations / count, (double) led.mBytesWritten / count);
+
+    buf.mJournal.Close(true);
+    close(input[0]);
+    close(input[1]);
+    close(sink);
+}
+
+// led-bench check: behaviour rather than speed. each check says ok or
+// FAIL, and the exit status is the number that failed.
+int gFailures = 0;
+
+void Check(const std::string& name, bool ok, const std::string& detail = "")
+{
+    printf("%-44s %s%s%s\n", name.c_str(), ok ? "ok" : "FAIL", ok || detail.empty() ? "" : ": ",
+           ok ? "" : detail.c_str());
+    gFailures += !ok;
+}
+
+std::string TextOf(TextStorage& text)
+{
+    std::string all;
+    text.ForEachPiece([&](const char* data, size_t length)
+    {
+        all.append(data, length);
+        all += '\n';
+    });
+    return all;
+}
+
+std::string FileText(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+off_t FileBytes(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+// opens path in a child process, edits it, waits for the journal to be on
+// disk and then dies without closing anything, as if led had crashed.
+// returns the text as the child left it.
+std::string EditAndCrash(const std::string& path, std::function<void(Buffer&)> edit)
+{
+    int pipeFds[2];
+    if(pipe(pipeFds) != 0)
+    {
+        return "";
+    }
+    pid_t child = fork();
+    if(child == 0)
+    {
+        close(pipeFds[0]);
+        Buffer buf(path, 0, 80, 24);
+        buf.OpenFile(path);
+        edit(buf);
+        buf.FinishSave();
+        buf.mJournal.Flush();
+        std::string text = TextOf(buf.mText);
+        for(size_t done = 0; done < text.size();)
+        {
+            ssize_t written = write(pipeFds[1], text.data() + done, text.size() - done);
+            if(written <= 0)
+            {
+                break;
+            }
+            done += written;
+        }
+        _exit(0);
+    }
+    close(pipeFds[1]);
+    std::string text;
+    char chunk[65536];
+    ssize_t got;
+    while((got = read(pipeFds[0], chunk, sizeof(chunk))) > 0)
+    {
+        text.append(chunk, got);
+    }
+    close(pipeFds[0]);
+    waitpid(child, nullptr, 0);
+    return text;
+}
+
+// crash with edits, open the file again and compare. crashed is called
+// in between, to look at the journal as it was left.
+void CheckRecovery(const std::string& name, const std::string& path, const std::string& contents,
+                   std::function<void(Buffer&)> edit, std::function<void()> crashed = nullptr)
+{
+    std::ofstream(path, std::ios::binary) << contents;
+    std::string expected = EditAndCrash(path, edit);
+    if(crashed)
+    {
+        crashed();
+    }
+    Buffer buf(path, 0, 80, 24);
+    buf.OpenFile(path);
+    std::string recovered = TextOf(buf.mText);
+    Check(name, buf.mRecovered && recovered == expected,
+          "recovered " + std::to_string(buf.mRecovered) + ", " + std::to_string(recovered.size()) + " bytes for " +
+          std::to_string(expected.size()));
+    buf.mJournal.Close(true);
+    unlink(path.c_str());
+}
+
+void CheckJournal(const std::string& dir)
+{
+    std::string path = dir + "/journal.txt";
+    std::string small = "one\ntwo\nthree\nfour\n";
+
+    CheckRecovery("journal: typing recovered", path, small, [](Buffer& buf)
+    {
+        buf.mCursY = 1;
+        buf.mCursX = 3;
+        buf.InsertChar('!');
+        buf.InsertNewLine();
+        buf.InsertChar('x');
+        buf.mCursY = 3;
+        buf.mCursX = 0;
+        buf.DeleteCharBackwards();
+        buf.KillForward();
+    });
+
+    CheckRecovery("journal: paste and undo recovered", path, small, [](Buffer& buf)
+    {
+        buf.mCursY = 0;
+        buf.mCursX = 1;
+        buf.Paste("pasted\nover\nlines");
+        buf.InsertChar('a');
+        buf.InsertChar('b');
+        buf.Undo();
+    });
+
+    CheckRecovery("journal: recovered from a checkpoint", path, small, [](Buffer& buf)
+    {
+        buf.InsertChar('a');
+        Regex regex;
+        regex.Compile("o+");
+        buf.ReplaceAll(regex, "[&]");
+        buf.mCursY = 2;
+        buf.InsertChar('b');
+    });
+
+    CheckRecovery("journal: edits after a save recovered", path, small, [](Buffer& buf)
+    {
+        buf.InsertChar('a');
+        buf.SaveToFile();
+        buf.mCursY = 3;
+        buf.InsertChar('b');
+        buf.BeginBatch();
+        buf.mCursY = 1;
+        buf.InsertChar('c');
+        buf.EndBatch();
+        buf.InsertChar('d');
+    });
+
+    // big enough to be mapped. a checkpoint after a save is made of runs of
+    // the saved file's lines, not the lines themselves.
+    std::string big = GenerateCode(400000);
+    off_t swapBytes = -1;
+    CheckRecovery("journal: mapped file recovered after a save", path, big, [&](Buffer& buf)
+    {
+        buf.mCursY = 10;
+        buf.InsertChar('a');
+        buf.SaveToFile();
+        buf.mCursY = 300000;
+        buf.InsertChar('b');
+        buf.BeginBatch();
+        buf.mCursY = 20;
+        buf.InsertNewLine();
+        buf.EndBatch();
+    },
+    [&]() { swapBytes = FileBytes(EditJournal::PathFor(path)); });
+    Check("journal: checkpoint after a save stays small", swapBytes >= 0 && swapBytes < 4096,
+          std::to_string(swapBytes) + " bytes");
+
+    // a journal for some other version of the file is kept, not overwritten
+    std::ofstream(path, std::ios::binary) << small;
+    EditAndCrash(path, [](Buffer& buf) { buf.InsertChar('z'); });
+    std::string journal = EditJournal::PathFor(path);
+    off_t before = FileBytes(journal);
+    std::ofstream(path, std::ios::binary | std::ios::app) << "five\n";
+    {
+        Buffer buf(path, 0, 80, 24);
+        buf.OpenFile(path);
+        buf.InsertChar('y');
+        buf.mJournal.Flush();
+        Check("journal: stale journal moved aside", !buf.mRecovered && FileBytes(journal + ".1") == before,
+              "recovered " + std::to_string(buf.mRecovered) + ", " + std::to_string(FileBytes(journal + ".1")) +
+              " bytes moved aside");
+        buf.mJournal.Close(true);
+    }
+    unlink((journal + ".1").c_str());
+    unlink(path.c_str());
+}
+
+// matches are leftmost longest, as in posix, not leftmost first as with
+// backtracking
+void CheckRegex()
+{
+    struct Case
+    {
+        const char* mPattern;
+        const char* mText;
+        const char* mMatches;
+    };
+    const Case cases[] = {
+        { "a|ab", "abc", "0-2" },
+        { "(a|ab)(c|bcd)", "abcd", "0-4" },
+        { "(foo|foobar)baz", "foobarbaz", "0-9" },
+        { "a+", "baaab aa", "1-4 6-8" },
+        { "colou?r", "color colour", "0-5 6-12" },
+        { "\\bfoo\\b", "foo food foo", "0-3 9-12" },
+        { "[0-9]{2,3}", "1 12 1234", "2-4 5-8" },
+        { "a.c", "abc\na\nc", "0-3" },
+        { "x[^y]*", "xay xb\nxc", "0-2 4-6 7-9" },
+        { "\\w+@\\w+", "me@here you@there", "0-7 8-17" },
+    };
+    for(auto& test : cases)
+    {
+        Regex regex;
+        std::string found;
+        if(!regex.Compile(test.mPattern))
+        {
+            found = "error: " + regex.mError;
+        }
+        std::string text = test.mText;
+        regex.ForEachMatch(text.data(), text.size(), 0, [&](size_t start, size_t end)
+        {
+            found += (found.empty() ? "" : " ") + std::to_string(start) + "-" + std::to_string(end);
+            return true;
+        });
+        Check(std::string("regex: ") + test.mPattern, found == test.mMatches,
+              "got \"" + found + "\", wanted \"" + test.mMatches + "\"");
+    }
+}
+
+void CheckMacroPaste()
+{
+    Editor led;
+    led.mOutputFd = open("/dev/null", O_WRONLY);
+    led.SetScreenSize(24, 80);
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(""));
+    buf.ZeroLineCheck();
+    led.AddBuffer(&buf);
+    led.SetCurrentBuffer(&buf);
+    led.HandleKey(CtrlKey('x'));
+    led.mInput.mPaste = "first";
+    led.HandleKey(KEY_PASTE);
+    led.HandleKey(CtrlKey('x'));
+    led.mInput.mPaste = "second";
+    led.HandleKey(CtrlKey('v'));
+    std::string line = buf.mText.GetLine(0);
+    Check("macro: replays what was pasted", line == "firstfirst", "line \"" + line + "\"");
+    close(led.mOutputFd);
+}
+
+void CheckCursors()
+{
+    std::string text = "for(a)\nx\nfor(b) for(c)\n";
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString(text));
+    std::string error;
+    size_t cursors = buf.PlaceCursors("for\\(", true, error);
+    buf.InsertChar('/');
+    buf.InsertChar('/');
+    buf.InsertChar('!');
+    buf.DeleteCharBackwards();
+    std::string edited = TextOf(buf.mText);
+    Check("cursors: typed at every match", cursors == 3 && edited == "//for(a)\nx\n//for(b) //for(c)\n",
+          std::to_string(cursors) + " cursors, text \"" + edited + "\"");
+
+    // each key was one edit at all the cursors, and is undone as one
+    buf.Undo();
+    std::string undone = TextOf(buf.mText);
+    buf.Undo();
+    buf.Undo();
+    buf.Undo();
+    std::string original = TextOf(buf.mText);
+    Check("cursors: undone at every cursor at once",
+          undone == "//!for(a)\nx\n//!for(b) //!for(c)\n" && original == text,
+          "text \"" + undone + "\" then \"" + original + "\"");
+}
+
+// following a file carries on from where the last save left it, and
+// isn't started over edits that aren't saved
+void CheckFollow(const std::string& dir)
+{
+    std::string path = dir + "/follow.txt";
+    std::ofstream(path, std::ios::binary) << "a\nb\n";
+    Buffer buf(path, 0, 80, 24);
+    buf.OpenFile(path);
+    buf.InsertChar('x');
+    std::string error;
+    bool refused = !buf.StartFollowing(error);
+    buf.InsertNewLine();
+    buf.SaveToFile();
+    bool started = buf.StartFollowing(error);
+    std::ofstream(path, std::ios::binary | std::ios::app) << "c\n";
+    buf.Follow(1 << 20);
+    std::string text = TextOf(buf.mText);
+    Check("follow: not started over unsaved edits", refused);
+    Check("follow: carries on from the last save", started && text == "x\na\nb\nc\n", "text \"" + text + "\"");
+    buf.StopFollowing();
+
+    // an empty file is shown as one empty line, which what's written first
+    // carries on
+    std::ofstream(path, std::ios::binary | std::ios::trunc);
+    Buffer empty(path, 0, 80, 24);
+    empty.OpenFile(path);
+    started = empty.StartFollowing(error);
+    std::ofstream(path, std::ios::binary | std::ios::app) << "a\nb\n";
+    empty.Follow(1 << 20);
+    text = TextOf(empty.mText);
+    Check("follow: an empty file", started && text == "a\nb\n", "text \"" + text + "\"");
+    empty.StopFollowing();
+    unlink(path.c_str());
+}
+
+// the word index keeps up with edits in the middle of a batch, where a
+// macro moving by words would see it
+void CheckBatchWords()
+{
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString("aaa bbb ccc\n"));
+    buf.NextWord();
+    buf.mCursX = 0;
+    buf.BeginBatch();
+    for(char c : std::string("zzzzzz "))
+    {
+        buf.InsertChar(c);
+    }
+    buf.mCursX = 0;
+    buf.NextWord();
+    int col = buf.mCursX;
+    buf.EndBatch();
+    Check("macro: moves by words after an edit", col == 7, "went to column " + std::to_string(col));
+}
+
+// a batch inside another is part of it, and the whole lot is undone
+// back to the text from before the outer one
+void CheckNestedBatch()
+{
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString("one\ntwo\n"));
+    buf.BeginBatch();
+    buf.InsertChar('a');
+    buf.BeginBatch();
+    buf.InsertChar('b');
+    buf.EndBatch();
+    buf.InsertChar('c');
+    buf.EndBatch();
+    buf.Undo();
+    std::string text = TextOf(buf.mText);
+    Check("macro: nested batch undone as one", text == "one\ntwo\n", "text \"" + text + "\"");
+}
+
+// a ctags pattern is matched without the escapes ctags put in it
+void CheckTags()
+{
+    auto index = SymbolIndex::FromText("gCount\tx.cc\t/^int gCount; \\/\\/ hits$/;\"\tv\n"
+                                       "gPath\tx.cc\t/^char* gPath = \"a\\\\b\";$/;\"\tv\n", "");
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString("// x.cc\nchar* gPath = \"a\\b\";\nint gCount; // hits\n"));
+    std::string where;
+    for(const char* name : { "gCount", "gPath" })
+    {
+        auto tags = index->Find(name);
+        if(!tags.empty())
+        {
+            buf.GoToTag(tags[0].mLine, tags[0].mPattern, tags[0].mName);
+            where += (where.empty() ? "" : " ") + std::to_string(buf.mCursY) + ":" + std::to_string(buf.mCursX);
+        }
+    }
+    Check("tags: pattern with // and \\ in it", where == "2:4 1:6", "went to " + where);
+}
+
+// a command that replaces and then edits is one undo step, like any other
+void CheckReplaceCommand()
+{
+    Editor led;
+    led.mOutputFd = open("/dev/null", O_WRONLY);
+    led.SetScreenSize(24, 80);
+    Buffer buf("", 0, 80, 24);
+    buf.Load(TextSource::FromString("foo\nbar\n"));
+    led.AddBuffer(&buf);
+    led.SetCurrentBuffer(&buf);
+    led.RunCommand("replace \"o+\" \"0\"; insert \"x\"; replace \"a\" \"4\"; insert \"y\"");
+    std::string edited = TextOf(buf.mText);
+    buf.Undo();
+    std::string undone = TextOf(buf.mText);
+    Check("regex: replace in a command is one undo step", edited == "xyf0\nb4r\n" && undone == "foo\nbar\n",
+          "text \"" + edited + "\" then \"" + undone + "\"");
+    close(led.mOutputFd);
+}
+
+// numbers that don't fit are an error, not some other number
+void CheckLedLangNumbers()
+{
+    LedLang lang;
+    std::string results;
+    for(const char* source : { "9223372036854775807", "99999999999999999999", "1 + 9223372036854775808",
+                               "-9223372036854775807 - 1" })
+    {
+        LedValue result;
+        bool ok = lang.Run(source, result);
+        results += (results.empty() ? "" : ", ") + (ok ? result.ToString() : lang.mError);
+    }
+    const char* wanted = "9223372036854775807, number too big, number too big, -9223372036854775808";
+    Check("ledlang: numbers too big", results == wanted, "got " + results);
+}
+
+int RunChecks()
+{
+    char dir[] = "/tmp/led-check-XXXXXX";
+    if(mkdtemp(dir) == nullptr)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    CheckJournal(dir);
+    CheckRegex();
+    CheckReplaceCommand();
+    CheckLedLangNumbers();
+    CheckMacroPaste();
+    CheckBatchWords();
+    CheckNestedBatch();
+    CheckCursors();
+    CheckTags();
+    CheckFollow(dir);
+    rmdir(dir);
+    printf("%d failed\n", gFailures);
+    return gFailures;
+}
+
+int Usage()
+{
+    fprintf(stderr, "usage: led-bench [max lines]\n"
+                    "       led-bench script <file of raw key bytes> [lines] [rows] [cols]\n"
+                    "       led-bench check\n");
+    return 2;
+}
+
+// a count on the command line, which has to be a number above 0
+bool ParseCount(const char* arg, size_t& count)
+{
+    char* end = nullptr;
+    errno = 0;
+    count = std::strtoull(arg, &end, 10);
+    return isdigit((unsigned char) arg[0]) && *end == '\0' && errno == 0 && count > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc > 1 && std::string(argv[1]) == "check")
+    {
+        return RunChecks();
+    }
+    if(argc > 2 && std::string(argv[1]) == "script")
+    {
+        size_t lines = 100000;
+        size_t rows = 24;
+        size_t cols = 80;
+        if((argc > 3 && !ParseCount(argv[3], lines)) || (argc > 4 && (!ParseCount(argv[4], rows) || rows > 10000)) ||
+           (argc > 5 && (!ParseCount(argv[5], cols) || cols > 10000)) || argc > 6)
+        {
+            return Usage();
+        }
+        KeyScript keys = LoadScript(argv[2]);
+        PrintReplayHeader(rows, cols);
+        Replay("script", keys, lines, rows, cols);
+        return 0;
+    }
+
+    size_t maxLines = 10000000;
+    if((argc > 1 && !ParseCount(argv[1], maxLines)) || argc > 2)
+    {
+        return Usage();
+    }
+
+    // with few lines, the benches that need some to work with still get them
+    auto between = [](size_t count, size_t low, size_t high) { return std::min(std::max(count, low), high); };
+
+    printf("keystroke latency, ns/op\n");
+    printf("%10s %14s %14s %14s\n", "lines", "InsertChar", "InsertNewLine", "JoinLines");
+    for(size_t lines = std::min<size_t>(maxLines, 1000); lines <= maxLines; lines *= 10)
+    {
+        BenchKeystrokes(lines, 20000);
+    }
+
+    printf("\n");
+    BenchTokeniser(16 << 20);
+
+    printf("\n");
+    BenchSearch(std::min<size_t>(maxLines, 10000000));
+
+    printf("\n");
+    BenchRegex(std::min<size_t>(maxLines, 10000000), std::min<size_t>(maxLines, 2000000));
+
+    printf("\n");
+    BenchGrep(between(maxLines / 1000, 1, 10000));
+
+    printf("\n");
+    BenchBuffers(between(maxLines / 1000, 1, 2000));
+
+    printf("\n");
+    BenchFollow(between(maxLines / 10000, 1, 256));
+
+    printf("\n");
+    BenchLedLang(100000);
+
+    printf("\n");
+    BenchCursors(between(maxLines, 1000, 1000000));
+
+    printf("\n");
+    BenchJump(std::min<size_t>(maxLines, 10000000), 1000);
+
+    printf("\n");
+    BenchTags(between(maxLines / 5, 1, 2000000));
+
+    printf("\n");
+    BenchPaste(10000, 1000);
+
+    printf("\n");
+    BenchInput(8 << 20);
+
+    printf("\n");
+    BenchMacro(between(maxLines, 1000, 1000000));
+
+    printf("\n");
+    PrintReplayHeader(24, 80);
+    for(size_t lines = std::min<size_t>(maxLines, 10000); lines <= std::min<size_t>(maxLines, 1000000); lines *= 100)
+    {
+        Replay("typing", TypingScript(), lines, 24, 80);
+        Replay("typing+swp", TypingScript(), lines, 24, 80, true);
+        Replay("typing+vs", TypingScript(), lines, 24, 80, false, true);
+        Replay("editing", EditingScript(), lines, 24, 80);
+        Replay("scrolling", ScrollingScript(), lines, 24, 80);
+        Replay("jumping", JumpingScript(), lines, 24, 80);
+    }
+    return 0;
+}
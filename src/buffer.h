@@ -1,18 +1,38 @@
 #pragma once
+#include <algorithm>
 #include <vector>
 #include <fstream>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <sys/stat.h>
+#include "file_saver.h"
+#include "follow.h"
+#include "highlighter.h"
+#include "journal.h"
+#include "regex.h"
+#include "search.h"
+#include "text_storage.h"
+#include "undo.h"
+#include "word_index.h"
 
 const std::string VERSION = "0.0.1";
 
+// files at least this big are mapped and indexed lazily instead of read in
+const off_t kMapFileSize = 16 << 20;
+
 enum Mode
 {
     MODE_EDIT,
     MODE_COMMAND,
-    MODE_JUMP
+    MODE_JUMP,
+    MODE_SEARCH
 };
 
-struct Buffer
+struct Buffer : EditTarget
 {
     Buffer(std::string filename, int id, int cols, int rows)
     {
@@ -21,20 +41,35 @@ struct Buffer
         mNumRows = rows;
         mFileName = filename;
         mName = filename;
+        mListeners.push_back(&mWords);
+        mBatchedListeners.push_back(&mHighlighter);
+        mBatchedListeners.push_back(&mJournal);
         Scroll();
     }
 
+    ~Buffer()
+    {
+        CloseJournal();
+    }
+
+    // listeners point into the buffer
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
     // TODO add filename etc. here when we start doing that
     std::string DescribeSelf()
     {
         return "--Buffer-- "
             " name: " + mName +
             " id: " + std::to_string(mBufId) +
-            " lc: " + std::to_string(mLines.size());
+            " lc: " + std::to_string(mText.LineCount());
     }
     
     int mBufId;
     std::string mName;
+
+    // how many views show it, a buffer on screen is never unloaded
+    int mViews = 0;
     std::string mFileName = "foo.txt";
 
     int mNumCols;
@@ -51,17 +86,60 @@ struct Buffer
     int mScrollY = 0;
     int mScrollX = 0;
 
-    // TODO do we want a linked list here for efficient insertion?
-    std::vector<std::string> mLines = {};
-    std::vector<std::string> mSavedLines = {};
-    
-    std::string* CurrLine()
+    TextStorage mText;
+
+    // the text as it was at the last save/open. it shares all its unedited
+    // lines with mText, so it only costs memory for the lines we've changed
+    TextStorage mSavedText;
+    uint64_t mSavedVersion = 0;
+    uint64_t mSavedHash = 0;
+    bool mSavedHashKnown = false;
+
+    // when set, text that has been edited back to how it was saved counts as
+    // unmodified. costs a hash of each edited line.
+    bool mCheckContentHash = true;
+
+    bool IsModified()
     {
-        if(mLines.size() == 0)
+        if(mText.Version() == mSavedVersion)
+        {
+            return false;
+        }
+
+        // mapped files have no hashes, and we don't wait for a big file to
+        // finish indexing just to draw the status line
+        if(!mCheckContentHash || !mText.Hashed() || !mSavedText.Hashed() || !mText.FullyIndexed())
+        {
+            return true;
+        }
+
+        if(!mSavedHashKnown)
         {
-            mLines.push_back("");
+            mSavedHash = mSavedText.Hash();
+            mSavedHashKnown = true;
         }
-        return &mLines[mCursY];
+        return mText.Hash() != mSavedHash;
+    }
+
+    void MarkSaved()
+    {
+        mHistory.MarkSaved();
+        SetSavedText(mText);
+    }
+
+    void SetSavedText(const TextStorage& text)
+    {
+        mSavedText = text;
+        mSavedVersion = text.Version();
+        mSavedHashKnown = false;
+    }
+
+    int NumLines() { return mText.LineCount(); }
+
+    int CurrLineLength()
+    {
+        ZeroLineCheck();
+        return mText.LineLength(mCursY);
     }
     
     void NextColumn()  { mCursX++; Scroll(); }
@@ -71,17 +149,105 @@ struct Buffer
 
     void StartRow()    { mCursX = 0; Scroll(); }
     void StartColumn() { mCursY = 0; Scroll(); }
-    void EndRow()      { mCursX = CurrLine()->size(); Scroll(); }
-    void EndColumn()   { mCursY = mLines.size() - 1; Scroll(); }
+    void EndRow()      { mCursX = CurrLineLength(); Scroll(); }
+    void EndColumn()   { mCursY = NumLines() - 1; Scroll(); }
+    void PageDown()    { mCursY += std::max(1, mNumRows - 2); Scroll(); }
+    void PageUp()      { mCursY -= std::max(1, mNumRows - 2); Scroll(); }
+
+    WordIndex mWords;
+
+    // the word the cursor's in or just after, for looking up
+    std::string WordAtCursor()
+    {
+        if(!mText.HasLine(mCursY))
+        {
+            return "";
+        }
+        LineView line = mText.GetLineView(mCursY);
+        size_t start = std::min<size_t>(mCursX, line.mLength);
+        size_t end = start;
+        while(start > 0 && WordIndex::IsWordByte(line.mData[start - 1]))
+        {
+            start--;
+        }
+        while(end < line.mLength && WordIndex::IsWordByte(line.mData[end]))
+        {
+            end++;
+        }
+        return std::string(line.mData + start, end - start);
+    }
+
+    // where a tag says a name is defined: its line if that still starts with
+    // the tag's pattern, otherwise the nearest line that does
+    void GoToTag(size_t line, const std::string& pattern, const std::string& name)
+    {
+        size_t target = line > 0 ? line - 1 : 0;
+        auto matches = [&](size_t i)
+        {
+            LineView view = mText.GetLineView(i);
+            return view.mLength >= pattern.size() && memcmp(view.mData, pattern.data(), pattern.size()) == 0;
+        };
+        if(!pattern.empty() && !(mText.HasLine(target) && matches(target)))
+        {
+            for(size_t distance = 1; ; distance++)
+            {
+                bool below = mText.HasLine(target + distance);
+                bool above = distance <= target;
+                if(below && matches(target + distance))
+                {
+                    target += distance;
+                    break;
+                }
+                if(above && matches(target - distance))
+                {
+                    target -= distance;
+                    break;
+                }
+                if(!below && !above)
+                {
+                    break;
+                }
+            }
+        }
+        size_t col = pattern.rfind(name);
+        mCursY = target;
+        mCursX = col == std::string::npos ? 0 : col;
+        Scroll();
+    }
+
+    void NextWord()
+    {
+        TextPos next;
+        if(mText.HasLine(mCursY) && mWords.Next(mText, TextPos(mCursY, mCursX), next))
+        {
+            mCursY = next.mLine;
+            mCursX = next.mCol;
+        }
+        Scroll();
+    }
+
+    void PrevWord()
+    {
+        TextPos prev;
+        if(mText.HasLine(mCursY) && mWords.Prev(mText, TextPos(mCursY, mCursX), prev))
+        {
+            mCursY = prev.mLine;
+            mCursX = prev.mCol;
+        }
+        Scroll();
+    }
     
     void Scroll()
     {
-        if(mLines.size() > 0)
+        if(mText.HasLine(0))
         {
-            mCursY = std::min(mCursY, (int) mLines.size()-1);
             mCursY = std::max(mCursY, 0);
+            if(!mText.HasLine(mCursY))
+            {
+                mCursY = NumLines()-1;
+            }
         
-            mCursX = std::min(mCursX, (int) CurrLine()->length());
+            mCursX = std::min(mCursX, CurrLineLength());
             mCursX = std::max(mCursX, 0);
         }
         else
@@ -95,218 +261,1432 @@ struct Buffer
 
     void InsertChar(char c)
     {       
-        while(mCursX > (int) CurrLine()->length())
+        if(!mCursors.empty())
         {
-            CurrLine()->append(" ");
+            EditAtCursors([c](TextPos, TextPos&, TextPos&, std::string& text) { text = c; });
+            return;
         }
-        CurrLine()->insert(mCursX, std::string(1, c));
+        std::string text(1, c);
+        int length = CurrLineLength();
+        if(mCursX > length)
+        {
+            text.insert(0, mCursX - length, ' ');
+        }
+        Insert(TextPos(mCursY, std::min(mCursX, length)), text, true);
 
         // TODO vertical insert mode, just call NextRow() here
         NextColumn();
     }
     
-    void InsertLine(std::string text)
-    {
-        mLines.push_back(text);
-    }
-    
-    void DeleteCharForwards()
+    // a block of text in one go, as one edit and one undo step
+    void Paste(std::string text)
     {
-        // pressing delete at end of line
-        if(mCursX == (int) CurrLine()->length())
+        // terminals send new lines as \r, or sometimes \r\n
+        size_t out = 0;
+        for(size_t i = 0; i < text.size(); i++)
         {
-            if(mCursY < (int) mLines.size()-1)
+            if(text[i] == '\r')
             {
-                *CurrLine() += mLines[mCursY + 1];
+                text[out++] = '\n';
+                if(i + 1 < text.size() && text[i + 1] == '\n')
+                {
+                    i++;
+                }
             }
-            if(mCursY != (int) mLines.size() - 1)
+            else
             {
-                mLines.erase(mLines.begin() + mCursY + 1);
+                text[out++] = text[i];
             }
         }
-        else
+        text.resize(out);
+        if(text.empty())
         {
-            CurrLine()->erase(mCursX, 1);
+            return;
+        }
+
+        if(!mCursors.empty())
+        {
+            EditAtCursors([&text](TextPos, TextPos&, TextPos&, std::string& insert) { insert = text; });
+            return;
         }
-        Scroll();
         ZeroLineCheck();
+        TextPos pos(mCursY, std::min(mCursX, CurrLineLength()));
+        Insert(pos, text);
+        TextPos end = EndOfText(pos, text);
+        mCursY = end.mLine;
+        mCursX = end.mCol;
+        Scroll();
     }
 
-    // currently unbound
-    void DeleteCharBackwards()
+    void InsertLine(std::string text)
     {
-        // pressing backspace at start of line
-        if(mCursX == 0)
+        mText.AppendLine(text);
+        NotifyReload();
+    }
+
+    // all edits go through Insert and Erase so that they can be undone
+    void Insert(TextPos pos, const std::string& text, bool typing = false)
+    {
+        EditRecord edit;
+        edit.mInsert = true;
+        edit.mPos = pos;
+        edit.mText = text;
+        Record(edit, typing);
+        ApplyInsert(pos, text);
+    }
+
+    void Erase(TextPos from, TextPos to)
+    {
+        EditRecord edit;
+        edit.mInsert = false;
+        edit.mPos = from;
+        edit.mText = ApplyErase(from, to);
+        if(!edit.mText.empty())
         {
-            if(mCursY > 0)
-            {
-                mCursX = mLines[mCursY - 1].length();
-                mLines[mCursY - 1] += *CurrLine();
-                mLines.erase(mLines.begin() + mCursY);
-                mCursY--;
-            }
-            else if(mCursY == 0 && CurrLine()->empty())
-            {
-                mLines.erase(mLines.begin());
-            }
+            Record(edit, false);
         }
-        else
+    }
+
+    void Record(const EditRecord& edit, bool typing)
+    {
+        if(mBatchDepth > 0)
         {
-            CurrLine()->erase(mCursX-- -1, 1);
+            mBatchBytes += edit.mText.size() + edit.mSwapBytes;
+            return;
         }
-        Scroll();
-        ZeroLineCheck();
+        mHistory.Record(edit, typing, mCursX, mCursY);
     }
 
-    void ZeroLineCheck()
+    // edits made between BeginBatch and EndBatch, a macro replaying say,
+    // aren't recorded one by one and the batched listeners don't hear about
+    // them. at the end the text from before is swapped in as one edit, so
+    // undo costs the same however many there were, and the batched
+    // listeners get told it was reloaded. undo and redo do nothing in the
+    // middle of a batch.
+    int mBatchDepth = 0;
+    size_t mBatchBytes = 0;
+    TextStorage mBatchStart;
+    int mBatchCursX = 0;
+    int mBatchCursY = 0;
+
+    void BeginBatch()
     {
-        if(mLines.size() == 0)
+        if(mBatchDepth++ == 0)
         {
-            InsertLine("");
+            mBatchStart = mText;
+            mBatchBytes = 0;
+            mBatchCursX = mCursX;
+            mBatchCursY = mCursY;
         }
     }
-    
-    void KillForward()
+
+    void EndBatch()
     {
-        if(CurrLine()->empty() || mCursX == (int) CurrLine()->length())
+        if(--mBatchDepth > 0)
         {
-            DeleteCharForwards();
+            return;
         }
-        else
+        if(mBatchBytes == 0)
         {
-            CurrLine()->erase(mCursX);
+            mBatchStart = TextStorage();
+            return;
+        }
+        EditRecord edit;
+        edit.mSwap = true;
+        edit.mSwapText = mBatchStart;
+        edit.mSwapBytes = mBatchBytes;
+        mBatchStart = TextStorage();
+        mHistory.Record(edit, false, mBatchCursX, mBatchCursY);
+        for(auto listener : mBatchedListeners)
+        {
+            listener->OnReload();
         }
-        Scroll();
     }
 
-    void InsertNewLine()
+    // and then everything that changes the text, undo included, comes
+    // through here so the listeners hear about it. the word index and the
+    // views hear about each edit as it's made, even in a batch, as a macro
+    // moves by words and the views keep their cursors. the highlighter and
+    // the journal, which have more to do for each, are batched.
+    std::vector<TextListener*> mListeners;
+    std::vector<TextListener*> mBatchedListeners;
+    BackgroundHighlighter mHighlighter;
+    EditJournal mJournal;
+
+    TextPos ApplyInsert(TextPos pos, const std::string& text) override
     {
-        // split current line at the place where we pressed enter
-        std::string partBefore = CurrLine()->substr(0, mCursX);
-        std::string partAfter = CurrLine()->substr(mCursX);
+        TextPos end = mText.Insert(pos, text);
+        EditRecord edit;
+        edit.mInsert = true;
+        edit.mPos = pos;
+        edit.mText = text;
+        NotifyEdit(edit);
+        return end;
+    }
 
-        *CurrLine() = partBefore;
-        mLines.insert(mLines.begin() + mCursY + 1, partAfter);
-        NextRow();
-        StartRow();
+    std::string ApplyErase(TextPos from, TextPos to) override
+    {
+        EditRecord edit;
+        edit.mInsert = false;
+        edit.mPos = from;
+        edit.mText = mText.Erase(from, to);
+        if(!edit.mText.empty())
+        {
+            NotifyEdit(edit);
+        }
+        return edit.mText;
     }
-    
-    // line at the bottom of the buffer
-    std::string GetLedLine()
+
+    void ApplySwap(TextStorage& text) override
     {
-        std::string line = "";
+        std::swap(mText, text);
+        NotifyReload();
+    }
 
-        if(mMode == MODE_COMMAND)
+    // replace every match of regex, & in replacement standing for what it
+    // matched. the new text is built beside the old, untouched runs of lines
+    // going straight across from one to the other, and swapped in as one
+    // edit, which one undo swaps back. returns how many were replaced.
+    size_t ReplaceAll(Regex& regex, const std::string& replacement)
+    {
+        TextStorage replaced;
+        size_t count = 0;
+        size_t changedBytes = 0;
+        mText.ForEachNode([&](const TextNode& n)
         {
-            line = "Command: " + mCommandString;
-        }
-        else if(mMode == MODE_JUMP)
+            if(!n.mSource)
+            {
+                size_t before = count;
+                std::string text = ReplaceInLine(regex, n.mText->data(), n.mText->size(), replacement, count);
+                replaced.AppendLine(count == before ? *n.mText : text);
+                changedBytes += count == before ? 0 : n.mText->size() + text.size();
+                return;
+            }
+
+            // lines of the run up to one with a match go across as they are
+            const TextSource* source = n.mSource.get();
+            LineView first = source->Line(n.mFirst);
+            LineView last = source->Line(n.mFirst + n.mCount - 1);
+            size_t length = last.mData + last.mLength - first.mData;
+            size_t next = n.mFirst;
+            size_t lineStart;
+            size_t lineEnd;
+            for(size_t pos = 0; pos <= length && regex.FindLine(first.mData, length, pos, lineStart, lineEnd);
+                pos = lineEnd + 1)
+            {
+                size_t line = source->LineOf(first.mData + lineStart - source->mData);
+                std::string text = ReplaceInLine(regex, first.mData + lineStart, lineEnd - lineStart,
+                                                 replacement, count);
+                replaced.AppendRun(n.mSource, next, line - next);
+                replaced.AppendLine(text);
+                changedBytes += lineEnd - lineStart + text.size();
+                next = line + 1;
+            }
+            replaced.AppendRun(n.mSource, next, n.mFirst + n.mCount - next);
+        });
+        if(count == 0)
         {
-            line = "Jump: ";
+            return 0;
         }
-        else
+
+        EditRecord edit;
+        edit.mSwap = true;
+        edit.mSwapText = replaced;
+        edit.mSwapBytes = changedBytes;
+        ApplySwap(edit.mSwapText);
+        Record(edit, false);
+        return count;
+    }
+
+    static std::string ReplaceInLine(Regex& regex, const char* line, size_t length, const std::string& replacement,
+                                     size_t& count)
+    {
+        std::string text;
+        size_t copied = 0;
+        regex.ForEachMatch(line, length, 0, [&](size_t start, size_t end)
         {
-            // TODO too slow?
-            if(mSavedLines != mLines)
+            text.append(line + copied, start - copied);
+            for(size_t i = 0; i < replacement.size(); i++)
             {
-                line += "*";
+                if(replacement[i] == '&')
+                {
+                    text.append(line + start, end - start);
+                }
+                else
+                {
+                    // after a \ any character is just itself, \& is an &
+                    i += replacement[i] == '\\' && i + 1 < replacement.size();
+                    text += replacement[i];
+                }
             }
-            line += mName + " (" + std::to_string(mCursX) + "," + std::to_string(mCursY) + ")";
+            copied = end;
+            count++;
+            return true;
+        });
+        text.append(line + copied, length - copied);
+        return text;
+    }
+
+    // add lines to the end, leaving the undo history out of it
+    void AppendLines(const std::vector<std::string>& lines)
+    {
+        std::string text;
+        for(auto& line : lines)
+        {
+            text += '\n';
+            text += line;
         }
-        return line;
+        ZeroLineCheck();
+        size_t last = mText.LineCount() - 1;
+        ApplyInsert(TextPos(last, mText.LineLength(last)), text);
     }
 
-    void Tab()
+    void NotifyEdit(const EditRecord& edit)
     {
-        InsertChar(' ');
-        InsertChar(' ');
-        InsertChar(' ');
-        InsertChar(' ');
+        for(auto listener : mListeners)
+        {
+            listener->OnEdit(edit);
+        }
+        if(mBatchDepth > 0)
+        {
+            return;
+        }
+        for(auto listener : mBatchedListeners)
+        {
+            listener->OnEdit(edit);
+        }
     }
-    
-    std::string mCommandString;
-    
-    Mode mMode = MODE_EDIT;
 
-    void EnterCommandMode()
+    void NotifyReload()
     {
-        mCommandString = "";
-        mMode = MODE_COMMAND;
+        for(auto listener : mListeners)
+        {
+            listener->OnReload();
+        }
+        if(mBatchDepth > 0)
+        {
+            return;
+        }
+        for(auto listener : mBatchedListeners)
+        {
+            listener->OnReload();
+        }
     }
 
-    void InsertCommandChar(char c)
+    // what the text was last loaded from
+    std::shared_ptr<const TextSource> mSource;
+
+    // how long the file was when we last read or wrote it, and whether what
+    // comes after that carries on the text's last line, as it does when the
+    // file is empty or ends partway through a line. follow mode reads on
+    // from there.
+    off_t mFileBytes = 0;
+    bool mFileOpenLine = true;
+
+    // false while a file's buffer hasn't read it yet, or has let go of its
+    // text to save memory. see BufferManager.
+    bool mLoaded = true;
+
+    // replace the whole text, e.g. with a file's
+    void Load(std::shared_ptr<const TextSource> source)
     {
-        mCommandString += std::string(1, c);
+        mSource = source;
+        mLoaded = true;
+        mFileBytes = source->mSize;
+        mFileOpenLine = source->mSize == 0 || source->mData[source->mSize - 1] != '\n';
+        mText.Load(source);
+        mRecovered = false;
+        mHistory.Clear();
+        NotifyReload();
+        MarkSaved();
     }
-    
-    void EnterJumpMode()
+
+    // the same text from source, which has the same bytes as mSource, so
+    // that nothing's left reading mSource
+    void Rebase(std::shared_ptr<const TextSource> source)
     {
-        mMode = MODE_JUMP;
+        const TextSource* from = mSource.get();
+        mText.Rebase(from, source);
+        mSavedText.Rebase(from, source);
+        mBatchStart.Rebase(from, source);
+        mHistory.Rebase(from, source);
+        mJournal.Rebase(from, source);
+        mSource = source;
+
+        // for anything holding a snapshot of the text
+        NotifyReload();
     }
 
-    void Cancel()
+    // a copy of a mapped file in memory, for when the file's going to be
+    // written over or truncated under the mapping
+    void Unmap()
     {
-        if(mMode == MODE_COMMAND)
+        if(mSource && mSource->mMapping != nullptr)
         {
-            mMode = MODE_EDIT;
-            mCommandString = "";
+            Rebase(TextSource::FromString(std::string(mSource->mData, mSource->mSize), mSource->mHashed));
         }
-        else if(mMode == MODE_JUMP)
+    }
+
+    UndoHistory mHistory;
+
+    void Undo()
+    {
+        if(mBatchDepth == 0 && mHistory.Undo(*this, mCursX, mCursY))
         {
-            mMode = MODE_EDIT;
+            ZeroLineCheck();
+            NormaliseCursors();
+            Scroll();
         }
-        else if(mMode == MODE_EDIT)
+    }
+
+    void Redo()
+    {
+        if(mBatchDepth == 0 && mHistory.Redo(*this, mCursX, mCursY))
+        {
+            ZeroLineCheck();
+            NormaliseCursors();
+            Scroll();
+        }
+    }
+
+    // undo back to how the file was last saved, or if the history doesn't
+    // go back that far, just put the saved text back
+    void RevertToSaved()
+    {
+        if(mHistory.CanReachSaved())
         {
-            mLines = mSavedLines;
-            
-            if(mCursY > (int) mLines.size())
+            while(mHistory.mPosition > mHistory.mSavedPosition && mHistory.Undo(*this, mCursX, mCursY))
+            {
+            }
+            while(mHistory.mPosition < mHistory.mSavedPosition && mHistory.Redo(*this, mCursX, mCursY))
             {
-                mCursY = mLines.size();
             }
-
-            mCursX = std::min(mCursX, (int) CurrLine()->length());
-            Scroll();
         }
+        else
+        {
+            mText = mSavedText;
+            mHistory.Clear();
+            NotifyReload();
+        }
+        ZeroLineCheck();
+        Scroll();
     }
     
-    void SaveToFile()
+    void DeleteCharForwards()
     {
-        if(mFileName == "")
+        if(!mCursors.empty())
         {
-            // TODO prompt for a filename
+            EditAtCursors([this](TextPos at, TextPos&, TextPos& to, std::string&) { to = NextCharPos(at); });
+            return;
         }
-        else
+
+        // pressing delete at end of line
+        if(mCursX == CurrLineLength())
         {
-            std::ofstream  outfile;
-            outfile.open(mFileName);
-            for(auto line : mLines)
+            if(mText.HasLine(mCursY + 1))
             {
-                outfile << line << "\n";
+                Erase(TextPos(mCursY, mCursX), TextPos(mCursY + 1, 0));
             }
-            outfile.close();
         }
-        mSavedLines = mLines;
+        else
+        {
+            Erase(TextPos(mCursY, mCursX), TextPos(mCursY, mCursX + 1));
+        }
+        Scroll();
+        ZeroLineCheck();
     }
 
-    bool OpenFile(std::string filename)
+    // currently unbound
+    void DeleteCharBackwards()
     {
-        mFileName = filename;
-        mName = filename;
-        
-        std::ifstream infile(filename);
-        if(infile.is_open())
+        if(!mCursors.empty())
         {
-            std::string line;
-            while(getline(infile, line))
+            EditAtCursors([this](TextPos at, TextPos& from, TextPos&, std::string&)
             {
-                InsertLine(line);
-            }
-            infile.close();
-            mSavedLines = mLines;
+                if(at.mCol > 0)
+                {
+                    from.mCol--;
+                }
+                else if(at.mLine > 0)
+                {
+                    from = TextPos(at.mLine - 1, mText.LineLength(at.mLine - 1));
+                }
+            });
+            return;
         }
 
+        // pressing backspace at start of line
+        if(mCursX == 0)
+        {
+            if(mCursY > 0)
+            {
+                int joinAt = mText.LineLength(mCursY - 1);
+                Erase(TextPos(mCursY - 1, joinAt), TextPos(mCursY, 0));
+                mCursX = joinAt;
+                mCursY--;
+            }
+            else if(mCursY == 0 && CurrLineLength() == 0 && mText.HasLine(1))
+            {
+                Erase(TextPos(0, 0), TextPos(1, 0));
+            }
+        }
+        else
+        {
+            Erase(TextPos(mCursY, mCursX - 1), TextPos(mCursY, mCursX));
+            mCursX--;
+        }
+        Scroll();
         ZeroLineCheck();
-        return true;
+    }
+
+    void ZeroLineCheck()
+    {
+        if(!mText.HasLine(0))
+        {
+            // the line an empty text is shown as isn't an edit
+            bool saved = mText.Version() == mSavedVersion;
+            InsertLine("");
+            if(saved)
+            {
+                SetSavedText(mText);
+            }
+        }
+    }
+    
+    void KillForward()
+    {
+        if(!mCursors.empty())
+        {
+            EditAtCursors([this](TextPos at, TextPos&, TextPos& to, std::string&)
+            {
+                size_t length = mText.LineLength(at.mLine);
+                to = at.mCol < length ? TextPos(at.mLine, length) : NextCharPos(at);
+            });
+            return;
+        }
+        if(CurrLineLength() == 0 || mCursX == CurrLineLength())
+        {
+            DeleteCharForwards();
+        }
+        else
+        {
+            Erase(TextPos(mCursY, mCursX), TextPos(mCursY, CurrLineLength()));
+        }
+        Scroll();
+    }
+
+    void InsertNewLine()
+    {
+        if(!mCursors.empty())
+        {
+            EditAtCursors([](TextPos, TextPos&, TextPos&, std::string& text) { text = "\n"; });
+            return;
+        }
+
+        // split current line at the place where we pressed enter
+        Insert(TextPos(mCursY, mCursX), "\n");
+        NextRow();
+        StartRow();
+    }
+
+    // cursors besides the one at mCursX, mCursY, in order. the keys that
+    // edit do so at all of them as one undo step. what each cursor's edit
+    // erases and inserts is worked out first, then the edits are made from
+    // the bottom of the text up, so none of them moves text that another is
+    // still to edit, and last the cursors are moved to the end of their
+    // edits in one pass from the top down, carrying along how far the edits
+    // before them have shifted things. that's a tree edit per cursor and
+    // nothing else, however many there are.
+    std::vector<TextPos> mCursors;
+
+    struct CursorEdit
+    {
+        TextPos mFrom;
+        TextPos mTo;
+        std::string mText;
+        bool mMain = false;
+    };
+
+    // the edit at a cursor, which starts out as erasing nothing from it and
+    // inserting nothing
+    typedef std::function<void(TextPos at, TextPos& from, TextPos& to, std::string& text)> CursorEditFn;
+
+    void EditAtCursors(const CursorEditFn& fn)
+    {
+        ZeroLineCheck();
+        TextPos main(mCursY, std::min(mCursX, CurrLineLength()));
+        std::vector<TextPos> cursors;
+        cursors.reserve(mCursors.size() + 1);
+        for(auto cursor : mCursors)
+        {
+            cursor.mCol = std::min(cursor.mCol, mText.LineLength(cursor.mLine));
+            cursors.push_back(cursor);
+        }
+        cursors.push_back(main);
+        std::sort(cursors.begin(), cursors.end());
+        cursors.erase(std::unique(cursors.begin(), cursors.end()), cursors.end());
+
+        std::vector<CursorEdit> edits;
+        edits.reserve(cursors.size());
+        TextPos done;
+        for(auto at : cursors)
+        {
+            CursorEdit edit;
+            edit.mFrom = at;
+            edit.mTo = at;
+            edit.mMain = at == main;
+            fn(at, edit.mFrom, edit.mTo, edit.mText);
+
+            // where two cursors' edits overlap the second loses the overlap
+            edit.mFrom = std::max(edit.mFrom, done);
+            edit.mTo = std::max(edit.mTo, edit.mFrom);
+            done = edit.mTo;
+            edits.push_back(edit);
+        }
+
+        mHistory.BeginGroup();
+        for(size_t i = edits.size(); i-- > 0;)
+        {
+            CursorEdit& edit = edits[i];
+            if(edit.mFrom < edit.mTo)
+            {
+                Erase(edit.mFrom, edit.mTo);
+            }
+            if(!edit.mText.empty())
+            {
+                Insert(edit.mFrom, edit.mText);
+            }
+        }
+        mHistory.EndGroup();
+
+        // the edits so far move the rest of the line the last one ended on
+        // by colShift, and the lines after it by lineShift
+        size_t endLine = SIZE_MAX;
+        size_t endLineNow = 0;
+        long colShift = 0;
+        long lineShift = 0;
+        mCursors.clear();
+        for(auto& edit : edits)
+        {
+            TextPos from = edit.mFrom.mLine == endLine ? TextPos(endLineNow, edit.mFrom.mCol + colShift)
+                                                       : TextPos(edit.mFrom.mLine + lineShift, edit.mFrom.mCol);
+            TextPos end = EndOfText(from, edit.mText);
+            endLine = edit.mTo.mLine;
+            endLineNow = end.mLine;
+            colShift = (long) end.mCol - (long) edit.mTo.mCol;
+            lineShift = (long) end.mLine - (long) edit.mTo.mLine;
+
+            if(edit.mMain)
+            {
+                mCursY = end.mLine;
+                mCursX = end.mCol;
+            }
+            else if(mCursors.empty() || mCursors.back() != end)
+            {
+                mCursors.push_back(end);
+            }
+        }
+        NormaliseCursors();
+        ZeroLineCheck();
+        Scroll();
+    }
+
+    // where delete at pos deletes up to
+    TextPos NextCharPos(TextPos pos)
+    {
+        if(pos.mCol < mText.LineLength(pos.mLine))
+        {
+            return TextPos(pos.mLine, pos.mCol + 1);
+        }
+        return mText.HasLine(pos.mLine + 1) ? TextPos(pos.mLine + 1, 0) : pos;
+    }
+
+    // in order, on the text, and none twice or where the main cursor is
+    void NormaliseCursors()
+    {
+        for(auto& cursor : mCursors)
+        {
+            cursor.mLine = std::min<size_t>(cursor.mLine, std::max(NumLines(), 1) - 1);
+            cursor.mCol = std::min(cursor.mCol, mText.HasLine(cursor.mLine) ? mText.LineLength(cursor.mLine) : 0);
+        }
+        std::sort(mCursors.begin(), mCursors.end());
+        mCursors.erase(std::unique(mCursors.begin(), mCursors.end()), mCursors.end());
+        TextPos main(mCursY, mCursX);
+        auto at = std::lower_bound(mCursors.begin(), mCursors.end(), main);
+        if(at != mCursors.end() && *at == main)
+        {
+            mCursors.erase(at);
+        }
+    }
+
+    // a cursor movement, made by every cursor
+    void MoveCursors(void (Buffer::*move)())
+    {
+        (this->*move)();
+        if(mCursors.empty())
+        {
+            return;
+        }
+        int cursX = mCursX;
+        int cursY = mCursY;
+        for(auto& cursor : mCursors)
+        {
+            mCursX = cursor.mCol;
+            mCursY = cursor.mLine;
+            (this->*move)();
+            cursor = TextPos(mCursY, mCursX);
+        }
+        mCursX = cursX;
+        mCursY = cursY;
+        NormaliseCursors();
+        Scroll();
+    }
+
+    // a cursor at the start of every match of needle, the main one at the
+    // first. returns how many there are.
+    size_t PlaceCursors(const std::string& needle, bool regex, std::string& error)
+    {
+        std::vector<TextPos> found;
+        TextPos from;
+        TextSearch search;
+        search.Start(needle, from, regex);
+        if(!search.mError.empty())
+        {
+            error = search.mError;
+            return 0;
+        }
+        for(;;)
+        {
+            while(!search.Step(mText, kSearchSlice))
+            {
+            }
+
+            // it wraps round to the ones we've already got
+            if(!search.mFound || (!found.empty() && !(found.back() < search.mMatch)))
+            {
+                break;
+            }
+            found.push_back(search.mMatch);
+
+            from = TextPos(search.mMatch.mLine, search.mMatch.mCol + std::max<size_t>(search.mMatchLength, 1));
+            if(from.mCol > mText.LineLength(from.mLine))
+            {
+                from = TextPos(from.mLine + 1, 0);
+                if(!mText.HasLine(from.mLine))
+                {
+                    break;
+                }
+            }
+            search.Restart(from);
+        }
+
+        if(found.empty())
+        {
+            return 0;
+        }
+        mCursY = found.front().mLine;
+        mCursX = found.front().mCol;
+        mCursors.assign(found.begin() + 1, found.end());
+        Scroll();
+        return found.size();
+    }
+    
+    // line at the bottom of the buffer
+    std::string GetLedLine()
+    {
+        std::string line = "";
+
+        if(mMode == MODE_COMMAND)
+        {
+            line = "Command: " + mCommandString;
+        }
+        else if(mMode == MODE_JUMP)
+        {
+            line = "Jump: " + mJumpString;
+        }
+        else if(mMode == MODE_SEARCH)
+        {
+            line = (mSearchRegex ? "Regex search: " : "Search: ") + mSearchString;
+            if(!mSearch.mError.empty())
+            {
+                line += " (" + mSearch.mError + ")";
+            }
+            else if(!mSearch.mDone)
+            {
+                line += " searching";
+            }
+            else if(!mSearch.mFound && !mSearchString.empty())
+            {
+                line += " not found";
+            }
+        }
+        else
+        {
+            if(IsModified())
+            {
+                line += mRecovered ? "*recovered* " : "*";
+            }
+            line += mName + " (" + std::to_string(mCursX) + "," + std::to_string(mCursY) + ")";
+            if(mFollow.Active())
+            {
+                line += " following";
+            }
+            if(!mCursors.empty())
+            {
+                line += " " + std::to_string(mCursors.size() + 1) + " cursors";
+            }
+            if(mSave)
+            {
+                line += " saving";
+            }
+            else if(mSaveFailed)
+            {
+                line += " save failed";
+            }
+            if(!mMessage.empty())
+            {
+                line += " " + mMessage;
+            }
+        }
+        return line;
+    }
+
+    void Tab()
+    {
+        if(!mCursors.empty())
+        {
+            EditAtCursors([](TextPos, TextPos&, TextPos&, std::string& text) { text = "    "; });
+            return;
+        }
+        InsertChar(' ');
+        InsertChar(' ');
+        InsertChar(' ');
+        InsertChar(' ');
+    }
+    
+    std::string mCommandString;
+
+    // shown on the led line until the next key
+    std::string mMessage;
+    
+    Mode mMode = MODE_EDIT;
+
+    void EnterCommandMode()
+    {
+        mCommandString = "";
+        mMode = MODE_COMMAND;
+    }
+
+    void InsertCommandChar(char c)
+    {
+        mCommandString += std::string(1, c);
+    }
+    
+    // jump mode puts a label on every word start on the screen, and typing
+    // one moves the cursor there. the nearest words get the shortest labels.
+    struct JumpTarget
+    {
+        TextPos mPos;
+        std::string mLabel;
+
+        bool operator<(const JumpTarget& other) const { return mPos < other.mPos; }
+    };
+
+    // the targets in text order, and every label and label prefix to which
+    // target it is, or kJumpPrefix if it's only the start of longer ones
+    std::vector<JumpTarget> mJumpTargets;
+    std::unordered_map<std::string, size_t> mJumpLabels;
+    std::string mJumpString;
+    static const size_t kJumpPrefix = SIZE_MAX;
+
+    // easiest to type first
+    static const char* JumpAlphabet() { return "asdfjklghqwertyuiopzxcvbnm"; }
+
+    // count labels none of which starts another, the short ones first. each
+    // label taken for a prefix becomes the start of a full set of longer ones.
+    static std::vector<std::string> JumpLabels(size_t count)
+    {
+        std::string alphabet = JumpAlphabet();
+        std::vector<std::string> labels(1);
+        size_t used = 0;
+        while(labels.size() - used < count || labels.size() == 1)
+        {
+            std::string prefix = labels[used++];
+            for(char c : alphabet)
+            {
+                labels.push_back(prefix + c);
+            }
+        }
+        return std::vector<std::string>(labels.begin() + used, labels.begin() + used + count);
+    }
+
+    void EnterJumpMode()
+    {
+        mJumpTargets.clear();
+        mJumpLabels.clear();
+        mJumpString.clear();
+
+        // the rows above the led line, as far across as the screen goes
+        for(int y = mScrollY; y < mScrollY + mNumRows - 1 && mText.HasLine(y); y++)
+        {
+            for(uint32_t col : mWords.Starts(mText, y))
+            {
+                if(col >= (uint32_t) mNumCols)
+                {
+                    break;
+                }
+                JumpTarget target;
+                target.mPos = TextPos(y, col);
+                mJumpTargets.push_back(target);
+            }
+        }
+        if(mJumpTargets.empty())
+        {
+            mMessage = "no words to jump to";
+            return;
+        }
+
+        auto distance = [this](const JumpTarget& target)
+        {
+            int lines = std::abs((int) target.mPos.mLine - mCursY);
+            int cols = std::abs((int) target.mPos.mCol - mCursX);
+            return std::make_pair(lines, cols);
+        };
+        std::stable_sort(mJumpTargets.begin(), mJumpTargets.end(), [&](const JumpTarget& a, const JumpTarget& b)
+        {
+            return distance(a) < distance(b);
+        });
+        std::vector<std::string> labels = JumpLabels(mJumpTargets.size());
+        for(size_t i = 0; i < mJumpTargets.size(); i++)
+        {
+            mJumpTargets[i].mLabel = labels[i];
+        }
+
+        std::sort(mJumpTargets.begin(), mJumpTargets.end());
+        for(size_t i = 0; i < mJumpTargets.size(); i++)
+        {
+            const std::string& label = mJumpTargets[i].mLabel;
+            for(size_t length = 1; length < label.size(); length++)
+            {
+                mJumpLabels[label.substr(0, length)] = kJumpPrefix;
+            }
+            mJumpLabels[label] = i;
+        }
+        mMode = MODE_JUMP;
+    }
+
+    void InsertJumpChar(char c)
+    {
+        mJumpString += c;
+        auto found = mJumpLabels.find(mJumpString);
+        if(found == mJumpLabels.end())
+        {
+            mMessage = "no label " + mJumpString;
+            mMode = MODE_EDIT;
+        }
+        else if(found->second != kJumpPrefix)
+        {
+            TextPos pos = mJumpTargets[found->second].mPos;
+            mCursY = pos.mLine;
+            mCursX = pos.mCol;
+            mMode = MODE_EDIT;
+            Scroll();
+        }
+    }
+
+    void DeleteJumpChar()
+    {
+        if(!mJumpString.empty())
+        {
+            mJumpString.pop_back();
+        }
+    }
+
+    // incremental search. the cursor goes to the first match at or after
+    // where it was when the search started, as the search string is typed.
+    std::string mSearchString;
+    TextPos mSearchOrigin;
+    TextSearch mSearch;
+
+    // the search string is a regex, this sticks from one search to the next
+    bool mSearchRegex = false;
+
+    // bytes looked through at a time, about a millisecond's worth
+    static const size_t kSearchSlice = 4 << 20;
+
+    void EnterSearchMode()
+    {
+        mSearchString = "";
+        mSearchOrigin = TextPos(mCursY, mCursX);
+        mSearch.Start("", mSearchOrigin);
+        mMode = MODE_SEARCH;
+    }
+
+    void InsertSearchChar(char c)
+    {
+        mSearchString += c;
+        mSearch.Start(mSearchString, mSearchOrigin, mSearchRegex);
+        ContinueSearch();
+    }
+
+    void DeleteSearchChar()
+    {
+        if(!mSearchString.empty())
+        {
+            mSearchString.pop_back();
+        }
+        mSearch.Start(mSearchString, mSearchOrigin, mSearchRegex);
+        mCursY = mSearchOrigin.mLine;
+        mCursX = mSearchOrigin.mCol;
+        ContinueSearch();
+        Scroll();
+    }
+
+    void ToggleSearchRegex()
+    {
+        mSearchRegex = !mSearchRegex;
+        mSearch.Start(mSearchString, mSearchOrigin, mSearchRegex);
+        mCursY = mSearchOrigin.mLine;
+        mCursX = mSearchOrigin.mCol;
+        ContinueSearch();
+        Scroll();
+    }
+
+    // on to the match after this one
+    void SearchNext()
+    {
+        TextPos from(mCursY, mCursX);
+        if(mSearch.mFound)
+        {
+            // a regex carries on after the match, it might match part of it
+            size_t skip = mSearchRegex ? std::max<size_t>(mSearch.mMatchLength, 1) : 1;
+            from = TextPos(mSearch.mMatch.mLine, mSearch.mMatch.mCol + skip);
+        }
+        mSearch.Start(mSearchString, from, mSearchRegex);
+        ContinueSearch();
+    }
+
+    // look through the next slice of the text, moving the cursor if that
+    // finds it. returns true if there's more to look through.
+    bool ContinueSearch()
+    {
+        if(mMode == MODE_SEARCH && !mSearch.mDone && mSearch.Step(mText, kSearchSlice) && mSearch.mFound)
+        {
+            mCursY = mSearch.mMatch.mLine;
+            mCursX = mSearch.mMatch.mCol;
+            Scroll();
+        }
+        return mMode == MODE_SEARCH && !mSearch.mDone;
+    }
+
+    // stay where the search got to
+    void FinishSearch()
+    {
+        mSearch.mDone = true;
+        mMode = MODE_EDIT;
+    }
+
+    void Cancel()
+    {
+        if(mMode == MODE_COMMAND)
+        {
+            mMode = MODE_EDIT;
+            mCommandString = "";
+        }
+        else if(mMode == MODE_JUMP)
+        {
+            mMode = MODE_EDIT;
+        }
+        else if(mMode == MODE_SEARCH)
+        {
+            // back to where we were before the search
+            mSearch.mDone = true;
+            mMode = MODE_EDIT;
+            mCursY = mSearchOrigin.mLine;
+            mCursX = mSearchOrigin.mCol;
+            Scroll();
+        }
+        else if(mMode == MODE_EDIT)
+        {
+            // one cursor again, or if there already is just one, the text
+            // as it was saved
+            if(!mCursors.empty())
+            {
+                mCursors.clear();
+            }
+            else
+            {
+                RevertToSaved();
+            }
+        }
+    }
+    
+    // how work finished on another thread gets back to the editor's. set
+    // by the editor, without it saves are finished before SaveToFile returns.
+    std::function<void(std::function<void()>)> mPost;
+
+    // the save that's running, if there is one, and where the history was
+    // when it started
+    std::unique_ptr<BackgroundSave> mSave;
+    int mSaveId = 0;
+    long mSavePosition = 0;
+    uint64_t mSaveGeneration = 0;
+    bool mSaveFailed = false;
+
+    void SaveToFile()
+    {
+        if(mFileName == "")
+        {
+            // TODO prompt for a filename
+            MarkSaved();
+            return;
+        }
+
+        // one at a time, a second Ctrl-S waits for the first
+        FinishSave();
+
+        // writing over the file in place would change the text under us
+        if(BackgroundSave::InPlace(mFileName))
+        {
+            Unmap();
+        }
+
+        // typing from here on mustn't join the group the save ends with
+        mHistory.Seal();
+        mJournal.SaveStarted();
+        mSavePosition = mHistory.mPosition;
+        mSaveGeneration = mHistory.mGeneration;
+        mSaveFailed = false;
+        mSave.reset(new BackgroundSave());
+
+        if(mPost)
+        {
+            int id = ++mSaveId;
+            auto post = mPost;
+            mSave->Start(mText, mFileName, [this, id, post]()
+            {
+                post([this, id]()
+                {
+                    if(id == mSaveId)
+                    {
+                        FinishSave();
+                    }
+                });
+            });
+        }
+        else
+        {
+            mSave->Start(mText, mFileName, nullptr);
+            FinishSave();
+        }
+    }
+
+    // wait for the save in progress and take note of how it went
+    void FinishSave()
+    {
+        if(!mSave)
+        {
+            return;
+        }
+        mSave->Join();
+        if(mSave->mOk)
+        {
+            mFileBytes = mSave->mBytes;
+            mFileOpenLine = mSave->mBytes == 0;
+            SetSavedText(mSave->mText);
+            mHistory.MarkSavedAt(mSavePosition, mSaveGeneration);
+        }
+        else
+        {
+            mSaveFailed = true;
+        }
+        mJournal.SaveFinished(mSave->mOk, mFileName, mSave->mText);
+        mRecovered = mRecovered && !mSave->mOk;
+        mSave.reset();
+    }
+
+    // true if the text came back from a journal left by a led that died
+    bool mRecovered = false;
+
+    // put back the edits in filename's journal, if it has one for the
+    // version of the file in base. they come back as one undo step.
+    bool RecoverJournal(std::shared_ptr<const TextSource> source, const JournalBase& base)
+    {
+        JournalContents contents;
+        if(!EditJournal::Read(mFileName, base, source, contents))
+        {
+            return false;
+        }
+
+        if(contents.mHasCheckpoint)
+        {
+            // there's no undoing back past this, so revert by reloading
+            mText = contents.mCheckpoint;
+            NotifyReload();
+            mHistory.mSavedPosition = -1;
+        }
+
+        mHistory.BeginGroup();
+        for(auto& edit : contents.mEdits)
+        {
+            TextPos end = edit.mInsert ? edit.mPos : edit.End();
+            if(!ValidPos(edit.mPos) || !ValidPos(end))
+            {
+                break;
+            }
+            if(edit.mInsert)
+            {
+                Insert(edit.mPos, edit.mText);
+                end = edit.End();
+            }
+            else
+            {
+                Erase(edit.mPos, end);
+                end = edit.mPos;
+            }
+            mCursY = end.mLine;
+            mCursX = end.mCol;
+        }
+        mHistory.EndGroup();
+
+        mRecovered = true;
+        ZeroLineCheck();
+        Scroll();
+        return true;
+    }
+
+    bool ValidPos(TextPos pos)
+    {
+        if(!mText.HasLine(0))
+        {
+            return pos == TextPos();
+        }
+        return mText.HasLine(pos.mLine) && pos.mCol <= mText.LineLength(pos.mLine);
+    }
+
+    // journal edits to the text loaded from source, first putting back any
+    // that were journalled and never saved
+    void StartJournal(std::shared_ptr<const TextSource> source)
+    {
+        JournalBase base = JournalBase::Of(mFileName);
+        bool recovered = RecoverJournal(source, base);
+        if(!recovered)
+        {
+            // edits to some other version of the file can't be put back,
+            // but they mustn't be lost either
+            std::string aside = EditJournal::MoveAsideIfStale(mFileName, base);
+            if(!aside.empty())
+            {
+                mMessage = "the file changed since its unsaved edits, they're in " + aside;
+            }
+        }
+        mJournal.Start(mFileName, base, source, &mText, recovered);
+    }
+
+    // a journal of edits we never saved is kept for next time
+    void CloseJournal()
+    {
+        FinishSave();
+        if(mJournal.Active())
+        {
+            mJournal.Close(!IsModified());
+        }
+    }
+
+    bool OpenFile(std::string filename)
+    {
+        return OpenSource(filename, ReadFile(filename));
+    }
+
+    // a file's text, mapped if it's big and read in if not, or always read
+    // in without map. nullptr if it can't be read. touches nothing else, so
+    // any thread can read ahead.
+    static std::shared_ptr<const TextSource> ReadFile(const std::string& filename, bool map = true)
+    {
+        struct stat info;
+        if(map && stat(filename.c_str(), &info) == 0 && info.st_size >= kMapFileSize)
+        {
+            auto source = TextSource::MapFile(filename);
+            if(source)
+            {
+                return source;
+            }
+        }
+
+        std::ifstream infile(filename, std::ios::binary);
+        if(!infile.is_open())
+        {
+            return nullptr;
+        }
+        // one big read, lines are cut out of it by the storage as needed
+        infile.seekg(0, std::ios::end);
+        std::string data(infile.tellg(), '\0');
+        infile.seekg(0, std::ios::beg);
+        infile.read(&data[0], data.size());
+        return TextSource::FromString(data);
+    }
+
+    // open filename with the text already read from it, or as a new file
+    // if there wasn't any
+    bool OpenSource(std::string filename, std::shared_ptr<const TextSource> source)
+    {
+        CloseJournal();
+        mFileName = filename;
+        mName = filename;
+        if(source)
+        {
+            Load(source);
+        }
+        mLoaded = true;
+        StartJournal(source);
+        ZeroLineCheck();
+        return true;
+    }
+
+    // roughly what the buffer holds on the heap that Unload would let go
+    // of: the text it was loaded from and the undo history
+    size_t MemoryBytes() const
+    {
+        size_t bytes = mHistory.mBytes;
+        if(mSource)
+        {
+            bytes += mSource->HeapBytes();
+        }
+        return bytes;
+    }
+
+    // let go of the text, to be read from the file again when it's wanted.
+    // only for a buffer with nothing unsaved, and its undo history goes too.
+    void Unload()
+    {
+        CloseJournal();
+        mText.Clear();
+        SetSavedText(mText);
+        mSource.reset();
+        mHistory.Clear();
+        mCursors.clear();
+        NotifyReload();
+        mHighlighter.Stop();
+        mLoaded = false;
+    }
+
+    // follow mode: what's added to the end of the file is added to the end
+    // of the text as it's written. appended lines are pieces of their own in
+    // the text, nothing before them is copied or looked at again, and they
+    // aren't edits to undo. the journal isn't kept, the file has it all, and
+    // edits made while following are lost if the file is truncated or
+    // replaced and read again. a followed file is never mapped, it's
+    // expected to shrink, and the pages past its new end would be lost.
+    // following starts from the end of the file as we last read or wrote
+    // it, which is only the end of the text if nothing's unsaved.
+    FileFollower mFollow;
+
+    bool StartFollowing(std::string& error)
+    {
+        if(mFileName.empty())
+        {
+            error = "no file to follow";
+            return false;
+        }
+        FinishSave();
+        if(IsModified())
+        {
+            error = "save first, the edits would be lost";
+            return false;
+        }
+        if(!mFollow.Start(mFileName, mFileBytes, error))
+        {
+            return false;
+        }
+        CloseJournal();
+        Unmap();
+        return true;
+    }
+
+    void StopFollowing()
+    {
+        mFollow.Stop();
+    }
+
+    // take in what's been added to the file, up to maxBytes of it, or read it
+    // all again if it was truncated or replaced. false if nothing changed.
+    // a cursor on the last line stays on the last line.
+    bool Follow(size_t maxBytes)
+    {
+        std::string bytes;
+        FileFollower::Change change = mFollow.Read(bytes, maxBytes);
+        if(change == FileFollower::kNone)
+        {
+            return false;
+        }
+        ZeroLineCheck();
+        bool atEnd = mCursY >= NumLines() - 1;
+        if(change == FileFollower::kReplaced)
+        {
+            auto source = ReadFile(mFileName, false);
+            off_t size = source ? source->mSize : 0;
+            if(source)
+            {
+                Load(source);
+            }
+            else
+            {
+                mText.Clear();
+                NotifyReload();
+                MarkSaved();
+                mFileBytes = 0;
+                mFileOpenLine = true;
+            }
+            mFollow.Restart(size);
+            mFollow.mReplaced++;
+            ZeroLineCheck();
+        }
+        else
+        {
+            AppendFollowed(bytes);
+        }
+        if(atEnd)
+        {
+            mCursY = NumLines() - 1;
+        }
+        Scroll();
+        return true;
+    }
+
+    void AppendFollowed(std::string& bytes)
+    {
+        bool saved = !IsModified();
+        size_t last = NumLines() - 1;
+        bool closed = bytes.back() == '\n';
+
+        EditRecord edit;
+        edit.mPos = TextPos(last, mText.LineLength(last));
+        edit.mText = mFileOpenLine ? "" : "\n";
+        edit.mText.append(bytes, 0, bytes.size() - closed);
+
+        // the open line is finished first, then whole lines go on the end
+        // straight from what was read
+        size_t first = 0;
+        if(mFileOpenLine)
+        {
+            size_t newline = std::min(bytes.find('\n'), bytes.size());
+            mText.SetLine(last, mText.GetLine(last).append(bytes, 0, newline));
+            first = 1;
+        }
+        mFileBytes += bytes.size();
+        auto source = TextSource::FromString(std::move(bytes), false);
+        size_t lines = source->LineCount();
+        if(lines > first)
+        {
+            mText.AppendRun(source, first, lines - first);
+        }
+        mFileOpenLine = !closed;
+
+        NotifyEdit(edit);
+        if(saved)
+        {
+            SetSavedText(mText);
+        }
     }
 
     void MakeFile(std::string filename)
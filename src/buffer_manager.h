@@ -0,0 +1,278 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "grep.h"
+
+// every open buffer, found by id or by path in one lookup, in the order
+// they were opened for going round them, and most recently used first for
+// going back to the last one. a file isn't read until its buffer is first
+// shown, or ahead of that on other threads, when the text waits in the slot
+// until then. once the buffers add up to more than mMemoryBudget, the ones
+// used longest ago let go of their text, to read it from the file again if
+// they're shown again. only buffers with nothing unsaved that aren't on
+// screen or being followed are let go of.
+struct BufferManager
+{
+    struct Slot
+    {
+        Buffer* mBuffer = nullptr;
+        std::unique_ptr<Buffer> mOwned;
+
+        // where it is in mOrdered and mRecent
+        size_t mOrder = 0;
+        std::list<int>::iterator mRecent;
+
+        // read ahead, for when the buffer is first shown
+        std::shared_ptr<const TextSource> mAhead;
+    };
+
+    std::unordered_map<int, Slot> mById;
+    std::unordered_map<std::string, int> mByPath;
+    std::vector<Buffer*> mOrdered;
+
+    // ids, most recently used first
+    std::list<int> mRecent;
+    int mNextId = 0;
+
+    size_t mMemoryBudget = 512 << 20;
+
+    // buffers that have let go of their text, to see the budget working
+    size_t mUnloads = 0;
+
+    // what new buffers start out as
+    int mNumCols = 80;
+    int mNumRows = 24;
+
+    // hands a callback to the main thread, for files read ahead
+    std::function<void(std::function<void()>)> mPost;
+
+    std::vector<Buffer*>::const_iterator begin() const { return mOrdered.begin(); }
+    std::vector<Buffer*>::const_iterator end() const { return mOrdered.end(); }
+    size_t size() const { return mOrdered.size(); }
+
+    // the same file by whatever path it's opened with
+    static std::string PathKey(const std::string& path)
+    {
+        char* resolved = realpath(path.c_str(), nullptr);
+        if(resolved == nullptr)
+        {
+            return path;
+        }
+        std::string key = resolved;
+        free(resolved);
+        return key;
+    }
+
+    // buf keeps its id unless another buffer has it already. owned buffers
+    // are deleted with the manager, others belong to whoever added them.
+    Buffer* Add(Buffer* buf, std::unique_ptr<Buffer> owned = nullptr)
+    {
+        if(buf->mBufId < 0 || mById.count(buf->mBufId) != 0)
+        {
+            buf->mBufId = mNextId;
+        }
+        mNextId = std::max(mNextId, buf->mBufId + 1);
+
+        Slot& slot = mById[buf->mBufId];
+        slot.mBuffer = buf;
+        slot.mOwned = std::move(owned);
+        slot.mOrder = mOrdered.size();
+        mOrdered.push_back(buf);
+        slot.mRecent = mRecent.insert(mRecent.end(), buf->mBufId);
+        if(!buf->mFileName.empty())
+        {
+            mByPath[PathKey(buf->mFileName)] = buf->mBufId;
+        }
+        return buf;
+    }
+
+    // a buffer of the manager's own
+    Buffer* Create(const std::string& filename)
+    {
+        std::unique_ptr<Buffer> buf(new Buffer(filename, mNextId, mNumCols, mNumRows));
+        Buffer* added = buf.get();
+        return Add(added, std::move(buf));
+    }
+
+    Buffer* FindId(int id) const
+    {
+        auto found = mById.find(id);
+        return found == mById.end() ? nullptr : found->second.mBuffer;
+    }
+
+    Buffer* FindPath(const std::string& path) const
+    {
+        auto found = mByPath.find(PathKey(path));
+        return found == mByPath.end() ? nullptr : FindId(found->second);
+    }
+
+    // the buffer for a file, made if there isn't one yet but without reading
+    // the file, that waits for Load
+    Buffer* Open(const std::string& path)
+    {
+        Buffer* buf = FindPath(path);
+        if(buf == nullptr)
+        {
+            buf = Create(path);
+            buf->mLoaded = false;
+        }
+        return buf;
+    }
+
+    void Load(Buffer* buf)
+    {
+        if(buf->mLoaded)
+        {
+            return;
+        }
+        auto found = mById.find(buf->mBufId);
+        if(found != mById.end() && found->second.mAhead)
+        {
+            buf->OpenSource(buf->mFileName, std::move(found->second.mAhead));
+        }
+        else
+        {
+            buf->OpenFile(buf->mFileName);
+        }
+    }
+
+    // buf is being shown: it goes to the front of the recently used, and if
+    // it has to be read in, other buffers make room for it
+    void Use(Buffer* buf)
+    {
+        auto found = mById.find(buf->mBufId);
+        if(found == mById.end())
+        {
+            return;
+        }
+        mRecent.splice(mRecent.begin(), mRecent, found->second.mRecent);
+        if(!buf->mLoaded)
+        {
+            Load(buf);
+            Trim();
+        }
+    }
+
+    // step buffers on from buf in the order they were opened, round to the
+    // start at the end
+    Buffer* Step(Buffer* buf, int step) const
+    {
+        auto found = mById.find(buf->mBufId);
+        if(found == mById.end() || mOrdered.empty())
+        {
+            return buf;
+        }
+        long size = mOrdered.size();
+        return mOrdered[((long) found->second.mOrder + step % size + size) % size];
+    }
+
+    // the most recently used buffer other than the one in use
+    Buffer* Previous() const
+    {
+        if(mRecent.size() < 2)
+        {
+            return nullptr;
+        }
+        return FindId(*std::next(mRecent.begin()));
+    }
+
+    size_t MemoryBytes() const
+    {
+        size_t bytes = 0;
+        for(auto& slot : mById)
+        {
+            bytes += slot.second.mBuffer->MemoryBytes();
+            bytes += slot.second.mAhead ? slot.second.mAhead->HeapBytes() : 0;
+        }
+        return bytes;
+    }
+
+    static bool CanUnload(Buffer* buf)
+    {
+        return buf->mLoaded && buf->mSource && !buf->mFileName.empty() && buf->mViews == 0 &&
+               !buf->mFollow.Active() && !buf->IsModified();
+    }
+
+    // let go of the text of the buffers used longest ago until everything
+    // fits in the budget again, apart from the one in use
+    void Trim()
+    {
+        size_t bytes = MemoryBytes();
+        for(auto id = mRecent.rbegin(); bytes > mMemoryBudget && id != mRecent.rend(); ++id)
+        {
+            Slot& slot = mById[*id];
+            Buffer* buf = slot.mBuffer;
+            if(slot.mAhead)
+            {
+                bytes -= std::min(bytes, slot.mAhead->HeapBytes());
+                slot.mAhead.reset();
+            }
+            if(id == std::prev(mRecent.rend()) || !CanUnload(buf))
+            {
+                continue;
+            }
+            size_t freed = buf->MemoryBytes();
+            buf->Unload();
+            freed -= std::min(freed, buf->MemoryBytes());
+            bytes -= std::min(bytes, freed);
+            mUnloads++;
+        }
+    }
+
+    // read files ahead on all the cores, as many as fit in the budget, and
+    // hand each one to its slot back on the main thread unless the buffer's
+    // been read some other way by then
+    std::unique_ptr<WorkStealingPool> mReader;
+
+    void ReadAhead(const std::vector<Buffer*>& bufs)
+    {
+        if(!mPost)
+        {
+            return;
+        }
+        if(!mReader)
+        {
+            mReader.reset(new WorkStealingPool(std::thread::hardware_concurrency()));
+        }
+        size_t bytes = MemoryBytes();
+        for(auto buf : bufs)
+        {
+            struct stat info;
+            if(buf->mLoaded || stat(buf->mFileName.c_str(), &info) != 0)
+            {
+                continue;
+            }
+            // big files are mapped, they cost little until they're looked at
+            bytes += info.st_size >= kMapFileSize ? 0 : info.st_size;
+            if(bytes > mMemoryBudget)
+            {
+                break;
+            }
+            int id = buf->mBufId;
+            std::string path = buf->mFileName;
+            mReader->Submit([this, id, path]()
+            {
+                auto source = Buffer::ReadFile(path);
+                mPost([this, id, path, source]()
+                {
+                    auto found = mById.find(id);
+                    if(source && found != mById.end() && !found->second.mBuffer->mLoaded &&
+                       found->second.mBuffer->mFileName == path)
+                    {
+                        found->second.mAhead = source;
+                    }
+                });
+            });
+        }
+    }
+};
@@ -1,14 +1,20 @@
 #pragma once
-#include <sstream>
-#include <istream>
 #include "buffer.h"
+#include "buffer_manager.h"
 #include "ledlang.h"
 #include <iostream>
-#include <iterator>
 #include <algorithm>
+#include <climits>
 #include <stdexcept>
 #include <sys/ioctl.h>
 #include "tokeniser.h"
+#include "screen.h"
+#include "term_setup.h"
+#include "event_loop.h"
+#include "grep.h"
+#include "input.h"
+#include "layout.h"
+#include "tags.h"
 #include <string>
 
 
@@ -17,140 +23,752 @@ constexpr char CtrlKey(char k)
     return ((k) & 0x1f);
 }
 
-enum SpecialKeys
-{
-    BACKSPACE = 127,
-    KEY_UP = 1000,
-    KEY_DOWN = 1001,
-    KEY_LEFT = 1002,
-    KEY_RIGHT = 1003
-};
-
 struct Editor
 {
     // number of rows/columns in the screen, updated when screen size changes.
     int mNumRows = 0;
     int mNumCols = 0;
 
-    // read one key from std input
+    // where keys come from and frames go. the terminal, unless something
+    // like the benchmarks wants to drive the editor itself.
+    int mInputFd = STDIN_FILENO;
+    int mOutputFd = STDOUT_FILENO;
+    size_t mBytesWritten = 0;
+
+    // what's been read from mInputFd, decoded into keys
+    InputDecoder mInput;
+
+    // how long a lone escape waits to see if it starts a sequence
+    static const int kEscapeWaitMs = 25;
+
+    // read one key from the input, -1 if there isn't one waiting
     int ReadKey()
     {
-        int bytesRead;
-        char c;
+        int key = mInput.ReadKey(mInputFd);
+        if(key == -1 && mInput.Partial())
+        {
+            // the rest of a sequence is usually right behind its start,
+            // if it doesn't come it was the escape key
+            struct pollfd input = { mInputFd, POLLIN, 0 };
+            if(poll(&input, 1, kEscapeWaitMs) > 0)
+            {
+                key = mInput.ReadKey(mInputFd);
+            }
+            if(key == -1 && mInput.Partial())
+            {
+                key = mInput.Flush();
+            }
+        }
+        return key;
+    }
+
+    Editor()
+    {
+        mBuffers.mPost = [this](std::function<void()> callback) { mEvents.Post(callback); };
+        AddCommands();
+    }
+
+    // interprets commands, stores variables etc.
+    LedLang mLedLang;
+
+    // parse and run a user inputted command. whatever it does to the buffer
+    // is one undo step, and its value, if it has one, goes on the led line.
+    void RunCommand(const std::string& command)
+    {
+        if(command.compare(0, 2, "s/") == 0)
+        {
+            Replace(command);
+            return;
+        }
 
-        while((bytesRead = read(STDIN_FILENO, &c, 1)) != 1)
+        Buffer* buf = mCurrBuffer;
+        buf->mHistory.BeginGroup();
+        LedValue result;
+        bool ok = mLedLang.Run(command, result);
+        buf->mHistory.EndGroup();
+
+        if(!ok)
         {
+            mCurrBuffer->mMessage = mLedLang.mError;
         }
-        
-        if (c == '\x1b')
+        else if(result.mType != LedValue::kNil)
         {
-            char seq[3];
-            if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-            if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';            
+            mCurrBuffer->mMessage = result.ToString();
+        }
+    }
 
-            Message(std::string(seq));
-            
-            if (seq[0] == '[') {
-                
-                switch (seq[1]) {
-                    case 'A': return KEY_UP;
-                    case 'B': return KEY_DOWN;
-                    case 'C': return KEY_RIGHT;
-                    case 'D': return KEY_LEFT;
+    // the numbers a builtin was given, or how many times to do it if it
+    // wasn't given one
+    static bool NumberArg(const LedArgs& args, size_t i, int64_t& number, std::string& error)
+    {
+        if(i >= args.size())
+        {
+            return true;
+        }
+        if(args[i].mType != LedValue::kNumber)
+        {
+            error = "\"" + args[i].ToString() + "\" isn't a number";
+            return false;
+        }
+        number = args[i].mNumber;
+        return true;
+    }
+
+    // something done count times, count being its argument
+    void AddRepeated(const std::string& name, std::function<void(Buffer*)> action)
+    {
+        mLedLang.AddBuiltin(name, 0, 1, [this, action](const LedArgs& args, std::string& error)
+        {
+            int64_t count = 1;
+            if(NumberArg(args, 0, count, error))
+            {
+                for(int64_t i = 0; i < count; i++)
+                {
+                    action(mCurrBuffer);
+                }
+            }
+            return LedValue();
+        });
+    }
+
+    // what the editor can do from ledlang
+    void AddCommands()
+    {
+        LedLang& lang = mLedLang;
+
+        AddRepeated("up", [](Buffer* buf) { buf->PrevRow(); });
+        AddRepeated("down", [](Buffer* buf) { buf->NextRow(); });
+        AddRepeated("left", [](Buffer* buf) { buf->PrevColumn(); });
+        AddRepeated("right", [](Buffer* buf) { buf->NextColumn(); });
+        AddRepeated("newline", [](Buffer* buf) { buf->InsertNewLine(); });
+        AddRepeated("delete", [](Buffer* buf) { buf->DeleteCharForwards(); });
+        AddRepeated("backspace", [](Buffer* buf) { buf->DeleteCharBackwards(); });
+        AddRepeated("kill", [](Buffer* buf) { buf->KillForward(); });
+        AddRepeated("undo", [](Buffer* buf) { buf->Undo(); });
+        AddRepeated("redo", [](Buffer* buf) { buf->Redo(); });
+        AddRepeated("home", [](Buffer* buf) { buf->StartRow(); });
+        AddRepeated("end", [](Buffer* buf) { buf->EndRow(); });
+        AddRepeated("top", [](Buffer* buf) { buf->StartColumn(); });
+        AddRepeated("bottom", [](Buffer* buf) { buf->EndColumn(); });
+        AddRepeated("nextword", [](Buffer* buf) { buf->NextWord(); });
+        AddRepeated("prevword", [](Buffer* buf) { buf->PrevWord(); });
+        AddRepeated("save", [](Buffer* buf) { buf->SaveToFile(); });
+        AddRepeated("nb", [this](Buffer*) { NextBuffer(); });
+        AddRepeated("pb", [this](Buffer*) { PrevBuffer(); });
+        AddRepeated("lb", [this](Buffer*) { LastBuffer(); });
+        AddRepeated("nv", [this](Buffer*) { FocusView(mLayout.Step(mLayout.mFocus, 1)); });
+        AddRepeated("pv", [this](Buffer*) { FocusView(mLayout.Step(mLayout.mFocus, -1)); });
+        lang.AddBuiltin("split", 0, 0, [this](const LedArgs&, std::string&) { SplitView(false); return LedValue(); });
+        lang.AddBuiltin("vsplit", 0, 0, [this](const LedArgs&, std::string&) { SplitView(true); return LedValue(); });
+        lang.AddBuiltin("close", 0, 0, [this](const LedArgs&, std::string&) { CloseView(); return LedValue(); });
+        lang.AddBuiltin("only", 0, 0, [this](const LedArgs&, std::string&) { OnlyView(); return LedValue(); });
+        lang.AddBuiltin("follow", 0, 0, [this](const LedArgs&, std::string&) { ToggleFollow(mCurrBuffer); return LedValue(); });
+        lang.AddBuiltin("reload", 0, 0, [this](const LedArgs&, std::string&) { ReloadBuffer(mCurrBuffer); return LedValue(); });
+
+        // switch to a buffer by id, or by file, opening it if need be
+        lang.AddBuiltin("buffer", 1, 1, [this](const LedArgs& args, std::string& error)
+        {
+            Buffer* buf = args[0].mType == LedValue::kNumber ? mBuffers.FindId(args[0].mNumber) :
+                          OpenBuffer(args[0].ToString());
+            if(buf == nullptr)
+            {
+                error = "no buffer " + args[0].ToString();
+                return LedValue();
+            }
+            SetCurrentBuffer(buf);
+            return LedValue();
+        });
+
+        // the buffers most recently used first, as id:name
+        lang.AddBuiltin("buffers", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            std::string list;
+            for(int id : mBuffers.mRecent)
+            {
+                Buffer* buf = mBuffers.FindId(id);
+                list += (list.empty() ? "" : " ") + std::to_string(id) + ":" + buf->mName + (buf->mLoaded ? "" : "~");
+            }
+            return LedValue(list);
+        });
+
+        // how many MB the buffers hold, and with a number the most they're
+        // let hold before the least recently used let go of their text
+        lang.AddBuiltin("budget", 0, 1, [this](const LedArgs& args, std::string& error)
+        {
+            int64_t megabytes = mBuffers.mMemoryBudget >> 20;
+            if(NumberArg(args, 0, megabytes, error) && !args.empty())
+            {
+                mBuffers.mMemoryBudget = (size_t) std::max<int64_t>(megabytes, 0) << 20;
+                mBuffers.Trim();
+            }
+            return LedValue((int64_t) (mBuffers.MemoryBytes() >> 20));
+        });
+
+        lang.AddBuiltin("macro", 0, 1, [this](const LedArgs& args, std::string& error)
+        {
+            int64_t count = 1;
+            if(NumberArg(args, 0, count, error))
+            {
+                ReplayMacro(count, error);
+            }
+            return LedValue();
+        });
+
+        // lines and columns count from 1, as they do in grep's results
+        lang.AddBuiltin("goto", 1, 2, [this](const LedArgs& args, std::string& error)
+        {
+            int64_t line = 1;
+            int64_t col = 1;
+            if(NumberArg(args, 0, line, error) && NumberArg(args, 1, col, error))
+            {
+                mCurrBuffer->mCursY = std::max<int64_t>(0, std::min<int64_t>(line - 1, INT_MAX));
+                mCurrBuffer->mCursX = std::max<int64_t>(0, std::min<int64_t>(col - 1, INT_MAX));
+                mCurrBuffer->Scroll();
+            }
+            return LedValue();
+        });
+        lang.AddBuiltin("line", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            return LedValue((int64_t) mCurrBuffer->mCursY + 1);
+        });
+        lang.AddBuiltin("col", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            return LedValue((int64_t) mCurrBuffer->mCursX + 1);
+        });
+        lang.AddBuiltin("lines", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            return LedValue((int64_t) mCurrBuffer->NumLines());
+        });
+        lang.AddBuiltin("modified", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            return LedValue((int64_t) mCurrBuffer->IsModified());
+        });
+        lang.AddBuiltin("name", 0, 0, [this](const LedArgs&, std::string&)
+        {
+            return LedValue(mCurrBuffer->mName);
+        });
+
+        // the cursor's line, or another one
+        lang.AddBuiltin("text", 0, 1, [this](const LedArgs& args, std::string& error)
+        {
+            int64_t line = mCurrBuffer->mCursY + 1;
+            if(!NumberArg(args, 0, line, error))
+            {
+                return LedValue();
+            }
+            if(line < 1 || !mCurrBuffer->mText.HasLine(line - 1))
+            {
+                error = "no line " + std::to_string(line);
+                return LedValue();
+            }
+            return LedValue(mCurrBuffer->mText.GetLine(line - 1));
+        });
+
+        // at the cursor, as if it was typed
+        lang.AddBuiltin("insert", 1, 255, [this](const LedArgs& args, std::string&)
+        {
+            for(size_t i = 0; i < args.size(); i++)
+            {
+                std::string text = (i > 0 ? " " : "") + args[i].ToString();
+                for(char c : text)
+                {
+                    if(c == '\n')
+                    {
+                        mCurrBuffer->InsertNewLine();
+                    }
+                    else
+                    {
+                        mCurrBuffer->InsertChar(c);
+                    }
                 }
             }
-            return 0;
+            return LedValue();
+        });
+
+        // on to the next match of a regex, 1 if there was one
+        lang.AddBuiltin("find", 1, 1, [this](const LedArgs& args, std::string& error)
+        {
+            Buffer* buf = mCurrBuffer;
+            TextSearch search;
+            search.Start(args[0].ToString(), TextPos(buf->mCursY, buf->mCursX + 1), true);
+            if(!search.mError.empty())
+            {
+                error = search.mError;
+                return LedValue();
+            }
+            while(!search.Step(buf->mText, Buffer::kSearchSlice))
+            {
+            }
+            if(search.mFound)
+            {
+                buf->mCursY = search.mMatch.mLine;
+                buf->mCursX = search.mMatch.mCol;
+                buf->Scroll();
+            }
+            return LedValue((int64_t) search.mFound);
+        });
+
+        // replace every match of a regex, how many there were
+        lang.AddBuiltin("replace", 2, 2, [this](const LedArgs& args, std::string& error)
+        {
+            Regex regex;
+            if(!regex.Compile(args[0].ToString()))
+            {
+                error = regex.mError;
+                return LedValue();
+            }
+            return LedValue((int64_t) mCurrBuffer->ReplaceAll(regex, args[1].ToString()));
+        });
 
+        // a cursor at every match of a regex, how many there are. with no
+        // regex, how many there are now.
+        lang.AddBuiltin("cursors", 0, 1, [this](const LedArgs& args, std::string& error)
+        {
+            if(args.empty())
+            {
+                return LedValue((int64_t) mCurrBuffer->mCursors.size() + 1);
+            }
+            return LedValue((int64_t) mCurrBuffer->PlaceCursors(args[0].ToString(), true, error));
+        });
+
+        lang.AddBuiltin("grep", 1, 2, [this](const LedArgs& args, std::string&)
+        {
+            Grep(args[0].ToString(), args.size() > 1 ? args[1].ToString() : ".");
+            return LedValue();
+        });
+
+        lang.AddBuiltin("tags", 0, 1, [this](const LedArgs& args, std::string&)
+        {
+            LoadTags(args.empty() ? "TAGS" : args[0].ToString());
+            return LedValue();
+        });
+
+        lang.AddBuiltin("maketags", 0, 1, [this](const LedArgs& args, std::string&)
+        {
+            MakeTags(args.empty() ? "." : args[0].ToString());
+            return LedValue();
+        });
+
+        lang.AddBuiltin("def", 0, 1, [this](const LedArgs& args, std::string&)
+        {
+            GoToDefinition(args.empty() ? "" : args[0].ToString());
+            return LedValue();
+        });
+
+        lang.AddBuiltin("symbols", 0, 1, [this](const LedArgs& args, std::string&)
+        {
+            ListSymbols(args.empty() ? "" : args[0].ToString());
+            return LedValue();
+        });
+
+        lang.AddBuiltin("print", 0, 255, [](const LedArgs& args, std::string&)
+        {
+            std::string text;
+            for(size_t i = 0; i < args.size(); i++)
+            {
+                text += (i > 0 ? " " : "") + args[i].ToString();
+            }
+            return LedValue(text);
+        });
+    }
+
+    // s/regex/replacement/ replaces every match in the current buffer, as
+    // one undo step. a / in either needs a \ in front of it.
+    void Replace(const std::string& command)
+    {
+        std::string parts[2];
+        size_t i = 2;
+        for(int part = 0; part < 2; part++)
+        {
+            for(; i < command.size() && command[i] != '/'; i++)
+            {
+                if(command[i] == '\\' && i + 1 < command.size() && command[i + 1] == '/')
+                {
+                    i++;
+                }
+                else if(command[i] == '\\' && i + 1 < command.size())
+                {
+                    parts[part] += command[i++];
+                }
+                parts[part] += command[i];
+            }
+            if(i++ >= command.size())
+            {
+                mCurrBuffer->mMessage = "usage: s/regex/replacement/";
+                return;
+            }
         }
-        else
+
+        Regex regex;
+        if(!regex.Compile(parts[0]))
         {
-            return c;
+            mCurrBuffer->mMessage = "bad regex: " + regex.mError;
+            return;
         }
+        size_t count = mCurrBuffer->ReplaceAll(regex, parts[1]);
+        mCurrBuffer->mMessage = "replaced " + std::to_string(count);
     }
 
-    void Message(std::string message)
+    // round the buffers in the order they were opened
+    void NextBuffer()
     {
-        mCurrBuffer->InsertLine(message);
+        SetCurrentBuffer(mBuffers.Step(mCurrBuffer, 1));
     }
 
-    // interprets commands, stores variables etc.
-    LedLang mLedLang;    
-    
-    void RunCommand(std::string command)
+    void PrevBuffer()
     {
-        // parse and run a user inputted command
+        SetCurrentBuffer(mBuffers.Step(mCurrBuffer, -1));
+    }
 
-        // TODO remove me after the language works properly
-        if(command == "nb")
+    // back to the buffer in use before this one
+    void LastBuffer()
+    {
+        Buffer* buf = mBuffers.Previous();
+        if(buf == nullptr)
         {
-            NextBuffer();
+            mCurrBuffer->mMessage = "no other buffer";
+            return;
         }
-        
-        // split into tokens
-        std::stringstream ss(command);
-        std::istream_iterator<std::string> begin(ss);
-        std::istream_iterator<std::string> end;
-        std::vector<std::string> tokens(begin, end);
+        SetCurrentBuffer(buf);
+    }
+
+    // a buffer someone else owns
+    void AddBuffer(Buffer* buf)
+    {
+        mBuffers.Add(buf);
+        Attach(buf);
+    }
 
-        auto AST = mLedLang.ParseTokens(tokens);
-        mLedLang.RunCommand(AST, this);
-        (void) AST;
+    // a buffer of our own, e.g. for results
+    Buffer* NewBuffer(const std::string& name)
+    {
+        Buffer* buf = Attach(mBuffers.Create(""));
+        buf->mName = name;
+        return buf;
     }
 
-    std::vector<Buffer*> mBuffers = {};
+    // the buffer for a file, opened if it isn't. the file's read when the
+    // buffer's first shown.
+    Buffer* OpenBuffer(const std::string& path)
+    {
+        size_t count = mBuffers.size();
+        Buffer* buf = mBuffers.Open(path);
+        return mBuffers.size() > count ? Attach(buf) : buf;
+    }
 
-    void NextBuffer()
+    Buffer* Attach(Buffer* buf)
+    {
+        // the highlighter finishes on its own thread, go round and draw it
+        buf->mHighlighter.mOnResult = [this]() { mEvents.Wake(); };
+        buf->mPost = [this](std::function<void()> callback) { mEvents.Post(callback); };
+        return buf;
+    }
+
+    // follow mode reads what's been added to a file at most this many
+    // times a second, however often it's written to, and at most this much
+    // at a time so a burst doesn't hold up the keys
+    static const int kFollowReadsPerSecond = 30;
+    static const size_t kFollowReadBytes = 16 << 20;
+
+    void ToggleFollow(Buffer* buf)
     {
-        unsigned int currIndex = mCurrBuffer->mBufId;
-        currIndex++;
-        if(currIndex > mBuffers.size() - 1)
+        FileFollower& follow = buf->mFollow;
+        if(follow.Active())
         {
-            currIndex = 0;
+            mEvents.RemoveFd(follow.mNotify);
+            mEvents.RemoveTimer(follow.mTimer);
+            buf->StopFollowing();
+            buf->mMessage = "stopped following";
+            return;
         }
-        mCurrBuffer = GetBufferById(0);
-        if(mCurrBuffer == nullptr)
+        mBuffers.Load(buf);
+        std::string error;
+        if(!buf->StartFollowing(error))
         {
-            throw std::invalid_argument("Next buffer got a nullptr");
+            buf->mMessage = error;
+            return;
         }
+        buf->EndColumn();
+        FollowRead(buf);
+    }
 
-        DrawScreen();
+    // read what's new, then wait for inotify to say there's more. while
+    // there's more than one read's worth, or until it's time for the next
+    // read, inotify isn't listened to, so a file written to all the time
+    // wakes us no more than kFollowReadsPerSecond times a second.
+    void FollowRead(Buffer* buf)
+    {
+        FileFollower& follow = buf->mFollow;
+        follow.mTimer = -1;
+        follow.mLastRead = std::chrono::steady_clock::now();
+        buf->Follow(kFollowReadBytes);
+        bool more = follow.mOffset < FileSize(follow.mFd);
+        if(more)
+        {
+            FollowLater(buf);
+            return;
+        }
+        int fd = follow.mNotify;
+        mEvents.AddFd(fd, POLLIN, [this, buf, fd](short)
+        {
+            buf->mFollow.Drain();
+            mEvents.RemoveFd(fd);
+            FollowLater(buf);
+        });
     }
 
-    void AddBuffer(Buffer* buf)
+    void FollowLater(Buffer* buf)
+    {
+        FileFollower& follow = buf->mFollow;
+        auto next = follow.mLastRead + std::chrono::milliseconds(1000 / kFollowReadsPerSecond);
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+        follow.mTimer = mEvents.AddTimer(std::max<int>(wait.count(), 0), false, [this, buf]() { FollowRead(buf); });
+    }
+
+    // read buf's file again, throwing away any edits
+    void ReloadBuffer(Buffer* buf)
+    {
+        if(buf->mFileName.empty() || buf->mFollow.Active())
+        {
+            return;
+        }
+        buf->OpenFile(buf->mFileName);
+        buf->ZeroLineCheck();
+        buf->Scroll();
+        buf->mMessage = "reloaded " + buf->mName;
+    }
+
+    // a big file that was truncated while we had it mapped reads as zeros
+    // past its new end. buffers with nothing unsaved read it again, the
+    // others keep what they've got until told to reload.
+    uint64_t mMappingsLost = 0;
+
+    bool ReloadLostFiles()
+    {
+        uint64_t lost = MappingsLost();
+        if(lost == mMappingsLost)
+        {
+            return false;
+        }
+        mMappingsLost = lost;
+        for(Buffer* buf : mBuffers)
+        {
+            if(!buf->mLoaded || !buf->mSource || !buf->mSource->Lost())
+            {
+                continue;
+            }
+            if(buf->IsModified())
+            {
+                buf->mMessage = buf->mName + " changed on disk, reload to read it again";
+            }
+            else
+            {
+                ReloadBuffer(buf);
+                buf->mMessage = buf->mName + " changed on disk, reloaded";
+            }
+        }
+        return true;
+    }
+
+    static off_t FileSize(int fd)
     {
-        mBuffers.push_back(buf);
+        struct stat info;
+        return fd >= 0 && fstat(fd, &info) == 0 ? info.st_size : 0;
     }
 
+    // show buf in the view with the focus
     void SetCurrentBuffer(Buffer* buf)
     {
         mCurrBuffer = buf;
+        mLayout.mFocus->Show(buf);
+        mBuffers.Use(buf);
         buf->ZeroLineCheck();
+        mLayout.mFocus->Focus();
+    }
+
+    void FocusView(View* view)
+    {
+        mLayout.Focus(view);
+        mCurrBuffer = view->mBuffer;
+        mBuffers.Use(mCurrBuffer);
+    }
+
+    // the view with the focus in two, with the focus going to the new half
+    void SplitView(bool sideBySide)
+    {
+        View* view = mLayout.Split(mLayout.mFocus, sideBySide);
+        if(view == nullptr)
+        {
+            mCurrBuffer->mMessage = "no room to split";
+            return;
+        }
+        FocusView(view);
+    }
+
+    void CloseView()
+    {
+        if(!mLayout.Close(mLayout.mFocus))
+        {
+            mCurrBuffer->mMessage = "only one view";
+            return;
+        }
+        FocusView(mLayout.mFocus);
+    }
+
+    void OnlyView()
+    {
+        mLayout.Only(mLayout.mFocus);
+    }
+
+    // what to do with the views, the key after ctrl-w
+    void ViewKey(int c)
+    {
+        switch(c)
+        {
+            case 's': SplitView(false); break;
+            case 'v': SplitView(true); break;
+            case 'w':
+            case CtrlKey('w'): FocusView(mLayout.Step(mLayout.mFocus, 1)); break;
+            case 'W': FocusView(mLayout.Step(mLayout.mFocus, -1)); break;
+            case 'c':
+            case 'q': CloseView(); break;
+            case 'o': OnlyView(); break;
+            case CtrlKey('g'): break;
+            default:
+            {
+                mCurrBuffer->mMessage = "ctrl-w: s split, v side by side, w next, W previous, c close, o only";
+            }
+        }
     }
     
     // returns nullptr if it can't find it
     Buffer* GetBufferById(int id)
     {
-        for(auto buf : mBuffers)
+        return mBuffers.FindId(id);
+    }
+
+    // keys typed between one ctrl-x and the next are a macro, which ctrl-v
+    // or the macro command plays back. a paste is kept with its text, and
+    // played back as what was pasted then.
+    struct MacroKey
+    {
+        int mKey;
+        std::string mPaste;
+    };
+
+    bool mRecording = false;
+    bool mReplaying = false;
+    std::vector<MacroKey> mRecordingKeys;
+    std::vector<MacroKey> mMacro;
+
+    // the text of a paste being played back
+    const std::string* mReplayPaste = nullptr;
+
+    void ToggleRecording()
+    {
+        mRecording = !mRecording;
+        if(mRecording)
+        {
+            mRecordingKeys.clear();
+            mCurrBuffer->mMessage = "recording a macro";
+        }
+        else
+        {
+            mMacro.swap(mRecordingKeys);
+            mCurrBuffer->mMessage = "recorded " + std::to_string(mMacro.size()) + " keys";
+        }
+    }
+
+    // play the macro back count times without drawing anything, its edits
+    // to the buffer it starts in batched up into one undo step
+    bool ReplayMacro(int64_t count, std::string& error)
+    {
+        if(mReplaying)
+        {
+            error = "a macro can't play a macro";
+            return false;
+        }
+        if(mMacro.empty())
         {
-            if(buf->mBufId == id)
+            error = "no macro recorded";
+            return false;
+        }
+
+        Buffer* buf = mCurrBuffer;
+        mReplaying = true;
+        buf->BeginBatch();
+        for(int64_t i = 0; i < count; i++)
+        {
+            for(auto& key : mMacro)
             {
-                return buf;
+                mReplayPaste = &key.mPaste;
+                HandleKey(key.mKey);
             }
         }
-        return nullptr;
+        mReplayPaste = nullptr;
+        buf->EndBatch();
+        mReplaying = false;
+        return true;
     }
 
     // returns true when it's time to exit
     bool HandleKey(int c)
     {
         auto buf = mCurrBuffer;
+        buf->mMessage.clear();
+
+        if(mRecording && !mReplaying && c != CtrlKey('x') && c != CtrlKey('v'))
+        {
+            mRecordingKeys.push_back({c, c == KEY_PASTE ? mInput.mPaste : std::string()});
+        }
+
+        if(mViewKey)
+        {
+            mViewKey = false;
+            ViewKey(c);
+            return false;
+        }
+
+        // jump mode takes the letters of a label. any other key leaves it
+        // and then does what it does.
+        if(buf->mMode == MODE_JUMP)
+        {
+            if(IsTextKey(c))
+            {
+                for(char ch : EncodeUtf8(c))
+                {
+                    if(buf->mMode == MODE_JUMP)
+                    {
+                        buf->InsertJumpChar(ch);
+                    }
+                }
+                return false;
+            }
+            if(c == BACKSPACE)
+            {
+                buf->DeleteJumpChar();
+                return false;
+            }
+            buf->Cancel();
+            if(c == CtrlKey('g'))
+            {
+                return false;
+            }
+        }
         
         // TODO read these keys from .led file
         switch(c)
         {
             case BACKSPACE:
             {
-                buf->DeleteCharBackwards();
+                if(buf->mMode == MODE_SEARCH)
+                {
+                    buf->DeleteSearchChar();
+                }
+                else
+                {
+                    buf->DeleteCharBackwards();
+                }
             } break;
 
             case '\t':
@@ -171,47 +789,112 @@ struct Editor
             
             case CtrlKey('n'):
             {
-                buf->NextRow();
+                buf->MoveCursors(&Buffer::NextRow);
             } break;
 
             case KEY_DOWN:
             {
-                buf->NextRow();
+                buf->MoveCursors(&Buffer::NextRow);
             } break;
 
-            case CtrlKey('p'):
+            case KEY_UP:
             {
-                buf->PrevRow();
+                buf->MoveCursors(&Buffer::PrevRow);
             } break;
 
-            case CtrlKey('f'):
+            case KEY_RIGHT:
             {
-                buf->NextColumn();
+                buf->MoveCursors(&Buffer::NextColumn);
             } break;
 
-            case CtrlKey('b'):
+            case KEY_LEFT:
             {
-                buf->PrevColumn();
-            } break;        
+                buf->MoveCursors(&Buffer::PrevColumn);
+            } break;
 
-            case CtrlKey('a'):
+            case KEY_HOME:
             {
-                buf->StartRow();
+                buf->MoveCursors(&Buffer::StartRow);
             } break;
 
-            case CtrlKey('t'):
+            case KEY_END:
             {
-                buf->StartColumn();
+                buf->MoveCursors(&Buffer::EndRow);
             } break;
 
-            case CtrlKey('e'):
+            case KEY_PAGE_DOWN:
             {
-                buf->EndRow();
+                buf->MoveCursors(&Buffer::PageDown);
             } break;
 
-            case CtrlKey('z'):
+            case KEY_PAGE_UP:
             {
-                buf->EndColumn();
+                buf->MoveCursors(&Buffer::PageUp);
+            } break;
+
+            case KEY_ALT | 'f':
+            {
+                buf->MoveCursors(&Buffer::NextWord);
+            } break;
+
+            case KEY_ALT | 'b':
+            {
+                buf->MoveCursors(&Buffer::PrevWord);
+            } break;
+
+            case CtrlKey('^'):
+            {
+                LastBuffer();
+            } break;
+
+            case KEY_ALT | '.':
+            {
+                GoToDefinition("");
+            } break;
+
+            case KEY_ALT | ',':
+            {
+                PopTag();
+            } break;
+
+            case KEY_DELETE:
+            {
+                buf->DeleteCharForwards();
+            } break;
+
+            case CtrlKey('p'):
+            {
+                buf->MoveCursors(&Buffer::PrevRow);
+            } break;
+
+            case CtrlKey('f'):
+            {
+                buf->MoveCursors(&Buffer::NextColumn);
+            } break;
+
+            case CtrlKey('b'):
+            {
+                buf->MoveCursors(&Buffer::PrevColumn);
+            } break;        
+
+            case CtrlKey('a'):
+            {
+                buf->MoveCursors(&Buffer::StartRow);
+            } break;
+
+            case CtrlKey('t'):
+            {
+                buf->MoveCursors(&Buffer::StartColumn);
+            } break;
+
+            case CtrlKey('e'):
+            {
+                buf->MoveCursors(&Buffer::EndRow);
+            } break;
+
+            case CtrlKey('z'):
+            {
+                buf->MoveCursors(&Buffer::EndColumn);
             } break;
         
             case CtrlKey('g'):
@@ -219,6 +902,16 @@ struct Editor
                 buf->Cancel();
             } break;
 
+            case CtrlKey('u'):
+            {
+                buf->Undo();
+            } break;
+
+            case CtrlKey('y'):
+            {
+                buf->Redo();
+            } break;
+
             case CtrlKey('d'):
             {
                 buf->DeleteCharForwards();
@@ -226,7 +919,14 @@ struct Editor
 
             case CtrlKey('r'):
             {
-                buf->DeleteCharBackwards();
+                if(buf->mMode == MODE_SEARCH)
+                {
+                    buf->ToggleSearchRegex();
+                }
+                else
+                {
+                    buf->DeleteCharBackwards();
+                }
             } break;
         
             case CtrlKey('k'):
@@ -234,12 +934,72 @@ struct Editor
                 buf->KillForward();
             } break;        
 
+            // a cursor at every match of the search
+            case CtrlKey('l'):
+            {
+                if(buf->mMode == MODE_SEARCH)
+                {
+                    std::string error;
+                    size_t count = buf->PlaceCursors(buf->mSearchString, buf->mSearchRegex, error);
+                    buf->FinishSearch();
+                    buf->mMessage = !error.empty() ? error : count == 0 ? "no matches" : std::to_string(count) + " cursors";
+                }
+            } break;
+
+            case KEY_PASTE:
+            {
+                const std::string& paste = mReplayPaste ? *mReplayPaste : mInput.mPaste;
+                if(buf->mMode == MODE_EDIT)
+                {
+                    buf->Paste(paste);
+                }
+                else
+                {
+                    // the command line and search take the first line
+                    std::string line = paste.substr(0, paste.find_first_of("\r\n"));
+                    for(char ch : line)
+                    {
+                        if(buf->mMode == MODE_COMMAND)
+                        {
+                            buf->InsertCommandChar(ch);
+                        }
+                        else if(buf->mMode == MODE_SEARCH)
+                        {
+                            buf->InsertSearchChar(ch);
+                        }
+                    }
+                }
+            } break;
+
+            case CtrlKey('x'):
+            {
+                if(!mReplaying)
+                {
+                    ToggleRecording();
+                }
+            } break;
+
+            case CtrlKey('v'):
+            {
+                std::string error;
+                if(!ReplayMacro(1, error))
+                {
+                    buf->mMessage = error;
+                }
+            } break;
+
             case '\r':
             {
                 if(buf->mMode == MODE_COMMAND)
                 {
-                    RunCommand(buf->mCommandString);
+                    // out of command mode first, the command might type
+                    std::string command = buf->mCommandString;
                     buf->Cancel();
+                    RunCommand(command);
+                }
+                else if(buf->mMode == MODE_SEARCH)
+                {
+                    buf->FinishSearch();
                 }
                 else
                 {
@@ -255,19 +1015,46 @@ struct Editor
             case CtrlKey('j'):
             {
                 buf->EnterJumpMode();
-            }
+            } break;
+
+            // the next key says what to do with the views
+            case CtrlKey('w'):
+            {
+                mViewKey = true;
+            } break;
+
+            case CtrlKey('o'):
+            {
+                if(buf->mMode == MODE_SEARCH)
+                {
+                    buf->SearchNext();
+                }
+                else
+                {
+                    buf->EnterSearchMode();
+                }
+            } break;
         
             default:
             {
-                if(!iscntrl(c))
+                if(!IsTextKey(c))
+                {
+                    break;
+                }
+                // columns are bytes, so a character goes in a byte at a time
+                for(char ch : EncodeUtf8(c))
                 {
                     if(buf->mMode == MODE_COMMAND)
                     {
-                        buf->InsertCommandChar(c);
+                        buf->InsertCommandChar(ch);
+                    }
+                    else if(buf->mMode == MODE_SEARCH)
+                    {
+                        buf->InsertSearchChar(ch);
                     }
                     else
                     {
-                        buf->InsertChar(c);
+                        buf->InsertChar(ch);
                     }
                 }
             }
@@ -275,158 +1062,667 @@ struct Editor
         return false;
     }
 
-    std::string MakeColourString(int red, int green, int blue)
-    {
-        return "\x1b[38;2;" + std::to_string(red) + ";" + std::to_string(green) + ";" + std::to_string(blue) + "m";        
-    }
-
-    std::string SalmonString = MakeColourString(255, 82, 92);
-    std::string GreyString = MakeColourString(164, 163, 170);
-    std::string WhiteString = MakeColourString(255, 255, 255);
-    std::string OceanBlueString = MakeColourString(82, 76, 234);
-    std::string GreenString = MakeColourString(17, 160, 21);
+    Colour SalmonColour = RgbColour(255, 82, 92);
+    Colour GreyColour = RgbColour(164, 163, 170);
+    Colour WhiteColour = RgbColour(255, 255, 255);
+    Colour OceanBlueColour = RgbColour(82, 76, 234);
+    Colour GreenColour = RgbColour(17, 160, 21);
 
+    Style LedLineStyle = Style(PaletteColour(0), PaletteColour(7));
+    Style OtherLedLineStyle = Style(PaletteColour(0), PaletteColour(8));
+    Style SearchMatchStyle = Style(PaletteColour(0), PaletteColour(3));
+    Style CurrentMatchStyle = Style(PaletteColour(0), PaletteColour(6));
+    Style CursorStyle = Style(PaletteColour(0), PaletteColour(7));
+    Style JumpLabelStyle = Style(PaletteColour(0), PaletteColour(1));
 
-    std::string TokenTypeToColourString(TokenType type)
+    Colour TokenTypeToColour(TokenType type)
     {
         switch(type)
         {
             case Identifier:
             {
-                return GreyString;
+                return GreyColour;
             } break;
             case Keyword:
             {
-                return WhiteString;
+                return WhiteColour;
             } break;
             case Literal:
             {
-                return OceanBlueString;
+                return OceanBlueColour;
             } break;
             case Operator:
             {
-                return GreenString;
+                return GreenColour;
             } break;
             case Punctuator:
             {
-                return GreenString;
+                return GreenColour;
             } break;
             case Comment:
             {
-                return SalmonString;
+                return SalmonColour;
             } break;
             default:
             {
-                return GreyString;
+                return GreyColour;
             } break;
         }
     }
 
-    // tabs mess display up so just replace them with 1 space
-    std::string FixTabs(std::string text)
+    // what's on the terminal, and the frame we're drawing next
+    Screen mScreen;
+
+    void UpdateScreenSize()
     {
-	std::string newString = text;
-	std::replace(newString.begin(), newString.end(), '\t', ' ');
-	return newString;
+        if(!gWindowResized)
+        {
+            return;
+        }
+        gWindowResized = 0;
+
+        struct winsize ws;
+        if(ioctl(mOutputFd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0)
+        {
+            SetScreenSize(ws.ws_row, ws.ws_col);
+        }
+        else if(mNumRows == 0)
+        {
+            // not a terminal
+            SetScreenSize(24, 80);
+        }
     }
-    
-    void DrawScreen()
+
+    void SetScreenSize(int rows, int cols)
     {
-        auto buf = mCurrBuffer;
-        
-        struct winsize ws;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
-        mNumCols = ws.ws_col;
-        mNumRows = ws.ws_row;
+        mNumRows = rows;
+        mNumCols = cols;
+        mBuffers.mNumRows = rows;
+        mBuffers.mNumCols = cols;
+        mScreen.Resize(mNumRows, mNumCols);
 
-        buf->mNumCols = mNumCols;
-        buf->mNumRows = mNumRows;
+        // a new screen has nothing drawn on it yet
+        mLayout.Arrange(Rect(0, 0, rows, cols));
+        for(View* view : mLayout.mViews)
+        {
+            view->mDrawn = ViewState();
+        }
+        mLayout.mFocus->Focus();
+    }
+
+    // every match of the search on a row, over the top of its highlighting
+    void DrawSearchMatches(Buffer* buf, int row, int y, LineView line)
+    {
+        const std::string& needle = buf->mSearchString;
+        if(needle.empty())
+        {
+            return;
+        }
+        if(buf->mSearchRegex)
+        {
+            DrawRegexMatches(buf, row, y, line);
+            return;
+        }
+
+        // matches that start on screen
+        size_t visible = std::min(line.mLength, mScreen.mWinCols + needle.size() - 1);
+        const char* from = line.mData;
+        const char* end = line.mData + visible;
+        const char* match;
+        while((match = FindBytes(from, end - from, needle.data(), needle.size())) != nullptr)
+        {
+            int col = match - line.mData;
+            bool current = buf->mSearch.mFound && y == buf->mCursY && col == buf->mCursX;
+            mScreen.PutText(row, col, match, needle.size(), current ? CurrentMatchStyle : SearchMatchStyle);
+            from = match + 1;
+        }
+    }
 
-        // build up our one string to write to the screen so we don't flicker
-        std::string writeString = "";
+    void DrawRegexMatches(Buffer* buf, int row, int y, LineView line)
+    {
+        if(!buf->mSearch.mRegex)
+        {
+            return;
+        }
+        buf->mSearch.mRegex->ForEachMatch(line.mData, line.mLength, 0, [&](size_t start, size_t end)
+        {
+            if(start >= (size_t) mScreen.mWinCols)
+            {
+                return false;
+            }
+            bool current = buf->mSearch.mFound && y == buf->mCursY && (int) start == buf->mCursX;
+            size_t length = std::min<size_t>(end, mScreen.mWinCols) - start;
+            mScreen.PutText(row, start, line.mData + start, length, current ? CurrentMatchStyle : SearchMatchStyle);
+            return true;
+        });
+    }
 
-        // hide cursor
-        writeString += "\x1b[?25l";
+    // the cursors besides the terminal's own on a row
+    void DrawCursors(Buffer* buf, int row, int y, LineView line)
+    {
+        auto cursor = std::lower_bound(buf->mCursors.begin(), buf->mCursors.end(), TextPos(y, 0));
+        for(; cursor != buf->mCursors.end() && cursor->mLine == (size_t) y; ++cursor)
+        {
+            if(cursor->mCol >= (size_t) mScreen.mWinCols)
+            {
+                break;
+            }
+            char c = cursor->mCol < line.mLength ? line.mData[cursor->mCol] : ' ';
+            mScreen.PutText(row, cursor->mCol, &c, 1, CursorStyle);
+        }
+    }
 
-        // put cursor at top left corner
-        writeString += "\x1b[H";
+    // what's left to type of the labels on a row, over the words they're for
+    void DrawJumpLabels(Buffer* buf, int row, int y)
+    {
+        Buffer::JumpTarget first;
+        first.mPos = TextPos(y, 0);
+        auto target = std::lower_bound(buf->mJumpTargets.begin(), buf->mJumpTargets.end(), first);
+        for(; target != buf->mJumpTargets.end() && target->mPos.mLine == (size_t) y; ++target)
+        {
+            const std::string& label = target->mLabel;
+            if(label.compare(0, buf->mJumpString.size(), buf->mJumpString) != 0)
+            {
+                continue;
+            }
+            size_t col = target->mPos.mCol;
+            size_t length = std::min(label.size() - buf->mJumpString.size(), mScreen.mWinCols - col);
+            mScreen.PutText(row, col, label.data() + buf->mJumpString.size(), length, JumpLabelStyle);
+        }
+    }
 
-        int start = buf->mScrollY;
-        int end = buf->mScrollY + mNumRows;
+    // what a view would be drawn from now
+    ViewState StateOf(View& view)
+    {
+        Buffer* buf = view.mBuffer;
+        ViewState state;
+        state.mBuffer = buf;
+        state.mRect = view.mRect;
+        state.mFocused = view.mFocused;
+        state.mVersion = buf->mText.Version();
+        state.mSpans = buf->mHighlighter.mInstalls;
+        state.mCursX = view.CursX();
+        state.mCursY = view.CursY();
+        state.mScrollY = view.ScrollY();
+        if(!view.mFocused)
+        {
+            state.mLedLine = (buf->IsModified() ? "*" : "") + buf->mName +
+                             " (" + std::to_string(state.mCursX) + "," + std::to_string(state.mCursY) + ")";
+            return state;
+        }
 
-        writeString += GreyString;
-        
-        // colours
-        // writeString += "\x1b[40m";
-        // writeString += "\x1b[37m";
+        state.mLedLine = buf->GetLedLine();
+        if(mRecording)
+        {
+            state.mLedLine += " [recording]";
+        }
+        state.mMode = buf->mMode;
+        state.mSearchString = buf->mSearchString;
+        state.mSearchRegex = buf->mSearchRegex;
+        state.mFound = buf->mSearch.mFound;
+        auto first = std::lower_bound(buf->mCursors.begin(), buf->mCursors.end(), TextPos(state.mScrollY, 0));
+        auto last = std::lower_bound(first, buf->mCursors.end(), TextPos(state.mScrollY + view.mRect.mRows, 0));
+        state.mCursors.assign(first, last);
+        state.mJumpString = buf->mJumpString;
+        state.mJumpTargets = buf->mJumpTargets.size();
+        return state;
+    }
 
-        // TODO: handle long lines        
-        for(int y = start; y < end; y++)
+    // each buffer on screen is highlighted once for all its views, over all
+    // the lines they show if the highlighter can keep that many, otherwise
+    // over the lines of the view with the focus or the first one
+    void HighlightViews()
+    {
+        auto& views = mLayout.mViews;
+        for(size_t i = 0; i < views.size(); i++)
         {
-            //writeString += std::to_string(y) + ": ";
-            // clear line
-            writeString += "\x1b[K";
-            if(y == end - 1)
+            Buffer* buf = views[i]->mBuffer;
+            bool seen = false;
+            View* main = views[i];
+            int first = INT_MAX;
+            int last = 0;
+            for(size_t j = 0; j < views.size(); j++)
             {
-                writeString += "\x1b[47m";
-                writeString += "\x1b[30m";
-                
-                // write the led line, centered
-                std::string ledLine = buf->GetLedLine();
-                int padding = (mNumCols-ledLine.size()) / 2;
-                int backpadding = mNumCols - (padding + ledLine.size());
-                while(padding-- > 0)
-                {
-                    writeString += " ";
-                }
-                writeString += ledLine;
-                while(backpadding-- > 0)
+                if(views[j]->mBuffer != buf)
                 {
-                    writeString += " ";
+                    continue;
                 }
+                seen = seen || j < i;
+                main = views[j]->mFocused ? views[j] : main;
+                first = std::min(first, views[j]->ScrollY());
+                last = std::max(last, views[j]->ScrollY() + views[j]->mRect.mRows - 1);
+            }
+            if(seen)
+            {
+                continue;
+            }
+            if(last - first > (int) SpanCache::kMaxLines)
+            {
+                first = main->ScrollY();
+                last = first + main->mRect.mRows - 1;
+            }
+            buf->mHighlighter.Update(buf->mText, first, last);
+        }
+    }
+
+    // views drawn, and left as they were because nothing in them changed
+    size_t mViewsDrawn = 0;
+    size_t mViewsKept = 0;
 
-                writeString += "\x1b[40m";
-                writeString += "\x1b[37m";
+    // one view into its part of the screen, the last row of which is its
+    // led line
+    void DrawView(View& view)
+    {
+        view.Clamp();
+        ViewState state = StateOf(view);
+        if(state == view.mDrawn)
+        {
+            mViewsKept++;
+            return;
+        }
+        mViewsDrawn++;
+
+        Buffer* buf = view.mBuffer;
+        const Rect& rect = view.mRect;
+        mScreen.SetWindow(rect.mRow, rect.mCol, rect.mRows, rect.mCols);
+        mScreen.ClearWindow();
+
+        int start = state.mScrollY;
+        int end = state.mScrollY + rect.mRows;
+
+        // TODO: handle long lines
+        for(int y = start; y < end; y++)
+        {
+            int row = y - start;
+            if(y == end - 1)
+            {
+                // write the led line, centered
+                const std::string& ledLine = state.mLedLine;
+                Style style = view.mFocused ? LedLineStyle : OtherLedLineStyle;
+                int padding = std::max(0, (rect.mCols - (int) ledLine.size()) / 2);
+                mScreen.FillRow(row, 0, style);
+                mScreen.PutText(row, padding, ledLine.data(), ledLine.size(), style);
             }
-            else
+            else if(buf->mText.HasLine(y))
             {
-                if((unsigned int) y < buf->mLines.size())
+                LineView line = buf->mText.GetLineView(y);
+
+                // lines the highlighter hasn't got to yet are drawn plain
+                const std::vector<TokenSpan>* spans = buf->mHighlighter.Spans(y);
+                if(!spans)
+                {
+                    size_t length = std::min(line.mLength, (size_t) rect.mCols);
+                    mScreen.PutText(row, 0, line.mData, length, Style());
+                }
+                else
                 {
-                    std::string partOfLineToWrite = buf->mLines[y];
-                    if((int) partOfLineToWrite.length() > mNumCols)
+                    for(auto& span : *spans)
                     {
-                        partOfLineToWrite = partOfLineToWrite.substr(0, mNumCols);
+                        if(span.start >= (uint32_t) rect.mCols)
+                        {
+                            break;
+                        }
+                        size_t length = std::min<size_t>(span.length, rect.mCols - span.start);
+                        Style style(TokenTypeToColour(span.type), kDefaultColour);
+                        mScreen.PutText(row, span.start, line.mData + span.start, length, style);
                     }
+                }
 
-                    for(auto token : Tokenise(partOfLineToWrite, mCurrBuffer->mFileName))
+                if(!view.mFocused)
+                {
+                    // where its cursor will be when it has the focus again
+                    if(y == state.mCursY)
                     {
-                        writeString += TokenTypeToColourString(token.type);
-                        writeString += FixTabs(token.text);
+                        char c = state.mCursX < (int) line.mLength ? line.mData[state.mCursX] : ' ';
+                        mScreen.PutText(row, state.mCursX, &c, 1, CursorStyle);
                     }
+                    continue;
                 }
-                else
+                if(buf->mMode == MODE_SEARCH)
+                {
+                    DrawSearchMatches(buf, row, y, line);
+                }
+                DrawCursors(buf, row, y, line);
+                if(buf->mMode == MODE_JUMP)
                 {
-                    // uncomment this for vim style . on 'not lines'
-                    //writeString += ".";
+                    DrawJumpLabels(buf, row, y);
                 }
             }
+            else
+            {
+                // uncomment this for vim style . on 'not lines'
+                //mScreen.Put(row, 0, '.', Style(GreyColour, kDefaultColour));
+            }
+        }
+        view.mDrawn = std::move(state);
+    }
+
+    // draws the views that changed into mScreen, then writes out only the
+    // cells that are different from the last frame
+    void DrawScreen()
+    {
+        // nothing's drawn while a macro plays, only once it's finished
+        if(mReplaying)
+        {
+            return;
+        }
+        UpdateScreenSize();
+
+        HighlightViews();
+        for(View* view : mLayout.mViews)
+        {
+            DrawView(*view);
+        }
+
+        mScreen.FullWindow();
+        for(const Rect& separator : mLayout.mSeparators)
+        {
+            for(int row = 0; row < separator.mRows; row++)
+            {
+                mScreen.Put(separator.mRow + row, separator.mCol, '|', OtherLedLineStyle);
+            }
+        }
+
+        View* focus = mLayout.mFocus;
+        Buffer* buf = focus->mBuffer;
+        mScreen.SetCursor(focus->mRect.mRow + buf->GetScreenCursY() - 1, focus->mRect.mCol + buf->GetScreenCursX() - 1);
+
+        std::string writeString = mScreen.Flush();
+        if(!writeString.empty())
+        {
+            ssize_t written = write(mOutputFd, writeString.c_str(), writeString.size());
+            if(written > 0)
+            {
+                mBytesWritten += written;
+            }
+        }
+    }
+
+    // everything that wakes the editor up: keys, resizes, timers, jobs
+    EventLoop mEvents;
+
+    // after mEvents, buffers and the threads reading files ahead use it
+    BufferManager mBuffers;
+
+    // after mBuffers, which outlive the views showing them
+    Layout mLayout;
+
+    // ctrl-w was the last key
+    bool mViewKey = false;
+
+    // handle keys until it's time to quit. all the keys that are waiting get
+    // handled before we redraw, so a burst of input costs one frame.
+    void Run()
+    {
+        mEvents.AddFd(mInputFd, POLLIN, [this](short) { ReadInput(); });
+        mEvents.WatchSignal(SIGWINCH, []() { gWindowResized = 1; });
+        mEvents.mAfterEvents = [this]()
+        {
+            DrawScreen();
+            if(ReloadLostFiles())
+            {
+                DrawScreen();
+            }
+            WriteJournals();
+        };
+
+        // a TAGS file where we're started is loaded while we get going
+        struct stat info;
+        if(stat("TAGS", &info) == 0)
+        {
+            LoadTags("TAGS");
+        }
+
+        DrawScreen();
+        mEvents.Run();
+    }
+
+    // the edits from this pass go to disk while we wait for the next
+    void WriteJournals()
+    {
+        for(auto buf : mBuffers)
+        {
+            buf->mJournal.Kick();
+        }
+    }
+
+    void ReadInput()
+    {
+        int c;
+        while((c = ReadKey()) != -1)
+        {
+            if(HandleKey(c))
+            {
+                mEvents.Stop();
+                return;
+            }
+        }
+        SearchInBackground();
+    }
+
+    // grep runs on all the cores and its results turn up in a buffer of
+    // their own as they're found. the search looks through the open buffers
+    // as they are rather than their files.
+    std::unique_ptr<GrepSearch> mGrep;
+    Buffer* mGrepBuffer = nullptr;
+    size_t mGrepMatches = 0;
+    bool mGrepReported = false;
+
+    void Grep(const std::string& needle, const std::string& dir)
+    {
+        if(needle.empty())
+        {
+            mCurrBuffer->mMessage = "nothing to grep for";
+            return;
+        }
+        mGrep.reset();
+        if(!mGrepBuffer)
+        {
+            mGrepBuffer = NewBuffer("*grep*");
+        }
+        Buffer* results = mGrepBuffer;
+        results->Load(TextSource::FromString("grep " + needle + " in " + dir + "\n"));
+        results->mCursX = 0;
+        results->mCursY = 0;
+        mGrepMatches = 0;
+        mGrepReported = false;
 
-            // write a newline after all but the last line
-            if(y != end - 1)
+        mGrep.reset(new GrepSearch(needle, std::thread::hardware_concurrency()));
+        mGrep->mOnResults = [this]() { mEvents.Post([this]() { TakeGrepResults(); }); };
+        for(auto buf : mBuffers)
+        {
+            if(buf != results && buf->mLoaded && !buf->mFileName.empty())
+            {
+                mGrep->SkipFile(buf->mFileName);
+            }
+        }
+        for(auto buf : mBuffers)
+        {
+            if(buf != results && buf->mLoaded)
             {
-                writeString += "\r\n";
+                std::string name = buf->mName.empty() ? "[buffer " + std::to_string(buf->mBufId) + "]" : buf->mName;
+                mGrep->SearchText(name, buf->mText);
             }
         }
+        mGrep->SearchDirectory(dir);
+        mGrep->Start();
+        SetCurrentBuffer(results);
+    }
 
-        // move the cursor to the right place
-        writeString += "\x1b[" +
-            std::to_string(buf->GetScreenCursY()) + ";" +
-            std::to_string(buf->GetScreenCursX()) +  "H";
+    // file:line:column: text, as grep -n and compilers do
+    void TakeGrepResults()
+    {
+        if(!mGrep)
+        {
+            return;
+        }
+        std::vector<std::string> lines;
+        for(auto& match : mGrep->TakeResults())
+        {
+            lines.push_back(match.mName + ":" + std::to_string(match.mLine + 1) + ":" +
+                            std::to_string(match.mCol + 1) + ": " + match.mText);
+        }
+        mGrepMatches += lines.size();
+        if(mGrep->Finished() && !mGrepReported)
+        {
+            mGrepReported = true;
+            lines.push_back(std::to_string(mGrepMatches) + " matching lines, " +
+                            std::to_string(mGrep->mFilesSearched) + " files searched");
+        }
+        if(!lines.empty())
+        {
+            mGrepBuffer->AppendLines(lines);
+        }
+    }
+
+    // tags for going to definitions, loaded from a tags file or made by
+    // scanning a directory, either way on other threads. Alt-. goes to the
+    // definition of the word at the cursor, again to the next one, and
+    // Alt-, goes back to where it was.
+    std::shared_ptr<SymbolIndex> mSymbols;
+    std::unique_ptr<SymbolIndexBuild> mSymbolBuild;
+    std::vector<std::pair<Buffer*, TextPos>> mTagStack;
+    std::string mLastTagName;
+    size_t mLastTagIndex = 0;
+    Buffer* mSymbolsBuffer = nullptr;
+
+    SymbolIndexBuild::Done TagsDone(const std::string& from)
+    {
+        return [this, from](std::shared_ptr<SymbolIndex> index, const std::string& error)
+        {
+            mEvents.Post([this, from, index, error]()
+            {
+                if(index)
+                {
+                    mSymbols = index;
+                    mLastTagName.clear();
+                }
+                mCurrBuffer->mMessage = index ? std::to_string(index->Size()) + " tags from " + from : error;
+            });
+        };
+    }
 
-        // display the cursor
-        writeString += "\x1b[?25h";
+    void LoadTags(const std::string& path)
+    {
+        mSymbolBuild.reset(new SymbolIndexBuild(1));
+        mSymbolBuild->Load(path, TagsDone(path));
+    }
 
-        write(STDOUT_FILENO, writeString.c_str(), writeString.size());
+    void MakeTags(const std::string& dir)
+    {
+        mSymbolBuild.reset(new SymbolIndexBuild(std::thread::hardware_concurrency()));
+        mSymbolBuild->Scan(dir, TagsDone(dir));
+    }
+
+    // with no name, the word at the cursor
+    void GoToDefinition(std::string name)
+    {
+        Buffer* buf = mCurrBuffer;
+        if(name.empty())
+        {
+            name = buf->WordAtCursor();
+        }
+        if(!mSymbols)
+        {
+            buf->mMessage = "no tags loaded, see tags and maketags";
+            return;
+        }
+        std::vector<Tag> tags = mSymbols->Find(name);
+        if(tags.empty())
+        {
+            buf->mMessage = "no definition of " + name;
+            return;
+        }
+
+        // asking again for the same name goes round its definitions
+        bool again = name == mLastTagName && !mTagStack.empty();
+        mLastTagIndex = again ? (mLastTagIndex + 1) % tags.size() : 0;
+        mLastTagName = name;
+        const Tag& tag = tags[mLastTagIndex];
+
+        struct stat info;
+        if(stat(tag.mFile.c_str(), &info) != 0)
+        {
+            buf->mMessage = "can't open " + tag.mFile;
+            return;
+        }
+        if(!again)
+        {
+            mTagStack.push_back(std::make_pair(buf, TextPos(buf->mCursY, buf->mCursX)));
+        }
+        Buffer* target = OpenBuffer(tag.mFile);
+        SetCurrentBuffer(target);
+        target->GoToTag(tag.mLine, tag.mPattern, tag.mName);
+        if(tags.size() > 1)
+        {
+            target->mMessage = std::to_string(mLastTagIndex + 1) + " of " + std::to_string(tags.size()) + " definitions";
+        }
+    }
+
+    void PopTag()
+    {
+        if(mTagStack.empty())
+        {
+            mCurrBuffer->mMessage = "no definitions to go back from";
+            return;
+        }
+        auto back = mTagStack.back();
+        mTagStack.pop_back();
+        mLastTagName.clear();
+        SetCurrentBuffer(back.first);
+        back.first->mCursY = back.second.mLine;
+        back.first->mCursX = back.second.mCol;
+        back.first->Scroll();
+    }
+
+    // file:line: name for the definitions of names starting with prefix,
+    // in a buffer of their own like grep's
+    void ListSymbols(const std::string& prefix)
+    {
+        if(!mSymbols)
+        {
+            mCurrBuffer->mMessage = "no tags loaded, see tags and maketags";
+            return;
+        }
+        static const size_t kMaxListed = 10000;
+        std::vector<Tag> tags = mSymbols->Search(prefix, kMaxListed);
+        std::string text = "symbols " + prefix + "\n";
+        for(auto& tag : tags)
+        {
+            text += tag.mFile + ":" + std::to_string(tag.mLine) + ": " + tag.mName + "\n";
+        }
+        text += std::to_string(tags.size()) + (tags.size() == kMaxListed ? "+" : "") + " symbols\n";
+
+        if(!mSymbolsBuffer)
+        {
+            mSymbolsBuffer = NewBuffer("*symbols*");
+        }
+        mSymbolsBuffer->Load(TextSource::FromString(text));
+        mSymbolsBuffer->mCursX = 0;
+        mSymbolsBuffer->mCursY = 0;
+        SetCurrentBuffer(mSymbolsBuffer);
+    }
+
+    // a search that didn't finish in the slice its key ran carries on a
+    // slice per pass of the event loop, so keys still get handled and the
+    // led line shows it's going
+    bool mSearchPosted = false;
+
+    void SearchInBackground()
+    {
+        if(mSearchPosted || mCurrBuffer->mSearch.mDone)
+        {
+            return;
+        }
+        mSearchPosted = true;
+        mEvents.Post([this]()
+        {
+            mSearchPosted = false;
+            if(mCurrBuffer->ContinueSearch())
+            {
+                SearchInBackground();
+            }
+        });
     }
 
     Buffer* mCurrBuffer;
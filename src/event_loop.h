@@ -0,0 +1,327 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+// write end of the pipe signal handlers report through, one byte per signal
+int gSignalPipe = -1;
+
+void OnSignalForEventLoop(int signo)
+{
+    int savedErrno = errno;
+    unsigned char byte = signo;
+    if(write(gSignalPipe, &byte, 1) < 0)
+    {
+        // pipe full, a wakeup is already on its way
+    }
+    errno = savedErrno;
+}
+
+// single threaded event loop. sleeps in poll() until a registered fd is
+// ready, a timer is due, a watched signal arrives or another thread calls
+// Post()/Wake(), so an idle editor uses no cpu at all.
+struct EventLoop
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct FdSource
+    {
+        int mFd;
+        short mEvents;
+        std::function<void(short)> mCallback;
+    };
+
+    struct Timer
+    {
+        int mId;
+        Clock::time_point mDue;
+        std::chrono::milliseconds mInterval;
+        bool mRepeat;
+        std::function<void()> mCallback;
+    };
+
+    EventLoop()
+    {
+        // wakes poll for Post() and Wake() from other threads
+        if(pipe(mWakePipe) == 0)
+        {
+            fcntl(mWakePipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(mWakePipe[1], F_SETFL, O_NONBLOCK);
+        }
+    }
+
+    ~EventLoop()
+    {
+        for(auto& watched : mSignals)
+        {
+            signal(watched.first, SIG_DFL);
+        }
+        close(mWakePipe[0]);
+        close(mWakePipe[1]);
+        if(mSignalPipe[0] >= 0)
+        {
+            gSignalPipe = -1;
+            close(mSignalPipe[0]);
+            close(mSignalPipe[1]);
+        }
+    }
+
+    std::vector<FdSource> mFds;
+    std::vector<Timer> mTimers;
+    int mNextTimerId = 1;
+
+    std::map<int, std::function<void()>> mSignals;
+    int mSignalPipe[2] = {-1, -1};
+
+    int mWakePipe[2] = {-1, -1};
+    std::mutex mPostedMutex;
+    std::vector<std::function<void()>> mPosted;
+
+    // called once after each batch of events, e.g. to redraw the screen
+    std::function<void()> mAfterEvents;
+
+    bool mStopped = false;
+
+    // events is POLLIN and/or POLLOUT, the callback gets the revents
+    void AddFd(int fd, short events, std::function<void(short)> callback)
+    {
+        RemoveFd(fd);
+        FdSource source = {fd, events, callback};
+        mFds.push_back(source);
+    }
+
+    void RemoveFd(int fd)
+    {
+        for(auto it = mFds.begin(); it != mFds.end(); ++it)
+        {
+            if(it->mFd == fd)
+            {
+                mFds.erase(it);
+                return;
+            }
+        }
+    }
+
+    // returns an id for RemoveTimer
+    int AddTimer(int milliseconds, bool repeat, std::function<void()> callback)
+    {
+        Timer timer;
+        timer.mId = mNextTimerId++;
+        timer.mInterval = std::chrono::milliseconds(milliseconds);
+        timer.mDue = Clock::now() + timer.mInterval;
+        timer.mRepeat = repeat;
+        timer.mCallback = callback;
+        mTimers.push_back(timer);
+        return timer.mId;
+    }
+
+    void RemoveTimer(int id)
+    {
+        for(auto it = mTimers.begin(); it != mTimers.end(); ++it)
+        {
+            if(it->mId == id)
+            {
+                mTimers.erase(it);
+                return;
+            }
+        }
+    }
+
+    void WatchSignal(int signo, std::function<void()> callback)
+    {
+        if(mSignalPipe[0] < 0 && pipe(mSignalPipe) == 0)
+        {
+            fcntl(mSignalPipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(mSignalPipe[1], F_SETFL, O_NONBLOCK);
+            gSignalPipe = mSignalPipe[1];
+        }
+        mSignals[signo] = callback;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = OnSignalForEventLoop;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(signo, &action, nullptr);
+    }
+
+    // run callback on the loop's thread. safe to call from any thread.
+    void Post(std::function<void()> callback)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mPostedMutex);
+            mPosted.push_back(callback);
+        }
+        Wake();
+    }
+
+    // make the loop go round again, e.g. to redraw. safe from any thread.
+    void Wake()
+    {
+        char byte = 0;
+        if(write(mWakePipe[1], &byte, 1) < 0)
+        {
+            // pipe full, it's awake anyway
+        }
+    }
+
+    void Stop() { mStopped = true; }
+
+    void Run()
+    {
+        mStopped = false;
+        while(!mStopped)
+        {
+            RunOnce(-1);
+        }
+    }
+
+    // wait up to timeoutMs (-1 for as long as it takes) for something to
+    // happen and handle everything that has
+    void RunOnce(int timeoutMs)
+    {
+        int timeout = timeoutMs;
+        if(!mTimers.empty())
+        {
+            auto now = Clock::now();
+            for(auto& timer : mTimers)
+            {
+                // rounded up, waking before it's due would go round again
+                // and again with nothing to do
+                auto left = timer.mDue - now;
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(left);
+                if(wait < left)
+                {
+                    wait += std::chrono::milliseconds(1);
+                }
+                long long waitMs = std::max<long long>(wait.count(), 0);
+                if(timeout < 0 || waitMs < timeout)
+                {
+                    timeout = waitMs;
+                }
+            }
+        }
+
+        std::vector<pollfd> pollFds;
+        pollFds.push_back({mWakePipe[0], POLLIN, 0});
+        pollFds.push_back({mSignalPipe[0], POLLIN, 0});
+        for(auto& source : mFds)
+        {
+            pollFds.push_back({source.mFd, source.mEvents, 0});
+        }
+
+        int ready = poll(pollFds.data(), pollFds.size(), timeout);
+        if(ready < 0 && errno != EINTR)
+        {
+            return;
+        }
+
+        if(pollFds[0].revents & POLLIN)
+        {
+            DrainPipe(mWakePipe[0]);
+            RunPosted();
+        }
+
+        if(pollFds[1].revents & POLLIN)
+        {
+            unsigned char signals[64];
+            ssize_t count;
+            while((count = read(mSignalPipe[0], signals, sizeof(signals))) > 0)
+            {
+                for(ssize_t i = 0; i < count; i++)
+                {
+                    auto watched = mSignals.find(signals[i]);
+                    if(watched != mSignals.end())
+                    {
+                        watched->second();
+                    }
+                }
+            }
+        }
+
+        // callbacks can add and remove fds, so go by fd rather than index
+        for(size_t i = 2; i < pollFds.size(); i++)
+        {
+            if(pollFds[i].revents == 0)
+            {
+                continue;
+            }
+            for(auto& source : mFds)
+            {
+                if(source.mFd == pollFds[i].fd)
+                {
+                    auto callback = source.mCallback;
+                    callback(pollFds[i].revents);
+                    break;
+                }
+            }
+        }
+
+        RunTimers();
+
+        if(mAfterEvents)
+        {
+            mAfterEvents();
+        }
+    }
+
+    void RunTimers()
+    {
+        auto now = Clock::now();
+        std::vector<Timer> due;
+        for(auto it = mTimers.begin(); it != mTimers.end();)
+        {
+            if(it->mDue <= now)
+            {
+                due.push_back(*it);
+                if(it->mRepeat)
+                {
+                    it->mDue = now + it->mInterval;
+                    ++it;
+                }
+                else
+                {
+                    it = mTimers.erase(it);
+                }
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        for(auto& timer : due)
+        {
+            timer.mCallback();
+        }
+    }
+
+    void RunPosted()
+    {
+        std::vector<std::function<void()>> posted;
+        {
+            std::lock_guard<std::mutex> lock(mPostedMutex);
+            posted.swap(mPosted);
+        }
+        for(auto& callback : posted)
+        {
+            callback();
+        }
+    }
+
+    void DrainPipe(int fd)
+    {
+        char bytes[256];
+        while(read(fd, bytes, sizeof(bytes)) > 0)
+        {
+        }
+    }
+};
@@ -0,0 +1,257 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "text_storage.h"
+
+// fsync the directory a file is in, so a rename into it sticks
+inline void SyncDirectoryOf(const std::string& filename)
+{
+    size_t slash = filename.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, std::max<size_t>(slash, 1));
+    int dirFd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if(dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+}
+
+// writes to a file in big writev()s. short pieces are copied together into
+// a chunk, long ones (a run of a mapped file, say) go straight from where
+// they are, so a save is a handful of syscalls per megabyte.
+struct ChunkWriter
+{
+    explicit ChunkWriter(int fd) : mFd(fd)
+    {
+        mChunk.resize(kChunkSize);
+    }
+
+    static const size_t kChunkSize = 1 << 20;
+
+    // anything this long isn't worth copying
+    static const size_t kDirectSize = 64 << 10;
+
+    int mFd;
+    bool mFailed = false;
+    std::vector<char> mChunk;
+    size_t mChunkUsed = 0;
+
+    // the part of the chunk not in mPending yet starts here
+    size_t mChunkStart = 0;
+    std::vector<iovec> mPending;
+
+    void Append(const char* data, size_t length)
+    {
+        if(length >= kDirectSize)
+        {
+            EndChunkPiece();
+            mPending.push_back({const_cast<char*>(data), length});
+        }
+        else
+        {
+            if(mChunkUsed + length > kChunkSize)
+            {
+                Flush();
+            }
+            memcpy(&mChunk[mChunkUsed], data, length);
+            mChunkUsed += length;
+        }
+
+        if(mPending.size() >= IOV_MAX - 1)
+        {
+            Flush();
+        }
+    }
+
+    void EndChunkPiece()
+    {
+        if(mChunkUsed > mChunkStart)
+        {
+            mPending.push_back({&mChunk[mChunkStart], mChunkUsed - mChunkStart});
+            mChunkStart = mChunkUsed;
+        }
+    }
+
+    void Flush()
+    {
+        EndChunkPiece();
+        iovec* pending = mPending.data();
+        size_t count = mPending.size();
+        while(count > 0 && !mFailed)
+        {
+            ssize_t written = writev(mFd, pending, count);
+            if(written <= 0)
+            {
+                mFailed = written == 0 || errno != EINTR;
+                continue;
+            }
+
+            // step over what went, a short write can stop part way into one
+            size_t done = written;
+            while(count > 0 && done >= pending->iov_len)
+            {
+                done -= pending->iov_len;
+                pending++;
+                count--;
+            }
+            if(count > 0)
+            {
+                pending->iov_base = (char*) pending->iov_base + done;
+                pending->iov_len -= done;
+            }
+        }
+        mPending.clear();
+        mChunkUsed = 0;
+        mChunkStart = 0;
+    }
+};
+
+// saves a snapshot of some text on its own thread. the text goes to a temp
+// file next to the real one, which is synced and then renamed over it, so
+// the file is always either the old version or the new one, never half of
+// each. the snapshot can't change under us, so editing carries on meanwhile.
+// a symlink is followed and the file it points to replaced. a file with
+// other hard links, or whose owner we can't give the new one, is written
+// over in place instead, as renaming would split it from its links or
+// change who owns it.
+struct BackgroundSave
+{
+    // true if saving filename means writing over it in place, or might. we
+    // can only give a file to another owner as root.
+    static bool InPlace(const std::string& filename)
+    {
+        struct stat info;
+        if(stat(filename.c_str(), &info) != 0)
+        {
+            return false;
+        }
+        return info.st_nlink > 1 || (geteuid() != 0 && (info.st_uid != geteuid() || info.st_gid != getegid()));
+    }
+
+    ~BackgroundSave()
+    {
+        // a save that's started always gets finished
+        Join();
+    }
+
+    TextStorage mText;
+    std::string mFileName;
+
+    std::thread mThread;
+    std::atomic<bool> mDone{false};
+    bool mOk = false;
+
+    // how long the file is once it's been written
+    size_t mBytes = 0;
+
+    // onDone is called on the save's thread once it's finished
+    void Start(const TextStorage& text, const std::string& filename, std::function<void()> onDone)
+    {
+        mText = text;
+        mFileName = filename;
+        mThread = std::thread([this, onDone]()
+        {
+            mOk = Write();
+            mDone = true;
+            if(onDone)
+            {
+                onDone();
+            }
+        });
+    }
+
+    void Join()
+    {
+        if(mThread.joinable())
+        {
+            mThread.join();
+        }
+    }
+
+    bool Write()
+    {
+        std::string path = mFileName;
+        char* resolved = realpath(mFileName.c_str(), nullptr);
+        if(resolved != nullptr)
+        {
+            path = resolved;
+            free(resolved);
+        }
+
+        struct stat info;
+        bool exists = stat(path.c_str(), &info) == 0;
+        if(exists && info.st_nlink > 1)
+        {
+            return WriteInPlace(path);
+        }
+
+        std::string tempName = path + ".led-tmp";
+        int fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(fd < 0)
+        {
+            return false;
+        }
+
+        // keep the owner and permissions of the file we're replacing
+        if(exists)
+        {
+            if(fchown(fd, info.st_uid, info.st_gid) != 0)
+            {
+                close(fd);
+                unlink(tempName.c_str());
+                return WriteInPlace(path);
+            }
+            fchmod(fd, info.st_mode & 07777);
+        }
+
+        bool ok = WriteText(fd);
+        ok = close(fd) == 0 && ok;
+        if(!ok || rename(tempName.c_str(), path.c_str()) != 0)
+        {
+            unlink(tempName.c_str());
+            return false;
+        }
+
+        SyncDirectoryOf(path);
+        return true;
+    }
+
+    // over the file itself, which keeps everything about it but the text
+    bool WriteInPlace(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+        if(fd < 0)
+        {
+            return false;
+        }
+        bool ok = WriteText(fd);
+        return close(fd) == 0 && ok;
+    }
+
+    // the text, and synced
+    bool WriteText(int fd)
+    {
+        ChunkWriter writer(fd);
+        mBytes = 0;
+        mText.ForEachPiece([&](const char* data, size_t length)
+        {
+            writer.Append(data, length);
+            writer.Append("\n", 1);
+            mBytes += length + 1;
+        });
+        writer.Flush();
+        return !writer.mFailed && fsync(fd) == 0;
+    }
+};
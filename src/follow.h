@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// watches a file that's being written to, a log say, and reads what's been
+// added to its end since last time. inotify says when the file or the
+// directory it's in changes, and then a stat tells what happened: more was
+// written, it was truncated, or it was rotated, moved or deleted and a new
+// file made with its name. the name is what's followed, like tail -F.
+struct FileFollower
+{
+    enum Change
+    {
+        kNone,
+        kAppended,
+        kReplaced
+    };
+
+    std::string mPath;
+    int mNotify = -1;
+    int mFileWatch = -1;
+
+    // the file as it was opened, and how much of it we have
+    int mFd = -1;
+    dev_t mDevice = 0;
+    ino_t mInode = 0;
+    off_t mOffset = 0;
+
+    // for the editor, which reads at most so many times a second however
+    // often the file's written to
+    int mTimer = -1;
+    std::chrono::steady_clock::time_point mLastRead;
+
+    // reads of what was added, and times the file was read from the start
+    // again
+    size_t mReads = 0;
+    size_t mReplaced = 0;
+
+    FileFollower() {}
+    FileFollower(const FileFollower&) = delete;
+    FileFollower& operator=(const FileFollower&) = delete;
+
+    ~FileFollower()
+    {
+        Stop();
+    }
+
+    bool Active() const { return mNotify >= 0; }
+
+    // follow path, offset bytes of which we have already
+    bool Start(const std::string& path, off_t offset, std::string& error)
+    {
+        Stop();
+        mNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(mNotify < 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+        mPath = path;
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+        if(inotify_add_watch(mNotify, dir.c_str(), IN_CREATE | IN_MOVED_TO) < 0)
+        {
+            error = strerror(errno);
+            Stop();
+            return false;
+        }
+        Restart(offset);
+        return true;
+    }
+
+    void Stop()
+    {
+        if(mFd >= 0)
+        {
+            close(mFd);
+            mFd = -1;
+        }
+        if(mNotify >= 0)
+        {
+            close(mNotify);
+            mNotify = -1;
+        }
+        mFileWatch = -1;
+    }
+
+    // open the file that has the name now, offset bytes of which we have
+    void Restart(off_t offset)
+    {
+        if(mFd >= 0)
+        {
+            close(mFd);
+        }
+        if(mFileWatch >= 0)
+        {
+            inotify_rm_watch(mNotify, mFileWatch);
+        }
+        mFd = open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+        mFileWatch = inotify_add_watch(mNotify, mPath.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+        struct stat info;
+        if(mFd >= 0 && fstat(mFd, &info) == 0)
+        {
+            mDevice = info.st_dev;
+            mInode = info.st_ino;
+        }
+        mOffset = offset;
+    }
+
+    // read the events inotify has, they only say to look at the file again
+    void Drain()
+    {
+        char events[4096];
+        while(read(mNotify, events, sizeof(events)) > 0)
+        {
+        }
+    }
+
+    // what's happened to the file since last time. kAppended with up to
+    // maxBytes of what was added in bytes, the rest is left for next time.
+    // kReplaced if the file was truncated or there's a new one by its name,
+    // for the caller to read it all and Restart. what was written to a file
+    // before it was rotated away is read first.
+    Change Read(std::string& bytes, size_t maxBytes)
+    {
+        bytes.clear();
+        struct stat info;
+        if(mFd >= 0 && fstat(mFd, &info) == 0)
+        {
+            if(info.st_size < mOffset)
+            {
+                return kReplaced;
+            }
+            if(info.st_size > mOffset)
+            {
+                bytes.resize(std::min<size_t>(info.st_size - mOffset, maxBytes));
+                ssize_t got = pread(mFd, &bytes[0], bytes.size(), mOffset);
+                bytes.resize(std::max<ssize_t>(got, 0));
+                mOffset += bytes.size();
+                mReads++;
+                return bytes.empty() ? kNone : kAppended;
+            }
+        }
+
+        struct stat named;
+        if(stat(mPath.c_str(), &named) == 0 && (mFd < 0 || named.st_dev != mDevice || named.st_ino != mInode))
+        {
+            return kReplaced;
+        }
+        return kNone;
+    }
+};
@@ -0,0 +1,456 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "search.h"
+#include "text_storage.h"
+
+// a pool of threads that each work through a deque of tasks of their own,
+// newest first, and steal the oldest from someone else's when theirs runs
+// dry. a task that adds tasks (a directory adding its files, say) adds them
+// to its own thread's deque, so work stays where it was found until some
+// other thread is idle enough to come and take it.
+struct WorkStealingPool
+{
+    typedef std::function<void()> Task;
+
+    struct Worker
+    {
+        std::mutex mMutex;
+        std::deque<Task> mTasks;
+    };
+
+    explicit WorkStealingPool(size_t threads)
+    {
+        threads = std::max<size_t>(threads, 1);
+        for(size_t i = 0; i < threads; i++)
+        {
+            mWorkers.emplace_back(new Worker());
+        }
+        for(size_t i = 0; i < threads; i++)
+        {
+            mThreads.emplace_back(&WorkStealingPool::WorkerMain, this, i);
+        }
+    }
+
+    // tasks that haven't started yet are dropped
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+            mStop = true;
+        }
+        mSleep.notify_all();
+        for(auto& thread : mThreads)
+        {
+            thread.join();
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::vector<std::thread> mThreads;
+
+    // tasks waiting in deques, and tasks not finished yet
+    std::atomic<size_t> mQueued{0};
+    std::atomic<size_t> mPending{0};
+
+    std::mutex mSleepMutex;
+    std::condition_variable mSleep;
+    bool mStop = false;
+
+    // called on a pool thread whenever the last pending task finishes
+    std::function<void()> mOnIdle;
+
+    // the pool and worker the current thread is, if it's one of ours
+    static thread_local WorkStealingPool* tPool;
+    static thread_local size_t tWorker;
+
+    void Submit(Task task)
+    {
+        size_t worker = tPool == this ? tWorker : mNextWorker++ % mWorkers.size();
+        mPending++;
+        {
+            std::lock_guard<std::mutex> lock(mWorkers[worker]->mMutex);
+            mWorkers[worker]->mTasks.push_back(std::move(task));
+        }
+        mQueued++;
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mSleep.notify_one();
+    }
+
+    std::atomic<size_t> mNextWorker{0};
+
+    // keep the pool from going idle while tasks are still being added
+    void Hold()
+    {
+        mPending++;
+    }
+
+    void Release()
+    {
+        if(--mPending == 0 && mOnIdle)
+        {
+            mOnIdle();
+        }
+    }
+
+    bool Take(size_t worker, Task& task)
+    {
+        {
+            Worker& own = *mWorkers[worker];
+            std::lock_guard<std::mutex> lock(own.mMutex);
+            if(!own.mTasks.empty())
+            {
+                task = std::move(own.mTasks.back());
+                own.mTasks.pop_back();
+                mQueued--;
+                return true;
+            }
+        }
+        for(size_t i = 1; i < mWorkers.size(); i++)
+        {
+            Worker& victim = *mWorkers[(worker + i) % mWorkers.size()];
+            std::lock_guard<std::mutex> lock(victim.mMutex);
+            if(!victim.mTasks.empty())
+            {
+                task = std::move(victim.mTasks.front());
+                victim.mTasks.pop_front();
+                mQueued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerMain(size_t worker)
+    {
+        tPool = this;
+        tWorker = worker;
+        for(;;)
+        {
+            Task task;
+            if(Take(worker, task))
+            {
+                task();
+                Release();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mSleepMutex);
+            mSleep.wait(lock, [this]() { return mStop || mQueued > 0; });
+            if(mStop)
+            {
+                return;
+            }
+        }
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::tPool = nullptr;
+thread_local size_t WorkStealingPool::tWorker = 0;
+
+// one line with a match on it
+struct GrepMatch
+{
+    std::string mName;
+    size_t mLine;
+    size_t mCol;
+    std::string mText;
+};
+
+// looks for a string in some buffers' text and in every file under a
+// directory, spread over all the cores. files are mapped read-only and
+// searched where they are, and matches come back in batches through
+// TakeResults as they're found, each file's in order.
+struct GrepSearch
+{
+    GrepSearch(const std::string& needle, size_t threads) : mNeedle(needle), mPool(threads)
+    {
+        mPool.mOnIdle = [this]()
+        {
+            mFinished = true;
+            Notify();
+        };
+        mPool.Hold();
+    }
+
+    ~GrepSearch()
+    {
+        Cancel();
+    }
+
+    std::string mNeedle;
+
+    // called on a search thread when there are results to take, or it's
+    // finished. not again until they've been taken.
+    std::function<void()> mOnResults;
+
+    // matched lines are cut down to this
+    static const size_t kMaxLineLength = 200;
+
+    std::mutex mResultsMutex;
+    std::vector<GrepMatch> mResults;
+    std::atomic<bool> mNotified{false};
+    std::atomic<bool> mFinished{false};
+    std::atomic<bool> mCancelled{false};
+
+    std::atomic<size_t> mFilesSearched{0};
+    std::atomic<size_t> mBytesSearched{0};
+
+    // files that are open in a buffer, by device and inode. the buffer's
+    // text is searched instead, it may have been edited.
+    std::set<std::pair<dev_t, ino_t>> mSkip;
+
+    // these must all be added before anything is searched
+    void SkipFile(const std::string& filename)
+    {
+        struct stat info;
+        if(stat(filename.c_str(), &info) == 0)
+        {
+            mSkip.insert(std::make_pair(info.st_dev, info.st_ino));
+        }
+    }
+
+    void SearchText(const std::string& name, const TextStorage& text)
+    {
+        TextStorage snapshot = text;
+        mPool.Submit([this, name, snapshot]() mutable
+        {
+            std::vector<GrepMatch> matches;
+            size_t line = 0;
+            snapshot.ForEachNode([&](const TextNode& n)
+            {
+                if(n.mSource)
+                {
+                    LineView first = n.mSource->Line(n.mFirst);
+                    LineView last = n.mSource->Line(n.mFirst + n.mCount - 1);
+                    SearchBlock(name, first.mData, last.mData + last.mLength - first.mData, line, matches);
+                }
+                else
+                {
+                    SearchBlock(name, n.mText->data(), n.mText->size(), line, matches);
+                }
+                line += n.PieceLines();
+            });
+            mFilesSearched++;
+            AddResults(matches);
+        });
+    }
+
+    // everything under dir, leaving out hidden files and directories
+    void SearchDirectory(const std::string& dir)
+    {
+        mPool.Submit([this, dir]() { WalkDirectory(dir); });
+    }
+
+    // call once everything to search has been added
+    void Start()
+    {
+        mPool.Release();
+    }
+
+    void Cancel()
+    {
+        mCancelled = true;
+    }
+
+    bool Finished() const { return mFinished; }
+
+    // the matches found since last time. a batch added after this takes
+    // them notifies again, so none are left behind.
+    std::vector<GrepMatch> TakeResults()
+    {
+        std::vector<GrepMatch> results;
+        {
+            std::lock_guard<std::mutex> lock(mResultsMutex);
+            mNotified = false;
+            results.swap(mResults);
+        }
+        return results;
+    }
+
+    void WalkDirectory(const std::string& dir)
+    {
+        DIR* handle = opendir(dir.c_str());
+        if(handle == nullptr)
+        {
+            return;
+        }
+        struct dirent* entry;
+        while(!mCancelled && (entry = readdir(handle)) != nullptr)
+        {
+            if(entry->d_name[0] == '.')
+            {
+                continue;
+            }
+            std::string path = dir == "." ? entry->d_name : dir + "/" + entry->d_name;
+
+            // symlinks aren't followed
+            unsigned char type = entry->d_type;
+            if(type == DT_UNKNOWN)
+            {
+                struct stat info;
+                if(lstat(path.c_str(), &info) != 0)
+                {
+                    continue;
+                }
+                type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if(type == DT_DIR)
+            {
+                mPool.Submit([this, path]() { WalkDirectory(path); });
+            }
+            else if(type == DT_REG)
+            {
+                mPool.Submit([this, path]() { SearchFile(path); });
+            }
+        }
+        closedir(handle);
+    }
+
+    void SearchFile(const std::string& path)
+    {
+        if(mCancelled)
+        {
+            return;
+        }
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size == 0 ||
+           mSkip.count(std::make_pair(info.st_dev, info.st_ino)) != 0)
+        {
+            close(fd);
+            return;
+        }
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+
+        // a file truncated while we read it, a log rotated with copytruncate
+        // say, reads as zeros past its new end rather than killing us. with
+        // no slot free for the mapping, the file is read in instead.
+        const char* data = (const char*) mapping;
+        size_t size = info.st_size;
+        std::string owned;
+        int slot = AddMappedRegion(mapping, size);
+        if(slot < 0)
+        {
+            munmap(mapping, size);
+            mapping = MAP_FAILED;
+            owned.resize(size);
+            ssize_t got = 0;
+            for(size = 0; size < owned.size() && (got = pread(fd, &owned[size], owned.size() - size, size)) > 0;)
+            {
+                size += got;
+            }
+            data = owned.data();
+        }
+        else
+        {
+            madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+
+        // a nul near the start means it's binary, like grep we leave those
+        if(memchr(data, 0, std::min<size_t>(size, 8192)) == nullptr)
+        {
+            std::vector<GrepMatch> matches;
+            SearchBlock(path, data, size, 0, matches);
+            mFilesSearched++;
+            mBytesSearched += size;
+            AddResults(matches);
+        }
+        if(mapping != MAP_FAILED)
+        {
+            RemoveMappedRegion(slot);
+            munmap(mapping, size);
+        }
+    }
+
+    // lines of text separated by newlines, the first of which is firstLine
+    void SearchBlock(const std::string& name, const char* data, size_t length, size_t firstLine,
+                     std::vector<GrepMatch>& matches)
+    {
+        const char* end = data + length;
+        const char* lineStart = data;
+        size_t line = firstLine;
+        const char* from = data;
+        const char* match;
+        while(!mCancelled && (match = FindBytes(from, end - from, mNeedle.data(), mNeedle.size())) != nullptr)
+        {
+            // count our way to the match's line
+            const char* newline;
+            while((newline = (const char*) memchr(lineStart, '\n', match - lineStart)) != nullptr)
+            {
+                lineStart = newline + 1;
+                line++;
+            }
+            const char* lineEnd = (const char*) memchr(match, '\n', end - match);
+            lineEnd = lineEnd ? lineEnd : end;
+
+            GrepMatch result;
+            result.mName = name;
+            result.mLine = line;
+            result.mCol = match - lineStart;
+            result.mText.assign(lineStart, std::min<size_t>(lineEnd - lineStart, (size_t) kMaxLineLength));
+            matches.push_back(std::move(result));
+
+            // one result per line
+            if(lineEnd == end)
+            {
+                break;
+            }
+            from = lineEnd + 1;
+        }
+    }
+
+    void AddResults(std::vector<GrepMatch>& matches)
+    {
+        if(matches.empty())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mResultsMutex);
+            for(auto& match : matches)
+            {
+                mResults.push_back(std::move(match));
+            }
+        }
+        Notify();
+    }
+
+    void Notify()
+    {
+        if(!mNotified.exchange(true) && mOnResults)
+        {
+            mOnResults();
+        }
+    }
+
+    // last, it has to go before everything its threads use
+    WorkStealingPool mPool;
+};
@@ -0,0 +1,440 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "line_cache.h"
+#include "text_storage.h"
+#include "tokeniser.h"
+#include "undo.h"
+
+struct CachedSpans
+{
+    bool mValid = false;
+    LexState mStartState = kLexNormal;
+    std::vector<TokenSpan> mSpans;
+
+    // the text version the spans were made for, where that matters
+    uint64_t mVersion = 0;
+};
+
+// token spans for a window of lines
+typedef LineCache<CachedSpans> SpanCache;
+
+// syntax highlighting for one buffer. keeps the lexer state each line starts
+// in, so a line can be tokenised without going back to the top of the file,
+// and the spans of the lines asked for last, so only lines that changed get
+// tokenised again. an edit re-lexes from the line it touched, only until the
+// states line up with what they were before it.
+struct Highlighter : TextListener
+{
+    // mStartStates[i] is the state line i starts in, for the lines lexed so
+    // far. from mDirtyFrom on they're left over from before an edit and
+    // might be wrong. the lines an edit inserted, up to mDirtyUntil, have
+    // no real old state so lexing can't stop before it gets past them.
+    std::vector<LexState> mStartStates = {kLexNormal};
+    size_t mDirtyFrom = SIZE_MAX;
+    size_t mDirtyUntil = 0;
+
+    SpanCache mCache;
+
+    // lines tokenised, to see how much work edits cost
+    size_t mLinesLexed = 0;
+
+    // when set, lexing a long way down the file gives up part way
+    const std::atomic<bool>* mInterrupt = nullptr;
+
+    std::vector<TokenSpan> mScratch;
+
+    void OnReload() override
+    {
+        mStartStates.assign(1, kLexNormal);
+        mDirtyFrom = SIZE_MAX;
+        mDirtyUntil = 0;
+        mCache.Clear();
+    }
+
+    void OnEdit(const EditRecord& edit) override
+    {
+        Splice(SpliceForEdit(edit));
+    }
+
+    void Splice(const LineSplice& splice)
+    {
+        size_t line = splice.mLine;
+        size_t erased = splice.mErased;
+        size_t inserted = splice.mInserted;
+
+        // the edited line still starts in the same state, every line after
+        // it might not
+        if(line + 1 < mStartStates.size())
+        {
+            auto first = mStartStates.begin() + line + 1;
+            auto last = mStartStates.begin() + std::min(line + erased, mStartStates.size());
+            first = mStartStates.erase(first, last);
+            mStartStates.insert(first, inserted - 1, kLexNormal);
+        }
+
+        auto shift = [&](size_t i)
+        {
+            if(i <= line)
+            {
+                return i;
+            }
+            return i >= line + erased ? i + inserted - erased : line + inserted;
+        };
+
+        if(mDirtyFrom == SIZE_MAX)
+        {
+            mDirtyFrom = line + 1;
+            mDirtyUntil = line + inserted;
+        }
+        else
+        {
+            // the states from the old mDirtyFrom on are still unchecked, so
+            // lexing from this edit can't stop before it gets to them
+            mDirtyUntil = std::max(std::max(shift(mDirtyUntil), shift(mDirtyFrom)), line + inserted);
+            mDirtyFrom = std::min(shift(mDirtyFrom), line + 1);
+        }
+
+        mCache.Splice(splice);
+    }
+
+    // the spans for a line, tokenising whatever it needs to first. the line
+    // has to exist.
+    const std::vector<TokenSpan>& LineSpans(TextStorage& text, size_t line)
+    {
+        LexUpTo(text, line);
+
+        SpanCache::CachedLine& cached = mCache.Entry(line);
+        LexState state = mStartStates[line];
+        if(!cached.mValid || cached.mStartState != state)
+        {
+            LineView view = text.GetLineView(line);
+            cached.mSpans.clear();
+            TokeniseLine(view.mData, view.mLength, state, cached.mSpans);
+            cached.mStartState = state;
+            cached.mValid = true;
+            mLinesLexed++;
+        }
+        return cached.mSpans;
+    }
+
+    // make sure we know the state line starts in. false if we don't, because
+    // the text ends first or we were interrupted.
+    bool LexUpTo(TextStorage& text, size_t line)
+    {
+        for(;;)
+        {
+            // states before here are right
+            size_t known = std::min(mDirtyFrom, mStartStates.size());
+            if(line < known)
+            {
+                return true;
+            }
+            if(!text.HasLine(known - 1) || (mInterrupt && *mInterrupt))
+            {
+                return false;
+            }
+
+            size_t lexed = known - 1;
+            LineView view = text.GetLineView(lexed);
+            mScratch.clear();
+            LexState end = TokeniseLine(view.mData, view.mLength, mStartStates[lexed], mScratch);
+            mLinesLexed++;
+
+            if(known == mStartStates.size())
+            {
+                mStartStates.push_back(end);
+                mDirtyFrom = SIZE_MAX;
+            }
+            else if(known >= mDirtyUntil && mStartStates[known] == end)
+            {
+                // back in step with how things were before the edit, so
+                // everything after here is still right
+                mDirtyFrom = SIZE_MAX;
+            }
+            else
+            {
+                mStartStates[known] = end;
+                mDirtyFrom = known + 1;
+            }
+        }
+    }
+};
+
+// runs a Highlighter on its own thread so drawing never waits on the
+// tokeniser. the editor asks for the lines it's about to draw, the worker
+// lexes them from a snapshot of the text, and the spans are used once they
+// come back for the text as it still is. until then a line keeps the spans
+// it had before, or is drawn plain if it was edited.
+struct BackgroundHighlighter : TextListener
+{
+    struct Job
+    {
+        TextStorage mText;
+        uint64_t mVersion = 0;
+        size_t mFirst = 0;
+        size_t mLast = 0;
+
+        // what happened to the text since the last job
+        bool mReload = false;
+        std::vector<LineSplice> mSplices;
+    };
+
+    struct Result
+    {
+        uint64_t mVersion = 0;
+        size_t mFirst = 0;
+        std::vector<std::vector<TokenSpan>> mLines;
+    };
+
+    ~BackgroundHighlighter()
+    {
+        Stop();
+    }
+
+    // let the worker thread go, e.g. when the buffer lets go of its text.
+    // the next Update starts another, which lexes from scratch.
+    void Stop()
+    {
+        if(!mThread.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+            mInterrupt = true;
+        }
+        mWakeWorker.notify_one();
+        mThread.join();
+
+        mStop = false;
+        mJob = Job();
+        mHasJob = false;
+        mHasResult = false;
+        mBusy = false;
+        mAwaiting = false;
+        mWorker.OnReload();
+        mUnsentReload = true;
+        mUnsentSplices.clear();
+    }
+
+    // called on the worker thread when a result is ready, e.g. to wake the
+    // event loop so it gets drawn
+    std::function<void()> mOnResult;
+
+    // main thread only. spans for the lines last drawn, moved along with
+    // any edits since they were made
+    SpanCache mFront;
+
+    // main thread only. what's happened since the last job was sent, and
+    // that job if we're still waiting for it
+    bool mUnsentReload = false;
+    std::vector<LineSplice> mUnsentSplices;
+    bool mAwaiting = false;
+    uint64_t mSentVersion = 0;
+    size_t mSentFirst = 0;
+    size_t mSentLast = 0;
+
+    // shared with the worker, under mMutex
+    std::mutex mMutex;
+    std::condition_variable mWakeWorker;
+    std::condition_variable mWorkerIdle;
+    Job mJob;
+    bool mHasJob = false;
+    Result mResult;
+    bool mHasResult = false;
+    bool mBusy = false;
+    bool mStop = false;
+    std::atomic<bool> mInterrupt{false};
+
+    // worker thread only
+    Highlighter mWorker;
+    std::thread mThread;
+
+    void OnReload() override
+    {
+        mUnsentReload = true;
+        mUnsentSplices.clear();
+        mFront.Clear();
+    }
+
+    void OnEdit(const EditRecord& edit) override
+    {
+        LineSplice splice = SpliceForEdit(edit);
+        mUnsentSplices.push_back(splice);
+        mFront.Splice(splice);
+    }
+
+    // the spans to draw a line with, or null to draw it plain
+    const std::vector<TokenSpan>* Spans(size_t line)
+    {
+        SpanCache::CachedLine* cached = mFront.Find(line);
+        return cached && cached->mValid ? &cached->mSpans : nullptr;
+    }
+
+    // take in anything the worker has finished, then ask for lines
+    // [first, last) as text is now if we don't already have them
+    void Update(TextStorage& text, size_t first, size_t last)
+    {
+        uint64_t version = text.Version();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(mHasResult)
+            {
+                mHasResult = false;
+                if(mResult.mVersion == mSentVersion && mResult.mFirst == mSentFirst)
+                {
+                    mAwaiting = false;
+                }
+                if(mResult.mVersion == version)
+                {
+                    Install(mResult);
+                }
+            }
+        }
+
+        bool upToDate = true;
+        for(size_t line = first; line < last && upToDate && text.HasLine(line); line++)
+        {
+            SpanCache::CachedLine* cached = mFront.Find(line);
+            upToDate = cached && cached->mValid && cached->mVersion == version;
+        }
+        if(upToDate)
+        {
+            return;
+        }
+        if(mAwaiting && version == mSentVersion && first == mSentFirst && last == mSentLast &&
+           !mUnsentReload && mUnsentSplices.empty())
+        {
+            // already on its way
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!mHasJob)
+            {
+                mJob.mReload = false;
+                mJob.mSplices.clear();
+            }
+            if(mUnsentReload)
+            {
+                mJob.mReload = true;
+                mJob.mSplices.clear();
+            }
+            mJob.mSplices.insert(mJob.mSplices.end(), mUnsentSplices.begin(), mUnsentSplices.end());
+            mJob.mText = text;
+            mJob.mVersion = version;
+            mJob.mFirst = first;
+            mJob.mLast = last;
+            mHasJob = true;
+
+            // whatever it's doing is out of date now
+            mInterrupt = true;
+        }
+        mUnsentReload = false;
+        mUnsentSplices.clear();
+        mAwaiting = true;
+        mSentVersion = version;
+        mSentFirst = first;
+        mSentLast = last;
+
+        if(!mThread.joinable())
+        {
+            mWorker.mInterrupt = &mInterrupt;
+            mThread = std::thread(&BackgroundHighlighter::WorkerMain, this);
+        }
+        mWakeWorker.notify_one();
+    }
+
+    // block until the worker has caught up, for benchmarks
+    void WaitForWorker()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWorkerIdle.wait(lock, [this]() { return (!mHasJob && !mBusy) || !mThread.joinable(); });
+    }
+
+    // results taken in, which can change what's drawn without an edit
+    uint64_t mInstalls = 0;
+
+    void Install(Result& result)
+    {
+        mInstalls++;
+        for(size_t i = 0; i < result.mLines.size(); i++)
+        {
+            SpanCache::CachedLine& cached = mFront.Entry(result.mFirst + i);
+            cached.mSpans.swap(result.mLines[i]);
+            cached.mValid = true;
+            cached.mVersion = result.mVersion;
+        }
+    }
+
+    void WorkerMain()
+    {
+        Result result;
+        for(;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mBusy = false;
+                mWorkerIdle.notify_all();
+                mWakeWorker.wait(lock, [this]() { return mHasJob || mStop; });
+                if(mStop)
+                {
+                    return;
+                }
+                job = std::move(mJob);
+                mJob = Job();
+                mHasJob = false;
+                mBusy = true;
+                mInterrupt = false;
+            }
+
+            if(job.mReload)
+            {
+                mWorker.OnReload();
+            }
+            for(auto& splice : job.mSplices)
+            {
+                mWorker.Splice(splice);
+            }
+
+            result.mVersion = job.mVersion;
+            result.mFirst = job.mFirst;
+            result.mLines.clear();
+            bool finished = true;
+            for(size_t line = job.mFirst; line < job.mLast; line++)
+            {
+                if(!mWorker.LexUpTo(job.mText, line))
+                {
+                    finished = !mInterrupt;
+                    break;
+                }
+                result.mLines.push_back(mWorker.LineSpans(job.mText, line));
+            }
+            if(!finished)
+            {
+                // a newer job is waiting, the lexing so far is kept
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                std::swap(mResult, result);
+                mHasResult = true;
+            }
+            if(mOnResult)
+            {
+                mOnResult();
+            }
+        }
+    }
+};
@@ -0,0 +1,512 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// keys that aren't characters are numbered after the last unicode code
+// point, and modifiers are bits above those
+enum SpecialKeys
+{
+    BACKSPACE = 127,
+    KEY_UP = 0x110000,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_INSERT,
+    KEY_DELETE,
+    KEY_PAGE_UP,
+    KEY_PAGE_DOWN,
+    KEY_F1,
+    KEY_F12 = KEY_F1 + 11,
+
+    // a bracketed paste, the text is in InputDecoder::mPaste
+    KEY_PASTE,
+
+    // a mouse report, what happened is in InputDecoder::mMouse
+    KEY_MOUSE,
+
+    // an escape sequence we don't know
+    KEY_UNKNOWN,
+
+    KEY_SHIFT = 1 << 24,
+    KEY_ALT = 1 << 25,
+    KEY_CTRL = 1 << 26
+};
+
+// a key that types something: printable ascii, or any other code point
+inline bool IsTextKey(int key)
+{
+    return (key >= ' ' && key < BACKSPACE) || (key > 0x9f && key < KEY_UP);
+}
+
+inline std::string EncodeUtf8(int codepoint)
+{
+    std::string text;
+    if(codepoint < 0x80)
+    {
+        text += (char) codepoint;
+    }
+    else if(codepoint < 0x800)
+    {
+        text += (char) (0xc0 | (codepoint >> 6));
+        text += (char) (0x80 | (codepoint & 0x3f));
+    }
+    else if(codepoint < 0x10000)
+    {
+        text += (char) (0xe0 | (codepoint >> 12));
+        text += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        text += (char) (0x80 | (codepoint & 0x3f));
+    }
+    else
+    {
+        text += (char) (0xf0 | (codepoint >> 18));
+        text += (char) (0x80 | ((codepoint >> 12) & 0x3f));
+        text += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        text += (char) (0x80 | (codepoint & 0x3f));
+    }
+    return text;
+}
+
+struct MouseEvent
+{
+    int mButton = 0;
+    int mX = 0;
+    int mY = 0;
+    bool mPressed = false;
+};
+
+// turns the bytes a terminal sends into keys. input is read as much as
+// there is at a time into a ring buffer, so a burst of it costs one
+// syscall, and decoded a byte at a time by a state machine driven from two
+// tables: what class each byte is, and for each state and class what to do
+// and which state comes next. the state carries over from one read to the
+// next, so a sequence split between reads just carries on where it was.
+struct InputDecoder
+{
+    enum { kCapacity = 64 << 10, kMask = kCapacity - 1 };
+
+    enum State
+    {
+        kGround,
+        kEscape,
+        kCsi,
+        kSs3,
+        kUtf8,
+        kMouse,     // the three bytes after ESC [ M
+        kPaste,     // between ESC [ 200 ~ and ESC [ 201 ~
+        kStates
+    };
+
+    enum Class
+    {
+        kControl,
+        kEsc,
+        kIntermediate,  // 0x20 to 0x2f
+        kParam,         // 0x30 to 0x3f
+        kFinal,         // 0x40 to 0x7e
+        kBracket,       // [
+        kLetterO,       // O
+        kDel,
+        kContinuation,
+        kLead2,
+        kLead3,
+        kLead4,
+        kInvalid,
+        kClasses
+    };
+
+    enum Action
+    {
+        kIgnore,
+        kEmit,
+        kEmitAlt,
+        kEmitEscape,        // an escape on its own, then the byte again
+        kStartSequence,
+        kCollect,
+        kDispatchCsi,
+        kDispatchSs3,
+        kUtf8Start,
+        kUtf8More,
+        kUtf8Bad,           // not finished, the byte starts something else
+        kEmitInvalid
+    };
+
+    struct Transition
+    {
+        uint8_t mAction = kIgnore;
+        uint8_t mNext = kGround;
+    };
+
+    struct Tables
+    {
+        uint8_t mClass[256];
+        Transition mNext[kStates][kClasses];
+
+        Tables()
+        {
+            for(int b = 0; b < 256; b++)
+            {
+                mClass[b] = b == 0x1b ? kEsc : b < 0x20 ? kControl : b < 0x30 ? kIntermediate :
+                            b < 0x40 ? kParam : b == '[' ? kBracket : b == 'O' ? kLetterO :
+                            b < 0x7f ? kFinal : b == 0x7f ? kDel : b < 0xc0 ? kContinuation :
+                            b < 0xc2 ? kInvalid : b < 0xe0 ? kLead2 : b < 0xf0 ? kLead3 :
+                            b < 0xf5 ? kLead4 : kInvalid;
+            }
+
+            Set(kGround, {kControl, kIntermediate, kParam, kFinal, kBracket, kLetterO, kDel}, kEmit, kGround);
+            Set(kGround, {kEsc}, kIgnore, kEscape);
+            Set(kGround, {kLead2, kLead3, kLead4}, kUtf8Start, kUtf8);
+            Set(kGround, {kContinuation, kInvalid}, kEmitInvalid, kGround);
+
+            Set(kEscape, {kBracket}, kStartSequence, kCsi);
+            Set(kEscape, {kLetterO}, kStartSequence, kSs3);
+            Set(kEscape, {kEsc}, kEmitEscape, kGround);
+            Set(kEscape, {kControl, kIntermediate, kParam, kFinal, kDel}, kEmitAlt, kGround);
+            Set(kEscape, {kContinuation, kLead2, kLead3, kLead4, kInvalid}, kEmitEscape, kGround);
+
+            Set(kCsi, {kParam, kIntermediate}, kCollect, kCsi);
+            Set(kCsi, {kFinal, kBracket, kLetterO}, kDispatchCsi, kGround);
+            Set(kCsi, {kControl}, kEmit, kCsi);
+            Set(kCsi, {kEsc}, kIgnore, kEscape);
+
+            Set(kSs3, {kParam, kFinal, kBracket, kLetterO}, kDispatchSs3, kGround);
+            Set(kSs3, {kEsc}, kIgnore, kEscape);
+
+            Set(kUtf8, {kContinuation}, kUtf8More, kUtf8);
+            Set(kUtf8, {kControl, kEsc, kIntermediate, kParam, kFinal, kBracket, kLetterO, kDel,
+                        kLead2, kLead3, kLead4, kInvalid}, kUtf8Bad, kGround);
+        }
+
+        void Set(State state, std::initializer_list<Class> classes, Action action, State next)
+        {
+            for(auto c : classes)
+            {
+                mNext[state][c].mAction = action;
+                mNext[state][c].mNext = next;
+            }
+        }
+    };
+
+    static const Tables& Table()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    std::vector<char> mRing = std::vector<char>(kCapacity);
+
+    // mHead is the next byte to decode and mTail one past the last one
+    // read. they only go up, and are masked to index the ring.
+    size_t mHead = 0;
+    size_t mTail = 0;
+
+    // reads made, to see what bursts of input cost
+    size_t mReads = 0;
+
+    State mState = kGround;
+    std::string mParams;
+    int mCodepoint = 0;
+    int mUtf8Left = 0;
+    int mUtf8Min = 0;
+    unsigned char mMouseBytes[3];
+    int mMouseCount = 0;
+
+    // bytes of the paste's end marker matched so far
+    size_t mPasteMatch = 0;
+
+    std::string mPaste;
+    MouseEvent mMouse;
+
+    // one readv of everything waiting that fits. false if there wasn't any.
+    bool Fill(int fd)
+    {
+        size_t space = kCapacity - (mTail - mHead);
+        if(space == 0)
+        {
+            return false;
+        }
+        size_t start = mTail & kMask;
+        size_t first = std::min<size_t>(space, kCapacity - start);
+        struct iovec io[2] = { { &mRing[start], first }, { &mRing[0], space - first } };
+        ssize_t got = readv(fd, io, space > first ? 2 : 1);
+        mReads++;
+        if(got <= 0)
+        {
+            return false;
+        }
+        mTail += got;
+        return true;
+    }
+
+    // the next key, reading more input when what's been read runs out. -1
+    // once there's nothing left but maybe part of a key.
+    int ReadKey(int fd)
+    {
+        for(;;)
+        {
+            while(mHead != mTail)
+            {
+                // pasted text goes across in runs up to the next escape
+                if(mState == kPaste && mPasteMatch == 0)
+                {
+                    size_t at = mHead & kMask;
+                    size_t run = std::min<size_t>(mTail - mHead, kCapacity - at);
+                    const char* esc = (const char*) memchr(&mRing[at], '\x1b', run);
+                    size_t plain = esc ? esc - &mRing[at] : run;
+                    if(plain > 0)
+                    {
+                        mPaste.append(&mRing[at], plain);
+                        mHead += plain;
+                        continue;
+                    }
+                }
+
+                bool again = false;
+                int key = Feed(mRing[mHead++ & kMask], again);
+                if(again)
+                {
+                    mHead--;
+                }
+                if(key != -1)
+                {
+                    return key;
+                }
+            }
+            if(!Fill(fd))
+            {
+                return -1;
+            }
+        }
+    }
+
+    // part way through something that might be a key on its own, a lone
+    // escape say, if nothing else comes soon
+    bool Partial() const
+    {
+        return mState != kGround && mState != kPaste;
+    }
+
+    // give up waiting for the rest: an escape is the escape key, anything
+    // else is dropped
+    int Flush()
+    {
+        State state = mState;
+        mState = kGround;
+        return state == kEscape ? 0x1b : -1;
+    }
+
+    // -1 if the byte doesn't finish a key. again means it wasn't used up
+    // and has to be fed in again.
+    int Feed(unsigned char byte, bool& again)
+    {
+        if(mState == kPaste)
+        {
+            return FeedPaste(byte);
+        }
+        if(mState == kMouse)
+        {
+            mMouseBytes[mMouseCount++] = byte;
+            if(mMouseCount < 3)
+            {
+                return -1;
+            }
+            mState = kGround;
+            mMouse.mButton = (mMouseBytes[0] - 32) & 3;
+            mMouse.mPressed = mMouse.mButton != 3;
+            mMouse.mX = mMouseBytes[1] - 33;
+            mMouse.mY = mMouseBytes[2] - 33;
+            return KEY_MOUSE;
+        }
+
+        const Tables& table = Table();
+        const Transition& next = table.mNext[mState][table.mClass[byte]];
+        mState = (State) next.mNext;
+        switch(next.mAction)
+        {
+            case kEmit:
+                return byte;
+
+            case kEmitAlt:
+                return KEY_ALT | byte;
+
+            case kEmitEscape:
+                again = true;
+                return 0x1b;
+
+            case kStartSequence:
+                mParams.clear();
+                return -1;
+
+            case kCollect:
+                if(mParams.size() < 32)
+                {
+                    mParams += byte;
+                }
+                return -1;
+
+            case kDispatchCsi:
+                return DispatchCsi(byte);
+
+            case kDispatchSs3:
+                return DispatchSs3(byte);
+
+            case kUtf8Start:
+            {
+                mUtf8Left = byte < 0xe0 ? 1 : byte < 0xf0 ? 2 : 3;
+                mUtf8Min = mUtf8Left == 1 ? 0x80 : mUtf8Left == 2 ? 0x800 : 0x10000;
+                mCodepoint = byte & (0x3f >> mUtf8Left);
+                return -1;
+            }
+
+            case kUtf8More:
+            {
+                mCodepoint = (mCodepoint << 6) | (byte & 0x3f);
+                if(--mUtf8Left > 0)
+                {
+                    return -1;
+                }
+                mState = kGround;
+                bool valid = mCodepoint >= mUtf8Min && mCodepoint < KEY_UP &&
+                             !(mCodepoint >= 0xd800 && mCodepoint < 0xe000);
+                return valid ? mCodepoint : 0xfffd;
+            }
+
+            case kUtf8Bad:
+                again = true;
+                return 0xfffd;
+
+            case kEmitInvalid:
+                return 0xfffd;
+
+            default:
+                return -1;
+        }
+    }
+
+    int FeedPaste(unsigned char byte)
+    {
+        static const char kEnd[] = "\x1b[201~";
+        mPaste += byte;
+        if(byte == kEnd[mPasteMatch])
+        {
+            if(++mPasteMatch == sizeof(kEnd) - 1)
+            {
+                mPaste.resize(mPaste.size() - mPasteMatch);
+                mPasteMatch = 0;
+                mState = kGround;
+                return KEY_PASTE;
+            }
+        }
+        else
+        {
+            mPasteMatch = byte == 0x1b ? 1 : 0;
+        }
+        return -1;
+    }
+
+    // the modifiers in the second parameter, 1 plus shift 1, alt 2, ctrl 4
+    static int Modifiers(int param)
+    {
+        int bits = param > 1 ? param - 1 : 0;
+        return (bits & 1 ? KEY_SHIFT : 0) | (bits & 2 ? KEY_ALT : 0) | (bits & 4 ? KEY_CTRL : 0);
+    }
+
+    int DispatchCsi(unsigned char final)
+    {
+        bool sgrMouse = !mParams.empty() && mParams[0] == '<';
+        int params[4] = {0, 0, 0, 0};
+        int count = 0;
+        for(size_t i = sgrMouse ? 1 : 0; i <= mParams.size() && count < 4; i++)
+        {
+            if(i == mParams.size() || mParams[i] == ';')
+            {
+                count++;
+            }
+            else if(isdigit((unsigned char) mParams[i]))
+            {
+                params[count] = params[count] * 10 + (mParams[i] - '0');
+            }
+        }
+        int modifiers = Modifiers(params[1]);
+
+        switch(final)
+        {
+            case 'A': return KEY_UP | modifiers;
+            case 'B': return KEY_DOWN | modifiers;
+            case 'C': return KEY_RIGHT | modifiers;
+            case 'D': return KEY_LEFT | modifiers;
+            case 'H': return KEY_HOME | modifiers;
+            case 'F': return KEY_END | modifiers;
+            case 'Z': return KEY_SHIFT | '\t';
+
+            case 'M':
+            case 'm':
+            {
+                if(sgrMouse)
+                {
+                    mMouse.mButton = params[0];
+                    mMouse.mX = params[1] - 1;
+                    mMouse.mY = params[2] - 1;
+                    mMouse.mPressed = final == 'M';
+                    return KEY_MOUSE;
+                }
+                if(final == 'M' && mParams.empty())
+                {
+                    mState = kMouse;
+                    mMouseCount = 0;
+                    return -1;
+                }
+                return KEY_UNKNOWN;
+            }
+
+            case '~':
+            {
+                int code = params[0];
+                if(code == 200)
+                {
+                    mState = kPaste;
+                    mPaste.clear();
+                    mPasteMatch = 0;
+                    return -1;
+                }
+                int key = code == 1 || code == 7 ? KEY_HOME :
+                          code == 4 || code == 8 ? KEY_END :
+                          code == 2 ? KEY_INSERT :
+                          code == 3 ? KEY_DELETE :
+                          code == 5 ? KEY_PAGE_UP :
+                          code == 6 ? KEY_PAGE_DOWN :
+                          code >= 11 && code <= 15 ? KEY_F1 + code - 11 :
+                          code >= 17 && code <= 21 ? KEY_F1 + 5 + code - 17 :
+                          code == 23 || code == 24 ? KEY_F1 + 10 + code - 23 : KEY_UNKNOWN;
+                return key == KEY_UNKNOWN ? key : key | modifiers;
+            }
+        }
+        return KEY_UNKNOWN;
+    }
+
+    int DispatchSs3(unsigned char final)
+    {
+        switch(final)
+        {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+            case 'P': return KEY_F1;
+            case 'Q': return KEY_F1 + 1;
+            case 'R': return KEY_F1 + 2;
+            case 'S': return KEY_F1 + 3;
+        }
+        return KEY_UNKNOWN;
+    }
+};
@@ -0,0 +1,894 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file_saver.h"
+#include "text_storage.h"
+#include "undo.h"
+
+// which version of a file a journal's edits apply to
+struct JournalBase
+{
+    uint64_t mSize = 0;
+    uint64_t mModifiedSec = 0;
+    uint64_t mModifiedNsec = 0;
+
+    // a file that isn't there has the all zero base
+    static JournalBase Of(const std::string& filename)
+    {
+        JournalBase base;
+        struct stat info;
+        if(stat(filename.c_str(), &info) == 0)
+        {
+            base.mSize = info.st_size;
+            base.mModifiedSec = info.st_mtim.tv_sec;
+            base.mModifiedNsec = info.st_mtim.tv_nsec;
+        }
+        return base;
+    }
+
+    bool operator==(const JournalBase& other) const
+    {
+        return mSize == other.mSize && mModifiedSec == other.mModifiedSec && mModifiedNsec == other.mModifiedNsec;
+    }
+};
+
+// what a journal had in it: the text at its checkpoint if it has one, and
+// the edits made after that
+struct JournalContents
+{
+    bool mHasCheckpoint = false;
+    TextStorage mCheckpoint;
+    std::vector<EditRecord> mEdits;
+};
+
+// the unsaved edits to a buffer, appended to <file>.led-swp as they're made
+// so they can be put back if led dies before they're saved.
+//
+// the file is a header saying which version of the file the edits apply to,
+// then records of kind, length, payload and a checksum, so a record that was
+// only half written when we died is spotted and it and anything after it is
+// dropped. records pile up in memory until Kick(), which the editor calls
+// once per pass of its event loop after the frame is drawn. a thread of
+// their own then writes each batch with one write(), and syncs at most once
+// a second. once enough has been appended the file is started over from a
+// checkpoint, which describes the text as runs of the original file's lines
+// and the lines that were edited, so it's small even for a huge file with a
+// few edits.
+//
+// numbers are written in the machine's byte order, a journal is only ever
+// read back by the machine that wrote it.
+struct EditJournal : TextListener
+{
+    ~EditJournal()
+    {
+        Close(false);
+    }
+
+    // record kinds, and the kinds of piece in a checkpoint
+    enum : char
+    {
+        kInsert = 'I',
+        kErase = 'E',
+        kCheckpoint = 'C',
+        kRunPiece = 'R',
+        kLinePiece = 'L'
+    };
+
+    // start over from a checkpoint once this much has been appended since
+    // the last one, and more than the last one took
+    static const size_t kCompactBytes = 4 << 20;
+
+    // appends are synced this long after they're written
+    static const int kSyncMilliseconds = 1000;
+
+    // set by Start. nothing is journalled without a path.
+    std::string mPath;
+    JournalBase mBase;
+
+    // the buffer's text, snapshotted for checkpoints
+    const TextStorage* mText = nullptr;
+
+    // what the writer thread has to do next, all under mMutex. a restart
+    // writes a new file (header, then the checkpoint if there is one, then
+    // mPending) and renames it over the old one.
+    //
+    // mBaseSource is where a checkpoint's runs of lines come from, the
+    // source loaded from the file at mBase. null once it's been saved over,
+    // when mSavedText is the text the save wrote and the runs come from
+    // that instead.
+    std::shared_ptr<const TextSource> mBaseSource;
+    TextStorage mSavedText;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mIdle;
+    std::string mPending;
+    bool mRestart = false;
+    bool mHasCheckpoint = false;
+    TextStorage mCheckpoint;
+    JournalBase mRestartBase;
+    bool mBusy = false;
+    bool mStop = false;
+    bool mFailed = false;
+    size_t mCheckpointBytes = 0;
+
+    std::thread mWriter;
+
+    // the open journal, only touched by the writer
+    int mFd = -1;
+
+    // bytes appended since the last checkpoint
+    size_t mAppended = 0;
+
+    // while the file is being saved, the edits made since the save's
+    // snapshot, which are what the journal will hold once it's done
+    bool mSaving = false;
+    bool mSinceSaveValid = false;
+    std::string mSinceSave;
+
+    bool Active() const { return !mPath.empty(); }
+
+    static std::string PathFor(const std::string& filename) { return filename + ".led-swp"; }
+
+    // start journalling the edits to text, which was loaded from filename as
+    // base. source is what it was loaded from. with checkpointNow the
+    // journal starts out with the text as it is, e.g. after a recovery.
+    void Start(const std::string& filename, const JournalBase& base,
+               std::shared_ptr<const TextSource> source, const TextStorage* text, bool checkpointNow)
+    {
+        Close(false);
+        mPath = PathFor(filename);
+        mBase = base;
+        mBaseSource = source;
+        mSavedText = TextStorage();
+        mText = text;
+        mAppended = 0;
+        mSaving = false;
+        mSinceSave.clear();
+        if(checkpointNow)
+        {
+            QueueCheckpoint();
+        }
+    }
+
+    // stop journalling. everything recorded so far is written first, unless
+    // remove, when the journal is deleted instead.
+    void Close(bool remove)
+    {
+        if(!Active())
+        {
+            return;
+        }
+        bool work;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+            if(remove)
+            {
+                mPending.clear();
+                mRestart = false;
+                mHasCheckpoint = false;
+                mCheckpoint = TextStorage();
+            }
+            work = !mPending.empty() || mRestart;
+        }
+        if(work || mWriter.joinable())
+        {
+            WakeWriter();
+            mWriter.join();
+        }
+        if(remove)
+        {
+            unlink(mPath.c_str());
+        }
+
+        mPath.clear();
+        mBaseSource = nullptr;
+        mSavedText = TextStorage();
+        mText = nullptr;
+        mStop = false;
+        mFailed = false;
+        mCheckpointBytes = 0;
+    }
+
+    // see TextStorage::Rebase. waits for the writer, which might be reading
+    // the old source.
+    void Rebase(const TextSource* from, std::shared_ptr<const TextSource> to)
+    {
+        Flush();
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mBaseSource.get() == from)
+        {
+            mBaseSource = to;
+        }
+        mCheckpoint.Rebase(from, to);
+        mSavedText.Rebase(from, to);
+    }
+
+    // have the writer start on what's been recorded
+    void Kick()
+    {
+        bool work;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            work = !mPending.empty() || mRestart;
+        }
+        if(work)
+        {
+            WakeWriter();
+        }
+    }
+
+    // the writer thread is started for the first thing there is to write,
+    // so a buffer that's never edited doesn't keep one
+    void WakeWriter()
+    {
+        if(!mWriter.joinable())
+        {
+            mWriter = std::thread(&EditJournal::WriterMain, this);
+        }
+        mWake.notify_one();
+    }
+
+    // wait until everything recorded so far is on disk
+    void Flush()
+    {
+        Kick();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mIdle.wait(lock, [this]() { return mPending.empty() && !mRestart && !mBusy; });
+    }
+
+    void OnEdit(const EditRecord& edit) override
+    {
+        if(!Active())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            size_t before = mPending.size();
+            AppendEdit(mPending, edit);
+            mAppended += mPending.size() - before;
+
+            // a failed write leaves the file with a hole in it
+            if(mFailed || (!mSaving && mAppended > kCompactBytes && mAppended > mCheckpointBytes))
+            {
+                QueueCheckpointLocked();
+            }
+        }
+        if(mSaving)
+        {
+            AppendEdit(mSinceSave, edit);
+        }
+    }
+
+    void OnReload() override
+    {
+        if(Active())
+        {
+            mSinceSaveValid = false;
+            QueueCheckpoint();
+        }
+    }
+
+    // the text is being saved as it is now
+    void SaveStarted()
+    {
+        mSaving = true;
+        mSinceSaveValid = true;
+        mSinceSave.clear();
+    }
+
+    // the save of text finished. if it worked, the journal starts over on
+    // top of the newly saved file.
+    void SaveFinished(bool ok, const std::string& filename, const TextStorage& text)
+    {
+        mSaving = false;
+        if(!Active() || !ok)
+        {
+            mSinceSave.clear();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBase = JournalBase::Of(filename);
+            mBaseSource = nullptr;
+            mSavedText = text;
+            if(mSinceSaveValid)
+            {
+                mPending.swap(mSinceSave);
+                mRestart = true;
+                mHasCheckpoint = false;
+                mCheckpoint = TextStorage();
+                mRestartBase = mBase;
+                mAppended = mPending.size();
+            }
+            else
+            {
+                QueueCheckpointLocked();
+            }
+        }
+        mSinceSave.clear();
+        WakeWriter();
+    }
+
+    // start the file over with the text as it is now
+    void QueueCheckpoint()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            QueueCheckpointLocked();
+        }
+        WakeWriter();
+    }
+
+    void QueueCheckpointLocked()
+    {
+        mPending.clear();
+        mRestart = true;
+        mHasCheckpoint = true;
+        mCheckpoint = *mText;
+        mRestartBase = mBase;
+        mFailed = false;
+        mAppended = 0;
+    }
+
+    static void Put(std::string& out, uint64_t value)
+    {
+        out.append((const char*) &value, sizeof(value));
+    }
+
+    static uint32_t Checksum(uint32_t sum, const char* data, size_t length)
+    {
+        // fnv-1a
+        for(size_t i = 0; i < length; i++)
+        {
+            sum = (sum ^ (unsigned char) data[i]) * 16777619u;
+        }
+        return sum;
+    }
+
+    static const uint32_t kChecksumStart = 2166136261u;
+
+    // kind, length, payload, then a checksum of all of those
+    static void AppendEdit(std::string& out, const EditRecord& edit)
+    {
+        size_t start = out.size();
+        out += edit.mInsert ? kInsert : kErase;
+        Put(out, 16 + edit.mText.size());
+        Put(out, edit.mPos.mLine);
+        Put(out, edit.mPos.mCol);
+        out += edit.mText;
+        uint32_t sum = Checksum(kChecksumStart, out.data() + start, out.size() - start);
+        out.append((const char*) &sum, sizeof(sum));
+    }
+
+    static std::string Header(const JournalBase& base)
+    {
+        std::string header = "LEDSWP1\n";
+        Put(header, base.mSize);
+        Put(header, base.mModifiedSec);
+        Put(header, base.mModifiedNsec);
+        return header;
+    }
+
+    // where the lines of the text a save wrote are in the file it wrote, so
+    // a checkpoint can give the lines it still shares with it as runs of
+    // that file's lines
+    struct SavedLines
+    {
+        struct Run
+        {
+            size_t mFirst;
+            size_t mCount;
+            size_t mLine;
+        };
+
+        // runs of each source's lines, by where they start in the source
+        std::unordered_map<const TextSource*, std::vector<Run>> mRuns;
+        std::unordered_map<const std::string*, size_t> mEdited;
+
+        explicit SavedLines(TextStorage& text)
+        {
+            size_t line = 0;
+            text.ForEachNode([&](const TextNode& n)
+            {
+                if(n.mSource)
+                {
+                    mRuns[n.mSource.get()].push_back({n.mFirst, n.mCount, line});
+                }
+                else
+                {
+                    mEdited[n.mText.get()] = line;
+                }
+                line += n.PieceLines();
+            });
+            for(auto& runs : mRuns)
+            {
+                std::sort(runs.second.begin(), runs.second.end(),
+                          [](const Run& a, const Run& b) { return a.mFirst < b.mFirst; });
+            }
+        }
+
+        // where an edited line was saved, or null
+        const size_t* Edited(const std::string* text) const
+        {
+            auto found = mEdited.find(text);
+            return found == mEdited.end() ? nullptr : &found->second;
+        }
+
+        // the saved run line of source is in. null if there isn't one, and
+        // then until is where the next one starts.
+        const Run* Find(const TextSource* source, size_t line, size_t& until) const
+        {
+            until = SIZE_MAX;
+            auto found = mRuns.find(source);
+            if(found == mRuns.end())
+            {
+                return nullptr;
+            }
+            auto& runs = found->second;
+            auto after = std::upper_bound(runs.begin(), runs.end(), line,
+                                          [](size_t l, const Run& run) { return l < run.mFirst; });
+            if(after != runs.end())
+            {
+                until = after->mFirst;
+            }
+            if(after == runs.begin() || line >= std::prev(after)->mFirst + std::prev(after)->mCount)
+            {
+                return nullptr;
+            }
+            return &*std::prev(after);
+        }
+    };
+
+    // calls run(first, count) for each run of lines the base file has, and
+    // line(data, size) for each of the others, for the whole text in order.
+    // the base file's lines are the lines of source, or with saved, the
+    // lines of what it says was saved. runs that carry on from each other
+    // are joined.
+    template<class RunF, class LineF>
+    static void ForEachCheckpointPiece(TextStorage& text, const TextSource* source, const SavedLines* saved,
+                                       RunF run, LineF line)
+    {
+        size_t runFirst = 0;
+        size_t runCount = 0;
+        auto addRun = [&](size_t first, size_t count)
+        {
+            if(runCount > 0 && runFirst + runCount == first)
+            {
+                runCount += count;
+                return;
+            }
+            if(runCount > 0)
+            {
+                run(runFirst, runCount);
+            }
+            runFirst = first;
+            runCount = count;
+        };
+        auto addLine = [&](const char* data, size_t size)
+        {
+            if(runCount > 0)
+            {
+                run(runFirst, runCount);
+                runCount = 0;
+            }
+            line(data, size);
+        };
+
+        text.ForEachNode([&](const TextNode& n)
+        {
+            if(!n.mSource)
+            {
+                const size_t* savedLine = saved ? saved->Edited(n.mText.get()) : nullptr;
+                if(savedLine)
+                {
+                    addRun(*savedLine, 1);
+                }
+                else
+                {
+                    addLine(n.mText->data(), n.mText->size());
+                }
+                return;
+            }
+            if(n.mSource.get() == source)
+            {
+                addRun(n.mFirst, n.mCount);
+                return;
+            }
+
+            // as much of the run as was saved as runs, the rest line by line
+            size_t i = 0;
+            while(i < n.mCount)
+            {
+                size_t until = SIZE_MAX;
+                const SavedLines::Run* savedRun = saved ? saved->Find(n.mSource.get(), n.mFirst + i, until) : nullptr;
+                if(savedRun)
+                {
+                    size_t count = std::min(n.mCount - i, savedRun->mFirst + savedRun->mCount - (n.mFirst + i));
+                    addRun(savedRun->mLine + n.mFirst + i - savedRun->mFirst, count);
+                    i += count;
+                    continue;
+                }
+                size_t count = std::min(n.mCount - i, until - (n.mFirst + i));
+                LineView first = n.mSource->Line(n.mFirst + i);
+                LineView last = n.mSource->Line(n.mFirst + i + count - 1);
+                const char* data = first.mData;
+                const char* end = last.mData + last.mLength;
+                for(size_t j = 0; j < count; j++)
+                {
+                    const char* newline = (const char*) memchr(data, '\n', end - data);
+                    newline = newline ? newline : end;
+                    addLine(data, newline - data);
+                    data = newline + 1;
+                }
+                i += count;
+            }
+        });
+        if(runCount > 0)
+        {
+            run(runFirst, runCount);
+        }
+    }
+
+    // writes the checkpoint record for text, see ForEachCheckpointPiece
+    static void WriteCheckpoint(ChunkWriter& writer, TextStorage& text, const TextSource* source,
+                                const SavedLines* saved)
+    {
+        uint64_t length = 0;
+        ForEachCheckpointPiece(text, source, saved, [&](size_t, size_t) { length += 17; },
+                               [&](const char*, size_t size) { length += 9 + size; });
+
+        std::string header(1, kCheckpoint);
+        Put(header, length);
+
+        uint32_t sum = Checksum(kChecksumStart, header.data(), header.size());
+        writer.Append(header.data(), header.size());
+        auto put = [&](const char* data, size_t size)
+        {
+            sum = Checksum(sum, data, size);
+            writer.Append(data, size);
+        };
+
+        ForEachCheckpointPiece(text, source, saved, [&](size_t first, size_t count)
+        {
+            char piece[17];
+            piece[0] = kRunPiece;
+            uint64_t first64 = first;
+            uint64_t count64 = count;
+            memcpy(piece + 1, &first64, 8);
+            memcpy(piece + 9, &count64, 8);
+            put(piece, sizeof(piece));
+        },
+        [&](const char* data, size_t size)
+        {
+            char piece[9];
+            piece[0] = kLinePiece;
+            uint64_t size64 = size;
+            memcpy(piece + 1, &size64, 8);
+            put(piece, sizeof(piece));
+            put(data, size);
+        });
+        writer.Append((const char*) &sum, sizeof(sum));
+    }
+
+    void WriterMain()
+    {
+        typedef std::chrono::steady_clock Clock;
+        auto ready = [this]() { return mStop || mRestart || !mPending.empty(); };
+        bool unsynced = false;
+        Clock::time_point syncDue;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        for(;;)
+        {
+            if(unsynced)
+            {
+                mWake.wait_until(lock, syncDue, ready);
+            }
+            else
+            {
+                mWake.wait(lock, ready);
+            }
+
+            if(!mRestart && mPending.empty())
+            {
+                if(unsynced && (mStop || Clock::now() >= syncDue))
+                {
+                    lock.unlock();
+                    fdatasync(mFd);
+                    unsynced = false;
+                    lock.lock();
+                }
+                if(mStop && !unsynced)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            bool restart = mRestart || mFd < 0;
+            bool hasCheckpoint = mHasCheckpoint;
+            TextStorage checkpoint = std::move(mCheckpoint);
+            mCheckpoint = TextStorage();
+            JournalBase base = mRestart ? mRestartBase : mBase;
+            std::string pending;
+            pending.swap(mPending);
+            mRestart = false;
+            mHasCheckpoint = false;
+            mBusy = true;
+            auto source = mBaseSource;
+            TextStorage saved = mSavedText;
+            lock.unlock();
+
+            // a fresh journal is synced before it's renamed into place. appends
+            // are safe from led dying as soon as they're written, the sync is
+            // for the machine dying and is put off so it's once a second at
+            // most rather than once a keystroke.
+            size_t checkpointBytes = 0;
+            bool ok;
+            if(restart)
+            {
+                ok = WriteFresh(base, hasCheckpoint ? &checkpoint : nullptr, source.get(), saved, pending,
+                                checkpointBytes);
+                unsynced = false;
+            }
+            else
+            {
+                ok = WriteAll(pending);
+                if(ok && !unsynced)
+                {
+                    unsynced = true;
+                    syncDue = Clock::now() + std::chrono::milliseconds((int) kSyncMilliseconds);
+                }
+            }
+
+            lock.lock();
+            mBusy = false;
+            if(restart && ok)
+            {
+                mCheckpointBytes = checkpointBytes;
+            }
+            if(!ok)
+            {
+                mFailed = true;
+                unsynced = false;
+                if(mFd >= 0)
+                {
+                    close(mFd);
+                    mFd = -1;
+                }
+            }
+            mIdle.notify_all();
+        }
+        if(mFd >= 0)
+        {
+            close(mFd);
+            mFd = -1;
+        }
+        mIdle.notify_all();
+    }
+
+    // the whole journal from scratch, renamed over the old one once it's
+    // on disk so there's always a whole journal there
+    bool WriteFresh(const JournalBase& base, TextStorage* checkpoint, const TextSource* source, TextStorage& saved,
+                    const std::string& pending, size_t& checkpointBytes)
+    {
+        if(mFd >= 0)
+        {
+            close(mFd);
+            mFd = -1;
+        }
+
+        std::string tempName = mPath + ".tmp";
+        int fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(fd < 0)
+        {
+            return false;
+        }
+
+        ChunkWriter writer(fd);
+        std::string header = Header(base);
+        writer.Append(header.data(), header.size());
+        if(checkpoint != nullptr)
+        {
+            std::unique_ptr<SavedLines> savedLines;
+            if(source == nullptr && saved.HasLine(0))
+            {
+                savedLines.reset(new SavedLines(saved));
+            }
+            WriteCheckpoint(writer, *checkpoint, source, savedLines.get());
+            writer.Flush();
+            checkpointBytes = lseek(fd, 0, SEEK_CUR);
+        }
+        writer.Append(pending.data(), pending.size());
+        writer.Flush();
+
+        bool ok = !writer.mFailed && fsync(fd) == 0;
+        if(!ok || rename(tempName.c_str(), mPath.c_str()) != 0)
+        {
+            close(fd);
+            unlink(tempName.c_str());
+            return false;
+        }
+        SyncDirectoryOf(mPath);
+
+        // the fd still refers to the renamed file, carry on appending to it
+        mFd = fd;
+        return true;
+    }
+
+    bool WriteAll(const std::string& data)
+    {
+        size_t done = 0;
+        while(done < data.size())
+        {
+            ssize_t written = write(mFd, data.data() + done, data.size() - done);
+            if(written <= 0)
+            {
+                if(written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            done += written;
+        }
+        return true;
+    }
+
+    // a journal for filename that's for some other version of the file is
+    // renamed to <file>.led-swp.1, or .2 and so on, before a new journal
+    // goes over it. returns what it was renamed to, or empty if there
+    // wasn't one.
+    static std::string MoveAsideIfStale(const std::string& filename, const JournalBase& base)
+    {
+        std::string path = PathFor(filename);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            return "";
+        }
+        std::string header = Header(base);
+        std::string found(header.size(), '\0');
+        ssize_t got = read(fd, &found[0], found.size());
+        close(fd);
+        if(got == (ssize_t) header.size() && found == header)
+        {
+            return "";
+        }
+
+        for(int i = 1; i < 1000; i++)
+        {
+            std::string aside = path + "." + std::to_string(i);
+            struct stat info;
+            if(stat(aside.c_str(), &info) != 0 && rename(path.c_str(), aside.c_str()) == 0)
+            {
+                return aside;
+            }
+        }
+        return "";
+    }
+
+    // read the journal for filename, as of base. returns false if there
+    // isn't one for that version of the file. a damaged record and anything
+    // after it are left out.
+    static bool Read(const std::string& filename, const JournalBase& base,
+                     std::shared_ptr<const TextSource> source, JournalContents& contents)
+    {
+        auto journal = TextSource::MapFile(PathFor(filename), false);
+        if(!journal)
+        {
+            return false;
+        }
+        const char* data = journal->mData;
+        size_t size = journal->mSize;
+        std::string header = Header(base);
+        if(size < header.size() || memcmp(data, header.data(), header.size()) != 0)
+        {
+            return false;
+        }
+
+        size_t pos = header.size();
+        while(size - pos >= 1 + 8 + 4)
+        {
+            char kind = data[pos];
+            uint64_t length;
+            memcpy(&length, data + pos + 1, 8);
+            if(length > size - pos - 1 - 8 - 4)
+            {
+                break;
+            }
+            const char* payload = data + pos + 1 + 8;
+            uint32_t sum;
+            memcpy(&sum, payload + length, 4);
+            if(sum != Checksum(kChecksumStart, data + pos, 1 + 8 + length))
+            {
+                break;
+            }
+            pos += 1 + 8 + length + 4;
+
+            if(kind == kInsert || kind == kErase)
+            {
+                if(length < 16)
+                {
+                    break;
+                }
+                EditRecord edit;
+                edit.mInsert = kind == kInsert;
+                uint64_t line, col;
+                memcpy(&line, payload, 8);
+                memcpy(&col, payload + 8, 8);
+                edit.mPos = TextPos(line, col);
+                edit.mText.assign(payload + 16, length - 16);
+                contents.mEdits.push_back(edit);
+            }
+            else if(kind == kCheckpoint)
+            {
+                contents.mEdits.clear();
+                contents.mCheckpoint = TextStorage();
+                contents.mHasCheckpoint = ReadCheckpoint(payload, length, source, contents.mCheckpoint);
+                if(!contents.mHasCheckpoint)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+        return contents.mHasCheckpoint || !contents.mEdits.empty();
+    }
+
+    static bool ReadCheckpoint(const char* data, size_t size, std::shared_ptr<const TextSource> source,
+                               TextStorage& text)
+    {
+        size_t pos = 0;
+        while(pos < size)
+        {
+            char kind = data[pos];
+            if(kind == kRunPiece && size - pos >= 17)
+            {
+                uint64_t first, count;
+                memcpy(&first, data + pos + 1, 8);
+                memcpy(&count, data + pos + 9, 8);
+                if(!source || !text.AppendRun(source, first, count))
+                {
+                    return false;
+                }
+                pos += 17;
+            }
+            else if(kind == kLinePiece && size - pos >= 9)
+            {
+                uint64_t length;
+                memcpy(&length, data + pos + 1, 8);
+                if(length > size - pos - 9)
+                {
+                    return false;
+                }
+                text.AppendLine(std::string(data + pos + 9, length));
+                pos += 9 + length;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,426 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "buffer.h"
+
+// a part of the screen
+struct Rect
+{
+    Rect() {}
+    Rect(int row, int col, int rows, int cols) : mRow(row), mCol(col), mRows(rows), mCols(cols) {}
+
+    int mRow = 0;
+    int mCol = 0;
+    int mRows = 0;
+    int mCols = 0;
+
+    bool operator==(const Rect& other) const
+    {
+        return mRow == other.mRow && mCol == other.mCol && mRows == other.mRows && mCols == other.mCols;
+    }
+    bool operator!=(const Rect& other) const { return !(*this == other); }
+};
+
+// everything a view was drawn from. if it's the same next frame the view's
+// cells are left as they are in the screen, only views that changed are
+// drawn again.
+struct ViewState
+{
+    const Buffer* mBuffer = nullptr;
+    Rect mRect;
+    bool mFocused = false;
+    uint64_t mVersion = 0;
+    uint64_t mSpans = 0;
+    int mCursX = 0;
+    int mCursY = 0;
+    int mScrollY = 0;
+    std::string mLedLine;
+
+    // only the view with the focus shows these
+    int mMode = MODE_EDIT;
+    std::string mSearchString;
+    bool mSearchRegex = false;
+    bool mFound = false;
+    std::vector<TextPos> mCursors;
+    std::string mJumpString;
+    size_t mJumpTargets = 0;
+
+    bool operator==(const ViewState& other) const
+    {
+        return mBuffer == other.mBuffer && mRect == other.mRect && mFocused == other.mFocused &&
+               mVersion == other.mVersion && mSpans == other.mSpans && mCursX == other.mCursX &&
+               mCursY == other.mCursY && mScrollY == other.mScrollY && mLedLine == other.mLedLine &&
+               mMode == other.mMode && mSearchString == other.mSearchString &&
+               mSearchRegex == other.mSearchRegex && mFound == other.mFound && mCursors == other.mCursors &&
+               mJumpString == other.mJumpString && mJumpTargets == other.mJumpTargets;
+    }
+    bool operator!=(const ViewState& other) const { return !(*this == other); }
+};
+
+// a buffer shown in part of the screen. the view with the focus leaves its
+// cursor and scroll in the buffer, where editing moves them. the others keep
+// their own, moved along by edits made from anywhere, so one buffer can be
+// shown in several places at once. views don't let go of their buffer when
+// they're deleted, the editor's buffers outlive them.
+struct View : TextListener
+{
+    Buffer* mBuffer = nullptr;
+    Rect mRect;
+    bool mFocused = false;
+
+    // while another view has the focus
+    int mCursX = 0;
+    int mCursY = 0;
+    int mScrollY = 0;
+    bool mListening = false;
+
+    // what it was last drawn from
+    ViewState mDrawn;
+
+    int CursX() const { return mFocused ? mBuffer->mCursX : mCursX; }
+    int CursY() const { return mFocused ? mBuffer->mCursY : mCursY; }
+    int ScrollY() const { return mFocused ? mBuffer->mScrollY : mScrollY; }
+
+    void Listen(bool listen)
+    {
+        if(listen == mListening || mBuffer == nullptr)
+        {
+            return;
+        }
+        auto& listeners = mBuffer->mListeners;
+        if(listen)
+        {
+            listeners.push_back(this);
+        }
+        else
+        {
+            listeners.erase(std::find(listeners.begin(), listeners.end(), this));
+        }
+        mListening = listen;
+    }
+
+    // show buf from where its cursor is, or nothing
+    void Show(Buffer* buf)
+    {
+        if(buf == mBuffer)
+        {
+            return;
+        }
+        if(mBuffer != nullptr)
+        {
+            Listen(false);
+            mBuffer->mViews--;
+        }
+        mBuffer = buf;
+        if(buf != nullptr)
+        {
+            buf->mViews++;
+            mCursX = buf->mCursX;
+            mCursY = buf->mCursY;
+            mScrollY = buf->mScrollY;
+            Listen(!mFocused);
+        }
+    }
+
+    // the same buffer from the same place as other
+    void ShowAs(const View& other)
+    {
+        Show(other.mBuffer);
+        mCursX = other.CursX();
+        mCursY = other.CursY();
+        mScrollY = other.ScrollY();
+    }
+
+    // take the focus, or if it's had it already, fit the buffer to a new size
+    void Focus()
+    {
+        if(mBuffer == nullptr)
+        {
+            mFocused = true;
+            return;
+        }
+        if(!mFocused)
+        {
+            mFocused = true;
+            Listen(false);
+            mBuffer->mCursX = mCursX;
+            mBuffer->mCursY = mCursY;
+        }
+        if(mRect.mRows > 0)
+        {
+            mBuffer->mNumRows = mRect.mRows;
+            mBuffer->mNumCols = mRect.mCols;
+        }
+        mBuffer->Scroll();
+    }
+
+    void Blur()
+    {
+        if(!mFocused)
+        {
+            return;
+        }
+        mFocused = false;
+        if(mBuffer != nullptr)
+        {
+            mCursX = mBuffer->mCursX;
+            mCursY = mBuffer->mCursY;
+            mScrollY = mBuffer->mScrollY;
+            Listen(true);
+        }
+    }
+
+    // where pos ends up after edit, text before it moves it along and text
+    // erased around it leaves it where the erasing started
+    static TextPos Moved(TextPos pos, const EditRecord& edit)
+    {
+        if(edit.mSwap || pos < edit.mPos)
+        {
+            return pos;
+        }
+        TextPos end = edit.End();
+        if(edit.mInsert)
+        {
+            if(pos.mLine == edit.mPos.mLine)
+            {
+                return TextPos(end.mLine, end.mCol + pos.mCol - edit.mPos.mCol);
+            }
+            return TextPos(pos.mLine + end.mLine - edit.mPos.mLine, pos.mCol);
+        }
+        if(pos < end)
+        {
+            return edit.mPos;
+        }
+        if(pos.mLine == end.mLine)
+        {
+            return TextPos(edit.mPos.mLine, edit.mPos.mCol + pos.mCol - end.mCol);
+        }
+        return TextPos(pos.mLine - (end.mLine - edit.mPos.mLine), pos.mCol);
+    }
+
+    void OnEdit(const EditRecord& edit) override
+    {
+        TextPos pos = Moved(TextPos(mCursY, mCursX), edit);
+        mCursY = pos.mLine;
+        mCursX = pos.mCol;
+    }
+
+    void OnReload() override {}
+
+    // keep the cursor in the text, and in the middle of the view the way
+    // the buffer does, ready to draw without the focus
+    void Clamp()
+    {
+        if(mFocused || mBuffer == nullptr)
+        {
+            return;
+        }
+        // only as far into a big file as the cursor, unless it's past the
+        // end, when the whole file has been looked at already
+        TextStorage& text = mBuffer->mText;
+        mCursY = std::max(mCursY, 0);
+        if(!text.HasLine(mCursY))
+        {
+            mCursY = std::max((int) text.LineCount() - 1, 0);
+        }
+        mCursX = text.HasLine(mCursY) ? std::min(std::max(mCursX, 0), (int) text.LineLength(mCursY)) : 0;
+        mScrollY = std::max(0, mCursY - mRect.mRows / 2);
+    }
+};
+
+// the views on screen, as a tree of splits each dividing its part of the
+// screen in two, one above the other or side by side. the leaves are views.
+struct Layout
+{
+    struct Node
+    {
+        // leaves only
+        std::unique_ptr<View> mView;
+
+        bool mSideBySide = false;
+        std::unique_ptr<Node> mFirst;
+        std::unique_ptr<Node> mSecond;
+        Node* mParent = nullptr;
+    };
+
+    std::unique_ptr<Node> mRoot;
+
+    // the leaves, top left first
+    std::vector<View*> mViews;
+    View* mFocus = nullptr;
+
+    // the screen, and the columns between views side by side
+    Rect mArea;
+    std::vector<Rect> mSeparators;
+
+    Layout()
+    {
+        mRoot.reset(new Node);
+        mRoot->mView.reset(new View);
+        mFocus = mRoot->mView.get();
+        mFocus->mFocused = true;
+        Collect();
+    }
+
+    void Collect()
+    {
+        mViews.clear();
+        Collect(mRoot.get());
+    }
+
+    void Collect(Node* node)
+    {
+        if(node->mView)
+        {
+            mViews.push_back(node->mView.get());
+            return;
+        }
+        Collect(node->mFirst.get());
+        Collect(node->mSecond.get());
+    }
+
+    Node* Find(Node* node, const View* view)
+    {
+        if(node->mView)
+        {
+            return node->mView.get() == view ? node : nullptr;
+        }
+        Node* found = Find(node->mFirst.get(), view);
+        return found ? found : Find(node->mSecond.get(), view);
+    }
+
+    void Arrange(const Rect& area)
+    {
+        mArea = area;
+        mSeparators.clear();
+        Place(mRoot.get(), area);
+    }
+
+    void Place(Node* node, const Rect& rect)
+    {
+        if(node->mView)
+        {
+            node->mView->mRect = rect;
+            return;
+        }
+        if(node->mSideBySide)
+        {
+            int left = (rect.mCols - 1) / 2;
+            mSeparators.push_back(Rect(rect.mRow, rect.mCol + left, rect.mRows, 1));
+            Place(node->mFirst.get(), Rect(rect.mRow, rect.mCol, rect.mRows, left));
+            Place(node->mSecond.get(), Rect(rect.mRow, rect.mCol + left + 1, rect.mRows, rect.mCols - left - 1));
+        }
+        else
+        {
+            int top = rect.mRows / 2;
+            Place(node->mFirst.get(), Rect(rect.mRow, rect.mCol, top, rect.mCols));
+            Place(node->mSecond.get(), Rect(rect.mRow + top, rect.mCol, rect.mRows - top, rect.mCols));
+        }
+    }
+
+    void Focus(View* view)
+    {
+        if(view != mFocus)
+        {
+            mFocus->Blur();
+            mFocus = view;
+        }
+        mFocus->Focus();
+    }
+
+    // split view in two, the new half below or to the right showing the same
+    // place. null if there's no room, every view needs a line of text and
+    // its led line.
+    View* Split(View* view, bool sideBySide)
+    {
+        Node* node = Find(mRoot.get(), view);
+        if(node == nullptr || (sideBySide ? view->mRect.mCols < 3 : view->mRect.mRows < 4))
+        {
+            return nullptr;
+        }
+        node->mSideBySide = sideBySide;
+        node->mFirst.reset(new Node);
+        node->mFirst->mView = std::move(node->mView);
+        node->mFirst->mParent = node;
+        node->mSecond.reset(new Node);
+        node->mSecond->mView.reset(new View);
+        node->mSecond->mParent = node;
+
+        View* added = node->mSecond->mView.get();
+        added->ShowAs(*view);
+        Collect();
+        Arrange(mArea);
+        mFocus->Focus();
+        return added;
+    }
+
+    // the view's part of the screen goes to its neighbour. false if it's
+    // the only one.
+    bool Close(View* view)
+    {
+        Node* node = Find(mRoot.get(), view);
+        if(node == nullptr || node == mRoot.get())
+        {
+            return false;
+        }
+        size_t index = std::find(mViews.begin(), mViews.end(), view) - mViews.begin();
+        view->Show(nullptr);
+
+        Node* parent = node->mParent;
+        std::unique_ptr<Node> kept = std::move(parent->mFirst.get() == node ? parent->mSecond : parent->mFirst);
+        parent->mView = std::move(kept->mView);
+        parent->mSideBySide = kept->mSideBySide;
+        parent->mFirst = std::move(kept->mFirst);
+        parent->mSecond = std::move(kept->mSecond);
+        for(Node* child : { parent->mFirst.get(), parent->mSecond.get() })
+        {
+            if(child)
+            {
+                child->mParent = parent;
+            }
+        }
+
+        Collect();
+        Arrange(mArea);
+        if(mFocus == view)
+        {
+            mFocus = mViews[std::min(index, mViews.size() - 1)];
+        }
+        mFocus->Focus();
+        return true;
+    }
+
+    // close all the views but this one
+    void Only(View* view)
+    {
+        Node* node = Find(mRoot.get(), view);
+        if(node == nullptr || node == mRoot.get())
+        {
+            return;
+        }
+        for(View* other : mViews)
+        {
+            if(other != view)
+            {
+                other->Show(nullptr);
+            }
+        }
+        std::unique_ptr<View> kept = std::move(node->mView);
+        mRoot.reset(new Node);
+        mRoot->mView = std::move(kept);
+        Collect();
+        Arrange(mArea);
+        Focus(view);
+    }
+
+    // the view step on from view, round to the start at the end
+    View* Step(View* view, int step) const
+    {
+        long size = mViews.size();
+        long index = std::find(mViews.begin(), mViews.end(), view) - mViews.begin();
+        return mViews[(index + step % size + size) % size];
+    }
+};
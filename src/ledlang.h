@@ -1,26 +1,1060 @@
 #pragma once
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
-struct Editor;
+// ledlang is what gets typed at the command line. a command is statements
+// separated by ; or newlines:
+//
+//   nb                            a builtin command and its arguments, which
+//   grep "two words" src          are words, "strings", numbers, $variables
+//   goto (line() + 10)            or (expressions)
+//   let n = lines() / 2           variables last from one command to the next
+//   repeat 3 { down; insert "> " }
+//   if modified() { save } else { print "nothing to save" }
+//   while line() < 10 { down }    # comments run to the end of the line
+//
+// a command is parsed to an AST, compiled to bytecode and run on a small
+// stack vm. compiled commands are kept by their source text, so running the
+// same one again, a macro say, goes straight to the vm.
 
+struct LedValue
+{
+    enum Type { kNil, kNumber, kString };
+
+    LedValue() {}
+    LedValue(int64_t number) : mType(kNumber), mNumber(number) {}
+    LedValue(const std::string& text) : mType(kString), mString(text) {}
+
+    Type mType = kNil;
+    int64_t mNumber = 0;
+    std::string mString;
+
+    bool Truthy() const
+    {
+        return mType == kNumber ? mNumber != 0 : mType == kString ? !mString.empty() : false;
+    }
+
+    std::string ToString() const
+    {
+        return mType == kNumber ? std::to_string(mNumber) : mString;
+    }
+
+    bool operator==(const LedValue& other) const
+    {
+        return mType == other.mType && mNumber == other.mNumber && mString == other.mString;
+    }
+};
+
+typedef std::vector<LedValue> LedArgs;
+
+// something the editor can do, callable from ledlang. setting error fails
+// the command.
+struct LedBuiltin
+{
+    std::string mName;
+    int mMinArgs = 0;
+    int mMaxArgs = 0;
+    std::function<LedValue(const LedArgs& args, std::string& error)> mRun;
+};
+
+// one node of a parsed command
 struct AST
 {
-    
+    enum Kind
+    {
+        kNumber,
+        kString,
+        kVariable,
+        kCall,
+        kUnary,
+        kBinary,
+        kAnd,
+        kOr,
+        kLet,
+        kIf,
+        kWhile,
+        kRepeat,
+        kBlock,
+        kExpression
+    };
+
+    explicit AST(Kind kind) : mKind(kind) {}
+
+    Kind mKind;
+    int64_t mNumber = 0;
+
+    // a string's text, a variable's or builtin's name, or an operator
+    std::string mText;
+
+    std::vector<std::unique_ptr<AST>> mChildren;
+
+    AST* Add(std::unique_ptr<AST> child)
+    {
+        mChildren.push_back(std::move(child));
+        return this;
+    }
+};
+
+typedef std::unique_ptr<AST> ASTPtr;
+
+struct LedParser
+{
+    LedParser(const std::string& source, const std::map<std::string, int>& builtins)
+        : mSource(source), mBuiltins(builtins)
+    {
+    }
+
+    const std::string& mSource;
+    const std::map<std::string, int>& mBuiltins;
+    size_t mPos = 0;
+    std::string mError;
+
+    // the whole command as a block, or null with mError set
+    ASTPtr Parse()
+    {
+        ASTPtr block = ParseStatements();
+        if(mError.empty() && mPos < mSource.size())
+        {
+            Fail("unmatched }");
+        }
+        return mError.empty() ? std::move(block) : nullptr;
+    }
+
+    char Peek(size_t ahead = 0) const
+    {
+        return mPos + ahead < mSource.size() ? mSource[mPos + ahead] : '\0';
+    }
+
+    void Fail(const std::string& error)
+    {
+        if(mError.empty())
+        {
+            mError = error;
+        }
+    }
+
+    void SkipSpaces()
+    {
+        while(Peek() == ' ' || Peek() == '\t' || Peek() == '\r')
+        {
+            mPos++;
+        }
+        if(Peek() == '#')
+        {
+            while(Peek() != '\0' && Peek() != '\n')
+            {
+                mPos++;
+            }
+        }
+    }
+
+    // spaces, newlines and ;s between statements
+    void SkipBreaks()
+    {
+        SkipSpaces();
+        while(Peek() == '\n' || Peek() == ';')
+        {
+            mPos++;
+            SkipSpaces();
+        }
+    }
+
+    bool AtStatementEnd()
+    {
+        SkipSpaces();
+        char c = Peek();
+        return c == '\0' || c == '\n' || c == ';' || c == '}';
+    }
+
+    bool Match(const char* text)
+    {
+        SkipSpaces();
+        size_t length = strlen(text);
+        if(mSource.compare(mPos, length, text) != 0)
+        {
+            return false;
+        }
+        mPos += length;
+        return true;
+    }
+
+    void Expect(const char* text)
+    {
+        if(!Match(text))
+        {
+            Fail(std::string("expected ") + text);
+        }
+    }
+
+    static bool IsNameStart(char c) { return isalpha((unsigned char) c) || c == '_'; }
+    static bool IsNameChar(char c) { return isalnum((unsigned char) c) || c == '_'; }
+
+    std::string PeekName()
+    {
+        SkipSpaces();
+        size_t end = mPos;
+        if(IsNameStart(Peek()))
+        {
+            while(end < mSource.size() && IsNameChar(mSource[end]))
+            {
+                end++;
+            }
+        }
+        return mSource.substr(mPos, end - mPos);
+    }
+
+    std::string ParseName()
+    {
+        std::string name = PeekName();
+        if(name.empty())
+        {
+            Fail("expected a name");
+        }
+        mPos += name.size();
+        return name;
+    }
+
+    bool IsBuiltin(const std::string& name) const { return mBuiltins.count(name) != 0; }
+
+    ASTPtr ParseStatements()
+    {
+        ASTPtr block(new AST(AST::kBlock));
+        SkipBreaks();
+        while(mError.empty() && Peek() != '\0' && Peek() != '}')
+        {
+            block->Add(ParseStatement());
+            if(!AtStatementEnd())
+            {
+                Fail("expected ; or a new line");
+            }
+            SkipBreaks();
+        }
+        return block;
+    }
+
+    ASTPtr ParseBlock()
+    {
+        Expect("{");
+        ASTPtr block = ParseStatements();
+        Expect("}");
+        return block;
+    }
+
+    ASTPtr ParseStatement()
+    {
+        std::string word = PeekName();
+        if(word == "let")
+        {
+            mPos += word.size();
+            return ParseAssignment(ParseName());
+        }
+        if(word == "if")
+        {
+            mPos += word.size();
+            ASTPtr node(new AST(AST::kIf));
+            node->Add(ParseExpression());
+            node->Add(ParseBlock());
+            if(PeekName() == "else")
+            {
+                mPos += 4;
+                if(PeekName() == "if")
+                {
+                    ASTPtr elseBlock(new AST(AST::kBlock));
+                    elseBlock->Add(ParseStatement());
+                    node->Add(std::move(elseBlock));
+                }
+                else
+                {
+                    node->Add(ParseBlock());
+                }
+            }
+            return node;
+        }
+        if(word == "while" || word == "repeat")
+        {
+            mPos += word.size();
+            ASTPtr node(new AST(word == "while" ? AST::kWhile : AST::kRepeat));
+            node->Add(ParseExpression());
+            node->Add(ParseBlock());
+            return node;
+        }
+
+        if(!word.empty())
+        {
+            size_t start = mPos;
+            mPos += word.size();
+            bool bracket = Peek() == '(';
+            SkipSpaces();
+            if(Peek() == '=' && Peek(1) != '=')
+            {
+                return ParseAssignment(word);
+            }
+
+            // a builtin without brackets straight after it takes its
+            // arguments as words
+            if(IsBuiltin(word) && !bracket)
+            {
+                ASTPtr call(new AST(AST::kCall));
+                call->mText = word;
+                while(mError.empty() && !AtStatementEnd())
+                {
+                    call->Add(ParseWord());
+                }
+                ASTPtr statement(new AST(AST::kExpression));
+                statement->Add(std::move(call));
+                return statement;
+            }
+            mPos = start;
+        }
+
+        ASTPtr statement(new AST(AST::kExpression));
+        statement->Add(ParseExpression());
+        return statement;
+    }
+
+    ASTPtr ParseAssignment(const std::string& name)
+    {
+        if(IsBuiltin(name))
+        {
+            Fail(name + " is a command");
+        }
+        Expect("=");
+        ASTPtr node(new AST(AST::kLet));
+        node->mText = name;
+        node->Add(ParseExpression());
+        return node;
+    }
+
+    // one argument to a command: anything up to the next space that isn't
+    // a string, $variable or (expression) is taken as it is
+    ASTPtr ParseWord()
+    {
+        SkipSpaces();
+        char c = Peek();
+        if(c == '"' || c == '$' || c == '(')
+        {
+            return ParsePrimary();
+        }
+
+        size_t start = mPos;
+        while(Peek() != '\0' && !isspace((unsigned char) Peek()) && Peek() != ';' && Peek() != '}')
+        {
+            mPos++;
+        }
+        std::string word = mSource.substr(start, mPos - start);
+
+        char* end;
+        errno = 0;
+        long long number = strtoll(word.c_str(), &end, 10);
+        if(!word.empty() && *end == '\0' && (isdigit((unsigned char) word[0]) || word.size() > 1))
+        {
+            if(errno == ERANGE)
+            {
+                Fail("number too big");
+            }
+            ASTPtr node(new AST(AST::kNumber));
+            node->mNumber = number;
+            return node;
+        }
+        ASTPtr node(new AST(AST::kString));
+        node->mText = word;
+        return node;
+    }
+
+    ASTPtr ParseExpression()
+    {
+        return ParseOr();
+    }
+
+    ASTPtr Binary(AST::Kind kind, const std::string& op, ASTPtr left, ASTPtr right)
+    {
+        ASTPtr node(new AST(kind));
+        node->mText = op;
+        node->Add(std::move(left));
+        node->Add(std::move(right));
+        return node;
+    }
+
+    ASTPtr ParseOr()
+    {
+        ASTPtr left = ParseAnd();
+        while(mError.empty() && Match("||"))
+        {
+            left = Binary(AST::kOr, "||", std::move(left), ParseAnd());
+        }
+        return left;
+    }
+
+    ASTPtr ParseAnd()
+    {
+        ASTPtr left = ParseEquality();
+        while(mError.empty() && Match("&&"))
+        {
+            left = Binary(AST::kAnd, "&&", std::move(left), ParseEquality());
+        }
+        return left;
+    }
+
+    // the operators at one level of precedence, longest first
+    ASTPtr ParseLevel(const std::vector<const char*>& ops, ASTPtr (LedParser::*next)())
+    {
+        ASTPtr left = (this->*next)();
+        bool more = true;
+        while(mError.empty() && more)
+        {
+            more = false;
+            for(auto op : ops)
+            {
+                if(Match(op))
+                {
+                    left = Binary(AST::kBinary, op, std::move(left), (this->*next)());
+                    more = true;
+                    break;
+                }
+            }
+        }
+        return left;
+    }
+
+    ASTPtr ParseEquality() { return ParseLevel({"==", "!="}, &LedParser::ParseComparison); }
+    ASTPtr ParseComparison() { return ParseLevel({"<=", ">=", "<", ">"}, &LedParser::ParseSum); }
+    ASTPtr ParseSum() { return ParseLevel({"+", "-"}, &LedParser::ParseProduct); }
+    ASTPtr ParseProduct() { return ParseLevel({"*", "/", "%"}, &LedParser::ParseUnary); }
+
+    ASTPtr ParseUnary()
+    {
+        SkipSpaces();
+        if((Peek() == '-' || Peek() == '!') && Peek(1) != '=')
+        {
+            ASTPtr node(new AST(AST::kUnary));
+            node->mText = std::string(1, mSource[mPos++]);
+            node->Add(ParseUnary());
+            return node;
+        }
+        return ParsePrimary();
+    }
+
+    ASTPtr ParsePrimary()
+    {
+        SkipSpaces();
+        char c = Peek();
+        if(isdigit((unsigned char) c))
+        {
+            ASTPtr node(new AST(AST::kNumber));
+            while(isdigit((unsigned char) Peek()))
+            {
+                int digit = mSource[mPos++] - '0';
+                if(node->mNumber > (INT64_MAX - digit) / 10)
+                {
+                    Fail("number too big");
+                    continue;
+                }
+                node->mNumber = node->mNumber * 10 + digit;
+            }
+            return node;
+        }
+        if(c == '"')
+        {
+            return ParseString();
+        }
+        if(c == '(')
+        {
+            mPos++;
+            ASTPtr node = ParseExpression();
+            Expect(")");
+            return node;
+        }
+        if(c == '$')
+        {
+            mPos++;
+            ASTPtr node(new AST(AST::kVariable));
+            node->mText = ParseName();
+            return node;
+        }
+        if(IsNameStart(c))
+        {
+            std::string name = ParseName();
+            if(!IsBuiltin(name))
+            {
+                ASTPtr node(new AST(AST::kVariable));
+                node->mText = name;
+                return node;
+            }
+
+            // in an expression builtins take their arguments in brackets, or
+            // none
+            ASTPtr call(new AST(AST::kCall));
+            call->mText = name;
+            if(Peek() == '(')
+            {
+                mPos++;
+                if(!Match(")"))
+                {
+                    do
+                    {
+                        call->Add(ParseExpression());
+                    } while(mError.empty() && Match(","));
+                    Expect(")");
+                }
+            }
+            return call;
+        }
+
+        Fail(c == '\0' ? "unexpected end" : std::string("unexpected ") + c);
+        return ASTPtr(new AST(AST::kNumber));
+    }
+
+    ASTPtr ParseString()
+    {
+        ASTPtr node(new AST(AST::kString));
+        mPos++;
+        while(Peek() != '"')
+        {
+            char c = Peek();
+            if(c == '\0' || c == '\n')
+            {
+                Fail("missing \"");
+                return node;
+            }
+            mPos++;
+            if(c == '\\')
+            {
+                c = Peek();
+                mPos++;
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+            }
+            node->mText += c;
+        }
+        mPos++;
+        return node;
+    }
+};
+
+// bytecode is a byte per op, followed by its operands, which are a byte or
+// two bytes little endian
+enum LedOp : uint8_t
+{
+    kOpConstant,        // u16 constant
+    kOpGetGlobal,       // u16 global
+    kOpSetGlobal,       // u16 global
+    kOpSetLocal,        // u8 local
+    kOpCall,            // u16 builtin, u8 argument count
+    kOpJump,            // u16 target
+    kOpJumpIfFalse,     // u16 target, pops the condition
+    kOpJumpIfTrue,      // u16 target, pops the condition
+    kOpCountDown,       // u8 local, u16 target: jump if it's run out, or count it down
+    kOpPop,
+    kOpDup,
+    kOpResult,          // pops the command's result so far
+    kOpNegate,
+    kOpNot,
+    kOpAdd,
+    kOpSubtract,
+    kOpMultiply,
+    kOpDivide,
+    kOpModulo,
+    kOpEqual,
+    kOpNotEqual,
+    kOpLess,
+    kOpLessEqual,
+    kOpGreater,
+    kOpGreaterEqual,
+    kOpEnd
+};
+
+struct LedChunk
+{
+    std::vector<uint8_t> mCode;
+    std::vector<LedValue> mConstants;
+    int mLocals = 0;
 };
 
 struct LedLang
 {
-    // tokens in -> AST out
-    AST ParseTokens(std::vector<std::string> tokens)
+    // a command can't run forever
+    enum { kMaxSteps = 10000000, kMaxCached = 256 };
+
+    std::string mError;
+
+    std::vector<LedBuiltin> mBuiltins;
+    std::map<std::string, int> mBuiltinIndex;
+
+    // variables, by the slot the compiler gave them. unset ones are nil.
+    std::vector<LedValue> mGlobals;
+    std::map<std::string, int> mGlobalIndex;
+
+    std::map<std::string, std::shared_ptr<const LedChunk>> mCache;
+    size_t mCompiles = 0;
+
+    std::vector<LedValue> mStack;
+
+    void AddBuiltin(const std::string& name, int minArgs, int maxArgs,
+                    std::function<LedValue(const LedArgs&, std::string&)> run)
     {
-        (void) tokens;
-        AST topNode;
-        return topNode;
+        LedBuiltin builtin;
+        builtin.mName = name;
+        builtin.mMinArgs = minArgs;
+        builtin.mMaxArgs = maxArgs;
+        builtin.mRun = run;
+        mBuiltinIndex[name] = mBuiltins.size();
+        mBuiltins.push_back(builtin);
+
+        // what parsed as a variable might be a call now
+        mCache.clear();
+    }
+
+    // run a command, setting result to the value of its last statement if
+    // that has one. false with mError set if it doesn't compile or fails.
+    bool Run(const std::string& source, LedValue& result)
+    {
+        mError.clear();
+        std::shared_ptr<const LedChunk> chunk = Compile(source);
+        return chunk && Execute(*chunk, result);
     }
 
-    void RunCommand(AST ast, Editor* ed)
+    std::shared_ptr<const LedChunk> Compile(const std::string& source)
     {
-        (void) ast;
-        (void) ed;
+        auto cached = mCache.find(source);
+        if(cached != mCache.end())
+        {
+            return cached->second;
+        }
+
+        LedParser parser(source, mBuiltinIndex);
+        ASTPtr ast = parser.Parse();
+        if(!ast)
+        {
+            mError = parser.mError;
+            return nullptr;
+        }
+
+        std::shared_ptr<LedChunk> chunk = std::make_shared<LedChunk>();
+        mCompiles++;
+        CompileNode(*chunk, *ast);
+        Emit(*chunk, kOpEnd);
+        if(!mError.empty())
+        {
+            return nullptr;
+        }
+
+        if(mCache.size() >= kMaxCached)
+        {
+            mCache.clear();
+        }
+        mCache[source] = chunk;
+        return chunk;
+    }
+
+    void Emit(LedChunk& chunk, uint8_t byte)
+    {
+        chunk.mCode.push_back(byte);
+    }
+
+    void Emit16(LedChunk& chunk, size_t value)
+    {
+        if(value > 0xffff)
+        {
+            mError = "command too big";
+        }
+        chunk.mCode.push_back(value & 0xff);
+        chunk.mCode.push_back((value >> 8) & 0xff);
+    }
+
+    // emit a jump whose target gets filled in by Patch
+    size_t EmitJump(LedChunk& chunk, LedOp op)
+    {
+        Emit(chunk, op);
+        Emit16(chunk, 0);
+        return chunk.mCode.size() - 2;
+    }
+
+    void Patch(LedChunk& chunk, size_t at)
+    {
+        size_t target = chunk.mCode.size();
+        if(target > 0xffff)
+        {
+            mError = "command too big";
+        }
+        chunk.mCode[at] = target & 0xff;
+        chunk.mCode[at + 1] = (target >> 8) & 0xff;
+    }
+
+    int Global(const std::string& name)
+    {
+        auto found = mGlobalIndex.find(name);
+        if(found != mGlobalIndex.end())
+        {
+            return found->second;
+        }
+        mGlobalIndex[name] = mGlobals.size();
+        mGlobals.push_back(LedValue());
+        return mGlobals.size() - 1;
+    }
+
+    std::string GlobalName(int slot) const
+    {
+        for(auto& global : mGlobalIndex)
+        {
+            if(global.second == slot)
+            {
+                return global.first;
+            }
+        }
+        return "";
+    }
+
+    void CompileNode(LedChunk& chunk, const AST& node)
+    {
+        switch(node.mKind)
+        {
+            case AST::kNumber:
+            case AST::kString:
+            {
+                chunk.mConstants.push_back(node.mKind == AST::kNumber ? LedValue(node.mNumber) : LedValue(node.mText));
+                Emit(chunk, kOpConstant);
+                Emit16(chunk, chunk.mConstants.size() - 1);
+            } break;
+
+            case AST::kVariable:
+            {
+                Emit(chunk, kOpGetGlobal);
+                Emit16(chunk, Global(node.mText));
+            } break;
+
+            case AST::kCall:
+            {
+                const LedBuiltin& builtin = mBuiltins[mBuiltinIndex[node.mText]];
+                int args = node.mChildren.size();
+                if(args < builtin.mMinArgs || args > builtin.mMaxArgs)
+                {
+                    mError = node.mText + " takes " + std::to_string(builtin.mMinArgs) +
+                             (builtin.mMaxArgs == builtin.mMinArgs ? "" : " to " + std::to_string(builtin.mMaxArgs)) +
+                             " arguments";
+                }
+                for(auto& child : node.mChildren)
+                {
+                    CompileNode(chunk, *child);
+                }
+                Emit(chunk, kOpCall);
+                Emit16(chunk, mBuiltinIndex[node.mText]);
+                Emit(chunk, args);
+            } break;
+
+            case AST::kUnary:
+            {
+                CompileNode(chunk, *node.mChildren[0]);
+                Emit(chunk, node.mText == "-" ? kOpNegate : kOpNot);
+            } break;
+
+            case AST::kBinary:
+            {
+                static const std::map<std::string, LedOp> ops =
+                {
+                    {"+", kOpAdd}, {"-", kOpSubtract}, {"*", kOpMultiply}, {"/", kOpDivide},
+                    {"%", kOpModulo}, {"==", kOpEqual}, {"!=", kOpNotEqual}, {"<", kOpLess},
+                    {"<=", kOpLessEqual}, {">", kOpGreater}, {">=", kOpGreaterEqual}
+                };
+                CompileNode(chunk, *node.mChildren[0]);
+                CompileNode(chunk, *node.mChildren[1]);
+                Emit(chunk, ops.at(node.mText));
+            } break;
+
+            case AST::kAnd:
+            case AST::kOr:
+            {
+                // the left side, if that decides it, otherwise the right
+                CompileNode(chunk, *node.mChildren[0]);
+                Emit(chunk, kOpDup);
+                size_t skip = EmitJump(chunk, node.mKind == AST::kAnd ? kOpJumpIfFalse : kOpJumpIfTrue);
+                Emit(chunk, kOpPop);
+                CompileNode(chunk, *node.mChildren[1]);
+                Patch(chunk, skip);
+            } break;
+
+            case AST::kLet:
+            {
+                CompileNode(chunk, *node.mChildren[0]);
+                Emit(chunk, kOpSetGlobal);
+                Emit16(chunk, Global(node.mText));
+            } break;
+
+            case AST::kIf:
+            {
+                CompileNode(chunk, *node.mChildren[0]);
+                size_t skipThen = EmitJump(chunk, kOpJumpIfFalse);
+                CompileNode(chunk, *node.mChildren[1]);
+                if(node.mChildren.size() > 2)
+                {
+                    size_t skipElse = EmitJump(chunk, kOpJump);
+                    Patch(chunk, skipThen);
+                    CompileNode(chunk, *node.mChildren[2]);
+                    Patch(chunk, skipElse);
+                }
+                else
+                {
+                    Patch(chunk, skipThen);
+                }
+            } break;
+
+            case AST::kWhile:
+            {
+                size_t top = chunk.mCode.size();
+                CompileNode(chunk, *node.mChildren[0]);
+                size_t exit = EmitJump(chunk, kOpJumpIfFalse);
+                CompileNode(chunk, *node.mChildren[1]);
+                Emit(chunk, kOpJump);
+                Emit16(chunk, top);
+                Patch(chunk, exit);
+            } break;
+
+            case AST::kRepeat:
+            {
+                // the count goes in a local of its own
+                int local = chunk.mLocals++;
+                if(local > 0xff)
+                {
+                    mError = "repeats nested too deep";
+                }
+                CompileNode(chunk, *node.mChildren[0]);
+                Emit(chunk, kOpSetLocal);
+                Emit(chunk, local);
+                size_t top = chunk.mCode.size();
+                Emit(chunk, kOpCountDown);
+                Emit(chunk, local);
+                Emit16(chunk, 0);
+                size_t exit = chunk.mCode.size() - 2;
+                CompileNode(chunk, *node.mChildren[1]);
+                Emit(chunk, kOpJump);
+                Emit16(chunk, top);
+                Patch(chunk, exit);
+            } break;
+
+            case AST::kBlock:
+            {
+                for(auto& child : node.mChildren)
+                {
+                    CompileNode(chunk, *child);
+                }
+            } break;
+
+            case AST::kExpression:
+            {
+                CompileNode(chunk, *node.mChildren[0]);
+                Emit(chunk, kOpResult);
+            } break;
+        }
+    }
+
+    bool Execute(const LedChunk& chunk, LedValue& result)
+    {
+        const uint8_t* code = chunk.mCode.data();
+        std::vector<LedValue> locals(chunk.mLocals);
+        std::vector<LedValue>& stack = mStack;
+        stack.clear();
+        result = LedValue();
+
+        size_t pc = 0;
+        for(size_t steps = 0; ; steps++)
+        {
+            if(steps == kMaxSteps)
+            {
+                mError = "gave up after " + std::to_string((int) kMaxSteps) + " steps";
+                return false;
+            }
+
+            uint8_t op = code[pc++];
+            size_t operand = 0;
+            if(op == kOpConstant || op == kOpGetGlobal || op == kOpSetGlobal || op == kOpCall ||
+               op == kOpJump || op == kOpJumpIfFalse || op == kOpJumpIfTrue)
+            {
+                operand = code[pc] | (code[pc + 1] << 8);
+                pc += 2;
+            }
+
+            switch(op)
+            {
+                case kOpConstant:
+                    stack.push_back(chunk.mConstants[operand]);
+                    break;
+
+                case kOpGetGlobal:
+                {
+                    if(mGlobals[operand].mType == LedValue::kNil)
+                    {
+                        mError = GlobalName(operand) + " isn't set";
+                        return false;
+                    }
+                    stack.push_back(mGlobals[operand]);
+                } break;
+
+                case kOpSetGlobal:
+                    mGlobals[operand] = std::move(stack.back());
+                    stack.pop_back();
+                    break;
+
+                case kOpSetLocal:
+                    locals[code[pc++]] = std::move(stack.back());
+                    stack.pop_back();
+                    break;
+
+                case kOpCall:
+                {
+                    const LedBuiltin& builtin = mBuiltins[operand];
+                    size_t count = code[pc++];
+                    LedArgs args(std::make_move_iterator(stack.end() - count), std::make_move_iterator(stack.end()));
+                    stack.resize(stack.size() - count);
+                    std::string error;
+                    LedValue value = builtin.mRun(args, error);
+                    if(!error.empty())
+                    {
+                        mError = builtin.mName + ": " + error;
+                        return false;
+                    }
+                    stack.push_back(std::move(value));
+                } break;
+
+                case kOpJump:
+                    pc = operand;
+                    break;
+
+                case kOpJumpIfFalse:
+                case kOpJumpIfTrue:
+                {
+                    if(stack.back().Truthy() == (op == kOpJumpIfTrue))
+                    {
+                        pc = operand;
+                    }
+                    stack.pop_back();
+                } break;
+
+                case kOpCountDown:
+                {
+                    LedValue& count = locals[code[pc]];
+                    size_t target = code[pc + 1] | (code[pc + 2] << 8);
+                    pc += 3;
+                    if(count.mType != LedValue::kNumber)
+                    {
+                        mError = "repeat needs a number";
+                        return false;
+                    }
+                    if(count.mNumber-- <= 0)
+                    {
+                        pc = target;
+                    }
+                } break;
+
+                case kOpPop:
+                    stack.pop_back();
+                    break;
+
+                case kOpDup:
+                    stack.push_back(stack.back());
+                    break;
+
+                case kOpResult:
+                    result = std::move(stack.back());
+                    stack.pop_back();
+                    break;
+
+                case kOpEnd:
+                    return true;
+
+                default:
+                {
+                    if(!Operate(op, stack))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    // the arithmetic and comparison ops
+    bool Operate(uint8_t op, std::vector<LedValue>& stack)
+    {
+        if(op == kOpNegate || op == kOpNot)
+        {
+            LedValue& value = stack.back();
+            if(op == kOpNot)
+            {
+                value = LedValue((int64_t) !value.Truthy());
+                return true;
+            }
+            if(value.mType != LedValue::kNumber)
+            {
+                mError = "can't negate \"" + value.ToString() + "\"";
+                return false;
+            }
+            value.mNumber = (int64_t) (0 - (uint64_t) value.mNumber);
+            return true;
+        }
+
+        LedValue right = std::move(stack.back());
+        stack.pop_back();
+        LedValue& left = stack.back();
+
+        // + joins strings, == and != compare anything, < and so on compare
+        // two strings too. the rest are only for numbers.
+        bool numbers = left.mType == LedValue::kNumber && right.mType == LedValue::kNumber;
+        bool strings = left.mType == LedValue::kString && right.mType == LedValue::kString;
+        if(op == kOpAdd && !numbers)
+        {
+            left = LedValue(left.ToString() + right.ToString());
+            return true;
+        }
+        if(op == kOpEqual || op == kOpNotEqual)
+        {
+            left = LedValue((int64_t) ((left == right) == (op == kOpEqual)));
+            return true;
+        }
+        if(strings && op >= kOpLess && op <= kOpGreaterEqual)
+        {
+            int compare = left.mString.compare(right.mString);
+            left = LedValue((int64_t) (op == kOpLess ? compare < 0 : op == kOpLessEqual ? compare <= 0 :
+                                       op == kOpGreater ? compare > 0 : compare >= 0));
+            return true;
+        }
+        if(!numbers)
+        {
+            mError = "\"" + left.ToString() + "\" and \"" + right.ToString() + "\" aren't both numbers";
+            return false;
+        }
+        if((op == kOpDivide || op == kOpModulo) && right.mNumber == 0)
+        {
+            mError = "division by zero";
+            return false;
+        }
+
+        // numbers wrap round when they overflow, the way they would in the
+        // machine, rather than the C++ leaving it undefined. the one
+        // division that overflows, the most negative number by -1, wraps
+        // round to itself.
+        int64_t a = left.mNumber;
+        int64_t b = right.mNumber;
+        uint64_t ua = a;
+        uint64_t ub = b;
+        switch(op)
+        {
+            case kOpSubtract:       a = (int64_t) (ua - ub); break;
+            case kOpMultiply:       a = (int64_t) (ua * ub); break;
+            case kOpDivide:         a = b == -1 ? (int64_t) (0 - ua) : a / b; break;
+            case kOpModulo:         a = b == -1 ? 0 : a % b; break;
+            case kOpLess:           a = a < b; break;
+            case kOpLessEqual:      a = a <= b; break;
+            case kOpGreater:        a = a > b; break;
+            case kOpGreaterEqual:   a = a >= b; break;
+            default:                a = (int64_t) (ua + ub); break;
+        }
+        left.mNumber = a;
+        return true;
     }
 };
@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "undo.h"
+
+// lines [mLine, mLine + mErased) of the text became mInserted lines
+struct LineSplice
+{
+    size_t mLine;
+    size_t mErased;
+    size_t mInserted;
+};
+
+inline LineSplice SpliceForEdit(const EditRecord& edit)
+{
+    size_t newLines = std::count(edit.mText.begin(), edit.mText.end(), '\n');
+    LineSplice splice;
+    splice.mLine = edit.mPos.mLine;
+    splice.mErased = edit.mInsert ? 1 : 1 + newLines;
+    splice.mInserted = edit.mInsert ? 1 + newLines : 1;
+    return splice;
+}
+
+// something worked out for each line of a window of lines, mFirst onwards,
+// kept lined up with the text as lines are inserted and erased. an entry
+// that's been dropped and made again has mValid false.
+template<typename Line>
+struct LineCache
+{
+    typedef Line CachedLine;
+
+    std::vector<CachedLine> mLines;
+    size_t mFirst = 0;
+    static const size_t kMaxLines = 1024;
+
+    void Clear()
+    {
+        mLines.clear();
+        mFirst = 0;
+    }
+
+    // the edited lines are dropped, the ones after move up or down
+    void Splice(const LineSplice& splice)
+    {
+        if(splice.mLine < mFirst)
+        {
+            if(splice.mLine + splice.mErased <= mFirst)
+            {
+                mFirst += splice.mInserted - splice.mErased;
+            }
+            else
+            {
+                mLines.clear();
+            }
+            return;
+        }
+
+        size_t offset = splice.mLine - mFirst;
+        if(offset < mLines.size())
+        {
+            auto first = mLines.begin() + offset;
+            auto last = mLines.begin() + std::min(offset + splice.mErased, mLines.size());
+            first = mLines.erase(first, last);
+
+            // no more than the window holds, a big paste or a log growing
+            // shouldn't make an entry for every line
+            mLines.insert(first, std::min(splice.mInserted, (size_t) kMaxLines), CachedLine());
+            if(mLines.size() > kMaxLines)
+            {
+                mLines.resize(kMaxLines);
+            }
+        }
+    }
+
+    CachedLine* Find(size_t line)
+    {
+        if(line < mFirst || line - mFirst >= mLines.size())
+        {
+            return nullptr;
+        }
+        return &mLines[line - mFirst];
+    }
+
+    // the entry for a line, sliding the window along to take it in
+    CachedLine& Entry(size_t line)
+    {
+        if(line < mFirst)
+        {
+            size_t grow = mFirst - line;
+            if(grow < kMaxLines && !mLines.empty())
+            {
+                mLines.insert(mLines.begin(), grow, CachedLine());
+                if(mLines.size() > kMaxLines)
+                {
+                    mLines.resize(kMaxLines);
+                }
+            }
+            else
+            {
+                mLines.clear();
+            }
+            mFirst = line;
+        }
+        else if(line >= mFirst + kMaxLines)
+        {
+            size_t drop = line + 1 - kMaxLines - mFirst;
+            if(drop < mLines.size())
+            {
+                mLines.erase(mLines.begin(), mLines.begin() + drop);
+                mFirst += drop;
+            }
+            else
+            {
+                mLines.clear();
+                mFirst = line;
+            }
+        }
+        if(line - mFirst >= mLines.size())
+        {
+            mLines.resize(line - mFirst + 1);
+        }
+        return mLines[line - mFirst];
+    }
+};
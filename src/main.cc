@@ -1,6 +1,7 @@
 #include <iostream>
 #include <unistd.h>
 #include <termios.h>
+#include <vector>
 #include <sys/ioctl.h>
 #include "buffer.h"
 #include "term_setup.h"
@@ -11,34 +12,33 @@ int main(int argc, char* argv[])
     TermSetup t;
 
     Editor led;
+    led.SetScreenSize(t.mNumRows, t.mNumCols);
 
-    Buffer buf("", 1, t.mNumCols, t.mNumRows);
-    
-    // open files
-    if(argc > 1)
+    // every file given gets a buffer. the first is read now and shown, the
+    // rest are read in the background. with -f they're followed as they're
+    // written to.
+    std::vector<Buffer*> files;
+    bool follow = false;
+    for(int i = 1; i < argc; i++)
     {
-        if(!buf.OpenFile(std::string(argv[1])))
+        if(std::string(argv[i]) == "-f")
         {
-            return 1;
+            follow = true;
+            continue;
         }
-        led.AddBuffer(&buf);
-        led.mCurrBuffer = &buf;        
+        files.push_back(led.OpenBuffer(argv[i]));
     }
-    else
+    if(files.empty())
     {
-        led.AddBuffer(&buf);
-        led.SetCurrentBuffer(&buf);
+        files.push_back(led.NewBuffer(""));
     }
-
-    bool done = false;
-    while(!done)
+    led.SetCurrentBuffer(files[0]);
+    led.mBuffers.ReadAhead(files);
+    for(size_t i = 0; follow && i < files.size(); i++)
     {
-        led.DrawScreen();
-        int c = led.ReadKey();
-        done = led.HandleKey(c);
+        led.ToggleFollow(files[i]);
     }
 
-    (void) led;
-    (void) done;
+    led.Run();
     return 0;
 }
@@ -0,0 +1,1024 @@
+#pragma once
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// regular expressions, matched in time linear in the text. there's no
+// backtracking: a pattern is compiled to an nfa, and that is turned into a
+// dfa a state at a time as the text being searched needs them, so once the
+// states a search uses are built it costs a table lookup per byte. patterns
+// that need more states than are worth keeping fall back to simulating the
+// nfa directly, which is slower but still linear.
+//
+// matches are leftmost longest, as in posix, and never span a newline. the
+// syntax is the usual one: . [] [^] * + ? {m} {m,} {m,n} | () ^ $ and the
+// escapes \b \B \d \D \w \W \s \S \t. there are no capture groups, a dfa
+// can't keep track of them.
+
+typedef std::bitset<256> ByteSet;
+
+inline bool IsWordByte(unsigned char c)
+{
+    return isalnum(c) || c == '_';
+}
+
+// a parsed pattern is a tree of these
+struct RegexNode
+{
+    enum Kind
+    {
+        kBytes,
+        kEmpty,
+        kConcat,
+        kAlternate,
+        kRepeat,
+        kLineStart,
+        kLineEnd,
+        kWordBoundary,
+        kNotWordBoundary
+    };
+
+    Kind mKind = kEmpty;
+
+    // for kBytes, which of the pattern's byte sets
+    int mBytes = 0;
+
+    // for kRepeat, mMax is -1 for no limit
+    int mMin = 0;
+    int mMax = 0;
+
+    std::vector<int> mChildren;
+};
+
+struct RegexParser
+{
+    // anything bigger than this is more likely a mistake than a pattern
+    enum { kMaxRepeat = 1000, kMaxDepth = 200 };
+
+    std::string mPattern;
+    size_t mPos = 0;
+    int mDepth = 0;
+    std::string mError;
+
+    std::vector<RegexNode> mNodes;
+    std::vector<ByteSet> mSets;
+
+    // returns the root node, or -1 with mError set
+    int Parse(const std::string& pattern)
+    {
+        mPattern = pattern;
+        int root = ParseAlternate();
+        if(mError.empty() && mPos < mPattern.size())
+        {
+            mError = "unmatched )";
+        }
+        return mError.empty() ? root : -1;
+    }
+
+    int Add(RegexNode::Kind kind)
+    {
+        RegexNode node;
+        node.mKind = kind;
+        mNodes.push_back(node);
+        return mNodes.size() - 1;
+    }
+
+    int AddBytes(const ByteSet& bytes)
+    {
+        // a newline is never part of a match
+        mSets.push_back(bytes);
+        mSets.back().reset('\n');
+        int node = Add(RegexNode::kBytes);
+        mNodes[node].mBytes = mSets.size() - 1;
+        return node;
+    }
+
+    bool More() const { return mError.empty() && mPos < mPattern.size(); }
+
+    int ParseAlternate()
+    {
+        if(++mDepth > kMaxDepth)
+        {
+            mError = "too deeply nested";
+            return -1;
+        }
+        int node = Add(RegexNode::kAlternate);
+        int branch = ParseConcat();
+        mNodes[node].mChildren.push_back(branch);
+        while(More() && mPattern[mPos] == '|')
+        {
+            mPos++;
+            branch = ParseConcat();
+            mNodes[node].mChildren.push_back(branch);
+        }
+        mDepth--;
+        return node;
+    }
+
+    int ParseConcat()
+    {
+        int node = Add(RegexNode::kConcat);
+        while(More() && mPattern[mPos] != '|' && mPattern[mPos] != ')')
+        {
+            int item = ParseRepeat();
+            mNodes[node].mChildren.push_back(item);
+        }
+        return node;
+    }
+
+    int ParseRepeat()
+    {
+        int node = ParseAtom();
+        while(More())
+        {
+            int min = 0;
+            int max = -1;
+            char c = mPattern[mPos];
+            if(c == '*')
+            {
+                mPos++;
+            }
+            else if(c == '+')
+            {
+                min = 1;
+                mPos++;
+            }
+            else if(c == '?')
+            {
+                max = 1;
+                mPos++;
+            }
+            else if(c == '{' && mPos + 1 < mPattern.size() && isdigit((unsigned char) mPattern[mPos + 1]))
+            {
+                mPos++;
+                if(!ParseCounts(min, max))
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                break;
+            }
+
+            int repeat = Add(RegexNode::kRepeat);
+            mNodes[repeat].mMin = min;
+            mNodes[repeat].mMax = max;
+            mNodes[repeat].mChildren.push_back(node);
+            node = repeat;
+        }
+        return node;
+    }
+
+    // {m}, {m,} or {m,n}, with the { already read
+    bool ParseCounts(int& min, int& max)
+    {
+        min = ParseNumber();
+        max = min;
+        if(mPos < mPattern.size() && mPattern[mPos] == ',')
+        {
+            mPos++;
+            max = mPos < mPattern.size() && mPattern[mPos] == '}' ? -1 : ParseNumber();
+        }
+        if(mPos >= mPattern.size() || mPattern[mPos] != '}')
+        {
+            mError = "missing }";
+            return false;
+        }
+        mPos++;
+        if(min > kMaxRepeat || max > kMaxRepeat || (max >= 0 && max < min))
+        {
+            mError = "bad repeat count";
+            return false;
+        }
+        return true;
+    }
+
+    int ParseNumber()
+    {
+        int number = 0;
+        while(mPos < mPattern.size() && isdigit((unsigned char) mPattern[mPos]) && number <= kMaxRepeat)
+        {
+            number = number * 10 + (mPattern[mPos++] - '0');
+        }
+        return number;
+    }
+
+    int ParseAtom()
+    {
+        char c = mPattern[mPos++];
+        switch(c)
+        {
+            case '(':
+            {
+                // (?: is only a group too, they all are
+                if(mPattern.compare(mPos, 2, "?:") == 0)
+                {
+                    mPos += 2;
+                }
+                int node = ParseAlternate();
+                if(mError.empty() && (mPos >= mPattern.size() || mPattern[mPos] != ')'))
+                {
+                    mError = "missing )";
+                }
+                mPos++;
+                return node;
+            }
+
+            case '[':
+                return ParseClass();
+
+            case '.':
+                return AddBytes(ByteSet().set());
+
+            case '^':
+                return Add(RegexNode::kLineStart);
+
+            case '$':
+                return Add(RegexNode::kLineEnd);
+
+            case '*':
+            case '+':
+            case '?':
+                mError = "nothing to repeat";
+                return -1;
+
+            case '\\':
+            {
+                if(mPos >= mPattern.size())
+                {
+                    mError = "trailing \\";
+                    return -1;
+                }
+                char escape = mPattern[mPos];
+                if(escape == 'b' || escape == 'B')
+                {
+                    mPos++;
+                    return Add(escape == 'b' ? RegexNode::kWordBoundary : RegexNode::kNotWordBoundary);
+                }
+                ByteSet bytes;
+                return ParseEscape(bytes) ? AddBytes(bytes) : -1;
+            }
+
+            default:
+            {
+                ByteSet bytes;
+                bytes.set((unsigned char) c);
+                return AddBytes(bytes);
+            }
+        }
+    }
+
+    // the escape after a \, into bytes
+    bool ParseEscape(ByteSet& bytes)
+    {
+        char c = mPattern[mPos++];
+        bool negate = isupper((unsigned char) c);
+        switch(tolower((unsigned char) c))
+        {
+            case 'd':
+            case 'w':
+            case 's':
+            {
+                for(int i = 0; i < 256; i++)
+                {
+                    bool in = tolower((unsigned char) c) == 'd' ? isdigit(i) :
+                              tolower((unsigned char) c) == 'w' ? IsWordByte(i) :
+                              (i == ' ' || i == '\t' || i == '\r' || i == '\f' || i == '\v');
+                    bytes.set(i, in != negate);
+                }
+                return true;
+            }
+
+            case 't':
+            {
+                if(!negate)
+                {
+                    bytes.set('\t');
+                    return true;
+                }
+            } break;
+
+            case 'n':
+            {
+                if(!negate)
+                {
+                    mError = "matches can't span lines";
+                    return false;
+                }
+            } break;
+
+            default:
+            {
+                if(!isalnum((unsigned char) c))
+                {
+                    bytes.set((unsigned char) c);
+                    return true;
+                }
+            }
+        }
+        mError = std::string("unknown escape \\") + c;
+        return false;
+    }
+
+    // [abc], [a-z], [^...], with the [ already read
+    int ParseClass()
+    {
+        ByteSet bytes;
+        bool negate = mPos < mPattern.size() && mPattern[mPos] == '^';
+        if(negate)
+        {
+            mPos++;
+        }
+
+        // a ] straight after the [ is part of the class
+        bool first = true;
+        while(mPos < mPattern.size() && (first || mPattern[mPos] != ']'))
+        {
+            first = false;
+            unsigned char low = mPattern[mPos++];
+            if(low == '\\' && mPos < mPattern.size())
+            {
+                ByteSet escaped;
+                if(!ParseEscape(escaped))
+                {
+                    return -1;
+                }
+                if(escaped.count() != 1)
+                {
+                    bytes |= escaped;
+                    continue;
+                }
+                low = FirstByte(escaped);
+            }
+
+            unsigned char high = low;
+            if(mPos + 1 < mPattern.size() && mPattern[mPos] == '-' && mPattern[mPos + 1] != ']')
+            {
+                mPos++;
+                high = mPattern[mPos++];
+                if(high == '\\' && mPos < mPattern.size())
+                {
+                    ByteSet escaped;
+                    if(!ParseEscape(escaped) || escaped.count() != 1)
+                    {
+                        mError = "bad range";
+                        return -1;
+                    }
+                    high = FirstByte(escaped);
+                }
+                if(high < low)
+                {
+                    mError = "bad range";
+                    return -1;
+                }
+            }
+            for(int i = low; i <= high; i++)
+            {
+                bytes.set(i);
+            }
+        }
+        if(mPos >= mPattern.size())
+        {
+            mError = "missing ]";
+            return -1;
+        }
+        mPos++;
+        if(negate)
+        {
+            bytes.flip();
+        }
+        return AddBytes(bytes);
+    }
+
+    static unsigned char FirstByte(const ByteSet& bytes)
+    {
+        int i = 0;
+        while(!bytes.test(i))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+// thompson's construction, forwards or backwards. the backwards nfa matches
+// the reverse of what the pattern does, which is how we find where a match
+// starts from where it ends.
+struct RegexNfa
+{
+    struct State
+    {
+        enum Kind { kBytes, kSplit, kAssert, kMatch };
+        Kind mKind = kMatch;
+        int mBytes = 0;
+        RegexNode::Kind mAssert = RegexNode::kEmpty;
+        int mOut = -1;
+        int mOut1 = -1;
+    };
+
+    enum { kMaxStates = 100000 };
+
+    std::vector<State> mStates;
+    int mStart = 0;
+    bool mReversed = false;
+    bool mTooBig = false;
+
+    void Build(const std::vector<RegexNode>& nodes, int root, bool reversed)
+    {
+        mReversed = reversed;
+        mStates.assign(1, State());
+        mStart = Build(nodes, root, 0);
+    }
+
+    int Add(const State& state)
+    {
+        if(mStates.size() >= kMaxStates)
+        {
+            mTooBig = true;
+        }
+        mStates.push_back(state);
+        return mStates.size() - 1;
+    }
+
+    int AddSplit(int out, int out1)
+    {
+        State split;
+        split.mKind = State::kSplit;
+        split.mOut = out;
+        split.mOut1 = out1;
+        return Add(split);
+    }
+
+    // builds from the end back, each piece leading on to next
+    int Build(const std::vector<RegexNode>& nodes, int index, int next)
+    {
+        if(mTooBig)
+        {
+            return next;
+        }
+
+        const RegexNode& node = nodes[index];
+        switch(node.mKind)
+        {
+            case RegexNode::kBytes:
+            {
+                State bytes;
+                bytes.mKind = State::kBytes;
+                bytes.mBytes = node.mBytes;
+                bytes.mOut = next;
+                return Add(bytes);
+            }
+
+            case RegexNode::kEmpty:
+                return next;
+
+            case RegexNode::kConcat:
+            {
+                if(mReversed)
+                {
+                    for(int child : node.mChildren)
+                    {
+                        next = Build(nodes, child, next);
+                    }
+                }
+                else
+                {
+                    for(auto child = node.mChildren.rbegin(); child != node.mChildren.rend(); ++child)
+                    {
+                        next = Build(nodes, *child, next);
+                    }
+                }
+                return next;
+            }
+
+            case RegexNode::kAlternate:
+            {
+                int entry = Build(nodes, node.mChildren.back(), next);
+                for(size_t i = node.mChildren.size() - 1; i-- > 0;)
+                {
+                    entry = AddSplit(Build(nodes, node.mChildren[i], next), entry);
+                }
+                return entry;
+            }
+
+            case RegexNode::kRepeat:
+            {
+                int child = node.mChildren[0];
+                int entry = next;
+                if(node.mMax < 0)
+                {
+                    int loop = AddSplit(-1, next);
+                    int body = Build(nodes, child, loop);
+                    mStates[loop].mOut = body;
+                    entry = loop;
+                }
+                else
+                {
+                    // x{0,2} is (x(x)?)?
+                    for(int i = node.mMin; i < node.mMax; i++)
+                    {
+                        entry = AddSplit(Build(nodes, child, entry), next);
+                    }
+                }
+                for(int i = 0; i < node.mMin; i++)
+                {
+                    entry = Build(nodes, child, entry);
+                }
+                return entry;
+            }
+
+            default:
+            {
+                State assert;
+                assert.mKind = State::kAssert;
+                assert.mAssert = node.mKind;
+                if(mReversed && node.mKind == RegexNode::kLineStart)
+                {
+                    assert.mAssert = RegexNode::kLineEnd;
+                }
+                else if(mReversed && node.mKind == RegexNode::kLineEnd)
+                {
+                    assert.mAssert = RegexNode::kLineStart;
+                }
+                assert.mOut = next;
+                return Add(assert);
+            }
+        }
+    }
+};
+
+// bytes that no part of the pattern tells apart share a class, so a dfa
+// state needs a transition per class rather than per byte. the class after
+// the last, mEnd, stands for the end of the text.
+struct RegexClasses
+{
+    unsigned char mClass[256];
+    int mEnd = 0;
+    std::vector<unsigned char> mByte;
+    std::vector<bool> mNewline;
+    std::vector<bool> mWord;
+
+    void Build(std::vector<ByteSet> sets)
+    {
+        ByteSet newline;
+        newline.set('\n');
+        ByteSet word;
+        for(int i = 0; i < 256; i++)
+        {
+            word.set(i, IsWordByte(i));
+        }
+        sets.push_back(newline);
+        sets.push_back(word);
+
+        std::map<std::vector<bool>, int> classes;
+        for(int i = 0; i < 256; i++)
+        {
+            std::vector<bool> in;
+            for(auto& set : sets)
+            {
+                in.push_back(set.test(i));
+            }
+            auto found = classes.insert(std::make_pair(in, (int) classes.size()));
+            mClass[i] = found.first->second;
+            if(found.second)
+            {
+                mByte.push_back(i);
+                mNewline.push_back(i == '\n');
+                mWord.push_back(IsWordByte(i));
+            }
+        }
+        mEnd = classes.size();
+        mByte.push_back(0);
+        mNewline.push_back(true);
+        mWord.push_back(false);
+    }
+};
+
+// a dfa built lazily from an nfa. a state is the set of nfa states the text
+// so far could have got to, along with what the last byte was, as far as ^,
+// $ and \b care, and whether a match ended just before it. anchored dfas
+// only match from where they're started, unanchored ones from anywhere.
+struct RegexDfa
+{
+    enum
+    {
+        kLineStart = 1,
+        kAfterWord = 2,
+        kMatched = 4
+    };
+
+    // when the cache gets this big it's thrown away and started again. if
+    // that keeps happening the pattern needs too many states to be worth
+    // caching, so we stop and simulate the nfa instead.
+    enum { kMaxCacheBytes = 4 << 20, kMaxFlushes = 4 };
+
+    struct State
+    {
+        // the nfa states, sorted, then the flags
+        std::vector<int> mKey;
+        std::vector<State*> mNext;
+        bool mMatched = false;
+        bool mDead = false;
+
+        // nothing's been matched towards yet
+        bool mIsStart = false;
+    };
+
+    RegexDfa(const RegexNfa& nfa, const std::vector<ByteSet>& sets, const RegexClasses& classes, bool anchored)
+        : mNfa(nfa), mSets(sets), mClasses(classes), mAnchored(anchored)
+    {
+        mSeen.resize(nfa.mStates.size(), 0);
+        for(auto& scratch : mScratch)
+        {
+            scratch.mNext.resize(classes.mEnd + 1, nullptr);
+        }
+    }
+
+    const RegexNfa& mNfa;
+    const std::vector<ByteSet>& mSets;
+    const RegexClasses& mClasses;
+    bool mAnchored;
+
+    std::map<std::vector<int>, std::unique_ptr<State>> mCache;
+    size_t mCacheBytes = 0;
+    int mFlushes = 0;
+
+    // once we've given up on caching, states are made in these by turns
+    bool mNoCache = false;
+    State mScratch[2];
+    int mFlip = 0;
+
+    // for the closure
+    std::vector<unsigned> mSeen;
+    unsigned mStamp = 0;
+    std::vector<int> mStack;
+    std::vector<int> mClosure;
+    std::vector<int> mKey;
+
+    // flags is what the byte before the start was
+    State* Start(int flags)
+    {
+        mKey.assign(1, mNfa.mStart);
+        mKey.push_back(flags);
+        return Intern(mKey);
+    }
+
+    // the state after reading a byte of class c, or the end of the text
+    State* Next(State* state, int c)
+    {
+        State* next = state->mNext[c];
+        return next ? next : Transition(state, c);
+    }
+
+    State* Transition(State* state, int c)
+    {
+        if(!mNoCache && mCacheBytes > kMaxCacheBytes)
+        {
+            std::vector<int> key = state->mKey;
+            Flush();
+            state = Intern(key);
+        }
+
+        Closure(state->mKey, c);
+        bool matched = false;
+        mKey.clear();
+        for(int i : mClosure)
+        {
+            const RegexNfa::State& nfaState = mNfa.mStates[i];
+            if(nfaState.mKind == RegexNfa::State::kMatch)
+            {
+                matched = true;
+            }
+            else if(c != mClasses.mEnd && mSets[nfaState.mBytes].test(mClasses.mByte[c]))
+            {
+                mKey.push_back(nfaState.mOut);
+            }
+        }
+        if(!mAnchored && c != mClasses.mEnd)
+        {
+            mKey.push_back(mNfa.mStart);
+        }
+        std::sort(mKey.begin(), mKey.end());
+        mKey.erase(std::unique(mKey.begin(), mKey.end()), mKey.end());
+
+        int flags = (mClasses.mNewline[c] ? kLineStart : 0) | (mClasses.mWord[c] ? kAfterWord : 0) |
+                    (matched ? kMatched : 0);
+        mKey.push_back(flags);
+        State* next = Intern(mKey);
+        if(!mNoCache)
+        {
+            state->mNext[c] = next;
+        }
+        return next;
+    }
+
+    // the nfa states reachable from key's without reading anything, when
+    // the next byte is of class c
+    void Closure(const std::vector<int>& key, int c)
+    {
+        int flags = key.back();
+        bool lineStart = flags & kLineStart;
+        bool afterWord = flags & kAfterWord;
+        bool lineEnd = mClasses.mNewline[c];
+        bool beforeWord = mClasses.mWord[c];
+
+        mClosure.clear();
+        mStamp++;
+        mStack.assign(key.begin(), key.end() - 1);
+        while(!mStack.empty())
+        {
+            int i = mStack.back();
+            mStack.pop_back();
+            if(mSeen[i] == mStamp)
+            {
+                continue;
+            }
+            mSeen[i] = mStamp;
+
+            const RegexNfa::State& state = mNfa.mStates[i];
+            if(state.mKind == RegexNfa::State::kSplit)
+            {
+                mStack.push_back(state.mOut1);
+                mStack.push_back(state.mOut);
+            }
+            else if(state.mKind == RegexNfa::State::kAssert)
+            {
+                bool holds = state.mAssert == RegexNode::kLineStart ? lineStart :
+                             state.mAssert == RegexNode::kLineEnd ? lineEnd :
+                             state.mAssert == RegexNode::kWordBoundary ? afterWord != beforeWord :
+                             afterWord == beforeWord;
+                if(holds)
+                {
+                    mStack.push_back(state.mOut);
+                }
+            }
+            else
+            {
+                mClosure.push_back(i);
+            }
+        }
+    }
+
+    State* Intern(const std::vector<int>& key)
+    {
+        State* state;
+        if(mNoCache)
+        {
+            state = &mScratch[mFlip];
+            mFlip ^= 1;
+            state->mKey = key;
+        }
+        else
+        {
+            auto found = mCache.find(key);
+            if(found != mCache.end())
+            {
+                return found->second.get();
+            }
+            state = new State();
+            state->mKey = key;
+            state->mNext.resize(mClasses.mEnd + 1, nullptr);
+            mCache[key].reset(state);
+            mCacheBytes += sizeof(State) + 2 * key.size() * sizeof(int) + state->mNext.size() * sizeof(State*);
+        }
+        state->mMatched = key.back() & kMatched;
+        state->mDead = key.size() == 1;
+        state->mIsStart = key.size() == 2 && key[0] == mNfa.mStart;
+        return state;
+    }
+
+    void Flush()
+    {
+        mCache.clear();
+        mCacheBytes = 0;
+        mNoCache = ++mFlushes >= kMaxFlushes;
+    }
+};
+
+struct Regex
+{
+    Regex() {}
+
+    // the dfas point into the rest of it
+    Regex(const Regex&) = delete;
+    Regex& operator=(const Regex&) = delete;
+
+    std::string mError;
+
+    RegexParser mParser;
+    RegexNfa mForward;
+    RegexNfa mBackward;
+    RegexClasses mClasses;
+
+    // finds the line with the first match, then where matches in it start,
+    // then how far each of those goes
+    std::unique_ptr<RegexDfa> mFind;
+    std::unique_ptr<RegexDfa> mStarts;
+    std::unique_ptr<RegexDfa> mLongest;
+
+    std::vector<size_t> mStartList;
+
+    // the byte every match starts with, if there's just the one, so the
+    // search can memchr from one to the next. -1 if not.
+    int mFirstByte = -1;
+
+    // returns false, with mError saying why, if pattern isn't a regex
+    bool Compile(const std::string& pattern)
+    {
+        mParser = RegexParser();
+        int root = mParser.Parse(pattern);
+        if(root < 0)
+        {
+            mError = mParser.mError;
+            return false;
+        }
+        mForward.Build(mParser.mNodes, root, false);
+        mBackward.Build(mParser.mNodes, root, true);
+        if(mForward.mTooBig || mBackward.mTooBig)
+        {
+            mError = "too big";
+            return false;
+        }
+        mClasses.Build(mParser.mSets);
+        mFind.reset(new RegexDfa(mForward, mParser.mSets, mClasses, false));
+        mStarts.reset(new RegexDfa(mBackward, mParser.mSets, mClasses, false));
+        mLongest.reset(new RegexDfa(mForward, mParser.mSets, mClasses, true));
+        mFirstByte = FirstByte();
+        return true;
+    }
+
+    int FirstByte() const
+    {
+        // what the start can get to, letting every assertion through
+        ByteSet first;
+        std::vector<bool> seen(mForward.mStates.size(), false);
+        std::vector<int> stack(1, mForward.mStart);
+        while(!stack.empty())
+        {
+            int i = stack.back();
+            stack.pop_back();
+            if(seen[i])
+            {
+                continue;
+            }
+            seen[i] = true;
+
+            const RegexNfa::State& state = mForward.mStates[i];
+            switch(state.mKind)
+            {
+                case RegexNfa::State::kMatch:
+                    return -1;
+
+                case RegexNfa::State::kBytes:
+                    first |= mParser.mSets[state.mBytes];
+                    break;
+
+                case RegexNfa::State::kSplit:
+                    stack.push_back(state.mOut1);
+                    stack.push_back(state.mOut);
+                    break;
+
+                case RegexNfa::State::kAssert:
+                    stack.push_back(state.mOut);
+                    break;
+            }
+        }
+        return first.count() == 1 ? RegexParser::FirstByte(first) : -1;
+    }
+
+    // what the byte before pos was, as far as a dfa's concerned
+    static int FlagsAt(const char* data, size_t pos)
+    {
+        if(pos == 0 || data[pos - 1] == '\n')
+        {
+            return RegexDfa::kLineStart;
+        }
+        return IsWordByte(data[pos - 1]) ? RegexDfa::kAfterWord : 0;
+    }
+
+    int ClassOf(char c) const { return mClasses.mClass[(unsigned char) c]; }
+
+    // the first line of data with a match that starts at or after from.
+    // data is whole lines with newlines between them.
+    bool FindLine(const char* data, size_t length, size_t from, size_t& lineStart, size_t& lineEnd)
+    {
+        // the first place a match ends tells us which line has one
+        RegexDfa::State* state = mFind->Start(FlagsAt(data, from));
+        size_t firstEnd = from;
+        while(firstEnd < length && !state->mMatched)
+        {
+            if(state->mIsStart && mFirstByte >= 0)
+            {
+                const char* next = (const char*) memchr(data + firstEnd, mFirstByte, length - firstEnd);
+                if(next == nullptr)
+                {
+                    return false;
+                }
+                firstEnd = next - data;
+                state = mFind->Start(FlagsAt(data, firstEnd));
+            }
+            state = mFind->Next(state, ClassOf(data[firstEnd++]));
+        }
+        if(state->mMatched)
+        {
+            firstEnd--;
+        }
+        else if(!mFind->Next(state, mClasses.mEnd)->mMatched)
+        {
+            return false;
+        }
+
+        const char* newline = (const char*) memchr(data + firstEnd, '\n', length - firstEnd);
+        lineEnd = newline ? newline - data : length;
+        lineStart = firstEnd;
+        while(lineStart > from && data[lineStart - 1] != '\n')
+        {
+            lineStart--;
+        }
+        return true;
+    }
+
+    // calls f(start, end) for each match in data that starts at or after
+    // from, in order, until f returns false. data is whole lines with
+    // newlines between them. after a match the next one starts where it
+    // ended, and can't be empty there.
+    template<class F> void ForEachMatch(const char* data, size_t length, size_t from, F f)
+    {
+        size_t lineStart;
+        size_t lineEnd;
+        for(size_t pos = from; pos <= length && FindLine(data, length, pos, lineStart, lineEnd); pos = lineEnd + 1)
+        {
+            // running backwards from the end of the line, each place the
+            // reversed pattern matches is somewhere a match starts
+            mStartList.clear();
+            RegexDfa::State* state = mStarts->Start(RegexDfa::kLineStart);
+            for(size_t i = lineEnd; i > lineStart; i--)
+            {
+                state = mStarts->Next(state, ClassOf(data[i - 1]));
+                if(state->mMatched)
+                {
+                    mStartList.push_back(i);
+                }
+            }
+            bool realStart = lineStart == 0 || data[lineStart - 1] == '\n';
+            state = mStarts->Next(state, realStart ? mClasses.mEnd : ClassOf(data[lineStart - 1]));
+            if(state->mMatched)
+            {
+                mStartList.push_back(lineStart);
+            }
+
+            // then the longest match from each, leftmost first
+            size_t lastEnd = SIZE_MAX;
+            for(size_t i = mStartList.size(); i-- > 0;)
+            {
+                size_t start = mStartList[i];
+                if(lastEnd != SIZE_MAX && start < lastEnd)
+                {
+                    continue;
+                }
+                size_t end = SIZE_MAX;
+                state = mLongest->Start(FlagsAt(data, start));
+                for(size_t j = start; j < lineEnd && !state->mDead; j++)
+                {
+                    state = mLongest->Next(state, ClassOf(data[j]));
+                    if(state->mMatched)
+                    {
+                        end = j;
+                    }
+                }
+                if(!state->mDead && mLongest->Next(state, mClasses.mEnd)->mMatched)
+                {
+                    end = lineEnd;
+                }
+                if(end == SIZE_MAX || (end == start && start == lastEnd))
+                {
+                    continue;
+                }
+                if(!f(start, end))
+                {
+                    return;
+                }
+                lastEnd = end;
+            }
+        }
+    }
+
+    // the first match starting at or after from
+    bool Search(const char* data, size_t length, size_t from, size_t& start, size_t& end)
+    {
+        bool found = false;
+        ForEachMatch(data, length, from, [&](size_t matchStart, size_t matchEnd)
+        {
+            start = matchStart;
+            end = matchEnd;
+            found = true;
+            return false;
+        });
+        return found;
+    }
+};
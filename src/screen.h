@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// colours are 0 for the terminal's default, a palette index or 24 bit rgb
+typedef uint32_t Colour;
+const Colour kDefaultColour = 0;
+
+constexpr Colour PaletteColour(int index) { return 0x1000000u | index; }
+constexpr Colour RgbColour(int red, int green, int blue)
+{
+    return 0x2000000u | (red << 16) | (green << 8) | blue;
+}
+
+struct Style
+{
+    Style() {}
+    Style(Colour fg, Colour bg) : mFg(fg), mBg(bg) {}
+
+    Colour mFg = kDefaultColour;
+    Colour mBg = kDefaultColour;
+
+    bool operator==(const Style& other) const { return mFg == other.mFg && mBg == other.mBg; }
+    bool operator!=(const Style& other) const { return !(*this == other); }
+};
+
+struct Cell
+{
+    char mChar = ' ';
+    Style mStyle;
+
+    bool operator==(const Cell& other) const { return mChar == other.mChar && mStyle == other.mStyle; }
+    bool operator!=(const Cell& other) const { return !(*this == other); }
+};
+
+// double buffered grid of cells. draw a frame into the back grid, then
+// Flush() works out the bytes that take the terminal from the front grid
+// (what it shows now) to the back one: only cells that changed, with the
+// shortest cursor moves and colour changes it can find. the back grid keeps
+// what was drawn, so parts of the screen that haven't changed needn't be
+// drawn again.
+struct Screen
+{
+    int mRows = 0;
+    int mCols = 0;
+    std::vector<Cell> mBack;
+    std::vector<Cell> mFront;
+
+    // false until the terminal has been cleared to match mFront
+    bool mFrontValid = false;
+
+    // drawing goes into this part of the screen. rows and columns are
+    // counted from its top left, and anything outside it is clipped.
+    int mWinRow = 0;
+    int mWinCol = 0;
+    int mWinRows = 0;
+    int mWinCols = 0;
+
+    // where the cursor should be left, 0 based
+    int mCursorRow = 0;
+    int mCursorCol = 0;
+
+    // the terminal's cursor and colours as of the last Flush. -1 if unknown
+    int mTermRow = -1;
+    int mTermCol = -1;
+    Style mTermStyle;
+
+    void Resize(int rows, int cols)
+    {
+        if(rows == mRows && cols == mCols)
+        {
+            return;
+        }
+        mRows = rows;
+        mCols = cols;
+        mBack.assign(rows * cols, Cell());
+        mFront.assign(rows * cols, Cell());
+        mFrontValid = false;
+        FullWindow();
+    }
+
+    void SetWindow(int row, int col, int rows, int cols)
+    {
+        mWinRow = row;
+        mWinCol = col;
+        mWinRows = rows;
+        mWinCols = cols;
+    }
+
+    void FullWindow() { SetWindow(0, 0, mRows, mCols); }
+
+    // forget what's on the terminal, the next Flush repaints everything
+    void Invalidate() { mFrontValid = false; }
+
+    void Clear()
+    {
+        std::fill(mBack.begin(), mBack.end(), Cell());
+    }
+
+    // blank the window
+    void ClearWindow()
+    {
+        for(int row = 0; row < mWinRows; row++)
+        {
+            FillRow(row, 0, Style());
+        }
+    }
+
+    void Put(int row, int col, char c, Style style)
+    {
+        if(row >= 0 && row < mWinRows && col >= 0 && col < mWinCols)
+        {
+            row += mWinRow;
+            col += mWinCol;
+            // control characters would move the terminal's cursor under us
+            if((unsigned char) c < ' ' || c == 127)
+            {
+                c = c == '\t' ? ' ' : '?';
+            }
+            Cell& cell = mBack[row * mCols + col];
+            cell.mChar = c;
+            cell.mStyle = style;
+        }
+    }
+
+    // returns the column after the text, which is clipped to the window
+    int PutText(int row, int col, const char* text, size_t length, Style style)
+    {
+        for(size_t i = 0; i < length; i++)
+        {
+            Put(row, col++, text[i], style);
+        }
+        return col;
+    }
+
+    // fill the rest of a row with blanks in style
+    void FillRow(int row, int col, Style style)
+    {
+        while(col < mWinCols)
+        {
+            Put(row, col++, ' ', style);
+        }
+    }
+
+    void SetCursor(int row, int col)
+    {
+        mCursorRow = mWinRow + row;
+        mCursorCol = mWinCol + col;
+    }
+
+    // the bytes to write to bring the terminal up to date, empty if nothing changed
+    std::string Flush()
+    {
+        std::string out;
+        if(!mFrontValid)
+        {
+            out += "\x1b[0m\x1b[2J";
+            mTermStyle = Style();
+            mTermRow = -1;
+            mTermCol = -1;
+            std::fill(mFront.begin(), mFront.end(), Cell());
+            mFrontValid = true;
+        }
+
+        bool cursorHidden = false;
+        for(int row = 0; row < mRows; row++)
+        {
+            Cell* back = &mBack[row * mCols];
+            Cell* front = &mFront[row * mCols];
+            for(int col = 0; col < mCols; col++)
+            {
+                if(back[col] == front[col])
+                {
+                    continue;
+                }
+                if(!cursorHidden)
+                {
+                    out += "\x1b[?25l";
+                    cursorHidden = true;
+                }
+
+                MoveTo(out, row, col);
+
+                // blank to the end of the row, one erase does it
+                if(BlankFrom(back, col))
+                {
+                    SetStyle(out, Style());
+                    out += "\x1b[K";
+                    std::copy(back + col, back + mCols, front + col);
+                    break;
+                }
+
+                SetStyle(out, back[col].mStyle);
+                out += back[col].mChar;
+                front[col] = back[col];
+                mTermCol++;
+                if(mTermCol >= mCols)
+                {
+                    // terminals differ on where the cursor is after the last column
+                    mTermRow = -1;
+                    mTermCol = -1;
+                }
+            }
+        }
+
+        if(cursorHidden || mTermRow != mCursorRow || mTermCol != mCursorCol)
+        {
+            MoveTo(out, mCursorRow, mCursorCol);
+        }
+        if(cursorHidden)
+        {
+            out += "\x1b[?25h";
+        }
+        return out;
+    }
+
+    bool BlankFrom(const Cell* row, int col)
+    {
+        // not worth an erase for the last cell or two
+        if(mCols - col < 3)
+        {
+            return false;
+        }
+        for(; col < mCols; col++)
+        {
+            if(row[col] != Cell())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void MoveTo(std::string& out, int row, int col)
+    {
+        if(row == mTermRow && col >= mTermCol)
+        {
+            int gap = col - mTermCol;
+            if(gap == 0)
+            {
+                return;
+            }
+
+            // rewriting a few unchanged cells is shorter than a cursor move
+            const Cell* front = &mFront[row * mCols];
+            bool rewrite = gap <= 3;
+            for(int i = mTermCol; rewrite && i < col; i++)
+            {
+                rewrite = front[i].mStyle == mTermStyle;
+            }
+            if(rewrite)
+            {
+                for(int i = mTermCol; i < col; i++)
+                {
+                    out += front[i].mChar;
+                }
+            }
+            else
+            {
+                out += "\x1b[" + std::to_string(gap) + "C";
+            }
+        }
+        else
+        {
+            out += "\x1b[" + std::to_string(row + 1) + ";" + std::to_string(col + 1) + "H";
+        }
+        mTermRow = row;
+        mTermCol = col;
+    }
+
+    void SetStyle(std::string& out, Style style)
+    {
+        if(style == mTermStyle)
+        {
+            return;
+        }
+
+        std::string params;
+        if(style.mFg != mTermStyle.mFg)
+        {
+            params += ColourParams(style.mFg, 30, 39);
+        }
+        if(style.mBg != mTermStyle.mBg)
+        {
+            if(!params.empty())
+            {
+                params += ";";
+            }
+            params += ColourParams(style.mBg, 40, 49);
+        }
+        out += "\x1b[" + params + "m";
+        mTermStyle = style;
+    }
+
+    // base is 30 for foreground and 40 for background. palette colours 8
+    // to 15 are the bright ones at base + 60, past that the 256 colour
+    // palette.
+    std::string ColourParams(Colour colour, int base, int defaultCode)
+    {
+        if(colour == kDefaultColour)
+        {
+            return std::to_string(defaultCode);
+        }
+        if(colour & 0x1000000u)
+        {
+            int index = colour & 0xff;
+            if(index < 8)
+            {
+                return std::to_string(base + index);
+            }
+            if(index < 16)
+            {
+                return std::to_string(base + 60 + index - 8);
+            }
+            return std::to_string(base + 8) + ";5;" + std::to_string(index);
+        }
+        return std::to_string(base + 8) + ";2;" +
+            std::to_string((colour >> 16) & 0xff) + ";" +
+            std::to_string((colour >> 8) & 0xff) + ";" +
+            std::to_string(colour & 0xff);
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "regex.h"
+#include "text_storage.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the first place needle appears in data, or nullptr. with sse2 it checks 16
+// places at a time for the needle's first and last bytes and only compares
+// the rest where both are there, which in ordinary text is rarely, so it
+// goes through a file about as fast as it can be read.
+inline const char* FindBytes(const char* data, size_t length, const char* needle, size_t needleLength)
+{
+    if(needleLength == 0)
+    {
+        return data;
+    }
+    if(needleLength > length)
+    {
+        return nullptr;
+    }
+
+    size_t starts = length - needleLength + 1;
+    size_t i = 0;
+#ifdef __SSE2__
+    if(needleLength > 1)
+    {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+        for(; i + 16 <= starts; i += 16)
+        {
+            __m128i head = _mm_loadu_si128((const __m128i*) (data + i));
+            __m128i tail = _mm_loadu_si128((const __m128i*) (data + i + needleLength - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                                _mm_cmpeq_epi8(tail, last)));
+            while(mask != 0)
+            {
+                size_t at = i + __builtin_ctz(mask);
+                if(memcmp(data + at + 1, needle + 1, needleLength - 2) == 0)
+                {
+                    return data + at;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    // the rest, or all of it for one byte needles: memchr to the next first byte
+    while(i < starts)
+    {
+        const char* candidate = (const char*) memchr(data + i, needle[0], starts - i);
+        if(candidate == nullptr)
+        {
+            return nullptr;
+        }
+        if(memcmp(candidate, needle, needleLength) == 0)
+        {
+            return candidate;
+        }
+        i = candidate - data + 1;
+    }
+    return nullptr;
+}
+
+// looks for a string in a TextStorage from a given place, round to the end
+// and back to the start again, a slice at a time so a search through a huge
+// file doesn't hold up the keys typed while it runs. lines are searched
+// where they are, and a run of untouched lines is one block of memory, so on
+// a mostly unedited file it's a handful of FindBytes calls per slice.
+// needles can't contain newlines. the needle can be a regex instead, which
+// is run over the same blocks, cut at the end of a line.
+struct TextSearch
+{
+    std::string mNeedle;
+    std::shared_ptr<Regex> mRegex;
+
+    // why the needle isn't a regex, if it's meant to be and it isn't
+    std::string mError;
+
+    // where the search started, and where it carries on from
+    TextPos mFrom;
+    TextPos mNext;
+    bool mWrapped = false;
+
+    // mDone is false while there's text left to look through
+    bool mDone = true;
+    bool mFound = false;
+    TextPos mMatch;
+    size_t mMatchLength = 0;
+
+    void Start(const std::string& needle, TextPos from, bool regex = false)
+    {
+        mNeedle = needle;
+        mRegex.reset();
+        mError.clear();
+        Restart(from);
+        if(regex && !needle.empty())
+        {
+            mRegex = std::make_shared<Regex>();
+            if(!mRegex->Compile(needle))
+            {
+                mError = mRegex->mError;
+                mRegex.reset();
+                mDone = true;
+            }
+        }
+    }
+
+    // the same needle again from somewhere else, without compiling it again
+    void Restart(TextPos from)
+    {
+        mFrom = from;
+        mNext = from;
+        mWrapped = false;
+        mFound = false;
+        mDone = mNeedle.empty() || !mError.empty();
+    }
+
+    // look through about budget bytes. returns true once the search is done.
+    bool Step(TextStorage& text, size_t budget)
+    {
+        // going from one piece to the next costs something too
+        const size_t pieceCost = 64;
+
+        while(!mDone && budget > 0)
+        {
+            size_t index;
+            const TextNode* piece = text.FindPiece(mNext.mLine, index);
+            if(piece == nullptr)
+            {
+                mDone = mWrapped;
+                mWrapped = true;
+                mNext = TextPos();
+                continue;
+            }
+            if(mWrapped && mNext.mLine > mFrom.mLine)
+            {
+                mDone = true;
+                break;
+            }
+
+            // the bytes from mNext to the end of the piece
+            size_t pieceLine = mNext.mLine - index;
+            LineView line = piece->mSource ? piece->mSource->Line(piece->mFirst + index) : LineView(*piece->mText);
+            const char* begin = line.mData + std::min(mNext.mCol, line.mLength);
+            const char* end = line.mData + line.mLength;
+            if(piece->mSource)
+            {
+                LineView last = piece->mSource->Line(piece->mFirst + piece->mCount - 1);
+                end = last.mData + last.mLength;
+            }
+
+            if(mRegex)
+            {
+                StepRegex(piece, pieceLine, line.mData, begin, end, budget);
+                continue;
+            }
+
+            // a match can start in this slice and finish past it
+            size_t starts = std::min<size_t>(end - begin, budget);
+            size_t window = std::min<size_t>(end - begin, starts + mNeedle.size() - 1);
+            const char* match = FindBytes(begin, window, mNeedle.data(), mNeedle.size());
+            if(match != nullptr)
+            {
+                mMatch = PosOf(piece, pieceLine, match);
+                mMatchLength = mNeedle.size();
+                mFound = true;
+                mDone = true;
+                break;
+            }
+
+            budget -= std::min(budget, starts + pieceCost);
+            if(begin + starts == end)
+            {
+                mNext = TextPos(pieceLine + piece->PieceLines(), 0);
+            }
+            else
+            {
+                mNext = PosOf(piece, pieceLine, begin + starts);
+            }
+        }
+        return mDone;
+    }
+
+    // the regex over whole lines from the one begin is in, which starts at
+    // lineStart, to the end of the one the budget runs out in
+    void StepRegex(const TextNode* piece, size_t pieceLine, const char* lineStart, const char* begin,
+                   const char* end, size_t& budget)
+    {
+        const size_t pieceCost = 64;
+
+        const char* stop = begin + std::min<size_t>(end - begin, budget);
+        const char* newline = (const char*) memchr(stop, '\n', end - stop);
+        const char* windowEnd = newline ? newline : end;
+
+        size_t start;
+        size_t matchEnd;
+        if(mRegex->Search(lineStart, windowEnd - lineStart, begin - lineStart, start, matchEnd))
+        {
+            mMatch = PosOf(piece, pieceLine, lineStart + start);
+            mMatchLength = matchEnd - start;
+            mFound = true;
+            mDone = true;
+            return;
+        }
+
+        budget -= std::min<size_t>(budget, windowEnd - begin + pieceCost);
+        if(windowEnd == end)
+        {
+            mNext = TextPos(pieceLine + piece->PieceLines(), 0);
+        }
+        else
+        {
+            mNext = PosOf(piece, pieceLine, windowEnd + 1);
+        }
+    }
+
+    // where a byte of piece, whose first line is pieceLine, is in the text
+    static TextPos PosOf(const TextNode* piece, size_t pieceLine, const char* at)
+    {
+        if(!piece->mSource)
+        {
+            return TextPos(pieceLine, at - piece->mText->data());
+        }
+        const TextSource* source = piece->mSource.get();
+        size_t line = source->LineOf(at - source->mData);
+        return TextPos(pieceLine + line - piece->mFirst, at - source->Line(line).mData);
+    }
+};
@@ -0,0 +1,871 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "grep.h"
+#include "text_storage.h"
+#include "tokeniser.h"
+
+// where something is defined. mLine counts from 1, 0 if the tags file only
+// gave a pattern. mPattern is the start of the line it's on, which finds it
+// again when the line number has gone stale.
+struct Tag
+{
+    std::string mName;
+    std::string mFile;
+    size_t mLine = 0;
+    std::string mPattern;
+};
+
+// the definitions from an etags or ctags file, sorted by name so a name or
+// the start of one is a binary search away. entries point into the file,
+// which is mapped rather than read, so millions of them cost 32 bytes each
+// on top of it.
+struct SymbolIndex
+{
+    struct Entry
+    {
+        uint64_t mName;
+        uint64_t mPattern;
+        uint32_t mNameLength;
+        uint32_t mPatternLength;
+        uint32_t mFile;
+        uint32_t mLine;
+    };
+
+    SymbolIndex() {}
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+    // the tags text, either a mapped file or mOwned
+    std::shared_ptr<const TextSource> mSource;
+    std::string mOwned;
+    const char* mData = "";
+    size_t mSize = 0;
+
+    // file names in the tags are relative to here
+    std::string mDir;
+
+    std::vector<std::string> mFiles;
+    std::vector<Entry> mEntries;
+
+    // ctags patterns with \/ \? or \\ in them, without the backslashes. an
+    // entry's mPattern with kUnescaped set is an offset in here.
+    static const uint64_t kUnescaped = 1ull << 63;
+    std::string mUnescaped;
+
+    size_t Size() const { return mEntries.size(); }
+
+    // nullptr and why if path can't be read
+    static std::shared_ptr<SymbolIndex> Load(const std::string& path, std::string& error)
+    {
+        auto source = TextSource::MapFile(path, false);
+        if(!source)
+        {
+            error = "can't read " + path;
+            return nullptr;
+        }
+        auto index = std::make_shared<SymbolIndex>();
+        index->mSource = source;
+        index->mData = source->mData;
+        index->mSize = source->mSize;
+        size_t slash = path.rfind('/');
+        index->mDir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+        index->Parse();
+        return index;
+    }
+
+    // tags text made some other way, see TagScanner
+    static std::shared_ptr<SymbolIndex> FromText(std::string text, const std::string& dir)
+    {
+        auto index = std::make_shared<SymbolIndex>();
+        index->mOwned.swap(text);
+        index->mData = index->mOwned.data();
+        index->mSize = index->mOwned.size();
+        index->mDir = dir.empty() || dir == "." ? "" : dir.back() == '/' ? dir : dir + "/";
+        index->Parse();
+        return index;
+    }
+
+    void Parse()
+    {
+        mFiles.clear();
+        mEntries.clear();
+        mUnescaped.clear();
+        if(mSize > 0 && mData[0] == '\f')
+        {
+            ParseEtags();
+        }
+        else
+        {
+            ParseCtags();
+        }
+
+        std::sort(mEntries.begin(), mEntries.end(), [this](const Entry& a, const Entry& b)
+        {
+            int order = Compare(a, mData + b.mName, b.mNameLength);
+            return order != 0 ? order < 0 : a.mFile != b.mFile ? a.mFile < b.mFile : a.mLine < b.mLine;
+        });
+    }
+
+    int Compare(const Entry& entry, const char* name, size_t length) const
+    {
+        int order = memcmp(mData + entry.mName, name, std::min<size_t>(entry.mNameLength, length));
+        if(order != 0)
+        {
+            return order;
+        }
+        return entry.mNameLength < length ? -1 : entry.mNameLength > length ? 1 : 0;
+    }
+
+    static bool IsNameChar(char c)
+    {
+        return isalnum((unsigned char) c) || c == '_' || c == '~' || c == '$';
+    }
+
+    // the digits at the start of [from, end)
+    static uint32_t ParseNumber(const char* from, const char* end)
+    {
+        uint32_t number = 0;
+        for(; from < end && isdigit((unsigned char) *from); from++)
+        {
+            number = number * 10 + (*from - '0');
+        }
+        return number;
+    }
+
+    // sections start with a form feed line and then "file,size". each tag
+    // is "pattern DEL name SOH line,offset", or without the name and SOH
+    // when the name is the last word of the pattern.
+    void ParseEtags()
+    {
+        const char* end = mData + mSize;
+        for(const char* line = mData; line < end;)
+        {
+            const char* lineEnd = (const char*) memchr(line, '\n', end - line);
+            lineEnd = lineEnd ? lineEnd : end;
+            const char* next = lineEnd + 1;
+
+            if(*line == '\f')
+            {
+                // the header is the line after
+                line = next;
+                if(line >= end)
+                {
+                    break;
+                }
+                lineEnd = (const char*) memchr(line, '\n', end - line);
+                lineEnd = lineEnd ? lineEnd : end;
+                const char* comma = lineEnd - 1;
+                while(comma > line && *comma != ',')
+                {
+                    comma--;
+                }
+                mFiles.push_back(std::string(line, comma > line ? comma : lineEnd));
+                line = lineEnd + 1;
+                continue;
+            }
+
+            const char* del = (const char*) memchr(line, '\x7f', lineEnd - line);
+            if(del != nullptr && !mFiles.empty())
+            {
+                Entry entry;
+                entry.mPattern = line - mData;
+                entry.mPatternLength = del - line;
+                entry.mFile = mFiles.size() - 1;
+
+                const char* soh = (const char*) memchr(del, '\x01', lineEnd - del);
+                const char* numbers = del + 1;
+                if(soh != nullptr)
+                {
+                    entry.mName = del + 1 - mData;
+                    entry.mNameLength = soh - del - 1;
+                    numbers = soh + 1;
+                }
+                else
+                {
+                    const char* nameEnd = del;
+                    while(nameEnd > line && !IsNameChar(nameEnd[-1]))
+                    {
+                        nameEnd--;
+                    }
+                    const char* nameStart = nameEnd;
+                    while(nameStart > line && IsNameChar(nameStart[-1]))
+                    {
+                        nameStart--;
+                    }
+                    entry.mName = nameStart - mData;
+                    entry.mNameLength = nameEnd - nameStart;
+                }
+                entry.mLine = ParseNumber(numbers, lineEnd);
+                if(entry.mNameLength > 0)
+                {
+                    mEntries.push_back(entry);
+                }
+            }
+            line = next;
+        }
+    }
+
+    // name TAB file TAB address, then ;" and fields. the address is a line
+    // number or a /^pattern$/ search.
+    void ParseCtags()
+    {
+        std::unordered_map<std::string, uint32_t> files;
+        const char* end = mData + mSize;
+        for(const char* line = mData; line < end;)
+        {
+            const char* lineEnd = (const char*) memchr(line, '\n', end - line);
+            lineEnd = lineEnd ? lineEnd : end;
+            const char* next = lineEnd + 1;
+
+            const char* tab1 = (const char*) memchr(line, '\t', lineEnd - line);
+            const char* tab2 = tab1 ? (const char*) memchr(tab1 + 1, '\t', lineEnd - tab1 - 1) : nullptr;
+            if(tab2 == nullptr || line[0] == '!')
+            {
+                line = next;
+                continue;
+            }
+
+            std::string file(tab1 + 1, tab2);
+            auto found = files.find(file);
+            if(found == files.end())
+            {
+                found = files.insert(std::make_pair(file, (uint32_t) mFiles.size())).first;
+                mFiles.push_back(file);
+            }
+
+            Entry entry;
+            entry.mName = line - mData;
+            entry.mNameLength = tab1 - line;
+            entry.mFile = found->second;
+            entry.mLine = 0;
+            entry.mPattern = 0;
+            entry.mPatternLength = 0;
+
+            const char* address = tab2 + 1;
+            const char* addressEnd = lineEnd;
+            const char* fields = FindBytes(address, lineEnd - address, ";\"", 2);
+            if(fields != nullptr)
+            {
+                addressEnd = fields;
+            }
+            if(address < addressEnd && isdigit((unsigned char) *address))
+            {
+                entry.mLine = ParseNumber(address, addressEnd);
+            }
+            else if(addressEnd - address >= 2 && (*address == '/' || *address == '?'))
+            {
+                const char* from = address + 1;
+                const char* to = addressEnd - 1;
+                from += from < to && *from == '^' ? 1 : 0;
+                to -= to > from && to[-1] == '$' ? 1 : 0;
+                entry.mPattern = from - mData;
+                entry.mPatternLength = to - from;
+                if(memchr(from, '\\', to - from) != nullptr)
+                {
+                    entry.mPattern = kUnescaped | mUnescaped.size();
+                    entry.mPatternLength = Unescape(from, to);
+                }
+            }
+            mEntries.push_back(entry);
+            line = next;
+        }
+    }
+
+    // append [from, to) to mUnescaped as the text it matches, and return
+    // its length
+    uint32_t Unescape(const char* from, const char* to)
+    {
+        size_t start = mUnescaped.size();
+        for(const char* c = from; c < to; c++)
+        {
+            if(*c == '\\' && c + 1 < to && (c[1] == '/' || c[1] == '?' || c[1] == '\\'))
+            {
+                c++;
+            }
+            mUnescaped += *c;
+        }
+        return mUnescaped.size() - start;
+    }
+
+    Tag MakeTag(const Entry& entry) const
+    {
+        Tag tag;
+        tag.mName.assign(mData + entry.mName, entry.mNameLength);
+        const std::string& file = mFiles[entry.mFile];
+        tag.mFile = file.empty() || file[0] == '/' ? file : mDir + file;
+        tag.mLine = entry.mLine;
+        const char* pattern = entry.mPattern & kUnescaped ? mUnescaped.data() + (entry.mPattern & ~kUnescaped)
+                                                          : mData + entry.mPattern;
+        tag.mPattern.assign(pattern, entry.mPatternLength);
+        return tag;
+    }
+
+    // everywhere name is defined
+    std::vector<Tag> Find(const std::string& name) const
+    {
+        auto first = std::lower_bound(mEntries.begin(), mEntries.end(), name, [this](const Entry& entry, const std::string& key)
+        {
+            return Compare(entry, key.data(), key.size()) < 0;
+        });
+        std::vector<Tag> tags;
+        for(auto entry = first; entry != mEntries.end() && Compare(*entry, name.data(), name.size()) == 0; ++entry)
+        {
+            tags.push_back(MakeTag(*entry));
+        }
+        return tags;
+    }
+
+    // the first max definitions of names starting with prefix
+    std::vector<Tag> Search(const std::string& prefix, size_t max) const
+    {
+        auto first = std::lower_bound(mEntries.begin(), mEntries.end(), prefix, [this](const Entry& entry, const std::string& key)
+        {
+            return Compare(entry, key.data(), key.size()) < 0;
+        });
+        std::vector<Tag> tags;
+        for(auto entry = first; entry != mEntries.end() && tags.size() < max; ++entry)
+        {
+            if(entry->mNameLength < prefix.size() || memcmp(mData + entry->mName, prefix.data(), prefix.size()) != 0)
+            {
+                break;
+            }
+            tags.push_back(MakeTag(*entry));
+        }
+        return tags;
+    }
+};
+
+// finds the definitions in a c++ file and writes them out as an etags
+// section: types, namespaces, functions defined at namespace or class
+// level, enumerators, typedefs, using aliases and macros. comments and
+// strings are left out going by the tokeniser, and what's left is read
+// with brace and paren depths, enough to tell a definition from a call.
+struct TagScanner
+{
+    std::string mOut;
+    size_t mTags = 0;
+
+    // 's' for a namespace or class body, 'e' an enum's, 'b' anything else
+    std::vector<char> mBraces;
+
+    // the statement so far at namespace or class level
+    std::string mKeyword;
+    std::string mKeywordName;
+    std::string mLastName;
+    std::string mFunctionName;
+    size_t mKeywordNameAt = 0;
+    size_t mLastNameAt = 0;
+    size_t mFunctionNameAt = 0;
+    int mParenDepth = 0;
+    int mAngleDepth = 0;
+    bool mSawParen = false;
+    bool mSawAssign = false;
+    bool mTypedef = false;
+    bool mUsing = false;
+    bool mTemplate = false;
+    bool mOperator = false;
+    bool mExtern = false;
+    bool mExpectEnumerator = false;
+
+    // the line being read and where it starts in the file
+    const char* mLine = nullptr;
+    size_t mLineLength = 0;
+    size_t mLineNumber = 0;
+    size_t mLineOffset = 0;
+
+    std::vector<TokenSpan> mSpans;
+    std::string mCode;
+
+    void ResetStatement()
+    {
+        mKeyword.clear();
+        mKeywordName.clear();
+        mLastName.clear();
+        mFunctionName.clear();
+        mParenDepth = 0;
+        mAngleDepth = 0;
+        mSawParen = mSawAssign = mTypedef = mUsing = mTemplate = mOperator = mExtern = false;
+    }
+
+    bool AtScope() const
+    {
+        return std::all_of(mBraces.begin(), mBraces.end(), [](char c) { return c == 's'; });
+    }
+
+    void Emit(const std::string& name, size_t col)
+    {
+        mOut.append(mLine, std::min(col + name.size(), mLineLength));
+        mOut += '\x7f';
+        mOut += name;
+        mOut += '\x01';
+        mOut += std::to_string(mLineNumber) + "," + std::to_string(mLineOffset) + "\n";
+        mTags++;
+    }
+
+    // a line with its comments and strings blanked out. the tokeniser gives
+    // what it can't read as one Other token running to the end of the line,
+    // so it's started again one char on from there.
+    LexState BlankLine(LexState state)
+    {
+        mCode.assign(mLine, mLineLength);
+        size_t from = 0;
+        while(from < mLineLength)
+        {
+            mSpans.clear();
+            LexState after = TokeniseLine(mLine + from, mLineLength - from, state, mSpans);
+            bool other = false;
+            for(auto& span : mSpans)
+            {
+                const char* text = mLine + from + span.start;
+                bool quoted = span.type == Literal && (memchr(text, '"', span.length) || memchr(text, '\'', span.length));
+                if(span.type == Comment || quoted)
+                {
+                    memset(&mCode[from + span.start], ' ', span.length);
+                }
+                other = span.type == Other;
+            }
+            if(!other || mSpans.empty())
+            {
+                return after;
+            }
+
+            // past the spaces the Other token starts with and its first char
+            const TokenSpan& last = mSpans.back();
+            size_t skip = last.start;
+            while(skip < last.start + last.length && IsSpaceChar(mLine[from + skip]))
+            {
+                skip++;
+            }
+            from += skip + 1;
+            state = kLexNormal;
+        }
+        return kLexNormal;
+    }
+
+    void Word(const std::string& word, size_t col)
+    {
+        if(InEnum())
+        {
+            if(mExpectEnumerator && mParenDepth == 0)
+            {
+                Emit(word, col);
+            }
+            mExpectEnumerator = false;
+            return;
+        }
+        if(!AtScope() || mAngleDepth > 0)
+        {
+            return;
+        }
+
+        if(word == "struct" || word == "class" || word == "union" || word == "enum" || word == "namespace")
+        {
+            if(mKeyword.empty())
+            {
+                mKeyword = word;
+            }
+        }
+        else if(word == "typedef")
+        {
+            mTypedef = true;
+        }
+        else if(word == "using")
+        {
+            mUsing = true;
+        }
+        else if(word == "template")
+        {
+            mTemplate = true;
+        }
+        else if(word == "operator")
+        {
+            mOperator = true;
+        }
+        else if(word == "extern")
+        {
+            mExtern = true;
+        }
+        else if(!IsKeyword(word.data(), word.size()))
+        {
+            if(!mKeyword.empty() && mKeywordName.empty() && !mSawParen)
+            {
+                mKeywordName = word;
+                mKeywordNameAt = col;
+            }
+            if(mParenDepth == 0)
+            {
+                mLastName = word;
+                mLastNameAt = col;
+            }
+            return;
+        }
+        mLastName.clear();
+    }
+
+    // directly in an enum's body, which is itself at namespace or class level
+    bool InEnum() const
+    {
+        return !mBraces.empty() && mBraces.back() == 'e' &&
+               std::all_of(mBraces.begin(), mBraces.end() - 1, [](char c) { return c == 's'; });
+    }
+
+    void Punctuation(char c)
+    {
+        if(c == '{')
+        {
+            char kind = 'b';
+            if(AtScope())
+            {
+                if(!mKeyword.empty() && !mSawAssign)
+                {
+                    if(!mKeywordName.empty())
+                    {
+                        Emit(mKeywordName, mKeywordNameAt);
+                    }
+                    kind = mKeyword == "enum" ? 'e' : 's';
+                    mExpectEnumerator = true;
+                }
+                else if(!mFunctionName.empty())
+                {
+                    Emit(mFunctionName, mFunctionNameAt);
+                }
+                else if(mExtern)
+                {
+                    kind = 's';
+                }
+            }
+            mBraces.push_back(kind);
+            ResetStatement();
+            return;
+        }
+        if(c == '}')
+        {
+            if(!mBraces.empty())
+            {
+                mBraces.pop_back();
+            }
+            ResetStatement();
+            return;
+        }
+        if(InEnum())
+        {
+            mParenDepth += c == '(' ? 1 : c == ')' ? -1 : 0;
+            mExpectEnumerator = c == ',' && mParenDepth == 0 ? true : mExpectEnumerator;
+            return;
+        }
+        if(!AtScope())
+        {
+            return;
+        }
+
+        if(mTemplate && (c == '<' || c == '>'))
+        {
+            mAngleDepth += c == '<' ? 1 : -1;
+            return;
+        }
+        if(mAngleDepth > 0)
+        {
+            return;
+        }
+        switch(c)
+        {
+            case '(':
+                if(mParenDepth++ == 0 && !mSawParen)
+                {
+                    mSawParen = true;
+                    if(!mLastName.empty() && !mSawAssign && !mOperator && !mTypedef && !mUsing)
+                    {
+                        mFunctionName = mLastName;
+                        mFunctionNameAt = mLastNameAt;
+                    }
+                }
+                break;
+
+            case ')':
+                mParenDepth--;
+                break;
+
+            case '=':
+                if(mParenDepth == 0)
+                {
+                    if(mUsing && !mSawAssign && !mLastName.empty())
+                    {
+                        Emit(mLastName, mLastNameAt);
+                    }
+                    mSawAssign = true;
+                }
+                break;
+
+            case ';':
+                if(mParenDepth == 0)
+                {
+                    if(mTypedef && !mLastName.empty())
+                    {
+                        Emit(mLastName, mLastNameAt);
+                    }
+                    ResetStatement();
+                }
+                break;
+        }
+        if(c != ':')
+        {
+            mLastName.clear();
+        }
+    }
+
+    // a #define's name
+    void Directive(size_t hash)
+    {
+        size_t i = hash + 1;
+        while(i < mLineLength && IsSpaceChar(mCode[i]))
+        {
+            i++;
+        }
+        if(mCode.compare(i, 6, "define") != 0)
+        {
+            return;
+        }
+        i += 6;
+        while(i < mLineLength && IsSpaceChar(mCode[i]))
+        {
+            i++;
+        }
+        size_t start = i;
+        while(i < mLineLength && IsNameChar(mCode[i]))
+        {
+            i++;
+        }
+        if(i > start)
+        {
+            Emit(mCode.substr(start, i - start), start);
+        }
+    }
+
+    static bool IsNameChar(char c)
+    {
+        return isalnum((unsigned char) c) || c == '_' || c == '$';
+    }
+
+    void Scan(const char* data, size_t size)
+    {
+        mOut.clear();
+        mBraces.clear();
+        ResetStatement();
+        mExpectEnumerator = false;
+
+        LexState state = kLexNormal;
+        bool continued = false;
+        mLineNumber = 0;
+        for(size_t offset = 0; offset < size;)
+        {
+            const char* newline = (const char*) memchr(data + offset, '\n', size - offset);
+            size_t end = newline ? newline - data : size;
+            mLine = data + offset;
+            mLineLength = end - offset;
+            mLineOffset = offset;
+            mLineNumber++;
+            offset = end + 1;
+
+            state = BlankLine(state);
+            size_t first = 0;
+            while(first < mLineLength && IsSpaceChar(mCode[first]))
+            {
+                first++;
+            }
+
+            // a macro's lines after its first are left alone
+            bool directive = continued || (first < mLineLength && mCode[first] == '#');
+            if(directive)
+            {
+                if(!continued)
+                {
+                    Directive(first);
+                }
+                continued = mLineLength > 0 && mLine[mLineLength - 1] == '\\';
+                continue;
+            }
+
+            for(size_t i = first; i < mLineLength;)
+            {
+                char c = mCode[i];
+                if(IsNameChar(c) || (c == '~' && i + 1 < mLineLength && IsAlphaChar(mCode[i + 1])))
+                {
+                    size_t start = i++;
+                    while(i < mLineLength && IsNameChar(mCode[i]))
+                    {
+                        i++;
+                    }
+                    if(!isdigit((unsigned char) mCode[start]))
+                    {
+                        Word(mCode.substr(start, i - start), start);
+                    }
+                    continue;
+                }
+                if(!IsSpaceChar(c))
+                {
+                    Punctuation(c);
+                }
+                i++;
+            }
+        }
+    }
+
+    // the etags section for a file, empty if it has no tags
+    std::string Section(const std::string& name, const char* data, size_t size)
+    {
+        Scan(data, size);
+        if(mOut.empty())
+        {
+            return "";
+        }
+        return "\f\n" + name + "," + std::to_string(mOut.size()) + "\n" + mOut;
+    }
+};
+
+// loads a tags file, or makes tags for every c++ file under a directory
+// using all the cores, on the files as they are on disk. done is called on
+// a pool thread with the index, or nullptr and why not.
+struct SymbolIndexBuild
+{
+    typedef std::function<void(std::shared_ptr<SymbolIndex>, const std::string&)> Done;
+
+    explicit SymbolIndexBuild(size_t threads) : mPool(threads)
+    {
+        mPool.mOnIdle = [this]() { Finish(); };
+    }
+
+    ~SymbolIndexBuild()
+    {
+        mCancelled = true;
+    }
+
+    Done mDone;
+    std::atomic<bool> mCancelled{false};
+    std::atomic<size_t> mFilesScanned{0};
+
+    std::string mLoadPath;
+    std::string mDir;
+    std::shared_ptr<SymbolIndex> mIndex;
+    std::string mError;
+    std::mutex mSectionsMutex;
+    std::string mSections;
+
+    void Load(const std::string& path, Done done)
+    {
+        mLoadPath = path;
+        mDone = done;
+        mPool.Submit([this, path]() { mIndex = SymbolIndex::Load(path, mError); });
+    }
+
+    void Scan(const std::string& dir, Done done)
+    {
+        mDir = dir;
+        mDone = done;
+        mPool.Submit([this, dir]() { WalkDirectory(dir); });
+    }
+
+    static bool IsSourceFile(const std::string& name)
+    {
+        static const char* const kExtensions[] = { ".h", ".hh", ".hpp", ".hxx", ".c", ".cc", ".cpp", ".cxx", ".inl" };
+        size_t dot = name.rfind('.');
+        if(dot == std::string::npos)
+        {
+            return false;
+        }
+        for(auto extension : kExtensions)
+        {
+            if(name.compare(dot, std::string::npos, extension) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WalkDirectory(const std::string& dir)
+    {
+        DIR* handle = opendir(dir.c_str());
+        if(handle == nullptr)
+        {
+            return;
+        }
+        struct dirent* entry;
+        while(!mCancelled && (entry = readdir(handle)) != nullptr)
+        {
+            if(entry->d_name[0] == '.')
+            {
+                continue;
+            }
+            std::string path = dir == "." ? entry->d_name : dir + "/" + entry->d_name;
+            unsigned char type = entry->d_type;
+            if(type == DT_UNKNOWN)
+            {
+                struct stat info;
+                if(lstat(path.c_str(), &info) != 0)
+                {
+                    continue;
+                }
+                type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if(type == DT_DIR)
+            {
+                mPool.Submit([this, path]() { WalkDirectory(path); });
+            }
+            else if(type == DT_REG && IsSourceFile(path))
+            {
+                mPool.Submit([this, path]() { ScanFile(path); });
+            }
+        }
+        closedir(handle);
+    }
+
+    void ScanFile(const std::string& path)
+    {
+        if(mCancelled)
+        {
+            return;
+        }
+        auto source = TextSource::MapFile(path, false);
+        if(!source)
+        {
+            return;
+        }
+        TagScanner scanner;
+        std::string section = scanner.Section(mDir == "." ? path : path.substr(mDir.size() + 1), source->mData, source->mSize);
+        mFilesScanned++;
+        if(!section.empty())
+        {
+            std::lock_guard<std::mutex> lock(mSectionsMutex);
+            mSections += section;
+        }
+    }
+
+    void Finish()
+    {
+        if(mCancelled || !mDone)
+        {
+            return;
+        }
+        if(mLoadPath.empty())
+        {
+            std::lock_guard<std::mutex> lock(mSectionsMutex);
+            mIndex = SymbolIndex::FromText(std::move(mSections), mDir);
+        }
+        if(!mCancelled)
+        {
+            mDone(mIndex, mError);
+        }
+    }
+
+    // last, it has to go before everything its threads use
+    WorkStealingPool mPool;
+};
@@ -2,7 +2,10 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <signal.h>
 
+// set when the terminal changes size, the editor re-reads the size and clears it
+volatile sig_atomic_t gWindowResized = 1;
 
 struct TermSetup
 {
@@ -23,13 +26,17 @@ struct TermSetup
         // turn off output processing
         termAttributes.c_oflag &= ~(OPOST);
 
-        // allow for real time loop
+        // reads never block, the editor waits in poll() for input instead
         termAttributes.c_cc[VMIN] = 0;
-        termAttributes.c_cc[VTIME] = 1;
+        termAttributes.c_cc[VTIME] = 0;
         
         // set terminal attributes to our changed version
         tcsetattr(STDIN_FILENO, TCSAFLUSH, &termAttributes);
 
+        // bracketed paste, pasted text comes wrapped in ESC [ 200 ~ and
+        // ESC [ 201 ~ so it can go in all at once rather than as keys
+        write(STDOUT_FILENO, "\x1b[?2004h", 8);
+
         struct winsize ws;
         ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
         mNumCols = ws.ws_col;
@@ -39,6 +46,8 @@ struct TermSetup
     // on close, set the terminal settings back to normal
     ~TermSetup()
     {
+        write(STDOUT_FILENO, "\x1b[?2004l", 8);
+        write(STDOUT_FILENO, "\x1b[0m", 4);
         write(STDOUT_FILENO, "\x1b[2J", 4);
         write(STDOUT_FILENO, "\x1b[H", 3);        
         tcsetattr(STDIN_FILENO, TCSAFLUSH, &mOriginalSettings);
@@ -0,0 +1,919 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// a read-only view of one line of text. only valid until the storage it came
+// from is next edited (or for as long as you keep a copy of that storage).
+struct LineView
+{
+    LineView() {}
+    LineView(const char* data, size_t length) : mData(data), mLength(length) {}
+    explicit LineView(const std::string& text) : mData(text.data()), mLength(text.size()) {}
+
+    const char* mData = "";
+    size_t mLength = 0;
+
+    std::string ToString() const { return std::string(mData, mLength); }
+
+    bool operator==(const LineView& other) const
+    {
+        return mLength == other.mLength && memcmp(mData, other.mData, mLength) == 0;
+    }
+    bool operator!=(const LineView& other) const { return !(*this == other); }
+};
+
+// content hashes. every line gets a hash, and a run of lines hashes as the
+// polynomial sum(hash(line i) * kHashBase^(n-1-i)) mod 2^61-1, which lets the
+// hash of two runs be combined in O(1): H(a ++ b) = H(a) * kHashBase^|b| + H(b)
+const uint64_t kHashModulus = (1ull << 61) - 1;
+const uint64_t kHashBase = 1000003;
+
+inline uint64_t HashMulMod(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = (unsigned __int128) a * b;
+    uint64_t result = (uint64_t) (product & kHashModulus) + (uint64_t) (product >> 61);
+    return result >= kHashModulus ? result - kHashModulus : result;
+}
+
+inline uint64_t HashAddMod(uint64_t a, uint64_t b)
+{
+    uint64_t result = a + b;
+    return result >= kHashModulus ? result - kHashModulus : result;
+}
+
+inline uint64_t HashPow(uint64_t exponent)
+{
+    uint64_t result = 1;
+    uint64_t base = kHashBase;
+    while(exponent > 0)
+    {
+        if(exponent & 1)
+        {
+            result = HashMulMod(result, base);
+        }
+        base = HashMulMod(base, base);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+// hashes 8 bytes at a time, this runs over every byte of a file we open
+inline uint64_t HashLine(const char* data, size_t length)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, length - i);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return h % kHashModulus;
+}
+
+// a mapped file that another process truncates, in log rotation or a git
+// checkout say, faults with SIGBUS on the pages past its new end. mapped
+// files are listed here, and the handler maps zeroed pages over the lost
+// ones and marks the file, so reading it carries on and the editor can say
+// it changed. the handler can't take locks, so the list is a fixed array
+// of atomics, and a file that doesn't fit in it is read in instead.
+struct MappedRegion
+{
+    std::atomic<uintptr_t> mStart{0};
+    std::atomic<size_t> mSize{0};
+    std::atomic<bool> mLost{false};
+};
+
+const size_t kMaxMappedFiles = 256;
+
+inline MappedRegion* MappedRegions()
+{
+    static MappedRegion regions[kMaxMappedFiles];
+    return regions;
+}
+
+// goes up every time a mapped file loses pages
+inline std::atomic<uint64_t>& MappingsLost()
+{
+    static std::atomic<uint64_t> lost(0);
+    return lost;
+}
+
+inline uintptr_t PageSize()
+{
+    static uintptr_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+inline void OnMappedFault(int, siginfo_t* info, void*)
+{
+    uintptr_t address = (uintptr_t) info->si_addr;
+    MappedRegion* regions = MappedRegions();
+    for(size_t i = 0; i < kMaxMappedFiles; i++)
+    {
+        uintptr_t start = regions[i].mStart;
+        size_t size = regions[i].mSize;
+        if(start != 0 && address >= start && address < start + size)
+        {
+            // from the page that faulted to the end, what's before it is
+            // still in the file
+            uintptr_t page = address & ~(PageSize() - 1);
+            mmap((void*) page, start + size - page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            regions[i].mLost = true;
+            MappingsLost()++;
+            return;
+        }
+    }
+    // not one of ours, fault again and die the way we would have
+    signal(SIGBUS, SIG_DFL);
+}
+
+// a slot in MappedRegions for the mapping, or -1 if they're all taken
+inline int AddMappedRegion(const void* start, size_t size)
+{
+    static bool installed = []()
+    {
+        PageSize();
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = OnMappedFault;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGBUS, &action, nullptr) == 0;
+    }();
+    if(!installed)
+    {
+        return -1;
+    }
+    MappedRegion* regions = MappedRegions();
+    for(size_t i = 0; i < kMaxMappedFiles; i++)
+    {
+        uintptr_t empty = 0;
+        if(regions[i].mStart.compare_exchange_strong(empty, (uintptr_t) start))
+        {
+            regions[i].mLost = false;
+            regions[i].mSize = size;
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline void RemoveMappedRegion(int slot)
+{
+    MappedRegion& region = MappedRegions()[slot];
+    region.mSize = 0;
+    region.mLost = false;
+    region.mStart = 0;
+}
+
+// the original contents of a file and where each of its lines starts.
+// the bytes never change once it's loaded, so any number of storages can
+// share it. big files are mapped rather than read, and their line index is
+// built as it's needed and by a background thread, so opening one doesn't
+// have to touch the whole file.
+struct TextSource
+{
+    TextSource() : mIndexed(false), mStopIndexer(false) {}
+
+    ~TextSource()
+    {
+        mStopIndexer = true;
+        if(mIndexer.joinable())
+        {
+            mIndexer.join();
+        }
+        // the region goes first, the address could be mapped again by
+        // another thread as soon as it's unmapped
+        if(mMapSlot >= 0)
+        {
+            RemoveMappedRegion(mMapSlot);
+        }
+        if(mMapping != nullptr)
+        {
+            munmap(mMapping, mSize);
+        }
+    }
+
+    // the bytes of the file, pointing into either mOwned or mMapping
+    const char* mData = "";
+    size_t mSize = 0;
+    std::string mOwned;
+    void* mMapping = nullptr;
+    int mMapSlot = -1;
+
+    // files we map skip content hashes, that would mean reading all of them
+    bool mHashed = true;
+
+    // everything below is filled in as the file is indexed, under mIndexMutex.
+    // mLineStarts has one more entry than there are indexed lines, line i runs
+    // from mLineStarts[i] up to the newline at mLineStarts[i + 1] - 1.
+    // mHashPrefix[i] is the content hash of lines [0, i).
+    mutable std::mutex mIndexMutex;
+    mutable std::vector<size_t> mLineStarts = {0};
+    mutable std::vector<uint64_t> mHashPrefix = {0};
+    mutable size_t mScanned = 0;
+    mutable std::atomic<bool> mIndexed;
+
+    std::thread mIndexer;
+    std::atomic<bool> mStopIndexer;
+
+    // without hashed, the lines aren't hashed as they're indexed, for text
+    // that's never compared
+    static std::shared_ptr<const TextSource> FromString(std::string data, bool hashed = true)
+    {
+        auto source = std::make_shared<TextSource>();
+        source->mHashed = hashed;
+        source->mOwned.swap(data);
+        source->mData = source->mOwned.data();
+        source->mSize = source->mOwned.size();
+        source->IndexUpTo(SIZE_MAX);
+        return source;
+    }
+
+    // map filename read-only. returns nullptr if it can't be mapped. see
+    // MappedRegion for what happens if the file's truncated while it is.
+    static std::shared_ptr<const TextSource> MapFile(const std::string& filename, bool indexInBackground = true)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return nullptr;
+        }
+
+        struct stat info;
+        if(fstat(fd, &info) != 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        auto source = std::make_shared<TextSource>();
+        source->mHashed = false;
+        if(info.st_size > 0)
+        {
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED)
+            {
+                close(fd);
+                return nullptr;
+            }
+            source->mMapSlot = AddMappedRegion(mapping, info.st_size);
+            if(source->mMapSlot < 0)
+            {
+                munmap(mapping, info.st_size);
+                close(fd);
+                return nullptr;
+            }
+            source->mMapping = mapping;
+            source->mData = (const char*) mapping;
+            source->mSize = info.st_size;
+        }
+        close(fd);
+
+        if(indexInBackground)
+        {
+            source->mIndexer = std::thread(&TextSource::IndexInBackground, source.get());
+        }
+        return source;
+    }
+
+    bool FullyIndexed() const { return mIndexed; }
+
+    // the file was truncated under the mapping, and some of it now reads as
+    // zeros rather than what was there
+    bool Lost() const { return mMapSlot >= 0 && MappedRegions()[mMapSlot].mLost; }
+
+    // what the source costs on the heap: its bytes if they were read in
+    // rather than mapped, and its line index
+    size_t HeapBytes() const
+    {
+        std::lock_guard<std::mutex> lock(mIndexMutex);
+        return mOwned.capacity() + (mLineStarts.capacity() + mHashPrefix.capacity()) * sizeof(size_t);
+    }
+
+    // index until there are at least lines lines, or we reach the end.
+    // returns how many lines are indexed.
+    size_t IndexUpTo(size_t lines) const
+    {
+        std::lock_guard<std::mutex> lock(mIndexMutex);
+        while(!mIndexed && mLineStarts.size() - 1 < lines)
+        {
+            ScanChunk(1 << 20);
+        }
+        return mLineStarts.size() - 1;
+    }
+
+    size_t LineCount() const { return IndexUpTo(SIZE_MAX); }
+
+    // line i must already be indexed
+    LineView Line(size_t i) const
+    {
+        std::lock_guard<std::mutex> lock(mIndexMutex);
+        size_t start = mLineStarts[i];
+        return LineView(mData + start, mLineStarts[i + 1] - 1 - start);
+    }
+
+    // the line the byte at offset is in, which must be indexed
+    size_t LineOf(size_t offset) const
+    {
+        std::lock_guard<std::mutex> lock(mIndexMutex);
+        return std::upper_bound(mLineStarts.begin(), mLineStarts.end(), offset) - mLineStarts.begin() - 1;
+    }
+
+    // content hash of lines [first, first + count), which must be indexed
+    uint64_t RangeHash(size_t first, size_t count, uint64_t pow) const
+    {
+        std::lock_guard<std::mutex> lock(mIndexMutex);
+        uint64_t shifted = HashMulMod(mHashPrefix[first], pow);
+        return HashAddMod(mHashPrefix[first + count], kHashModulus - shifted);
+    }
+
+    void IndexInBackground()
+    {
+        while(!mStopIndexer && !mIndexed)
+        {
+            std::lock_guard<std::mutex> lock(mIndexMutex);
+            ScanChunk(4 << 20);
+        }
+    }
+
+    // index up to maxBytes more of the file. mIndexMutex must be held.
+    void ScanChunk(size_t maxBytes) const
+    {
+        size_t end = std::min(mSize, mScanned + maxBytes);
+        size_t pos = mScanned;
+#ifdef __SSE2__
+        // compare 16 bytes at a time against '\n', then walk the set bits
+        const __m128i newline = _mm_set1_epi8('\n');
+        for(; pos + 16 <= end; pos += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*) (mData + pos));
+            unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+            while(mask != 0)
+            {
+                LineEnded(pos + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for(; pos < end; pos++)
+        {
+            if(mData[pos] == '\n')
+            {
+                LineEnded(pos);
+            }
+        }
+        mScanned = end;
+
+        if(mScanned == mSize)
+        {
+            // last line with no newline on the end
+            if(mLineStarts.back() < mSize)
+            {
+                LineEnded(mSize);
+            }
+            mIndexed = true;
+        }
+    }
+
+    void LineEnded(size_t newline) const
+    {
+        if(mHashed)
+        {
+            size_t start = mLineStarts.back();
+            mHashPrefix.push_back(HashAddMod(HashMulMod(mHashPrefix.back(), kHashBase),
+                                             HashLine(mData + start, newline - start)));
+        }
+        mLineStarts.push_back(newline + 1);
+    }
+};
+
+// a place in the text, between two characters
+struct TextPos
+{
+    TextPos() {}
+    TextPos(size_t line, size_t col) : mLine(line), mCol(col) {}
+
+    size_t mLine = 0;
+    size_t mCol = 0;
+
+    bool operator==(const TextPos& other) const { return mLine == other.mLine && mCol == other.mCol; }
+    bool operator!=(const TextPos& other) const { return !(*this == other); }
+    bool operator<(const TextPos& other) const
+    {
+        return mLine < other.mLine || (mLine == other.mLine && mCol < other.mCol);
+    }
+};
+
+// where text would end if it was inserted at pos
+inline TextPos EndOfText(TextPos pos, const std::string& text)
+{
+    size_t lastNewline = text.rfind('\n');
+    if(lastNewline == std::string::npos)
+    {
+        return TextPos(pos.mLine, pos.mCol + text.size());
+    }
+    size_t newlines = std::count(text.begin(), text.end(), '\n');
+    return TextPos(pos.mLine + newlines, text.size() - lastNewline - 1);
+}
+
+struct TextNode;
+typedef std::shared_ptr<const TextNode> TextNodePtr;
+
+// one node of the storage tree. each node holds a single piece of the
+// document: either a run of untouched lines from a TextSource, or one line
+// that has been edited. nodes are never changed after they're made, edits
+// build new nodes along the path they touch and share everything else.
+struct TextNode
+{
+    TextNodePtr mLeft;
+    TextNodePtr mRight;
+    uint32_t mPriority = 0;
+
+    // lines in this whole subtree, its content hash and kHashBase^mLines
+    size_t mLines = 0;
+    uint64_t mHash = 0;
+    uint64_t mPow = 1;
+
+    // the same for just this node's piece
+    uint64_t mPieceHash = 0;
+    uint64_t mPiecePow = 1;
+
+    // set for a run of lines [mFirst, mFirst + mCount) of mSource...
+    std::shared_ptr<const TextSource> mSource;
+    size_t mFirst = 0;
+    size_t mCount = 0;
+
+    // ...otherwise this is a single edited line
+    std::shared_ptr<const std::string> mText;
+
+    size_t PieceLines() const { return mSource ? mCount : 1; }
+
+    // call whenever the piece changes
+    void HashPiece()
+    {
+        if(mSource && !mSource->mHashed)
+        {
+            mPiecePow = 1;
+            mPieceHash = 0;
+        }
+        else if(mSource)
+        {
+            mPiecePow = HashPow(mCount);
+            mPieceHash = mSource->RangeHash(mFirst, mCount, mPiecePow);
+        }
+        else
+        {
+            mPiecePow = kHashBase;
+            mPieceHash = HashLine(mText->data(), mText->size());
+        }
+    }
+};
+
+// every edit to any storage gets a new version, so equal versions mean equal text
+inline uint64_t NextTextVersion()
+{
+    static std::atomic<uint64_t> version(0);
+    return ++version;
+}
+
+// the text of a buffer, as a list of lines.
+//
+// lines live in a persistent treap of pieces (a piece table with line sized
+// pieces), so getting, replacing, inserting or erasing a line is O(log n)
+// whatever the size of the file. copying a TextStorage is O(1) and the copy
+// is unaffected by later edits to the original.
+//
+// a freshly loaded file starts out with none of its lines in the tree, they
+// are pulled in from the source's index as something asks for them. so
+// LineCount() on a big file has to wait for it to be indexed, where
+// HasLine() only goes as far as it needs to.
+struct TextStorage
+{
+    size_t LineCount()
+    {
+        Pull(SIZE_MAX);
+        return Lines(mRoot);
+    }
+
+    bool HasLine(size_t line) { return Pull(line); }
+
+    // changes on every edit
+    uint64_t Version() const { return mVersion; }
+
+    // false until the file we loaded from is indexed to the end
+    bool FullyIndexed() const { return !mTailSource || mTailSource->FullyIndexed(); }
+
+    // false if the text came from a source without content hashes
+    bool Hashed() const { return mHashed; }
+
+    // hash of the whole text, for spotting edits that were undone by hand
+    uint64_t Hash()
+    {
+        Pull(SIZE_MAX);
+        return mRoot ? mRoot->mHash : 0;
+    }
+
+    LineView GetLineView(size_t line)
+    {
+        size_t index;
+        const TextNode* n = FindPiece(line, index);
+        if(n == nullptr)
+        {
+            return LineView();
+        }
+        if(n->mSource)
+        {
+            return n->mSource->Line(n->mFirst + index);
+        }
+        return LineView(*n->mText);
+    }
+
+    // the piece line is in, and which of the piece's lines it is. null if
+    // there's no such line. only valid until the next edit.
+    const TextNode* FindPiece(size_t line, size_t& index)
+    {
+        Pull(line);
+        const TextNode* n = mRoot.get();
+        while(n != nullptr)
+        {
+            size_t leftLines = Lines(n->mLeft);
+            if(line < leftLines)
+            {
+                n = n->mLeft.get();
+                continue;
+            }
+            line -= leftLines;
+            if(line < n->PieceLines())
+            {
+                index = line;
+                return n;
+            }
+            line -= n->PieceLines();
+            n = n->mRight.get();
+        }
+        return nullptr;
+    }
+
+    std::string GetLine(size_t line) { return GetLineView(line).ToString(); }
+    size_t LineLength(size_t line) { return GetLineView(line).mLength; }
+
+    // calls f(data, length) for the whole text in order. each call is one
+    // or more whole lines with the newlines between them but not the one
+    // after the last, so a run of untouched lines comes straight from its
+    // source in one go.
+    template<class F> void ForEachPiece(F f)
+    {
+        ForEachNode([&](const TextNode& n)
+        {
+            if(n.mSource)
+            {
+                // a source's lines sit one after another with a newline between
+                LineView first = n.mSource->Line(n.mFirst);
+                LineView last = n.mSource->Line(n.mFirst + n.mCount - 1);
+                f(first.mData, last.mData + last.mLength - first.mData);
+            }
+            else
+            {
+                f(n.mText->data(), n.mText->size());
+            }
+        });
+    }
+
+    // calls f(node) for each piece of the text in order
+    template<class F> void ForEachNode(F f)
+    {
+        Pull(SIZE_MAX);
+        ForEachNode(mRoot.get(), f);
+    }
+
+    // add lines [first, first + count) of source to the end. returns false
+    // if the source doesn't have them.
+    bool AppendRun(std::shared_ptr<const TextSource> source, size_t first, size_t count)
+    {
+        Pull(SIZE_MAX);
+        if(first + count < first || source->IndexUpTo(first + count) < first + count)
+        {
+            return false;
+        }
+        if(count > 0)
+        {
+            TextNode run;
+            run.mSource = source;
+            run.mFirst = first;
+            run.mCount = count;
+            run.mPriority = NextPriority();
+            run.HashPiece();
+            mRoot = Merge(mRoot, Make(run, nullptr, nullptr));
+            mHashed = mHashed && source->mHashed;
+            mVersion = NextTextVersion();
+        }
+        return true;
+    }
+
+    // replace the whole document with the lines of source
+    void Load(std::shared_ptr<const TextSource> source)
+    {
+        mRoot = nullptr;
+        mTailSource = source;
+        mTailFirst = 0;
+        mHashed = source->mHashed;
+        mVersion = NextTextVersion();
+    }
+
+    // read the lines that come from one source from another with the same
+    // bytes instead, e.g. a copy of a mapped file that's going to change.
+    // the text stays the same, and so does its version.
+    void Rebase(const TextSource* from, std::shared_ptr<const TextSource> to)
+    {
+        mRoot = Rebase(mRoot, from, to);
+        if(mTailSource.get() == from)
+        {
+            mTailSource = to;
+        }
+    }
+
+    void Clear()
+    {
+        mRoot = nullptr;
+        mTailSource = nullptr;
+        mHashed = true;
+        mVersion = NextTextVersion();
+    }
+
+    // move lines from the source's index into the tree until line is in it.
+    // returns false if the text doesn't have that many lines.
+    bool Pull(size_t line)
+    {
+        // grab lines a few thousand at a time so we don't make a node per line
+        const size_t pullAhead = 4096;
+
+        while(mTailSource && line >= Lines(mRoot))
+        {
+            size_t wanted = mTailFirst + (line - Lines(mRoot)) + 1;
+            size_t indexed = mTailSource->IndexUpTo(std::max(wanted, mTailFirst + pullAhead));
+            if(indexed > mTailFirst)
+            {
+                TextNode run;
+                run.mSource = mTailSource;
+                run.mFirst = mTailFirst;
+                run.mCount = indexed - mTailFirst;
+                run.mPriority = NextPriority();
+                run.HashPiece();
+                mRoot = Merge(mRoot, Make(run, nullptr, nullptr));
+                mTailFirst = indexed;
+            }
+            if(mTailSource->FullyIndexed() && mTailFirst == mTailSource->IndexUpTo(0))
+            {
+                mTailSource = nullptr;
+            }
+        }
+        return line < Lines(mRoot);
+    }
+
+    // erase eraseCount lines starting at line, then insert newLines there
+    void Splice(size_t line, size_t eraseCount, const std::vector<std::string>& newLines)
+    {
+        Pull(line + eraseCount);
+
+        TextNodePtr before, rest, erased, after;
+        Split(mRoot, line, before, rest);
+        Split(rest, eraseCount, erased, after);
+
+        TextNodePtr middle;
+        for(auto& text : newLines)
+        {
+            middle = Merge(middle, NewLine(text));
+        }
+        mRoot = Merge(Merge(before, middle), after);
+        mVersion = NextTextVersion();
+    }
+
+    void SetLine(size_t line, const std::string& text) { Splice(line, 1, {text}); }
+    void InsertLine(size_t line, const std::string& text) { Splice(line, 0, {text}); }
+    void AppendLine(const std::string& text) { Splice(LineCount(), 0, {text}); }
+    void EraseLine(size_t line) { Splice(line, 1, {}); }
+
+    // insert text, which can contain newlines, at pos. returns where it ends.
+    TextPos Insert(TextPos pos, const std::string& text)
+    {
+        if(!HasLine(0))
+        {
+            AppendLine("");
+        }
+
+        std::vector<std::string> lines;
+        size_t start = 0;
+        size_t newline;
+        while((newline = text.find('\n', start)) != std::string::npos)
+        {
+            lines.push_back(text.substr(start, newline - start));
+            start = newline + 1;
+        }
+        lines.push_back(text.substr(start));
+        TextPos end = EndOfText(pos, text);
+
+        LineView line = GetLineView(pos.mLine);
+        lines.front().insert(0, line.mData, pos.mCol);
+        lines.back().append(line.mData + pos.mCol, line.mLength - pos.mCol);
+        Splice(pos.mLine, 1, lines);
+        return end;
+    }
+
+    // erase the text between from and to, returning what was there
+    std::string Erase(TextPos from, TextPos to)
+    {
+        if(!HasLine(0) || !(from < to))
+        {
+            return "";
+        }
+
+        LineView first = GetLineView(from.mLine);
+        LineView last = GetLineView(to.mLine);
+        if(from.mLine == to.mLine)
+        {
+            std::string erased(first.mData + from.mCol, to.mCol - from.mCol);
+            std::string line = first.ToString();
+            line.erase(from.mCol, to.mCol - from.mCol);
+            SetLine(from.mLine, line);
+            return erased;
+        }
+
+        std::string erased(first.mData + from.mCol, first.mLength - from.mCol);
+        for(size_t i = from.mLine + 1; i < to.mLine; i++)
+        {
+            LineView middle = GetLineView(i);
+            erased += '\n';
+            erased.append(middle.mData, middle.mLength);
+        }
+        erased += '\n';
+        erased.append(last.mData, to.mCol);
+
+        std::string joined(first.mData, from.mCol);
+        joined.append(last.mData + to.mCol, last.mLength - to.mCol);
+        Splice(from.mLine, to.mLine - from.mLine + 1, {joined});
+        return erased;
+    }
+
+    TextNodePtr mRoot;
+    uint64_t mVersion = 0;
+    bool mHashed = true;
+
+    // lines of mTailSource from mTailFirst on that aren't in the tree yet
+    std::shared_ptr<const TextSource> mTailSource;
+    size_t mTailFirst = 0;
+
+    uint32_t mSeed = 2463534242u;
+
+    static size_t Lines(const TextNodePtr& n) { return n ? n->mLines : 0; }
+
+    template<class F> static void ForEachNode(const TextNode* n, F& f)
+    {
+        if(n == nullptr)
+        {
+            return;
+        }
+        ForEachNode(n->mLeft.get(), f);
+        f(*n);
+        ForEachNode(n->mRight.get(), f);
+    }
+
+    uint32_t NextPriority()
+    {
+        // xorshift32
+        mSeed ^= mSeed << 13;
+        mSeed ^= mSeed >> 17;
+        mSeed ^= mSeed << 5;
+        return mSeed;
+    }
+
+    TextNodePtr NewLine(const std::string& text)
+    {
+        TextNode piece;
+        piece.mText = std::make_shared<const std::string>(text);
+        piece.mPriority = NextPriority();
+        piece.HashPiece();
+        return Make(piece, nullptr, nullptr);
+    }
+
+    static TextNodePtr Make(const TextNode& piece, const TextNodePtr& left, const TextNodePtr& right)
+    {
+        auto n = std::make_shared<TextNode>(piece);
+        n->mLeft = left;
+        n->mRight = right;
+        n->mLines = Lines(left) + n->PieceLines() + Lines(right);
+
+        uint64_t hash = left ? left->mHash : 0;
+        uint64_t pow = left ? left->mPow : 1;
+        hash = HashAddMod(HashMulMod(hash, n->mPiecePow), n->mPieceHash);
+        pow = HashMulMod(pow, n->mPiecePow);
+        if(right)
+        {
+            hash = HashAddMod(HashMulMod(hash, right->mPow), right->mHash);
+            pow = HashMulMod(pow, right->mPow);
+        }
+        n->mHash = hash;
+        n->mPow = pow;
+        return n;
+    }
+
+    static TextNodePtr Rebase(const TextNodePtr& n, const TextSource* from, const std::shared_ptr<const TextSource>& to)
+    {
+        if(!n)
+        {
+            return n;
+        }
+        TextNodePtr left = Rebase(n->mLeft, from, to);
+        TextNodePtr right = Rebase(n->mRight, from, to);
+        if(left == n->mLeft && right == n->mRight && n->mSource.get() != from)
+        {
+            return n;
+        }
+        TextNode piece = *n;
+        if(piece.mSource.get() == from)
+        {
+            piece.mSource = to;
+        }
+        return Make(piece, left, right);
+    }
+
+    // left gets the first k lines of n, right gets the rest
+    static void Split(const TextNodePtr& n, size_t k, TextNodePtr& left, TextNodePtr& right)
+    {
+        if(!n)
+        {
+            left = nullptr;
+            right = nullptr;
+            return;
+        }
+
+        size_t leftLines = Lines(n->mLeft);
+        size_t pieceLines = n->PieceLines();
+        if(k <= leftLines)
+        {
+            TextNodePtr l, r;
+            Split(n->mLeft, k, l, r);
+            left = l;
+            right = Make(*n, r, n->mRight);
+        }
+        else if(k >= leftLines + pieceLines)
+        {
+            TextNodePtr l, r;
+            Split(n->mRight, k - leftLines - pieceLines, l, r);
+            left = Make(*n, n->mLeft, l);
+            right = r;
+        }
+        else
+        {
+            // k is in the middle of a run of source lines, cut the run in two
+            size_t cut = k - leftLines;
+            TextNode head = *n;
+            head.mCount = cut;
+            head.HashPiece();
+            TextNode tail = *n;
+            tail.mFirst += cut;
+            tail.mCount -= cut;
+            tail.HashPiece();
+            left = Make(head, n->mLeft, nullptr);
+            right = Make(tail, nullptr, n->mRight);
+        }
+    }
+
+    static TextNodePtr Merge(const TextNodePtr& a, const TextNodePtr& b)
+    {
+        if(!a)
+        {
+            return b;
+        }
+        if(!b)
+        {
+            return a;
+        }
+        if(a->mPriority > b->mPriority)
+        {
+            return Make(*a, a->mLeft, Merge(a->mRight, b));
+        }
+        return Make(*b, Merge(a, b->mLeft), b->mRight);
+    }
+};
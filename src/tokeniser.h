@@ -1,5 +1,9 @@
 #pragma once
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
 
 enum TokenType
 {
@@ -18,59 +22,49 @@ struct Token
     TokenType type = Other;
 };
 
-const std::vector<std::string> operators =
+// a token as a range of the line it came from. like Token::text, it starts
+// with any whitespace that came before it.
+struct TokenSpan
 {
-    "::", "++", "--", "(", ")", "[", "]", ".", "->",
-    "~", "!", "+", "-", "&", "*", "new", "delete", "sizeof",
-    "*", "%", "/", ">>", "<<", ">", "<", "<=", ">=", "==", "=",
-    "^", "|", "||", "&&", "=", "*=", "/=", "%=", "+=", "-=", ">>=",
-    "<<=", "&=", "^=", "|=", "?", ":", ","
+    uint32_t start;
+    uint32_t length;
+    TokenType type;
 };
 
-std::string& rtrim(std::string& str, const std::string& chars = "\t\n\v\f\r ")
-{
-    str.erase(str.find_last_not_of(chars) + 1);
-    return str;
-}
-
-bool IsOperator(std::string token)
-{
-    return (std::find(operators.begin(), operators.end(), rtrim(token)) != operators.end());
-}
+// what a line leaves the lexer in the middle of, carried on to the next
+// line. the low byte says what. a raw string keeps its delimiter's length
+// in the next byte and up to kMaxCarriedDelimiter chars of it above that.
+typedef uint64_t LexState;
+const LexState kLexNormal = 0;
+const LexState kLexBlockComment = 1;
+const LexState kLexRawString = 2;
+const size_t kMaxCarriedDelimiter = 6;
 
-Token TextToToken(std::string text)
+inline LexState RawStringState(const char* delimiter, size_t length)
 {
-    Token t;
-    t.text = text;
-
-    if(IsOperator(text))
+    LexState state = kLexRawString | (LexState) length << 8;
+    for(size_t i = 0; i < length; i++)
     {
-        t.type = Comment;
+        state |= (LexState) (unsigned char) delimiter[i] << (16 + 8 * i);
     }
-    else
-    {
-        t.type = Other;
-    }
-            
-    return t;
+    return state;
 }
 
-// returns the number of chars of an operator we read
-// 0 -> not an operator
-int TryReadOperator(std::string text)
+// where needle first starts in text, or length if it doesn't
+inline size_t FindText(const char* text, size_t length, const char* needle, size_t needleLength)
 {
-    const int lengthOfLongestOperator = 6;
-    
-    for(int i = lengthOfLongestOperator; i > 0; i--)
-    {
-        if(IsOperator(text.substr(0, i)))
-        {
-            return i;
-        }
-    }
-    return 0;
+    return std::search(text, text + length, needle, needle + needleLength) - text;
 }
 
+const std::vector<std::string> operators =
+{
+    "::", "++", "--", "(", ")", "[", "]", ".", "->",
+    "~", "!", "+", "-", "&", "*", "new", "delete", "sizeof",
+    "*", "%", "/", ">>", "<<", ">", "<", "<=", ">=", "==", "=",
+    "^", "|", "||", "&&", "=", "*=", "/=", "%=", "+=", "-=", ">>=",
+    "<<=", "&=", "^=", "|=", "?", ":", ","
+};
+
 const std::vector<std::string> keywords =
 {
 "__abstract", "__alignof", "__asm", "__assume", "__based", "__box", "__cdecl",
@@ -95,51 +89,201 @@ const std::vector<std::string> keywords =
 "class", "value", "struct", "virtual", "void", "volatile", "while"
 };
 
-bool IsKeyword(std::string token)
+// character classes, the same as the C locale's is* functions but safe for
+// any byte and just a table lookup
+enum CharClass
+{
+    CHAR_SPACE = 1,
+    CHAR_ALPHA = 2,
+    CHAR_DIGIT = 4
+};
+
+struct CharClassTable
+{
+    CharClassTable()
+    {
+        memset(mClasses, 0, sizeof(mClasses));
+        for(const char* c = " \t\n\v\f\r"; *c; c++)
+        {
+            mClasses[(unsigned char) *c] |= CHAR_SPACE;
+        }
+        for(int c = 'a'; c <= 'z'; c++)
+        {
+            mClasses[c] |= CHAR_ALPHA;
+            mClasses[c - 'a' + 'A'] |= CHAR_ALPHA;
+        }
+        for(int c = '0'; c <= '9'; c++)
+        {
+            mClasses[c] |= CHAR_DIGIT;
+        }
+    }
+
+    uint8_t mClasses[256];
+};
+
+const CharClassTable charClasses;
+
+inline bool IsSpaceChar(char c) { return charClasses.mClasses[(unsigned char) c] & CHAR_SPACE; }
+inline bool IsAlphaChar(char c) { return charClasses.mClasses[(unsigned char) c] & CHAR_ALPHA; }
+inline bool IsDigitChar(char c) { return charClasses.mClasses[(unsigned char) c] & CHAR_DIGIT; }
+
+// a fixed set of short words, built once into an open addressed hash table.
+// looking a word up hashes it and compares against one or two slots, with
+// no allocation.
+struct WordSet
+{
+    explicit WordSet(const std::vector<std::string>& words)
+    {
+        size_t size = 1;
+        while(size < words.size() * 4)
+        {
+            size <<= 1;
+        }
+        mSlots.assign(size, -1);
+        mMask = size - 1;
+
+        memset(mFirstChars, 0, sizeof(mFirstChars));
+        for(size_t i = 0; i < words.size(); i++)
+        {
+            const std::string& word = words[i];
+            if(Contains(word.data(), word.size()))
+            {
+                continue;
+            }
+            mWords.push_back(word);
+            size_t slot = Hash(word.data(), word.size()) & mMask;
+            while(mSlots[slot] >= 0)
+            {
+                slot = (slot + 1) & mMask;
+            }
+            mSlots[slot] = mWords.size() - 1;
+            mFirstChars[(unsigned char) word[0]] = true;
+            mLongest = std::max(mLongest, word.size());
+        }
+    }
+
+    static uint32_t Hash(const char* text, size_t length)
+    {
+        uint32_t h = 2166136261u;
+        for(size_t i = 0; i < length; i++)
+        {
+            h = (h ^ (unsigned char) text[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    bool Contains(const char* text, size_t length) const
+    {
+        if(length == 0 || length > mLongest || !mFirstChars[(unsigned char) text[0]])
+        {
+            return false;
+        }
+        size_t slot = Hash(text, length) & mMask;
+        while(mSlots[slot] >= 0)
+        {
+            const std::string& word = mWords[mSlots[slot]];
+            if(word.size() == length && memcmp(word.data(), text, length) == 0)
+            {
+                return true;
+            }
+            slot = (slot + 1) & mMask;
+        }
+        return false;
+    }
+
+    std::vector<std::string> mWords;
+    std::vector<int> mSlots;
+    size_t mMask = 0;
+    size_t mLongest = 0;
+    bool mFirstChars[256];
+};
+
+const WordSet operatorSet(operators);
+const WordSet keywordSet(keywords);
+
+// the length of text[0, length) without any whitespace on the end
+inline size_t TrimmedLength(const char* text, size_t length)
 {
-    return (std::find(keywords.begin(), keywords.end(), rtrim(token)) != keywords.end());
+    while(length > 0 && IsSpaceChar(text[length - 1]))
+    {
+        length--;
+    }
+    return length;
 }
 
-int TryReadKeyword(std::string text)
+inline bool IsOperator(const char* text, size_t length)
 {
-    const int lengthOfLongestKeyword = 21;
-    
-    for(unsigned int i = lengthOfLongestKeyword; i > 0; i--)
+    return operatorSet.Contains(text, TrimmedLength(text, length));
+}
+
+inline bool IsKeyword(const char* text, size_t length)
+{
+    return keywordSet.Contains(text, TrimmedLength(text, length));
+}
+
+// all the TryRead functions look at the start of text[0, length) and return
+// the number of chars they read, 0 if it isn't one of theirs. like they
+// always have, a match can run past the end of the text, and operators and
+// keywords take up to their maximum length in trailing whitespace.
+
+int TryReadOperator(const char* text, size_t length)
+{
+    const size_t lengthOfLongestOperator = 6;
+
+    size_t lastChecked = SIZE_MAX;
+    for(size_t i = lengthOfLongestOperator; i > 0; i--)
     {
-        if(IsKeyword(text.substr(0, i)) && (i+1>text.length() || !std::isalpha(text[i])))
+        // past the end of the text every i checks the same thing
+        size_t candidate = std::min(i, length);
+        if(candidate != lastChecked && IsOperator(text, candidate))
         {
             return i;
         }
+        lastChecked = candidate;
     }
     return 0;
 }
 
-
-int TryReadNumericalLiteral(std::string text)
+int TryReadKeyword(const char* text, size_t length)
 {
-    int charsRead = 0;
-    for(unsigned int i = 0; i<text.length(); i++)
+    const size_t lengthOfLongestKeyword = 21;
+
+    size_t lastChecked = SIZE_MAX;
+    for(size_t i = lengthOfLongestKeyword; i > 0; i--)
     {
-        if(!(std::isdigit(text[i]) || text[i] == '.'))
+        // a keyword can't run on into more letters, that's cheaper to check
+        // than the word itself so it goes first
+        if(i < length && IsAlphaChar(text[i]))
         {
-            break;
+            continue;
         }
-        else
+        size_t candidate = std::min(i, length);
+        if(candidate != lastChecked && IsKeyword(text, candidate))
         {
-            charsRead++;
+            return i;
         }
+        lastChecked = candidate;
     }
+    return 0;
+}
 
+int TryReadNumericalLiteral(const char* text, size_t length)
+{
+    size_t charsRead = 0;
+    while(charsRead < length && (IsDigitChar(text[charsRead]) || text[charsRead] == '.'))
+    {
+        charsRead++;
+    }
     return charsRead;
 }
 
-int TryReadStringLiteral(std::string text)
+int TryReadStringLiteral(const char* text, size_t length)
 {
     int charsRead = 0;
-    if(text[0] == '"' || text[0] == '\'')
+    if(length > 0 && (text[0] == '"' || text[0] == '\''))
     {
         charsRead++;
-        for(unsigned int i = 1; i<text.length(); i++)
+        for(size_t i = 1; i<length; i++)
         {
             charsRead++;            
             if(text[i] == text[0])
@@ -157,16 +301,59 @@ int TryReadStringLiteral(std::string text)
     return charsRead;
 }
 
+// R"delim(...)delim". one that doesn't end on this line runs to the end
+// of it and leaves its delimiter in state, if it fits there.
+int TryReadRawStringLiteral(const char* text, size_t length, LexState& state)
+{
+    if(length < 3 || text[0] != 'R' || text[1] != '"')
+    {
+        return 0;
+    }
+
+    const size_t maxDelimiter = 16;
+    size_t open = 2;
+    while(open < length && open - 2 <= maxDelimiter && text[open] != '(' &&
+          text[open] != ')' && text[open] != '\\' && !IsSpaceChar(text[open]))
+    {
+        open++;
+    }
+    if(open >= length || text[open] != '(' || open - 2 > maxDelimiter)
+    {
+        return 0;
+    }
+
+    char terminator[maxDelimiter + 2];
+    size_t delimiterLength = open - 2;
+    terminator[0] = ')';
+    memcpy(terminator + 1, text + 2, delimiterLength);
+    terminator[delimiterLength + 1] = '"';
+
+    size_t end = FindText(text + open + 1, length - open - 1, terminator, delimiterLength + 2);
+    if(end < length - open - 1)
+    {
+        return open + 1 + end + delimiterLength + 2;
+    }
+    if(delimiterLength <= kMaxCarriedDelimiter)
+    {
+        state = RawStringState(text + 2, delimiterLength);
+    }
+    return length;
+}
 
-int TryReadLiteral(std::string text)
+int TryReadLiteral(const char* text, size_t length, LexState& state)
 {
     int charsRead;
-    if((charsRead = TryReadNumericalLiteral(text)) > 0)
+    if((charsRead = TryReadNumericalLiteral(text, length)) > 0)
     {
         return charsRead;
     }
 
-    if((charsRead = TryReadStringLiteral(text)) > 0)
+    if((charsRead = TryReadRawStringLiteral(text, length, state)) > 0)
+    {
+        return charsRead;
+    }
+
+    if((charsRead = TryReadStringLiteral(text, length)) > 0)
     {
         return charsRead;
     }
@@ -174,89 +361,160 @@ int TryReadLiteral(std::string text)
     return 0;
 }
 
-int TryReadComment(std::string text)
+int TryReadComment(const char* text, size_t length, LexState& state)
 {
-    // TODO handle /* */ comments - multiline case is tricky
     int charsRead = 0;
-    if(text.substr(0, 2) == "//")
+    if(length >= 2 && text[0] == '/' && text[1] == '/')
     {
         // Assumption: we are tokenising line by line, not the whole program at once.
-        charsRead = text.length();
+        charsRead = length;
+    }
+    else if(length >= 2 && text[0] == '/' && text[1] == '*')
+    {
+        // a block comment that doesn't end here carries on to the next line
+        size_t end = FindText(text + 2, length - 2, "*/", 2);
+        if(end < length - 2)
+        {
+            charsRead = end + 4;
+        }
+        else
+        {
+            charsRead = length;
+            state = kLexBlockComment;
+        }
     }
     return charsRead;
 }
 
-int TryReadIdentifier(std::string text)
+// how much of the start of a line belongs to the comment or raw string the
+// line before left open, putting state back to normal if it ends here
+size_t ReadCarriedOver(const char* text, size_t length, LexState& state)
 {
-    int charsRead = 0;
-    for(unsigned int i = 0; i<text.length(); i++)
+    char terminator[kMaxCarriedDelimiter + 2];
+    size_t terminatorLength = 2;
+    if(state == kLexBlockComment)
+    {
+        memcpy(terminator, "*/", 2);
+    }
+    else
     {
-        if(!std::isalpha(text[i]) || text[i] == '_')
+        size_t delimiterLength = (state >> 8) & 0xff;
+        terminator[0] = ')';
+        for(size_t i = 0; i < delimiterLength; i++)
         {
-            break;
+            terminator[i + 1] = (char) (state >> (16 + 8 * i));
         }
+        terminator[delimiterLength + 1] = '"';
+        terminatorLength = delimiterLength + 2;
+    }
+
+    size_t end = FindText(text, length, terminator, terminatorLength);
+    if(end == length)
+    {
+        return length;
+    }
+    state = kLexNormal;
+    return end + terminatorLength;
+}
+
+int TryReadIdentifier(const char* text, size_t length)
+{
+    size_t charsRead = 0;
+    while(charsRead < length && IsAlphaChar(text[charsRead]))
+    {
         charsRead++;
     }
     return charsRead;
 }
 
-std::vector<Token> Tokenise(std::string text, std::string filename)
+// tokenise one line that starts in state, appending its tokens to spans and
+// returning the state the next line starts in. doesn't allocate once spans
+// has grown big enough, so keep the vector around between lines.
+LexState TokeniseLine(const char* text, size_t length, LexState state, std::vector<TokenSpan>& spans)
 {
-    // just do everything as c++ for now
-    (void) filename;
-    
-    std::vector<Token> tokens;
+    size_t tokenStart = 0;
+    size_t i = 0;
+    if(state != kLexNormal)
+    {
+        TokenType type = state == kLexBlockComment ? Comment : Literal;
+        i = ReadCarriedOver(text, length, state);
+        if(i > 0)
+        {
+            TokenSpan span = {0, (uint32_t) i, type};
+            spans.push_back(span);
+        }
+        tokenStart = i;
+    }
 
-    std::string currToken = "";
-    for(unsigned int i = 0; i<text.length();)
+    while(i < length)
     {
-        Token t;
-        if(std::isspace(text[i]))
+        if(IsSpaceChar(text[i]))
         {
-            currToken += text[i];           
             i++;
+            continue;
+        }
+
+        const char* rest = text + i;
+        size_t restLength = length - i;
+        TokenType type = Other;
+        size_t charsRead = 0;
+
+        if((charsRead = TryReadComment(rest, restLength, state)) > 0)
+        {
+            type = Comment;
+        }
+        else if((charsRead = TryReadOperator(rest, restLength)) > 0)
+        {
+            type = Operator;
+        }
+        else if((charsRead = TryReadLiteral(rest, restLength, state)) > 0)
+        {
+            type = Literal;
+        }
+        else if((charsRead = TryReadKeyword(rest, restLength)) > 0)
+        {
+            type = Keyword;
+        }
+        else if((charsRead = TryReadIdentifier(rest, restLength)) > 0)
+        {
+            type = Identifier;
         }
         else
         {
-            TokenType type = Other;
-            int charsRead = 0;
+            type = Other;
+            charsRead = restLength;
+        }
 
+        charsRead = std::min(charsRead, restLength);
+        TokenSpan span = {(uint32_t) tokenStart, (uint32_t) (i + charsRead - tokenStart), type};
+        spans.push_back(span);
+        i += charsRead;
+        tokenStart = i;
+    }
+    return state;
+}
 
-            if((charsRead = TryReadComment(text.substr(i))) > 0)
-            {
-                type = Comment;
-            }
-            else if((charsRead = TryReadOperator(text.substr(i))) > 0)
-            {
-                type = Operator;
-            }
-            else if((charsRead = TryReadLiteral(text.substr(i))) > 0)
-            {
-                type = Literal;
-            }
-            else if((charsRead = TryReadKeyword(text.substr(i))) > 0)
-            {
-                type = Keyword;
-            }
-            else if((charsRead = TryReadIdentifier(text.substr(i))) > 0)
-            {
-                type = Identifier;
-            }
-            else
-            {
-                type = Other;
-                charsRead = text.length() - i;
-            }
+// a line on its own, as if nothing was left open before it
+void TokeniseLine(const char* text, size_t length, std::vector<TokenSpan>& spans)
+{
+    TokeniseLine(text, length, kLexNormal, spans);
+}
 
-            t.text = currToken + text.substr(i, charsRead);
-            t.type = type;
-            i += charsRead;
-            currToken = "";
-            tokens.push_back(t);
-        }
+std::vector<Token> Tokenise(std::string text, std::string filename)
+{
+    // just do everything as c++ for now
+    (void) filename;
 
-        
-    }
+    std::vector<TokenSpan> spans;
+    TokeniseLine(text.data(), text.size(), spans);
 
+    std::vector<Token> tokens;
+    for(auto& span : spans)
+    {
+        Token t;
+        t.text = text.substr(span.start, span.length);
+        t.type = span.type;
+        tokens.push_back(t);
+    }
     return tokens;
 }
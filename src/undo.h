@@ -0,0 +1,320 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <vector>
+#include "text_storage.h"
+
+// one change to the text: mText was inserted at mPos, or erased from there
+struct EditRecord
+{
+    bool mInsert = true;
+    TextPos mPos;
+    std::string mText;
+
+    // or, for a change to too much of the text to list, the whole text was
+    // swapped for mSwapText, which holds what it replaced. copies of the text
+    // share what they have in common, mSwapBytes is roughly what they don't.
+    bool mSwap = false;
+    TextStorage mSwapText;
+    size_t mSwapBytes = 0;
+
+    TextPos End() const { return EndOfText(mPos, mText); }
+};
+
+// undo and redo apply their edits through one of these
+struct EditTarget
+{
+    virtual ~EditTarget() {}
+    virtual TextPos ApplyInsert(TextPos pos, const std::string& text) = 0;
+    virtual std::string ApplyErase(TextPos from, TextPos to) = 0;
+
+    // swap the whole text with text
+    virtual void ApplySwap(TextStorage& text) = 0;
+};
+
+// things that keep their own state about a buffer's text hear about every
+// edit made to it through one of these
+struct TextListener
+{
+    virtual ~TextListener() {}
+    virtual void OnEdit(const EditRecord& edit) = 0;
+
+    // the whole text was replaced
+    virtual void OnReload() = 0;
+};
+
+// the edits from one command, undone and redone together
+struct UndoGroup
+{
+    std::vector<EditRecord> mEdits;
+
+    // where the cursor was before the first edit
+    int mCursX = 0;
+    int mCursY = 0;
+
+    // a run of typed characters, later typing can be added on
+    bool mTyping = false;
+
+    size_t Bytes() const
+    {
+        size_t bytes = sizeof(UndoGroup);
+        for(auto& edit : mEdits)
+        {
+            bytes += EditBytes(edit);
+        }
+        return bytes;
+    }
+
+    static size_t EditBytes(const EditRecord& edit)
+    {
+        return sizeof(EditRecord) + edit.mText.size() + edit.mSwapBytes;
+    }
+};
+
+// undo/redo as a list of edit deltas, so undoing costs as much as the edit
+// did rather than as much as the file. oldest groups are thrown away once
+// the history uses more than mMaxBytes.
+struct UndoHistory
+{
+    std::deque<UndoGroup> mUndo;
+    std::vector<UndoGroup> mRedo;
+
+    size_t mBytes = 0;
+    size_t mMaxBytes = 64 << 20;
+
+    // groups applied since the history started, including ones thrown away
+    long mPosition = 0;
+    long mDropped = 0;
+
+    // mPosition when the file was saved, -1 if we can't get back there
+    long mSavedPosition = 0;
+
+    // the next edit starts a new group rather than joining the last one
+    bool mSealed = true;
+    int mGroupDepth = 0;
+
+    // goes up whenever a position might stop meaning the text it used to,
+    // because the history it led to was thrown away
+    uint64_t mGeneration = 0;
+
+    // see TextStorage::Rebase
+    void Rebase(const TextSource* from, std::shared_ptr<const TextSource> to)
+    {
+        for(auto& group : mUndo)
+        {
+            RebaseGroup(group, from, to);
+        }
+        for(auto& group : mRedo)
+        {
+            RebaseGroup(group, from, to);
+        }
+    }
+
+    static void RebaseGroup(UndoGroup& group, const TextSource* from, std::shared_ptr<const TextSource> to)
+    {
+        for(auto& edit : group.mEdits)
+        {
+            if(edit.mSwap)
+            {
+                edit.mSwapText.Rebase(from, to);
+            }
+        }
+    }
+
+    void Clear()
+    {
+        mUndo.clear();
+        mRedo.clear();
+        mBytes = 0;
+        mPosition = 0;
+        mDropped = 0;
+        mSavedPosition = 0;
+        mSealed = true;
+        mGeneration++;
+    }
+
+    // everything recorded between BeginGroup and EndGroup is one undo step
+    void BeginGroup()
+    {
+        if(mGroupDepth++ == 0)
+        {
+            mSealed = true;
+        }
+    }
+
+    void EndGroup()
+    {
+        if(--mGroupDepth == 0)
+        {
+            mSealed = true;
+        }
+    }
+
+    void Seal() { mSealed = true; }
+
+    void MarkSaved()
+    {
+        mSavedPosition = mPosition;
+        mSealed = true;
+    }
+
+    // for a save of the text as it was at position, in generation, that
+    // finished after more editing
+    void MarkSavedAt(long position, uint64_t generation)
+    {
+        mSavedPosition = generation == mGeneration ? position : -1;
+    }
+
+    bool CanReachSaved() const { return mSavedPosition >= mDropped; }
+
+    void Record(const EditRecord& edit, bool typing, int cursX, int cursY)
+    {
+        DropRedo();
+
+        if(!mSealed && !mUndo.empty())
+        {
+            UndoGroup& group = mUndo.back();
+            EditRecord& last = group.mEdits.back();
+            if(mGroupDepth == 0)
+            {
+                // only typing carries on into the last group, and only if
+                // it's straight after what was typed last
+                if(!typing || !group.mTyping || !last.mInsert || last.mSwap ||
+                   edit.mText.find('\n') != std::string::npos ||
+                   last.mText.find('\n') != std::string::npos ||
+                   last.End() != edit.mPos)
+                {
+                    mSealed = true;
+                }
+            }
+
+            // a group can have thousands of edits in it, one per cursor say,
+            // so its size is kept up as it grows rather than added up again
+            if(!mSealed)
+            {
+                if(mGroupDepth == 0)
+                {
+                    last.mText += edit.mText;
+                    mBytes += edit.mText.size();
+                }
+                else
+                {
+                    group.mEdits.push_back(edit);
+                    mBytes += UndoGroup::EditBytes(edit);
+                }
+                Trim();
+                return;
+            }
+        }
+
+        UndoGroup group;
+        group.mEdits.push_back(edit);
+        group.mCursX = cursX;
+        group.mCursY = cursY;
+        group.mTyping = typing && mGroupDepth == 0;
+        mBytes += group.Bytes();
+        mUndo.push_back(group);
+        mPosition++;
+        mSealed = false;
+        Trim();
+    }
+
+    // undo the last group, putting the cursor back where it was before it
+    bool Undo(EditTarget& text, int& cursX, int& cursY)
+    {
+        if(mUndo.empty())
+        {
+            return false;
+        }
+
+        UndoGroup group = std::move(mUndo.back());
+        mUndo.pop_back();
+        for(auto edit = group.mEdits.rbegin(); edit != group.mEdits.rend(); ++edit)
+        {
+            if(edit->mSwap)
+            {
+                text.ApplySwap(edit->mSwapText);
+            }
+            else if(edit->mInsert)
+            {
+                text.ApplyErase(edit->mPos, edit->End());
+            }
+            else
+            {
+                text.ApplyInsert(edit->mPos, edit->mText);
+            }
+        }
+        cursX = group.mCursX;
+        cursY = group.mCursY;
+
+        mRedo.push_back(std::move(group));
+        mPosition--;
+        mSealed = true;
+        return true;
+    }
+
+    // redo the last undone group, leaving the cursor at the end of it
+    bool Redo(EditTarget& text, int& cursX, int& cursY)
+    {
+        if(mRedo.empty())
+        {
+            return false;
+        }
+
+        UndoGroup group = std::move(mRedo.back());
+        mRedo.pop_back();
+        TextPos end;
+        for(auto& edit : group.mEdits)
+        {
+            if(edit.mSwap)
+            {
+                text.ApplySwap(edit.mSwapText);
+                end = TextPos(cursY, cursX);
+            }
+            else if(edit.mInsert)
+            {
+                end = text.ApplyInsert(edit.mPos, edit.mText);
+            }
+            else
+            {
+                text.ApplyErase(edit.mPos, edit.End());
+                end = edit.mPos;
+            }
+        }
+        cursX = end.mCol;
+        cursY = end.mLine;
+
+        mUndo.push_back(std::move(group));
+        mPosition++;
+        mSealed = true;
+        return true;
+    }
+
+    void DropRedo()
+    {
+        if(mRedo.empty())
+        {
+            return;
+        }
+        if(mSavedPosition > mPosition)
+        {
+            mSavedPosition = -1;
+        }
+        for(auto& group : mRedo)
+        {
+            mBytes -= group.Bytes();
+        }
+        mRedo.clear();
+        mGeneration++;
+    }
+
+    void Trim()
+    {
+        while(mBytes > mMaxBytes && mUndo.size() > 1)
+        {
+            mBytes -= mUndo.front().Bytes();
+            mUndo.pop_front();
+            mDropped++;
+        }
+    }
+};
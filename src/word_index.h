@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <vector>
+#include "line_cache.h"
+#include "text_storage.h"
+#include "undo.h"
+
+// where the words start on each line, for jump mode and moving a word at a
+// time. the starts are kept for a window of lines that follows the ones
+// asked about, and lined up with the text as it's edited, so a line is only
+// looked at again once an edit has touched it.
+struct WordIndex : TextListener
+{
+    struct LineWords
+    {
+        bool mValid = false;
+        std::vector<uint32_t> mStarts;
+    };
+
+    LineCache<LineWords> mCache;
+
+    // lines looked through, to see how much work edits cost
+    size_t mLinesScanned = 0;
+
+    void OnReload() override
+    {
+        mCache.Clear();
+    }
+
+    void OnEdit(const EditRecord& edit) override
+    {
+        mCache.Splice(SpliceForEdit(edit));
+    }
+
+    static bool IsWordByte(unsigned char c)
+    {
+        return isalnum(c) || c == '_' || c >= 0x80;
+    }
+
+    // the columns words start at on a line, which has to exist. good until
+    // the next call, which can move the window.
+    const std::vector<uint32_t>& Starts(TextStorage& text, size_t line)
+    {
+        LineWords& words = mCache.Entry(line);
+        if(!words.mValid)
+        {
+            LineView view = text.GetLineView(line);
+            words.mStarts.clear();
+            bool inWord = false;
+            for(size_t col = 0; col < view.mLength; col++)
+            {
+                bool wordByte = IsWordByte(view.mData[col]);
+                if(wordByte && !inWord)
+                {
+                    words.mStarts.push_back(col);
+                }
+                inWord = wordByte;
+            }
+            words.mValid = true;
+            mLinesScanned++;
+        }
+        return words.mStarts;
+    }
+
+    // the first word start after pos, false if there isn't one before the
+    // end of the text
+    bool Next(TextStorage& text, TextPos pos, TextPos& next)
+    {
+        for(size_t line = pos.mLine; text.HasLine(line); line++)
+        {
+            auto& starts = Starts(text, line);
+            auto after = line == pos.mLine ? std::upper_bound(starts.begin(), starts.end(), pos.mCol) : starts.begin();
+            if(after != starts.end())
+            {
+                next = TextPos(line, *after);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the last word start before pos
+    bool Prev(TextStorage& text, TextPos pos, TextPos& prev)
+    {
+        for(size_t line = pos.mLine + 1; line-- > 0;)
+        {
+            if(!text.HasLine(line))
+            {
+                continue;
+            }
+            auto& starts = Starts(text, line);
+            auto before = line == pos.mLine ? std::lower_bound(starts.begin(), starts.end(), pos.mCol) : starts.end();
+            if(before != starts.begin())
+            {
+                prev = TextPos(line, *(before - 1));
+                return true;
+            }
+        }
+        return false;
+    }
+};